@@ -1,7 +1,12 @@
 
 #include "directory.h"
+#include "mmap.h"
+#include "replaymanager.h"
+#include "scheduler.h"
 #include "textfile.h"
 
+#include "concurrentqueue.h"
+
 #include <rust/gitignore.h>
 
 #include <unordered_set>
@@ -9,6 +14,7 @@
 
 PGDirectory::PGDirectory(std::string path, PGDirectory* parent) :
 	path(path), last_modified_time(-1), loaded_files(false), expanded(false),
+	listed_modification_time(-1), ignore_modification_time(-1), ignore_glob(nullptr),
 	displayed_files(0), total_files(0), parent(parent) {
 	this->lock = std::unique_ptr<PGMutex>(CreateMutex());
 }
@@ -18,11 +24,11 @@ PGDirectory::~PGDirectory() {
 	if (index) {
 		LockMutex(index->lock.get());
 		for (auto it = files.begin(); it != files.end(); it++) {
-			index->RemoveEntry(it->path);
+			index->RemoveEntry(PGPathJoin(this->path, it->path));
 		}
 		UnlockMutex(index->lock.get());
 	}
-
+	PGDestroyIgnoreGlob(ignore_glob);
 }
 
 void PGDirectory::FindFile(lng file_number, PGDirectory** directory, PGFile* file) {
@@ -104,6 +110,32 @@ unlock:
 }
 
 
+std::shared_ptr<PGDirectory> PGDirectory::FindDirectory(std::shared_ptr<PGDirectory> root, std::string path) {
+	std::shared_ptr<PGDirectory> directory = root;
+	while (directory) {
+		if (directory->path == path) {
+			return directory;
+		}
+		if (path.size() <= directory->path.size() || path[directory->path.size()] != GetSystemPathSeparator() ||
+			path.compare(0, directory->path.size(), directory->path) != 0) {
+			return nullptr;
+		}
+		std::shared_ptr<PGDirectory> next = nullptr;
+		LockMutex(directory->lock.get());
+		for (auto it = directory->directories.begin(); it != directory->directories.end(); it++) {
+			const std::string& subpath = (*it)->path;
+			if (path.compare(0, subpath.size(), subpath) == 0 &&
+				(path.size() == subpath.size() || path[subpath.size()] == GetSystemPathSeparator())) {
+				next = *it;
+				break;
+			}
+		}
+		UnlockMutex(directory->lock.get());
+		directory = next;
+	}
+	return nullptr;
+}
+
 void PGDirectory::CollapseAll() {
 	LockMutex(lock.get());
 	for (auto it = directories.begin(); it != directories.end(); it++) {
@@ -117,7 +149,7 @@ void PGDirectory::SetExpanded(bool expand) {
 	if (this->expanded != expand) {
 		this->expanded = expand;
 		if (parent) {
-			lng file_diff = expand ? displayed_files : -displayed_files;
+			lng file_diff = expand ? displayed_files.load() : -displayed_files.load();
 			parent->AddDisplayedFiles(file_diff);
 		}
 	}
@@ -139,7 +171,7 @@ void PGDirectory::LoadWorkspace(nlohmann::json& j) {
 	assert(j.is_object());
 	std::string filename = PGFile(this->path).Filename();
 	if (j.count(filename) > 0 && j[filename].is_object()) {
-		this->expanded = true;
+		this->SetExpanded(true);
 		LockMutex(lock.get());
 		for (auto it = directories.begin(); it != directories.end(); it++) {
 			(*it)->LoadWorkspace(j[filename]);
@@ -167,21 +199,98 @@ bool PGDirectory::IterateOverFiles(PGDirectoryIterCallback callback, void* data,
 	return true;
 }
 
-void PGDirectory::Update(PGIgnoreGlob glob, std::queue<std::shared_ptr<PGDirectory>>& open_directories, std::shared_ptr<SearchIndex> index) {
+static void AddIndexEntry(SearchIndex* index, const std::string& directory, const std::string& filename) {
+	std::string path = PGPathJoin(directory, filename);
+	SearchEntry entry;
+	entry.display_name = filename;
+	entry.display_subtitle = path;
+	entry.text = path;
+	entry.basescore = 0;
+	entry.multiplier = 1;
+	index->AddEntry(entry);
+}
+
+// removes the ignored entries from a directory listing, using a single call to classify the entire listing
+static void RemoveIgnoredEntries(PGIgnoreGlob glob, const std::string& path, std::vector<PGFile>& directories, std::vector<PGFile>& files) {
+	size_t count = directories.size() + files.size();
+	if (count == 0) return;
+	std::vector<const char*> names;
+	std::unique_ptr<bool[]> is_directory = std::unique_ptr<bool[]>(new bool[count]);
+	std::unique_ptr<bool[]> ignored = std::unique_ptr<bool[]>(new bool[count]);
+	names.reserve(count);
+	for (size_t i = 0; i < directories.size(); i++) {
+		is_directory[names.size()] = true;
+		names.push_back(directories[i].path.c_str());
+	}
+	for (size_t i = 0; i < files.size(); i++) {
+		is_directory[names.size()] = false;
+		names.push_back(files[i].path.c_str());
+	}
+	PGIgnoreDirectoryEntries(glob, path.c_str(), names.data(), is_directory.get(), count, ignored.get());
+	// compact the lists after classifying, because "names" points into them
+	size_t entry = 0;
+	std::vector<PGFile>* lists[2] = { &directories, &files };
+	for (int list = 0; list < 2; list++) {
+		std::vector<PGFile>& entries = *lists[list];
+		size_t kept = 0;
+		for (size_t i = 0; i < entries.size(); i++, entry++) {
+			if (!ignored[entry]) {
+				if (kept != i) entries[kept] = std::move(entries[i]);
+				kept++;
+			}
+		}
+		entries.resize(kept);
+	}
+}
+
+void PGDirectory::Update(bool ignore_files, std::vector<std::shared_ptr<PGDirectory>>& subdirectories, std::shared_ptr<SearchIndex> index, bool force) {
 	lng difference, previous_dircount, directory_difference = 0, file_difference = 0;
-	loaded_files = false;
-	if (PGFileIsIgnored(glob, this->path.c_str(), true)) {
-		// file is ignored by the .gitignore glob, skip this path
-		return;
+	// the .gitignore rules of this directory are those of the parent plus the .gitignore in this directory
+	// the compiled .gitignore files are cached, so this only reads a .gitignore when it has changed
+	PGIgnoreGlob glob = nullptr;
+	if (ignore_files) {
+		if (parent) {
+			LockMutex(parent->lock.get());
+			glob = parent->ignore_glob ? PGCreateGlobForSubdirectory(parent->ignore_glob, this->path.c_str()) : nullptr;
+			UnlockMutex(parent->lock.get());
+		}
+		if (!glob) {
+			glob = PGCreateGlobForDirectory(this->path.c_str());
+		}
+		if (!parent && PGFileIsIgnored(glob, this->path.c_str(), true)) {
+			// file is ignored by the .gitignore glob, skip this path
+			PGDestroyIgnoreGlob(glob);
+			loaded_files = false;
+			return;
+		}
 	}
+	// the modification time of a directory only changes when entries are added, removed or renamed
+	// we obtain it before reading the directory, so changes made while we read it are picked up next time
+	auto info = PGGetFileFlags(this->path);
+	lng modification_time = info.flags == PGFileFlagsEmpty ? info.modification_time : -1;
 
 	LockMutex(lock.get());
+	if (index) {
+		this->index = std::weak_ptr<SearchIndex>(index);
+	}
+	if (glob && ignore_glob && !PGIgnoreGlobEquals(glob, ignore_glob)) {
+		// one of the .gitignore files has changed, so the contents have to be filtered again
+		force = true;
+	}
+	PGDestroyIgnoreGlob(ignore_glob);
+	ignore_glob = glob;
+	if (!force && loaded_files && modification_time >= 0 && modification_time == listed_modification_time) {
+		// the contents of this directory are unchanged, we only have to check the subdirectories
+		subdirectories.insert(subdirectories.end(), directories.begin(), directories.end());
+		UnlockMutex(lock.get());
+		return;
+	}
+	loaded_files = false;
 
 	lng previous_filecount = files.size();
 	std::unordered_set<std::string> old_files;
 	
 	if (index) {
-		this->index = std::weak_ptr<SearchIndex>(index);
 		// we keep a list of old files around, so we know which 
 		// files have been added and deleted
 		for (auto it = files.begin(); it != files.end(); it++) {
@@ -191,9 +300,12 @@ void PGDirectory::Update(PGIgnoreGlob glob, std::queue<std::shared_ptr<PGDirecto
 	files.clear();
 	std::vector<PGFile> dirs;
 	std::vector<std::shared_ptr<PGDirectory>> current_directories;
-	if (PGGetDirectoryFiles(path, dirs, files, glob) != PGDirectorySuccess) {
+	if (PGGetDirectoryFiles(path, dirs, files) != PGDirectorySuccess) {
 		goto unlock;
 	}
+	if (glob) {
+		RemoveIgnoredEntries(glob, this->path, dirs, files);
+	}
 	difference = files.size() - previous_filecount;
 	if (index) {
 		LockMutex(index->lock.get());
@@ -202,14 +314,7 @@ void PGDirectory::Update(PGIgnoreGlob glob, std::queue<std::shared_ptr<PGDirecto
 			auto current_entry = old_files.find(it->path);
 			if (current_entry == old_files.end()) {
 				// new file, add it to the search index
-				std::string path = PGPathJoin(this->path, it->path);
-				SearchEntry entry;
-				entry.display_name = it->path;
-				entry.display_subtitle = path;
-				entry.text = path;
-				entry.basescore = 0;
-				entry.multiplier = 1;
-				index->AddEntry(entry);
+				AddIndexEntry(index.get(), this->path, it->path);
 			} else {
 				// file already exists, remove it from old_files
 				old_files.erase(current_entry);
@@ -218,7 +323,7 @@ void PGDirectory::Update(PGIgnoreGlob glob, std::queue<std::shared_ptr<PGDirecto
 		// all remaining files in old_files have been deleted
 		// remove them from the search index
 		for (auto it = old_files.begin(); it != old_files.end(); it++) {
-			index->RemoveEntry(*it);
+			index->RemoveEntry(PGPathJoin(this->path, *it));
 		}
 		UnlockMutex(index->lock.get());
 	}
@@ -233,7 +338,7 @@ void PGDirectory::Update(PGIgnoreGlob glob, std::queue<std::shared_ptr<PGDirecto
 		bool found = false;
 		for (auto it2 = current_directories.begin(); it2 != current_directories.end(); it2++) {
 			if ((*it2)->path == path) {
-				open_directories.push(*it2);
+				subdirectories.push_back(*it2);
 				current_directories.erase(it2);
 				found = true;
 				break;
@@ -243,7 +348,7 @@ void PGDirectory::Update(PGIgnoreGlob glob, std::queue<std::shared_ptr<PGDirecto
 			// if the directory is not known add it and scan it
 			auto new_directory = std::shared_ptr<PGDirectory>(new PGDirectory(path, this));
 			directories.push_back(new_directory);
-			open_directories.push(new_directory);
+			subdirectories.push_back(new_directory);
 		}
 	}
 	// remove any directories we did not find (because they have been deleted or removed)
@@ -257,11 +362,294 @@ void PGDirectory::Update(PGIgnoreGlob glob, std::queue<std::shared_ptr<PGDirecto
 	directory_difference += directories.size() - previous_dircount;
 	this->AddFiles(file_difference);
 	this->AddDisplayedFiles(difference + directory_difference);
+	listed_modification_time = modification_time;
 	loaded_files = true;
 unlock:
 	UnlockMutex(lock.get());
 }
 
+struct PGDirectoryCrawl {
+	// the queue of directories to update; a nullptr is queued when the last directory has been updated
+	moodycamel::BlockingConcurrentQueue<std::shared_ptr<PGDirectory>> queue;
+	// the amount of directories that are either queued or being updated
+	std::atomic<lng> pending;
+	// the amount of helper tasks that are currently registered or running
+	std::atomic<lng> helpers;
+	std::atomic<bool> cancelled;
+
+	bool ignore_files;
+	std::shared_ptr<SearchIndex> index;
+	bool force;
+	PGDirectoryCrawlCallback callback;
+	void* data;
+
+	PGDirectoryCrawl(bool ignore_files, std::shared_ptr<SearchIndex> index, bool force, PGDirectoryCrawlCallback callback, void* data) :
+		pending(0), helpers(0), cancelled(false), ignore_files(ignore_files), index(index), force(force), callback(callback), data(data) { }
+};
+
+static void CrawlHelper(std::shared_ptr<PGDirectoryCrawl> crawl);
+
+static void SpawnCrawlHelpers(std::shared_ptr<PGDirectoryCrawl>& crawl, lng work) {
+	// helpers exit as soon as they find the queue empty, so we register new ones when work is added
+	lng maximum_helpers = Scheduler::GetThreadCount();
+	for (lng i = 0; i < work; i++) {
+		lng helpers = crawl->helpers;
+		if (helpers >= maximum_helpers) break;
+		if (!crawl->helpers.compare_exchange_weak(helpers, helpers + 1)) continue;
+		// helpers hold a reference to the crawl, so helpers that only start
+		// after the crawl has finished find no work left and exit immediately
+		auto reference = new std::shared_ptr<PGDirectoryCrawl>(crawl);
+		Scheduler::RegisterTask(std::make_shared<Task>([](std::shared_ptr<Task> task, void* data) {
+			std::shared_ptr<PGDirectoryCrawl>* crawl = (std::shared_ptr<PGDirectoryCrawl>*) data;
+			CrawlHelper(*crawl);
+			delete crawl;
+		}, reference), PGTaskUrgent);
+	}
+}
+
+static void CrawlDirectory(std::shared_ptr<PGDirectoryCrawl>& crawl, std::shared_ptr<PGDirectory> directory) {
+	// after the crawl is cancelled the remaining directories are only drained from the queue
+	if (!crawl->cancelled) {
+		std::vector<std::shared_ptr<PGDirectory>> subdirectories;
+		directory->Update(crawl->ignore_files, subdirectories, crawl->index, crawl->force);
+		if (subdirectories.size() > 0) {
+			crawl->pending += subdirectories.size();
+			crawl->queue.enqueue_bulk(subdirectories.begin(), subdirectories.size());
+			SpawnCrawlHelpers(crawl, subdirectories.size());
+		}
+		if (!crawl->callback(directory.get(), crawl->data)) {
+			crawl->cancelled = true;
+		}
+	}
+	if (--crawl->pending == 0) {
+		// wake up the crawling thread, which waits for the last directory to finish
+		crawl->queue.enqueue(nullptr);
+	}
+}
+
+static void CrawlHelper(std::shared_ptr<PGDirectoryCrawl> crawl) {
+	std::shared_ptr<PGDirectory> directory;
+	while (crawl->queue.try_dequeue(directory)) {
+		if (!directory) {
+			// the crawl is finished, leave the wake up for the crawling thread
+			crawl->queue.enqueue(nullptr);
+			break;
+		}
+		CrawlDirectory(crawl, directory);
+	}
+	crawl->helpers--;
+}
+
+bool PGDirectory::Crawl(std::shared_ptr<PGDirectory> root, bool ignore_files, std::shared_ptr<SearchIndex> index, bool force, PGDirectoryCrawlCallback callback, void* data) {
+	auto crawl = std::make_shared<PGDirectoryCrawl>(ignore_files, index, force, callback, data);
+	crawl->pending = 1;
+	crawl->queue.enqueue(root);
+	// the crawling thread updates directories as well, and blocks on the queue while the helpers
+	// are busy; it only returns after every directory has been updated, so after this
+	// no helper will touch the callback anymore
+	while (true) {
+		std::shared_ptr<PGDirectory> directory;
+		crawl->queue.wait_dequeue(directory);
+		if (!directory) break;
+		CrawlDirectory(crawl, directory);
+	}
+	return !crawl->cancelled;
+}
+
+/*
+Snapshot format (native byte order, it is only a local cache):
+"PGFT" [uint32 version] [int64 .gitignore modification time] [directory]
+directory: [string name] [int64 modification time] [uint32 files] [string]* [uint32 directories] [directory]*
+string: [uint32 length] [bytes]
+the name of the root directory is its full path, all other names are relative to their parent
+*/
+#define PGDIRECTORY_SNAPSHOT_VERSION 1
+
+std::string PGDirectory::SnapshotFilename(std::string path, bool show_all_files) {
+	// FNV-1a hash of the path, so every project gets its own snapshot
+	uint64_t hash = 14695981039346656037ULL;
+	for (auto it = path.begin(); it != path.end(); it++) {
+		hash = (hash ^ (unsigned char)*it) * 1099511628211ULL;
+	}
+	char filename[64];
+	snprintf(filename, 64, "filetree_%016llx_%d.cache", (unsigned long long) hash, show_all_files ? 1 : 0);
+	return std::string(filename);
+}
+
+static void WriteSnapshotInteger(std::string& snapshot, uint32_t value) {
+	snapshot.append((char*)&value, sizeof(uint32_t));
+}
+
+static void WriteSnapshotTime(std::string& snapshot, lng value) {
+	int64_t time = (int64_t)value;
+	snapshot.append((char*)&time, sizeof(int64_t));
+}
+
+static void WriteSnapshotString(std::string& snapshot, const std::string& value) {
+	WriteSnapshotInteger(snapshot, (uint32_t)value.size());
+	snapshot += value;
+}
+
+static bool ReadSnapshotInteger(const char*& ptr, const char* end, uint32_t& value) {
+	if (end - ptr < (lng) sizeof(uint32_t)) return false;
+	memcpy(&value, ptr, sizeof(uint32_t));
+	ptr += sizeof(uint32_t);
+	return true;
+}
+
+static bool ReadSnapshotTime(const char*& ptr, const char* end, lng& value) {
+	int64_t time;
+	if (end - ptr < (lng) sizeof(int64_t)) return false;
+	memcpy(&time, ptr, sizeof(int64_t));
+	ptr += sizeof(int64_t);
+	value = (lng)time;
+	return true;
+}
+
+static bool ReadSnapshotString(const char*& ptr, const char* end, std::string& value) {
+	uint32_t length;
+	if (!ReadSnapshotInteger(ptr, end, length) || end - ptr < (lng) length) return false;
+	value = std::string(ptr, length);
+	ptr += length;
+	return true;
+}
+
+void PGDirectory::WriteSnapshotDirectory(std::string& snapshot, PGDirectory* directory, std::string name) {
+	LockMutex(directory->lock.get());
+	auto files = directory->files;
+	auto directories = directory->directories;
+	// directories that were not read completely are stored without contents so they are read again
+	bool loaded = directory->loaded_files;
+	lng modification_time = directory->listed_modification_time;
+	UnlockMutex(directory->lock.get());
+
+	WriteSnapshotString(snapshot, name);
+	WriteSnapshotTime(snapshot, loaded ? modification_time : -1);
+	WriteSnapshotInteger(snapshot, loaded ? (uint32_t)files.size() : 0);
+	if (loaded) {
+		for (auto it = files.begin(); it != files.end(); it++) {
+			WriteSnapshotString(snapshot, it->path);
+		}
+	}
+	WriteSnapshotInteger(snapshot, loaded ? (uint32_t)directories.size() : 0);
+	if (loaded) {
+		for (auto it = directories.begin(); it != directories.end(); it++) {
+			WriteSnapshotDirectory(snapshot, it->get(), PGFile((*it)->path).Filename());
+		}
+	}
+}
+
+bool PGDirectory::ReadSnapshotDirectory(const char*& ptr, const char* end, PGDirectory* directory) {
+	uint32_t file_count, directory_count;
+	if (!ReadSnapshotTime(ptr, end, directory->listed_modification_time)) return false;
+	if (!ReadSnapshotInteger(ptr, end, file_count)) return false;
+	for (uint32_t i = 0; i < file_count; i++) {
+		std::string name;
+		if (!ReadSnapshotString(ptr, end, name)) return false;
+		directory->files.push_back(PGFile(name));
+	}
+	if (!ReadSnapshotInteger(ptr, end, directory_count)) return false;
+	lng total_files = directory->files.size();
+	for (uint32_t i = 0; i < directory_count; i++) {
+		std::string name;
+		if (!ReadSnapshotString(ptr, end, name)) return false;
+		auto subdirectory = std::shared_ptr<PGDirectory>(new PGDirectory(PGPathJoin(directory->path, name), directory));
+		directory->directories.push_back(subdirectory);
+		if (!ReadSnapshotDirectory(ptr, end, subdirectory.get())) return false;
+		total_files += subdirectory->total_files;
+	}
+	// directories in a snapshot start out collapsed
+	directory->total_files = total_files;
+	directory->displayed_files = directory->files.size() + directory->directories.size();
+	directory->loaded_files = directory->listed_modification_time >= 0;
+	return true;
+}
+
+void PGDirectory::AddSnapshotToIndex(PGDirectory* directory, std::shared_ptr<SearchIndex>& index) {
+	directory->index = std::weak_ptr<SearchIndex>(index);
+	for (auto it = directory->files.begin(); it != directory->files.end(); it++) {
+		AddIndexEntry(index.get(), directory->path, it->path);
+	}
+	for (auto it = directory->directories.begin(); it != directory->directories.end(); it++) {
+		AddSnapshotToIndex(it->get(), index);
+	}
+}
+
+bool PGDirectory::LoadSnapshot(std::string filename, std::shared_ptr<SearchIndex> index) {
+	lng size;
+	PGFileError error;
+	char* data = (char*)panther::ReadFile(filename, size, error);
+	if (!data) {
+		return false;
+	}
+	const char* ptr = data;
+	const char* end = data + size;
+	uint32_t version;
+	lng ignore_modification_time;
+	std::string name;
+	// we read the snapshot into a separate tree first, so a corrupt snapshot leaves this directory untouched
+	PGDirectory snapshot(this->path, nullptr);
+	bool success = end - ptr >= 4 && memcmp(ptr, "PGFT", 4) == 0;
+	ptr += 4;
+	success = success &&
+		ReadSnapshotInteger(ptr, end, version) && version == PGDIRECTORY_SNAPSHOT_VERSION &&
+		ReadSnapshotTime(ptr, end, ignore_modification_time) &&
+		ReadSnapshotString(ptr, end, name) && name == this->path &&
+		ReadSnapshotDirectory(ptr, end, &snapshot) && ptr == end;
+	panther::DestroyFileContents(data);
+	if (!success) {
+		return false;
+	}
+
+	LockMutex(lock.get());
+	if (loaded_files || files.size() > 0 || directories.size() > 0) {
+		// the directory has already been read
+		UnlockMutex(lock.get());
+		return false;
+	}
+	this->files.swap(snapshot.files);
+	this->directories.swap(snapshot.directories);
+	for (auto it = directories.begin(); it != directories.end(); it++) {
+		(*it)->parent = this;
+	}
+	this->listed_modification_time = snapshot.listed_modification_time;
+	this->ignore_modification_time = ignore_modification_time;
+	this->loaded_files = snapshot.loaded_files;
+	this->total_files = snapshot.total_files.load();
+	this->displayed_files = snapshot.displayed_files.load();
+	if (index) {
+		LockMutex(index->lock.get());
+		AddSnapshotToIndex(this, index);
+		UnlockMutex(index->lock.get());
+	}
+	UnlockMutex(lock.get());
+	return true;
+}
+
+bool PGDirectory::WriteSnapshot(std::string filename) {
+	if (PGGlobalReplayManager::running_replay) return false;
+
+	std::string snapshot = "PGFT";
+	WriteSnapshotInteger(snapshot, PGDIRECTORY_SNAPSHOT_VERSION);
+	WriteSnapshotTime(snapshot, ignore_modification_time);
+	WriteSnapshotDirectory(snapshot, this, this->path);
+
+	// we write the snapshot to a temporary file first, and then move it over the old snapshot
+	std::string temp_filename = filename + ".tmp";
+	PGFileError error;
+	PGFileHandle handle = panther::OpenFile(temp_filename, PGFileReadWrite, error);
+	if (!handle) {
+		return false;
+	}
+	panther::WriteToFile(handle, snapshot.c_str(), snapshot.size());
+	panther::CloseFile(handle);
+	if (PGRenameFile(temp_filename, filename) != PGIOSuccess) {
+		PGRemoveFile(temp_filename);
+		return false;
+	}
+	return true;
+}
+
 void PGDirectory::AddFiles(lng files) {
 	if (files == 0) return;
 
@@ -276,6 +664,6 @@ void PGDirectory::AddDisplayedFiles(lng files) {
 
 	this->displayed_files += files;
 	if (this->expanded && parent) {
-		parent->displayed_files += files;
+		parent->AddDisplayedFiles(files);
 	}
 }
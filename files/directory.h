@@ -6,14 +6,18 @@
 
 #include "thread.h"
 
-#include <queue>
+#include <atomic>
+#include <vector>
 
 #include <rust/globset.h>
 #include <rust/gitignore.h>
 
 struct SearchIndex;
+struct PGDirectory;
 
 typedef bool(*PGDirectoryIterCallback)(PGFile f, void* data, lng filenr, lng total_files);
+// called after a directory has been updated during a crawl; returning false cancels the crawl
+typedef bool(*PGDirectoryCrawlCallback)(PGDirectory* directory, void* data);
 
 struct PGDirectory {
 	friend class DirectoryIterator;
@@ -33,23 +37,49 @@ public:
 
 	lng FindFile(std::string full_name, PGDirectory** directory, PGFile* file, bool search_only_expanded = false);
 
+	// returns the directory with the given path if it is part of the tree of "root", or nullptr otherwise
+	static std::shared_ptr<PGDirectory> FindDirectory(std::shared_ptr<PGDirectory> root, std::string path);
+
 	bool IsExpanded() { return expanded; }
 	void SetExpanded(bool expand);
 	void CollapseAll();
 
 	// Returns the number of files displayed by this directory
-	lng DisplayedFiles() { return 1 + (expanded ? displayed_files : 0); }
+	lng DisplayedFiles() { return 1 + (expanded ? displayed_files.load() : 0); }
 	// Returns the total number of files in this directory
 	lng TotalFiles() { return total_files; }
 
 	bool IterateOverFiles(PGDirectoryIterCallback callback, void* data, lng& files, lng total_files);
 
-	void Update(PGIgnoreGlob glob, std::queue<std::shared_ptr<PGDirectory>>& open_directories, std::shared_ptr<SearchIndex> index);
+	// reads the contents of this directory, subdirectories that have to be checked are added to "subdirectories"
+	// if ignore_files is true, files matched by the .gitignore files of the directory (and its parents) are skipped
+	// if force is false and the directory has not been modified since it was last read, the contents are not read again
+	void Update(bool ignore_files, std::vector<std::shared_ptr<PGDirectory>>& subdirectories, std::shared_ptr<SearchIndex> index, bool force);
+	// updates the directory tree starting at "root", spreading the directories over the scheduler threads
+	// returns false if the crawl was cancelled by the callback
+	static bool Crawl(std::shared_ptr<PGDirectory> root, bool ignore_files, std::shared_ptr<SearchIndex> index, bool force, PGDirectoryCrawlCallback callback, void* data);
+
+	// the file in which the snapshot of the directory tree of "path" is stored
+	static std::string SnapshotFilename(std::string path, bool show_all_files);
+	// fills an empty directory with the tree stored in a snapshot, returns false if there is no valid snapshot
+	bool LoadSnapshot(std::string filename, std::shared_ptr<SearchIndex> index);
+	// writes the current directory tree (file names and modification times) to a snapshot
+	bool WriteSnapshot(std::string filename);
 private:
 	std::weak_ptr<SearchIndex> index;
 	bool expanded;
+	// modification time of the directory at the moment its contents were last read
+	lng listed_modification_time;
+	// modification time of the .gitignore file the current listing was created with (root directories only)
+	lng ignore_modification_time;
+	// the .gitignore rules that apply to the entries of this directory, nullptr if ignored files are shown
+	PGIgnoreGlob ignore_glob;
 	std::unique_ptr<PGMutex> lock;
 
+	static void WriteSnapshotDirectory(std::string& snapshot, PGDirectory* directory, std::string name);
+	static bool ReadSnapshotDirectory(const char*& ptr, const char* end, PGDirectory* directory);
+	static void AddSnapshotToIndex(PGDirectory* directory, std::shared_ptr<SearchIndex>& index);
+
 	void AddFiles(lng files);
 	void AddDisplayedFiles(lng files);
 
@@ -59,8 +89,9 @@ private:
 	// FIXME: this should probably be a weak ptr
 	PGDirectory* parent;
 
+	// the counters are atomic because directories in the same tree are updated from different threads
 	// total amount of displayed files for this directory (including directories)
-	lng displayed_files;
+	std::atomic<lng> displayed_files;
 	// total amount of files in this directory (excluding directories)
-	lng total_files;
+	std::atomic<lng> total_files;
 };
@@ -79,6 +79,14 @@ namespace panther {
 		return fsize;
 	}
 
+	bool SeekFile(PGFileHandle handle, lng offset) {
+#ifdef WIN32
+		return _fseeki64(handle->f, offset, SEEK_SET) == 0;
+#else
+		return fseeko(handle->f, offset, SEEK_SET) == 0;
+#endif
+	}
+
 	size_t ReadFromFile(PGFileHandle handle, char* buffer, size_t buffer_size) {
 		return fread(buffer, 1, buffer_size, handle->f);
 	}
@@ -141,11 +149,11 @@ namespace panther {
 		return string;
 	}
 
-	void WriteToFile(PGFileHandle handle, const char* text, lng length) {
-		if (PGGlobalReplayManager::running_replay) return;
+	bool WriteToFile(PGFileHandle handle, const char* text, lng length) {
+		if (PGGlobalReplayManager::running_replay) return true;
 
-		if (length == 0) return;
-		fwrite(text, sizeof(char), length, handle->f);
+		if (length == 0) return true;
+		return fwrite(text, sizeof(char), length, handle->f) == (size_t) length;
 	}	
 	
 	void Flush(PGFileHandle handle) {
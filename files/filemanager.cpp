@@ -1,6 +1,7 @@
 
 #include "filemanager.h"
 #include "inmemorytextfile.h"
+#include "settings.h"
 #include "streamingtextfile.h"
 
 FileManager::FileManager() {
@@ -15,8 +16,8 @@ std::shared_ptr<TextFile> FileManager::_OpenFile() {
 	return _OpenFile(textfile);
 }
 
-std::shared_ptr<TextFile> FileManager::_OpenFile(std::string path, PGFileError& error) {
-	return _OpenFile(StreamingTextFile::OpenTextFile(path, error, false));
+std::shared_ptr<TextFile> FileManager::_OpenFile(std::string path, PGFileError& error, bool defer_loading) {
+	return _OpenFile(StreamingTextFile::OpenTextFile(path, error, false, defer_loading));
 }
 
 std::shared_ptr<TextFile> FileManager::_OpenFile(TextFile* textfile) {
@@ -24,6 +25,7 @@ std::shared_ptr<TextFile> FileManager::_OpenFile(TextFile* textfile) {
 	auto ptr = std::shared_ptr<TextFile>(textfile);
 	LockMutex(lock.get());
 	open_files.push_back(ptr);
+	files_version++;
 	UnlockMutex(lock.get());
 	return ptr;
 }
@@ -33,6 +35,7 @@ std::shared_ptr<TextFile> FileManager::_OpenFile(std::shared_ptr<TextFile> textf
 	assert(std::find(open_files.begin(), open_files.end(), textfile) == open_files.end());
 	LockMutex(lock.get());
 	open_files.push_back(textfile);
+	files_version++;
 	UnlockMutex(lock.get());
 	return textfile;
 } 
@@ -42,6 +45,7 @@ void FileManager::_CloseFile(std::shared_ptr<TextFile> file) {
 	file->PendDelete();
 	assert(std::find(open_files.begin(), open_files.end(), file) != open_files.end());
 	open_files.erase(std::find(open_files.begin(), open_files.end(), file));
+	files_version++;
 	UnlockMutex(lock.get());
 }
 
@@ -57,9 +61,40 @@ std::shared_ptr<TextFile> FileManager::_FindFile(std::string path) {
 	return nullptr;
 }
 
+void FileManager::_EnforceMemoryBudget() {
+	lng budget = 512;
+	PGSettingsManager::GetSetting("open_files_memory_budget", budget);
+	budget *= 1024 * 1024;
+
+	std::vector<std::shared_ptr<TextFile>> files;
+	LockMutex(lock.get());
+	files = open_files;
+	UnlockMutex(lock.get());
+
+	lng total = 0;
+	std::vector<std::pair<lng, TextFile*>> candidates;
+	for (auto it = files.begin(); it != files.end(); it++) {
+		TextFile* file = it->get();
+		if (!file->IsLoaded()) continue;
+		total += file->GetMemoryUsage();
+		if (!file->IsVisible()) {
+			candidates.push_back(std::pair<lng, TextFile*>(file->GetLastUsed(), file));
+		}
+	}
+	if (total <= budget) return;
+	// unload the least recently used files first
+	std::sort(candidates.begin(), candidates.end(), [](const std::pair<lng, TextFile*>& a, const std::pair<lng, TextFile*>& b) {
+		return a.first < b.first;
+	});
+	for (auto it = candidates.begin(); it != candidates.end() && total > budget; it++) {
+		total -= it->second->Unload();
+	}
+}
+
 void FileManager::_LoadWorkspace(nlohmann::json& j) {
 	assert(j.is_array());
 	open_files.clear();
+	files_version++;
 	for (auto it = j.begin(); it != j.end(); it++) {
 		std::shared_ptr<TextFile> file = nullptr;
 		std::string path = "";
@@ -81,8 +116,9 @@ void FileManager::_LoadWorkspace(nlohmann::json& j) {
 		} else if (path.size() > 0) {
 			// otherwise, if there is a file speciifed
 			// we load the text from the file instead
+			// the file is only read when its tab is first shown (or warmed up by the tab control)
 			PGFileError error;
-			file = FileManager::OpenFile(path, error);
+			file = FileManager::OpenFile(path, error, true);
 		} else {
 			continue;
 		}
@@ -120,58 +156,90 @@ void FileManager::_LoadWorkspace(nlohmann::json& j) {
 
 }
 
-void FileManager::_WriteWorkspace(nlohmann::json& j) {
-	assert(j.is_array());
+void FileManager::_WriteWorkspace(std::vector<std::shared_ptr<const nlohmann::json>>& files, std::vector<PGWorkspaceFileText>& texts) {
+	// entries of files that have been closed are dropped by only keeping the entries of the open files
+	std::unordered_map<TextFile*, PGWorkspaceFileEntry> entries;
 	for (auto it = open_files.begin(); it != open_files.end(); it++) {
-		j.push_back(nlohmann::json::object());
-		auto& cur = j.back();
 		TextFile* file = it->get();
 
-		if (file->HasUnsavedChanges()) {
-			// the file has unsaved changes
-			// so we have to write the file
-			auto store_file_type = file->WorkspaceFileStorage();
-			if (store_file_type == TextFile::PGStoreFileBuffer) {
-				// write the buffer
-				cur["buffer"] = file->GetText();
-			} else if (store_file_type == TextFile::PGStoreFileDeltas) {
-				// delta storage not supported yet
-				assert(0);
-			}
+		PGWorkspaceFileEntry entry;
+		entry.path = file->GetFullPath();
+		entry.name = entry.path.size() == 0 ? file->GetName() : "";
+		entry.language = file->GetLanguage();
+		entry.loaded = file->IsLoaded();
+		entry.unsaved = file->HasUnsavedChanges();
+		if (entry.loaded) {
+			entry.line_ending = file->GetLineEnding();
+			entry.encoding = file->GetFileEncoding();
+		}
+		// the text of files with unsaved changes is written as well
+		// taking a snapshot is cheap, the text itself is copied out on the background thread
+		bool store_buffer = entry.unsaved && file->WorkspaceFileStorage() == TextFile::PGStoreFileBuffer;
+		auto snapshot = store_buffer && entry.loaded ? file->GetSnapshot() : nullptr;
+		if (snapshot) {
+			texts.push_back(PGWorkspaceFileText(files.size(), snapshot, file));
+		}
+		// if no snapshot can be taken the text is stored in the state itself, so it cannot be reused
+		bool inline_text = store_buffer && !snapshot;
+
+		auto previous = workspace_entries.find(file);
+		if (!inline_text && previous != workspace_entries.end() &&
+			previous->second.path == entry.path && previous->second.name == entry.name &&
+			previous->second.language == entry.language && previous->second.loaded == entry.loaded &&
+			previous->second.unsaved == entry.unsaved && previous->second.line_ending == entry.line_ending &&
+			previous->second.encoding == entry.encoding) {
+			// the file has not changed since the previous capture
+			files.push_back(previous->second.j);
+			entries[file] = previous->second;
+			continue;
 		}
 
-		std::string path = file->GetFullPath();
-		if (path.size() != 0) {
-			cur["file"] = path;
+		auto cur = std::make_shared<nlohmann::json>(nlohmann::json::object());
+		if (inline_text) {
+			(*cur)["buffer"] = file->GetText();
+		} else if (entry.unsaved && file->WorkspaceFileStorage() == TextFile::PGStoreFileDeltas) {
+			// delta storage not supported yet
+			assert(0);
+		}
+		if (entry.path.size() != 0) {
+			(*cur)["file"] = entry.path;
 		} else {
-			cur["name"] = file->GetName();
-		}
-		auto line_ending = file->GetLineEnding();
-		if (line_ending == PGLineEndingMixed || line_ending == PGLineEndingUnknown) {
-			line_ending = GetSystemLineEnding();
-		}
-		std::string endings;
-		switch (line_ending) {
-			case PGLineEndingWindows:
-				endings = "Windows";
-				break;
-			case PGLineEndingUnix:
-				endings = "Unix";
-				break;
-			case PGLineEndingMacOS:
-				endings = "MacOS";
-				break;
-			default:
-				endings = "Mixed";
-				break;
-		}
-		auto language = file->GetLanguage();
-		if (language) {
-			cur["language"] = language->GetName();
-		}
-		cur["lineending"] = endings;
-		cur["encoding"] = PGEncodingToString(file->GetFileEncoding());
+			(*cur)["name"] = entry.name;
+		}
+		if (entry.language) {
+			(*cur)["language"] = entry.language->GetName();
+		}
+		if (entry.loaded) {
+			// the line ending and encoding are not known until the file has been read
+			auto line_ending = entry.line_ending;
+			if (line_ending == PGLineEndingMixed || line_ending == PGLineEndingUnknown) {
+				line_ending = GetSystemLineEnding();
+			}
+			std::string endings;
+			switch (line_ending) {
+				case PGLineEndingWindows:
+					endings = "Windows";
+					break;
+				case PGLineEndingUnix:
+					endings = "Unix";
+					break;
+				case PGLineEndingMacOS:
+					endings = "MacOS";
+					break;
+				default:
+					endings = "Mixed";
+					break;
+			}
+			(*cur)["lineending"] = endings;
+			(*cur)["encoding"] = PGEncodingToString(entry.encoding);
+		}
+		files.push_back(cur);
+		if (!inline_text) {
+			entry.j = cur;
+			entries[file] = entry;
+		}
 	}
+	workspace_entries.swap(entries);
 }
 
 std::shared_ptr<TextFile> FileManager::_GetFileByIndex(size_t index) {
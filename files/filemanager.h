@@ -3,6 +3,31 @@
 #include "textfile.h"
 #include "windowfunctions.h"
 
+#include <unordered_map>
+
+// the text of a file with unsaved changes, which is written to the workspace on a background thread
+struct PGWorkspaceFileText {
+	size_t index;
+	std::shared_ptr<PGTextSnapshot> snapshot;
+
+	// the file the snapshot was taken from, only used to recognize unchanged texts
+	const void* file;
+
+	PGWorkspaceFileText(size_t index, std::shared_ptr<PGTextSnapshot> snapshot, const void* file) : index(index), snapshot(snapshot), file(file) { }
+};
+
+// the workspace state of a single file, it is captured again only when one of the properties changes
+struct PGWorkspaceFileEntry {
+	std::string path;
+	std::string name;
+	PGLanguage* language = nullptr;
+	bool loaded = false;
+	bool unsaved = false;
+	PGLineEnding line_ending = PGLineEndingUnknown;
+	PGFileEncoding encoding = PGEncodingUnknown;
+	std::shared_ptr<const nlohmann::json> j;
+};
+
 // FIXME: FileManager should not be static -> one filemanager per workspace
 class FileManager {
 public:
@@ -12,28 +37,36 @@ public:
 	}
 
 	static void LoadWorkspace(nlohmann::json& j) { GetInstance()->_LoadWorkspace(j); }
-	static void WriteWorkspace(nlohmann::json& j) { return GetInstance()->_WriteWorkspace(j); }
+	// the state of every open file is added to files; files that have not changed share their state with the previous call
+	// the text of files with unsaved changes is not stored in the state, but captured as snapshots in texts
+	static void WriteWorkspace(std::vector<std::shared_ptr<const nlohmann::json>>& files, std::vector<PGWorkspaceFileText>& texts) { return GetInstance()->_WriteWorkspace(files, texts); }
+	// incremented whenever files are opened or closed (which changes the file indices)
+	static lng GetFilesVersion() { return GetInstance()->files_version; }
 
 	static void Initialize() { GetInstance(); }
 
 	static std::shared_ptr<TextFile> GetFileByIndex(size_t index) { return GetInstance()->_GetFileByIndex(index); }
 	static size_t GetFileIndex(std::shared_ptr<TextFile> file) { return GetInstance()->_GetFileIndex(file); }
 	static std::shared_ptr<TextFile> OpenFile() { return GetInstance()->_OpenFile(); }
-	static std::shared_ptr<TextFile> OpenFile(std::string path, PGFileError& error) { return GetInstance()->_OpenFile(path, error); }
+	static std::shared_ptr<TextFile> OpenFile(std::string path, PGFileError& error, bool defer_loading = false) { return GetInstance()->_OpenFile(path, error, defer_loading); }
 	static std::shared_ptr<TextFile> OpenFile(std::shared_ptr<TextFile> textfile) { return GetInstance()->_OpenFile(textfile); }
 	static void CloseFile(std::shared_ptr<TextFile> ptr) { GetInstance()->_CloseFile(ptr); }
 
 	static std::shared_ptr<TextFile> FindFile(std::string path) { return GetInstance()->_FindFile(path); }
 
+	// unloads the files that have not been used for the longest time
+	// until the text of all open files fits in the memory budget ("open_files_memory_budget" in MB)
+	static void EnforceMemoryBudget() { GetInstance()->_EnforceMemoryBudget(); }
+
 private:
 	FileManager();
 	~FileManager();
 
 	void _LoadWorkspace(nlohmann::json& j);
-	void _WriteWorkspace(nlohmann::json& j);
+	void _WriteWorkspace(std::vector<std::shared_ptr<const nlohmann::json>>& files, std::vector<PGWorkspaceFileText>& texts);
 
 	std::shared_ptr<TextFile> _OpenFile();
-	std::shared_ptr<TextFile> _OpenFile(std::string path, PGFileError& error);
+	std::shared_ptr<TextFile> _OpenFile(std::string path, PGFileError& error, bool defer_loading);
 	std::shared_ptr<TextFile> _OpenFile(std::shared_ptr<TextFile> textfile);
 	void _CloseFile(std::shared_ptr<TextFile>);
 
@@ -41,8 +74,12 @@ private:
 	size_t _GetFileIndex(std::shared_ptr<TextFile> file);
 
 	std::shared_ptr<TextFile> _FindFile(std::string path);
+
+	void _EnforceMemoryBudget();
 	
 	std::vector<std::shared_ptr<TextFile>> open_files;
+	lng files_version = 0;
+	std::unordered_map<TextFile*, PGWorkspaceFileEntry> workspace_entries;
 
 	std::shared_ptr<TextFile> _OpenFile(TextFile* textfile);
 
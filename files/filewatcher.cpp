@@ -0,0 +1,358 @@
+
+#include "filewatcher.h"
+#include "textfile.h"
+#include "windowfunctions.h"
+
+#include <algorithm>
+#include <chrono>
+
+#if defined(__linux__)
+#define PANTHER_INOTIFY
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// interval in milliseconds at which polled paths are checked for changes
+#define PGFILEWATCHER_POLL_INTERVAL 1000
+
+struct PGFileWatchGroup {
+	// paths that have changed since the last call to GetChanges
+	std::unordered_set<std::string> changes;
+	// the paths watched by this group, mapped to whether or not they are a directory
+	std::unordered_map<std::string, bool> paths;
+	// the directories watched by this group as root directories
+	std::unordered_set<std::string> roots;
+};
+
+#ifdef PANTHER_INOTIFY
+static const uint32_t directory_mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+	IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+#endif
+
+FileWatcher::FileWatcher() {
+	lock = std::unique_ptr<PGMutex>(CreateMutex());
+#ifdef PANTHER_INOTIFY
+	inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+	thread = CreateThread(RunThread);
+	DetachThread(thread);
+}
+
+void FileWatcher::RunThread() {
+	FileWatcher& watcher = FileWatcher::GetInstance();
+	auto last_poll = std::chrono::steady_clock::now();
+	while (watcher.running) {
+#ifdef PANTHER_INOTIFY
+		if (watcher.inotify >= 0) {
+			struct pollfd fd;
+			fd.fd = watcher.inotify;
+			fd.events = POLLIN;
+			fd.revents = 0;
+			if (poll(&fd, 1, PGFILEWATCHER_POLL_INTERVAL) > 0) {
+				// events are aligned to struct inotify_event
+				alignas(struct inotify_event) char buffer[16384];
+				ssize_t size;
+				while ((size = read(watcher.inotify, buffer, sizeof(buffer))) > 0) {
+					LockMutex(watcher.lock.get());
+					watcher.ProcessEvents(buffer, size);
+					UnlockMutex(watcher.lock.get());
+				}
+			}
+		} else
+#endif
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(PGFILEWATCHER_POLL_INTERVAL));
+		}
+		auto now = std::chrono::steady_clock::now();
+		if (std::chrono::duration_cast<std::chrono::milliseconds>(now - last_poll).count() >= PGFILEWATCHER_POLL_INTERVAL) {
+			watcher.PollDirectories();
+			last_poll = now;
+		}
+	}
+}
+
+PGFileWatchGroupHandle FileWatcher::_CreateGroup() {
+	return new PGFileWatchGroup();
+}
+
+void FileWatcher::_DestroyGroup(PGFileWatchGroupHandle group) {
+	if (!group) return;
+	LockMutex(lock.get());
+	auto paths = group->paths;
+	UnlockMutex(lock.get());
+	for (auto it = paths.begin(); it != paths.end(); it++) {
+		_Unwatch(group, it->first, false);
+	}
+	delete group;
+}
+
+FileWatcher::WatchedDirectory* FileWatcher::AddDirectory(std::string path) {
+	auto entry = directories.find(path);
+	if (entry != directories.end()) {
+		return entry->second.get();
+	}
+	WatchedDirectory* directory = new WatchedDirectory();
+	directory->path = path;
+	directories[path] = std::unique_ptr<WatchedDirectory>(directory);
+#ifdef PANTHER_INOTIFY
+	if (inotify >= 0) {
+		int descriptor = inotify_add_watch(inotify, path.c_str(), directory_mask);
+		// if we run out of watches (ENOSPC) or the same directory is already watched
+		// through a different path, we fall back to polling this directory
+		if (descriptor >= 0 && descriptors.count(descriptor) == 0) {
+			directory->descriptor = descriptor;
+			descriptors[descriptor] = directory;
+			return directory;
+		}
+	}
+#endif
+	auto info = PGGetFileFlags(path);
+	directory->modification_time = info.flags == PGFileFlagsEmpty ? info.modification_time : -1;
+	return directory;
+}
+
+void FileWatcher::RemoveIfUnused(WatchedDirectory* directory) {
+	if (directory->groups.size() > 0 || directory->files.size() > 0) {
+		return;
+	}
+#ifdef PANTHER_INOTIFY
+	if (directory->descriptor >= 0) {
+		inotify_rm_watch(inotify, directory->descriptor);
+		descriptors.erase(directory->descriptor);
+	}
+#endif
+	// the key is owned by the directory that is destroyed by the erase
+	std::string path = directory->path;
+	directories.erase(path);
+}
+
+void FileWatcher::_Watch(PGFileWatchGroupHandle group, std::string path, bool is_directory, bool root) {
+	LockMutex(lock.get());
+	if (group->paths.count(path) > 0) {
+		// this path is already being watched
+		if (is_directory && root && group->paths[path] && group->roots.count(path) == 0) {
+			// the directory is now watched as a root directory
+			group->roots.insert(path);
+			directories[path]->roots++;
+		}
+		UnlockMutex(lock.get());
+		return;
+	}
+	group->paths[path] = is_directory;
+	if (is_directory) {
+		WatchedDirectory* directory = AddDirectory(path);
+		directory->groups.push_back(group);
+		if (root) {
+			group->roots.insert(path);
+			directory->roots++;
+		}
+	} else {
+		// files are watched through their directory, this way we also notice
+		// when the file is replaced (e.g. by an editor that saves to a temporary file first)
+		PGFile file(path);
+		WatchedDirectory* directory = AddDirectory(file.Directory());
+		WatchedFile& watched_file = directory->files[file.Filename()];
+		if (directory->descriptor < 0 && watched_file.groups.size() == 0) {
+			auto info = PGGetFileFlags(path);
+			watched_file.modification_time = info.flags == PGFileFlagsEmpty ? info.modification_time : -1;
+			watched_file.file_size = info.flags == PGFileFlagsEmpty ? info.file_size : -1;
+		}
+		watched_file.groups.push_back(group);
+	}
+	UnlockMutex(lock.get());
+}
+
+void FileWatcher::_Unwatch(PGFileWatchGroupHandle group, std::string path, bool recursive) {
+	LockMutex(lock.get());
+	std::vector<std::pair<std::string, bool>> removed_paths;
+	for (auto it = group->paths.begin(); it != group->paths.end(); it++) {
+		if (it->first == path || (recursive && it->first.size() > path.size() &&
+			it->first[path.size()] == GetSystemPathSeparator() &&
+			it->first.compare(0, path.size(), path) == 0)) {
+			removed_paths.push_back(*it);
+		}
+	}
+	for (auto it = removed_paths.begin(); it != removed_paths.end(); it++) {
+		group->paths.erase(it->first);
+		std::string directory_path = it->second ? it->first : PGFile(it->first).Directory();
+		auto entry = directories.find(directory_path);
+		if (entry == directories.end()) continue;
+		WatchedDirectory* directory = entry->second.get();
+		if (it->second) {
+			auto position = std::find(directory->groups.begin(), directory->groups.end(), group);
+			if (position != directory->groups.end()) {
+				directory->groups.erase(position);
+			}
+			if (group->roots.erase(it->first) > 0) {
+				directory->roots--;
+			}
+		} else {
+			auto file = directory->files.find(PGFile(it->first).Filename());
+			if (file != directory->files.end()) {
+				auto position = std::find(file->second.groups.begin(), file->second.groups.end(), group);
+				if (position != file->second.groups.end()) {
+					file->second.groups.erase(position);
+				}
+				if (file->second.groups.size() == 0) {
+					directory->files.erase(file);
+				}
+			}
+		}
+		RemoveIfUnused(directory);
+	}
+	UnlockMutex(lock.get());
+}
+
+std::vector<std::string> FileWatcher::_GetChanges(PGFileWatchGroupHandle group) {
+	std::vector<std::string> changes;
+	LockMutex(lock.get());
+	if (group->changes.size() > 0) {
+		changes.insert(changes.end(), group->changes.begin(), group->changes.end());
+		group->changes.clear();
+	}
+	UnlockMutex(lock.get());
+	return changes;
+}
+
+void FileWatcher::ReportDirectory(WatchedDirectory* directory, bool include_files) {
+	for (auto it = directory->groups.begin(); it != directory->groups.end(); it++) {
+		(*it)->changes.insert(directory->path);
+	}
+	if (include_files) {
+		for (auto it = directory->files.begin(); it != directory->files.end(); it++) {
+			std::string path = PGPathJoin(directory->path, it->first);
+			for (auto it2 = it->second.groups.begin(); it2 != it->second.groups.end(); it2++) {
+				(*it2)->changes.insert(path);
+			}
+		}
+	}
+}
+
+void FileWatcher::ReportPolledSubdirectories(WatchedDirectory* root) {
+	// directories below a polled root are not polled themselves, so when the root changes they might have changed too
+	// the subscriber reads them again, which is cheap for directories that have not changed
+	for (auto it = directories.begin(); it != directories.end(); it++) {
+		WatchedDirectory* directory = it->second.get();
+		if (directory == root || directory->descriptor >= 0) continue;
+		if (directory->path.size() > root->path.size() &&
+			directory->path[root->path.size()] == GetSystemPathSeparator() &&
+			directory->path.compare(0, root->path.size(), root->path) == 0) {
+			ReportDirectory(directory, false);
+		}
+	}
+}
+
+void FileWatcher::ProcessEvents(const char* buffer, lng size) {
+#ifdef PANTHER_INOTIFY
+	const char* ptr = buffer;
+	while (ptr < buffer + size) {
+		const struct inotify_event* event = (const struct inotify_event*) ptr;
+		ptr += sizeof(struct inotify_event) + event->len;
+		if (event->mask & IN_Q_OVERFLOW) {
+			// events have been dropped; we have to assume everything has changed
+			for (auto it = directories.begin(); it != directories.end(); it++) {
+				ReportDirectory(it->second.get(), true);
+			}
+			continue;
+		}
+		auto entry = descriptors.find(event->wd);
+		if (entry == descriptors.end()) continue;
+		WatchedDirectory* directory = entry->second;
+		if (event->mask & IN_IGNORED) {
+			// the directory itself has been deleted or unmounted: the watch is gone
+			// the directory watchers are notified and dropped, files in it are polled from now on
+			ReportDirectory(directory, true);
+			descriptors.erase(entry);
+			directory->descriptor = -1;
+			directory->modification_time = -1;
+			for (auto it = directory->groups.begin(); it != directory->groups.end(); it++) {
+				(*it)->paths.erase(directory->path);
+				(*it)->roots.erase(directory->path);
+			}
+			directory->groups.clear();
+			directory->roots = 0;
+			RemoveIfUnused(directory);
+			continue;
+		}
+		if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+			ReportDirectory(directory, true);
+			continue;
+		}
+		if (event->len == 0) continue;
+		if (event->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)) {
+			// the entries of the directory have changed
+			ReportDirectory(directory, false);
+		}
+		auto file = directory->files.find(std::string(event->name));
+		if (file != directory->files.end()) {
+			std::string path = PGPathJoin(directory->path, file->first);
+			for (auto it = file->second.groups.begin(); it != file->second.groups.end(); it++) {
+				(*it)->changes.insert(path);
+			}
+		}
+	}
+#endif
+}
+
+struct PolledPath {
+	std::string directory;
+	std::string filename;
+	lng modification_time;
+	lng file_size;
+};
+
+void FileWatcher::PollDirectories() {
+	// we collect the polled paths first, so we do not hold the lock while accessing the disk
+	std::vector<PolledPath> polled_paths;
+	LockMutex(lock.get());
+	for (auto it = directories.begin(); it != directories.end(); it++) {
+		WatchedDirectory* directory = it->second.get();
+		if (directory->descriptor >= 0) continue;
+		// only root directories are polled, the other directories are reported when their root changes
+		if (directory->roots > 0) {
+			polled_paths.push_back(PolledPath{ directory->path, "", directory->modification_time, -1 });
+		}
+		for (auto file = directory->files.begin(); file != directory->files.end(); file++) {
+			polled_paths.push_back(PolledPath{ directory->path, file->first, file->second.modification_time, file->second.file_size });
+		}
+	}
+	UnlockMutex(lock.get());
+	if (polled_paths.size() == 0) return;
+
+	std::vector<PolledPath> changed_paths;
+	for (auto it = polled_paths.begin(); it != polled_paths.end(); it++) {
+		std::string path = it->filename.size() > 0 ? PGPathJoin(it->directory, it->filename) : it->directory;
+		auto info = PGGetFileFlags(path);
+		lng modification_time = info.flags == PGFileFlagsEmpty ? info.modification_time : -1;
+		lng file_size = info.flags == PGFileFlagsEmpty && it->filename.size() > 0 ? info.file_size : -1;
+		if (modification_time != it->modification_time || file_size != it->file_size) {
+			changed_paths.push_back(PolledPath{ it->directory, it->filename, modification_time, file_size });
+		}
+	}
+	if (changed_paths.size() == 0) return;
+
+	LockMutex(lock.get());
+	for (auto it = changed_paths.begin(); it != changed_paths.end(); it++) {
+		// the path might have been unwatched in the meantime
+		auto entry = directories.find(it->directory);
+		if (entry == directories.end()) continue;
+		WatchedDirectory* directory = entry->second.get();
+		if (directory->descriptor >= 0) continue;
+		if (it->filename.size() == 0) {
+			directory->modification_time = it->modification_time;
+			ReportDirectory(directory, false);
+			ReportPolledSubdirectories(directory);
+		} else {
+			auto file = directory->files.find(it->filename);
+			if (file == directory->files.end()) continue;
+			file->second.modification_time = it->modification_time;
+			file->second.file_size = it->file_size;
+			std::string path = PGPathJoin(directory->path, file->first);
+			for (auto group = file->second.groups.begin(); group != file->second.groups.end(); group++) {
+				(*group)->changes.insert(path);
+			}
+		}
+	}
+	UnlockMutex(lock.get());
+}
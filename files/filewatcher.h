@@ -0,0 +1,88 @@
+#pragma once
+
+#include "utils.h"
+#include "thread.h"
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// a set of watched paths; changes to any of them are collected in the group until they are retrieved
+struct PGFileWatchGroup;
+typedef struct PGFileWatchGroup* PGFileWatchGroupHandle;
+
+// FileWatcher notifies about changes to directories and files on disk
+// on Linux changes are delivered by inotify; on other platforms (or when inotify runs out of watches)
+// only the root directories and the watched files are polled from the background thread instead
+// when a polled root directory changes, every directory below it without an inotify watch is reported as well
+class FileWatcher {
+public:
+	static void Initialize() { GetInstance(); }
+
+	static PGFileWatchGroupHandle CreateGroup() { return GetInstance()._CreateGroup(); }
+	static void DestroyGroup(PGFileWatchGroupHandle group) { GetInstance()._DestroyGroup(group); }
+
+	// watch a directory for entries that are created, deleted or renamed; the path of the directory is reported
+	// root directories are polled if they cannot be watched, other directories rely on the polling of their root
+	static void WatchDirectory(PGFileWatchGroupHandle group, std::string path, bool root = false) { GetInstance()._Watch(group, path, true, root); }
+	// watch a single file for modifications and deletion; the path of the file is reported
+	static void WatchFile(PGFileWatchGroupHandle group, std::string path) { GetInstance()._Watch(group, path, false, false); }
+	// stop watching a path; if recursive is true every watched path below it is removed as well
+	static void Unwatch(PGFileWatchGroupHandle group, std::string path, bool recursive = false) { GetInstance()._Unwatch(group, path, recursive); }
+
+	// returns the paths of the group that have changed since the previous call
+	// multiple changes to the same path are only reported once
+	static std::vector<std::string> GetChanges(PGFileWatchGroupHandle group) { return GetInstance()._GetChanges(group); }
+private:
+	struct WatchedFile {
+		std::vector<PGFileWatchGroupHandle> groups;
+		// only used when the directory is polled
+		lng modification_time = -1;
+		lng file_size = -1;
+	};
+
+	struct WatchedDirectory {
+		std::string path;
+		// the inotify watch descriptor, or -1 if this directory is polled
+		int descriptor = -1;
+		// only used when the directory is polled
+		lng modification_time = -1;
+		// the amount of groups that watch this directory as a root directory; only roots are polled
+		int roots = 0;
+		// groups that watch the entries of this directory
+		std::vector<PGFileWatchGroupHandle> groups;
+		// groups that watch individual files in this directory, by filename
+		std::unordered_map<std::string, WatchedFile> files;
+	};
+
+	FileWatcher();
+	static void RunThread(void);
+	static FileWatcher& GetInstance() {
+		static FileWatcher instance;
+		return instance;
+	}
+
+	PGFileWatchGroupHandle _CreateGroup();
+	void _DestroyGroup(PGFileWatchGroupHandle group);
+	void _Watch(PGFileWatchGroupHandle group, std::string path, bool is_directory, bool root);
+	void _Unwatch(PGFileWatchGroupHandle group, std::string path, bool recursive);
+	std::vector<std::string> _GetChanges(PGFileWatchGroupHandle group);
+
+	WatchedDirectory* AddDirectory(std::string path);
+	void RemoveIfUnused(WatchedDirectory* directory);
+	void ReportDirectory(WatchedDirectory* directory, bool include_files);
+	void ReportPolledSubdirectories(WatchedDirectory* root);
+	void ProcessEvents(const char* buffer, lng size);
+	void PollDirectories();
+
+	bool running = true;
+	// inotify instance, or -1 if it is not available
+	int inotify = -1;
+
+	std::unordered_map<std::string, std::unique_ptr<WatchedDirectory>> directories;
+	std::unordered_map<int, WatchedDirectory*> descriptors;
+
+	std::unique_ptr<PGMutex> lock;
+	PGThreadHandle thread;
+};
@@ -35,8 +35,11 @@ namespace panther {
 	PGFileHandle OpenFile(std::string filename, PGFileAccess access, PGFileError& error);
 	void CloseFile(PGFileHandle handle);
 	size_t GetFileSize(PGFileHandle handle);
+	// moves the read position of the file to the given byte offset
+	bool SeekFile(PGFileHandle handle, lng offset);
 	size_t ReadFromFile(PGFileHandle handle, char* buffer, size_t buffer_size);
-	void WriteToFile(PGFileHandle handle, const char* text, lng length);
+	// returns false if not all of the text could be written
+	bool WriteToFile(PGFileHandle handle, const char* text, lng length);
 	void Flush(PGFileHandle handle);
 	void* ReadFile(PGFileHandle, lng& result_size, PGFileError& error);
 	void* ReadFile(std::string filename, lng& result_size, PGFileError& error);
@@ -2,10 +2,12 @@
 #include "searchindex.h"
 
 #include <queue>
-#include <unordered_set>
+
+// amount of candidates that are scored by a single worker at a time
+#define SEARCH_CHUNK_SIZE 16384
 
 SearchIndex::SearchIndex() : 
-	ignore_glob(nullptr) {
+	ignore_glob(nullptr), garbage(0), generation(0) {
 	this->lock = std::unique_ptr<PGMutex>(CreateMutex());
 }
 
@@ -15,127 +17,243 @@ SearchIndex::~SearchIndex() {
 	}
 }
 
+uint64_t SearchIndex::CharacterMask(const char* str, size_t length) {
+	// letters and digits each get their own bit
+	// all other characters are hashed into the remaining bits
+	uint64_t mask = 0;
+	for (size_t i = 0; i < length; i++) {
+		unsigned char c = str[i];
+		int bit;
+		if (c >= 'a' && c <= 'z') {
+			bit = c - 'a';
+		} else if (c >= '0' && c <= '9') {
+			bit = 26 + (c - '0');
+		} else {
+			bit = 36 + c % 28;
+		}
+		mask |= ((uint64_t)1) << bit;
+	}
+	return mask;
+}
+
 void SearchIndex::AddEntry(SearchEntry e) {
 	if (ignore_glob && PGGlobSetMatches(ignore_glob, e.display_name.c_str())) {
 		return;
 	}
+	if (candidate_map.count(e.text) > 0) {
+		// we only insert the entry if it is not already present
+		return;
+	}
+	entries.push_back(e);
+	SearchEntry* entry = &entries.back();
+	entry->iterator = --entries.end();
 
-	TrieNode* node = &this->root;
-	for (size_t i = 0; i < e.display_name.size(); i++) {
-		byte b = tolower(e.display_name[i]);
-		TrieNode* next = nullptr;
-		for (auto it = node->leaves.begin(); it != node->leaves.end(); it++) {
-			if ((*it)->b == b) {
-				next = it->get();
-				break;
-			}
-		}
-		if (!next) {
-			next = new TrieNode(b);
-			node->leaves.push_back(std::unique_ptr<TrieNode>(next));
-		}
-		if (i == e.display_name.size() - 1) {
-			if (!node->entry) {
-				// we only insert the entry if it is not already present
-				entries.push_back(e);
-				SearchEntry* entry = &entries.back();
-				entry->iterator = --entries.end();
-				node->entry = entry;
-			}
-			return;
-		}
-		node = next;
+	SearchCandidate candidate;
+	candidate.offset = (uint32_t) arena.size();
+	candidate.length = (uint32_t) entry->display_name.size();
+	candidate.entry = entry;
+	for (size_t i = 0; i < entry->display_name.size(); i++) {
+		arena.push_back(tolower(entry->display_name[i]));
 	}
-	assert(0);
-}
+	candidate.mask = CharacterMask(arena.c_str() + candidate.offset, candidate.length);
 
-void SearchIndex::RemoveEntry(std::string name) {
-	TrieNode* node = &this->root;
-	std::vector<TrieNode*> list;
-	for (size_t i = 0; i < name.size(); i++) {
-		byte b = tolower(name[i]);
-		TrieNode* next = nullptr;
-		for (auto it = node->leaves.begin(); it != node->leaves.end(); it++) {
-			if ((*it)->b == b) {
-				next = it->get();
-				break;
-			}
-		}
-		if (!next) {
-			return;
-		}
-		if (i == name.size() - 1 && node->entry) {
-			// erase the element from the list using the iterator
-			entries.erase(node->entry->iterator);
-			node->entry = nullptr;
-		}
-		node = next;
-		list.push_back(node);
-	}
-	for (lng i = list.size() - 1; i >= 0; i--) {
-		TrieNode* node = list[i];
-		TrieNode* parent = i == 0 ? &this->root : list[i - 1];
-		if (node->entry == nullptr && node->leaves.size() == 0) {
-			// if the current element has no entry and no leaves
-			// erase it, as it is no longer required
-			for (size_t j = 0; j < parent->leaves.size(); j++) {
-				if (parent->leaves[j].get() == node) {
-					parent->leaves.erase(parent->leaves.begin() + j);
-					break;
-				}
-			}
-		}
+	candidate_map[entry->text] = candidates.size();
+	candidates.push_back(candidate);
+	generation++;
+}
 
+void SearchIndex::RemoveEntry(std::string text) {
+	auto it = candidate_map.find(text);
+	if (it == candidate_map.end()) {
+		return;
+	}
+	size_t index = it->second;
+	candidate_map.erase(it);
+	garbage += candidates[index].length;
+	entries.erase(candidates[index].entry->iterator);
+	if (index != candidates.size() - 1) {
+		// move the last candidate into the removed slot
+		candidates[index] = candidates.back();
+		candidate_map[candidates[index].entry->text] = index;
+	}
+	candidates.pop_back();
+	generation++;
+	if (garbage > arena.size() / 2) {
+		CompactArena();
 	}
 }
 
-struct SearchTermIndex {
-	TrieNode* node;
-	int index;
-	int depth;
-	int score;
-	friend bool operator<(const SearchTermIndex& l, const SearchTermIndex& r) {
-		return l.score > r.score;
+void SearchIndex::CompactArena() {
+	// rewrite the arena with only the names of the candidates that are still present
+	std::string new_arena;
+	new_arena.reserve(arena.size() - garbage);
+	for (auto it = candidates.begin(); it != candidates.end(); it++) {
+		uint32_t offset = (uint32_t) new_arena.size();
+		new_arena.append(arena, it->offset, it->length);
+		it->offset = offset;
 	}
-};
+	arena.swap(new_arena);
+	garbage = 0;
+}
 
-int SearchIndex::IndexScore(const std::string& str, const std::string& search_term) {
+int SearchIndex::IndexScore(const char* str, size_t length, const char* search_term, size_t search_length, bool& full_match) {
 	// compute the index score of how much "search_term" matches "str"
+	// rather than comparing "str" one character at a time, we jump directly to the next
+	// occurrence of the next character of the search term using memchr (which is vectorized)
 	size_t search_index = 0;
 	int score = 0;
-	for (size_t i = 0; i < str.size(); i++) {
-		if (search_index == search_term.size()) {
+	size_t i = 0;
+	full_match = false;
+	while (i < length) {
+		if (search_index == search_length) {
 			// if we have completely matched the search_term, we stop
-			return score;
-		} else if (str[i] == search_term[search_index]) {
-			// if the current character matches, we increase the score
-			// and move to the next character in the search term
-			// matches earlier in "str" are worth more points
-			// hence we divide by (i - search_index + 1)
-			score += 10000 / (i - search_index + 1);
-			search_index++;
-		} else {
-			// if the current position does not match and the string has not
-			// been fully matched the score is reduced by 20%
+			break;
+		}
+		const char* next = (const char*) memchr(str + i, search_term[search_index], length - i);
+		size_t next_index = next ? next - str : length;
+		// every position that does not match reduces the score by 20%
+		// once the score drops below 5 it no longer changes, so we can stop early
+		for (size_t k = i; k < next_index && score >= 5; k++) {
 			score = score - score / 5;
 		}
+		if (!next) {
+			return score;
+		}
+		// matches earlier in "str" are worth more points
+		// hence we divide by (i - search_index + 1)
+		score += 10000 / (next_index - search_index + 1);
+		search_index++;
+		i = next_index + 1;
 	}
+	full_match = search_index == search_length;
 	return score;
 }
 
-std::vector<SearchEntry*> SearchIndex::Search(std::vector<std::shared_ptr<SearchIndex>>& indices, const std::vector<SearchEntry*>& additional_entries, const std::string& search_term, size_t max_entries) {
-	// we search the trie for search_term, and return at most max_entries results
+int SearchIndex::IndexScore(const std::string& str, const std::string& search_term) {
+	bool full_match;
+	return IndexScore(str.c_str(), str.size(), search_term.c_str(), search_term.size(), full_match);
+}
+
+static void InsertRank(std::priority_queue<SearchRank>& results, SearchEntry* entry, double score, size_t max_entries) {
+	// the priority queue holds the top <max_entries> results, with the worst result on top
+	if (results.size() < max_entries) {
+		results.push(SearchRank(entry, score));
+	} else if (results.top().score < score) {
+		results.pop();
+		results.push(SearchRank(entry, score));
+	}
+}
+
+struct SearchScoreResults {
+	// entries that contain the entire search term
+	std::priority_queue<SearchRank> full;
+	// entries that only match a prefix of the search term
+	std::priority_queue<SearchRank> partial;
+	// candidate numbers of all entries that contain the entire search term
+	std::vector<uint32_t> matches;
+};
+
+struct SearchChunkData {
+	SearchIndex* index;
+	const std::string* search_term;
+	uint64_t mask;
+	size_t max_entries;
+	const std::unordered_set<std::string>* blacklist;
+	const std::vector<uint32_t>* subset;
+	const std::vector<SearchCandidate>* candidates;
+	const std::string* arena;
+	bool collect_partial;
+	std::vector<SearchScoreResults>* results;
+};
+
+void SearchIndex::ScoreCandidates(const std::string& search_term, size_t max_entries, const std::unordered_set<std::string>& blacklist,
+	const std::vector<uint32_t>* subset, bool collect_partial, SearchScoreResults& results) {
+	lng total = subset ? subset->size() : candidates.size();
+	lng chunks = (total + SEARCH_CHUNK_SIZE - 1) / SEARCH_CHUNK_SIZE;
+
+	std::vector<SearchScoreResults> chunk_results(chunks);
+	SearchChunkData data;
+	data.index = this;
+	data.search_term = &search_term;
+	data.mask = CharacterMask(search_term.c_str(), search_term.size());
+	data.max_entries = max_entries;
+	data.blacklist = &blacklist;
+	data.subset = subset;
+	data.candidates = &candidates;
+	data.arena = &arena;
+	data.collect_partial = collect_partial;
+	data.results = &chunk_results;
+
+	// every chunk is scored independently (and in parallel) into its own set of results
+	Scheduler::RunParallel(chunks, [](lng chunk, void* d) {
+		SearchChunkData* data = (SearchChunkData*)d;
+		SearchScoreResults& results = (*data->results)[chunk];
+		const std::vector<SearchCandidate>& candidates = *data->candidates;
+		const char* arena = data->arena->c_str();
+		const char* term = data->search_term->c_str();
+		size_t term_length = data->search_term->size();
+		lng total = data->subset ? data->subset->size() : candidates.size();
+		lng end = std::min(total, (chunk + 1) * (lng)SEARCH_CHUNK_SIZE);
+		for (lng i = chunk * SEARCH_CHUNK_SIZE; i < end; i++) {
+			uint32_t number = data->subset ? (*data->subset)[i] : (uint32_t) i;
+			const SearchCandidate& candidate = candidates[number];
+			bool possible_match = (candidate.mask & data->mask) == data->mask;
+			if (!possible_match && !data->collect_partial) {
+				// the candidate is missing one of the characters of the search term
+				continue;
+			}
+			bool full_match;
+			int score = IndexScore(arena + candidate.offset, candidate.length, term, term_length, full_match);
+			SearchEntry* entry = candidate.entry;
+			double final_score = entry->basescore + entry->multiplier * score;
+			if (full_match) {
+				if (data->blacklist->size() > 0 && data->blacklist->count(entry->text) > 0) {
+					continue;
+				}
+				results.matches.push_back(number);
+				InsertRank(results.full, entry, final_score, data->max_entries);
+			} else if (data->collect_partial) {
+				if (results.partial.size() >= data->max_entries && results.partial.top().score >= final_score) {
+					continue;
+				}
+				if (data->blacklist->size() > 0 && data->blacklist->count(entry->text) > 0) {
+					continue;
+				}
+				InsertRank(results.partial, entry, final_score, data->max_entries);
+			}
+		}
+	}, &data);
+
+	// merge the results of the chunks in order
+	for (auto it = chunk_results.begin(); it != chunk_results.end(); it++) {
+		results.matches.insert(results.matches.end(), it->matches.begin(), it->matches.end());
+		while (it->full.size() > 0) {
+			InsertRank(results.full, it->full.top().entry, it->full.top().score, max_entries);
+			it->full.pop();
+		}
+		while (it->partial.size() > 0) {
+			InsertRank(results.partial, it->partial.top().entry, it->partial.top().score, max_entries);
+			it->partial.pop();
+		}
+	}
+}
+
+static void PopResults(std::priority_queue<SearchRank>& results, std::vector<SearchEntry*>& entries) {
+	// the priority queue is in reverse order (i.e. top() is the worst match)
+	// so we reverse the results after popping them
+	size_t start = entries.size();
+	while (results.size() > 0) {
+		entries.push_back(results.top().entry);
+		results.pop();
+	}
+	std::reverse(entries.begin() + start, entries.end());
+}
+
+std::vector<SearchEntry*> SearchIndex::Search(std::vector<std::shared_ptr<SearchIndex>>& indices, const std::vector<SearchEntry*>& additional_entries, const std::string& search_term, size_t max_entries, SearchCache* cache) {
+	// we search the indices for search_term, and return at most max_entries results
 	// we do fuzzy matching here, and return the n best matches
-	// we compute the score as is done in SearchIndex::IndexScore incrementally over the trie
-	// each character we expand changes the score
-
-	// we expand nodes using a priority queue, and don't expand nodes which
-	// we know will not be able to get in the top n returned entries anymore
-	
-	// priority queue of all open nodes
-	std::priority_queue<SearchTermIndex> open_nodes;
-	// priority queue of top n found results
-	std::priority_queue<SearchRank> results;
+	// entries that contain the full search term are ranked above entries that only partially match
+	SearchScoreResults results;
 	// we create a blacklist of entries: any entries that appear in additional_entries
 	// should not be added again later
 	std::unordered_set<std::string> blacklist;
@@ -143,94 +261,90 @@ std::vector<SearchEntry*> SearchIndex::Search(std::vector<std::shared_ptr<Search
 	// first we iterate over the additional supplied entries
 	// for these we just directly compute the score and add them to the results
 	for (auto it = additional_entries.begin(); it != additional_entries.end(); it++) {
-		int score = (*it)->basescore + IndexScore((*it)->display_name, search_term) * (*it)->multiplier;
-		bool insert_entry = false;
-		if (results.size() < max_entries) {
-			insert_entry = true;
-		} else if (results.top().score < score) {
-			results.pop();
-			insert_entry = true;
-		}
-		if (insert_entry) {
-			SearchRank r(*it, score);
-			results.push(r);
-			blacklist.insert((*it)->text);
-		}
+		bool full_match;
+		int score = IndexScore((*it)->display_name.c_str(), (*it)->display_name.size(), search_term.c_str(), search_term.size(), full_match);
+		double final_score = (*it)->basescore + score * (*it)->multiplier;
+		InsertRank(full_match ? results.full : results.partial, *it, final_score, max_entries);
+		blacklist.insert((*it)->text);
 	}
 
-	for (auto it = indices.begin(); it != indices.end(); it++) {
-		LockMutex((*it)->lock.get());
-		SearchTermIndex index;
-		// we start our search at the root node of each index
-		index.node = &(*it)->root;
-		index.index = 0;
-		index.score = 0;
-		index.depth = 0;
-		open_nodes.push(index);
-	}
-
-	while (open_nodes.size() > 0) {
-		SearchTermIndex current = open_nodes.top();
-		open_nodes.pop();
-		TrieNode* node = current.node;
-		if (node->entry) {
-			// if the node has an entry we insert if its score is good enough
-			current.score = node->entry->basescore + node->entry->multiplier * current.score;
-			bool insert_entry = false;
-			if (results.size() < max_entries) {
-				insert_entry = true;
-			} else if (results.top().score < current.score) {
-				results.pop();
-				insert_entry = true;
+	// if the search term extends the previous search term, the entries that fully match
+	// the current search term are a subset of the entries that matched the previous search term
+	// in that case we only have to rescore the previous matches
+	bool refine = cache && cache->valid && cache->indices.size() == indices.size() &&
+		search_term.size() >= cache->search_term.size() &&
+		search_term.compare(0, cache->search_term.size(), cache->search_term) == 0;
+	std::vector<SearchCache::IndexMatches> matches(indices.size());
+	if (refine) {
+		SearchScoreResults refined;
+		size_t total_matches = 0;
+		for (size_t i = 0; i < indices.size(); i++) {
+			SearchIndex* index = indices[i].get();
+			SearchCache::IndexMatches& previous = cache->indices[i];
+			LockMutex(index->lock.get());
+			if (previous.index != index || previous.generation != index->generation) {
+				// the index has changed since the previous search
+				UnlockMutex(index->lock.get());
+				refine = false;
+				break;
 			}
-			if (insert_entry) {
-				if (blacklist.count(node->entry->text) == 0) {
-					SearchRank r(node->entry, current.score);
-					results.push(r);
-				}
+			SearchScoreResults current;
+			index->ScoreCandidates(search_term, max_entries, blacklist, &previous.matches, false, current);
+			UnlockMutex(index->lock.get());
+			while (current.full.size() > 0) {
+				InsertRank(refined.full, current.full.top().entry, current.full.top().score, max_entries);
+				current.full.pop();
 			}
+			total_matches += current.matches.size();
+			matches[i].index = index;
+			matches[i].generation = previous.generation;
+			matches[i].matches.swap(current.matches);
+		}
+		if (refine && total_matches + results.full.size() < max_entries) {
+			// not enough full matches: we need the best partial matches as well
+			// these can only be found by scoring every entry again
+			refine = false;
 		}
-		for (auto it = node->leaves.begin(); it != node->leaves.end(); it++) {
-			// for each of the leaves, compute the score based on the next character
-			SearchTermIndex next;
-			next.depth = current.depth + 1;
-			next.node = it->get();
-			if (current.index == search_term.size()) {
-				next.index = current.index;
-				next.score = current.score;
-			} else if (next.node->b == search_term[current.index]) {
-				next.index = current.index + 1;
-				next.score = current.score + 10000 / (current.depth - current.index + 1);
-			} else {
-				next.index = current.index;
-				next.score = current.score - current.score / 5;
+		if (refine) {
+			while (refined.full.size() > 0) {
+				InsertRank(results.full, refined.full.top().entry, refined.full.top().score, max_entries);
+				refined.full.pop();
 			}
-			if (results.size() >= max_entries) {
-				// if we already have n results we determine if we should stop branching
-				// based on the maximum possible score we can possible get in this branch
-				// assuming the next [search_term.size() - current.index] characters 
-				// match the query exactly, we compute the maximum possible score
-				// if this is lower than the lowest score in the top n entries, we stop
-				size_t maximum_score = next.score + (search_term.size() - next.index) * 10000 / (next.depth - next.index + 1);
-				if (maximum_score <= results.top().score) {
-					continue;
-				}
+		}
+	}
+	if (!refine) {
+		for (size_t i = 0; i < indices.size(); i++) {
+			SearchIndex* index = indices[i].get();
+			SearchScoreResults current;
+			LockMutex(index->lock.get());
+			index->ScoreCandidates(search_term, max_entries, blacklist, nullptr, true, current);
+			matches[i].index = index;
+			matches[i].generation = index->generation;
+			UnlockMutex(index->lock.get());
+			while (current.full.size() > 0) {
+				InsertRank(results.full, current.full.top().entry, current.full.top().score, max_entries);
+				current.full.pop();
+			}
+			while (current.partial.size() > 0) {
+				InsertRank(results.partial, current.partial.top().entry, current.partial.top().score, max_entries);
+				current.partial.pop();
 			}
-			open_nodes.push(next);
+			matches[i].matches.swap(current.matches);
 		}
 	}
-	for (auto it = indices.begin(); it != indices.end(); it++) {
-		UnlockMutex((*it)->lock.get());
+	if (cache) {
+		cache->valid = true;
+		cache->search_term = search_term;
+		cache->indices.swap(matches);
 	}
+
 	std::vector<SearchEntry*> entries;
-	while (results.size() > 0) {
-		SearchEntry* entry = results.top().entry;
-		results.pop();
-		entries.push_back(entry);
+	PopResults(results.full, entries);
+	if (entries.size() < max_entries) {
+		PopResults(results.partial, entries);
+		if (entries.size() > max_entries) {
+			entries.resize(max_entries);
+		}
 	}
-	// the priority queue was in reverse order (i.e. top() was the worst match)
-	// so we reverse the results before returning them
-	std::reverse(entries.begin(), entries.end());
 	return entries;
 }
-
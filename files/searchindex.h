@@ -3,8 +3,10 @@
 #include "textfile.h"
 #include "utils.h"
 
+#include <cstdint>
 #include <list>
 #include <unordered_map>
+#include <unordered_set>
 
 struct SearchEntry {
 	std::list<SearchEntry>::iterator iterator;
@@ -34,13 +36,36 @@ struct SearchRank {
 	friend bool operator!=(const SearchRank& lhs, const SearchRank& rhs) { return !(lhs == rhs); }
 };
 
-struct TrieNode {
-	byte b;
+// a single entry in the flat candidate store of the search index
+struct SearchCandidate {
+	// location of the lowercased display name within the name arena
+	uint32_t offset;
+	uint32_t length;
+	// bitmask of the characters that occur in the display name
+	// used to quickly discard candidates that cannot fully match a search term
+	uint64_t mask;
 	SearchEntry* entry;
-	std::vector<std::unique_ptr<TrieNode>> leaves;
+};
+
+struct SearchIndex;
+struct SearchScoreResults;
+
+// state of a previous search, used to incrementally refine the results
+// when the search term is extended (e.g. when the user types another character)
+// only the candidates that fully matched the previous search term are rescored
+struct SearchCache {
+	struct IndexMatches {
+		SearchIndex* index;
+		lng generation;
+		// candidates that fully matched the previous search term
+		std::vector<uint32_t> matches;
+	};
+
+	bool valid = false;
+	std::string search_term;
+	std::vector<IndexMatches> indices;
 
-	TrieNode() : entry(), b(0) { }
-	TrieNode(byte b) : entry(), b(b) { }
+	SearchCache() : valid(false) { }
 };
 
 struct SearchIndex {
@@ -48,7 +73,6 @@ struct SearchIndex {
 	~SearchIndex();
 
 	std::list<SearchEntry> entries;
-	TrieNode root;
 
 	// optional glob that allows ignoring of files that match a specific pattern
 	PGGlobSet ignore_glob;
@@ -58,20 +82,42 @@ struct SearchIndex {
 	// Adds an entry to the search index
 	// thread unsafe: should only be called when "lock" is held
 	void AddEntry(SearchEntry entry);
-	// Removes an entry with the given name from the search index
+	// Removes the entry with the given text (full path) from the search index
 	// thread unsafe: should only be called when "lock" is held
-	void RemoveEntry(std::string name);
+	void RemoveEntry(std::string text);
 
 	// Returns the matched score of a given string for a given search term
 	// this is the score used by SearchIndex::Search() to rank entries
 	static int IndexScore(const std::string& str, const std::string& search_term);
+	static int IndexScore(const char* str, size_t length, const char* search_term, size_t search_length, bool& full_match);
+	// Returns the character bitmask used to prefilter candidates
+	static uint64_t CharacterMask(const char* str, size_t length);
 	// Searches the index for the best <max_entries> SearchEntries that matches 
 	// the given search_term. Additional entries can be provided in the <entries> parameter.
-	// Note that the index is optional. 
+	// Entries that contain the entire search term are always ranked above partial matches.
+	// Note that the index is optional. If a cache is provided, the search is incrementally
+	// refined from the previous search when the search term extends the previous search term.
 	// This function is thread safe, and will get the the lock from "index" when required
 	static std::vector<SearchEntry*> Search(std::vector<std::shared_ptr<SearchIndex>>& indices,
 		const std::vector<SearchEntry*>& entries,
 		const std::string& search_term,
-		size_t max_entries);
-};
+		size_t max_entries,
+		SearchCache* cache = nullptr);
+private:
+	// lowercased display names of all candidates, stored contiguously
+	std::string arena;
+	// amount of bytes in the arena that belong to removed candidates
+	size_t garbage = 0;
+	std::vector<SearchCandidate> candidates;
+	// map of entry text -> index into candidates
+	std::unordered_map<std::string, size_t> candidate_map;
+	// incremented on every modification, used to invalidate SearchCaches
+	lng generation = 0;
+
+	void CompactArena();
 
+	// scores either all candidates or the given subset of candidates of the index
+	// thread unsafe: should only be called when "lock" is held
+	void ScoreCandidates(const std::string& search_term, size_t max_entries, const std::unordered_set<std::string>& blacklist,
+		const std::vector<uint32_t>* subset, bool collect_partial, SearchScoreResults& results);
+};
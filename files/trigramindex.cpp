@@ -0,0 +1,473 @@
+
+#include "trigramindex.h"
+#include "directory.h"
+#include "mmap.h"
+#include "replaymanager.h"
+
+#include <unordered_set>
+
+// the amount of modified files that are indexed in parallel before the results are added to the index
+#define TRIGRAM_INDEX_BATCH_SIZE 64
+// the amount of bits in the bloom filter of a file per distinct trigram
+#define TRIGRAM_BITS_PER_TRIGRAM 4
+// every trigram is 21 bits: three 7-bit characters
+#define TRIGRAM_COUNT (1 << 21)
+
+// returns the character as it is stored in a trigram, or -1 if it cannot be part of a trigram
+// only ASCII characters are stored, so the index is unaffected by the encoding and case folding of other characters
+static inline int TrigramCharacter(unsigned char c) {
+	if (c >= 0x80 || c == '\n' || c == '\r' || c == '\0') {
+		return -1;
+	}
+	return panther::chartolower(c);
+}
+
+static inline uint64_t TrigramHash(uint32_t trigram) {
+	// splitmix64 finalizer, both halves of the result are used as a probe into the bloom filter
+	uint64_t hash = trigram + 0x9E3779B97F4A7C15ULL;
+	hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+	return hash ^ (hash >> 31);
+}
+
+static inline void AddTrigram(std::vector<uint64_t>& bits, uint32_t trigram) {
+	uint64_t hash = TrigramHash(trigram);
+	uint64_t mask = bits.size() * 64 - 1;
+	uint64_t first = hash & mask, second = (hash >> 32) & mask;
+	bits[first / 64] |= 1ULL << (first % 64);
+	bits[second / 64] |= 1ULL << (second % 64);
+}
+
+static inline bool ContainsTrigram(const std::vector<uint64_t>& bits, uint32_t trigram) {
+	uint64_t hash = TrigramHash(trigram);
+	uint64_t mask = bits.size() * 64 - 1;
+	uint64_t first = hash & mask, second = (hash >> 32) & mask;
+	return (bits[first / 64] & (1ULL << (first % 64))) && (bits[second / 64] & (1ULL << (second % 64)));
+}
+
+PGTrigramIndex::PGTrigramIndex(std::string path) :
+	lock(CreateMutex()), update_lock(CreateMutex()), path(path), loaded(false), modified(false) {
+}
+
+static void CompileAtom(const std::string& atom, std::vector<uint32_t>& trigrams) {
+	for (size_t i = 0; i + 2 < atom.size(); i++) {
+		int a = TrigramCharacter(atom[i]), b = TrigramCharacter(atom[i + 1]), c = TrigramCharacter(atom[i + 2]);
+		if (a < 0 || b < 0 || c < 0) continue;
+		trigrams.push_back((a << 14) | (b << 7) | c);
+	}
+}
+
+static PGTrigramQuery CompileLiterals(const PGRegexLiterals& literals) {
+	PGTrigramQuery query;
+	switch (literals.type) {
+		case PGRegexLiteralsAtom:
+			CompileAtom(literals.atom, query.trigrams);
+			if (query.trigrams.size() > 0) {
+				query.type = PGRegexLiteralsAnd;
+			}
+			break;
+		case PGRegexLiteralsAnd:
+			// the trigrams of all the subs are required, subs that allow every file are dropped
+			for (auto it = literals.subs.begin(); it != literals.subs.end(); it++) {
+				PGTrigramQuery sub = CompileLiterals(*it);
+				if (sub.type == PGRegexLiteralsAnd) {
+					query.trigrams.insert(query.trigrams.end(), sub.trigrams.begin(), sub.trigrams.end());
+					query.subs.insert(query.subs.end(), sub.subs.begin(), sub.subs.end());
+				} else if (sub.type == PGRegexLiteralsOr) {
+					query.subs.push_back(sub);
+				}
+			}
+			if (query.trigrams.size() > 0 || query.subs.size() > 0) {
+				query.type = PGRegexLiteralsAnd;
+			}
+			break;
+		case PGRegexLiteralsOr:
+			// if any of the alternatives allows every file, so does the entire query
+			for (auto it = literals.subs.begin(); it != literals.subs.end(); it++) {
+				PGTrigramQuery sub = CompileLiterals(*it);
+				if (sub.type == PGRegexLiteralsAll) {
+					query.subs.clear();
+					break;
+				}
+				query.subs.push_back(sub);
+			}
+			if (query.subs.size() > 0) {
+				query.type = PGRegexLiteralsOr;
+			}
+			break;
+		default:
+			break;
+	}
+	return query;
+}
+
+PGTrigramQuery PGTrigramIndex::CompileQuery(PGRegexHandle handle) {
+	return CompileLiterals(PGGetRegexLiterals(handle));
+}
+
+bool PGTrigramIndex::MatchQuery(const PGTrigramFile& file, const PGTrigramQuery& query) {
+	switch (query.type) {
+		case PGRegexLiteralsAnd:
+			for (auto it = query.trigrams.begin(); it != query.trigrams.end(); it++) {
+				if (!ContainsTrigram(file.bits, *it)) {
+					return false;
+				}
+			}
+			for (auto it = query.subs.begin(); it != query.subs.end(); it++) {
+				if (!MatchQuery(file, *it)) {
+					return false;
+				}
+			}
+			return true;
+		case PGRegexLiteralsOr:
+			for (auto it = query.subs.begin(); it != query.subs.end(); it++) {
+				if (MatchQuery(file, *it)) {
+					return true;
+				}
+			}
+			return false;
+		default:
+			return true;
+	}
+}
+
+bool PGTrigramIndex::ExcludesFile(const std::string& path, const PGTrigramQuery& query) {
+	if (query.type == PGRegexLiteralsAll) {
+		return false;
+	}
+	bool excluded = false;
+	lng modification_time = -1, file_size = -1;
+	LockMutex(lock.get());
+	auto entry = files.find(path);
+	if (entry != files.end() && entry->second.bits.size() > 0 && !entry->second.IsRacy()) {
+		excluded = !MatchQuery(entry->second, query);
+		modification_time = entry->second.modification_time;
+		file_size = entry->second.file_size;
+	}
+	UnlockMutex(lock.get());
+	if (excluded) {
+		// the file might have been modified after it was indexed
+		// we only check this for excluded files, because every other file is read anyway
+		auto flags = PGGetFileFlags(path);
+		if (flags.flags != PGFileFlagsEmpty || flags.modification_time != modification_time || flags.file_size != file_size) {
+			excluded = false;
+		}
+	}
+	return excluded;
+}
+
+void PGTrigramIndex::IndexFile(const std::string& path, PGTrigramFile& file) {
+	file.bits.clear();
+	// recorded before the file is read, so a modification while it is read either changes the modification time or makes the entry racy
+	file.indexed_time = PGGetFileTimeNow();
+	if (file.file_size > TRIGRAM_INDEX_MAXIMUM_FILE_SIZE) {
+		return;
+	}
+	lng size;
+	PGFileError error;
+	unsigned char* data = (unsigned char*)panther::ReadFile(path, size, error);
+	if (!data) {
+		return;
+	}
+	if (memchr(data, '\0', size) != nullptr) {
+		// binary files and UTF-16 files are always searched
+		panther::DestroyFileContents(data);
+		return;
+	}
+	// mark the distinct trigrams of the file, so the bloom filter can be sized to fit them
+	std::unique_ptr<uint64_t[]> present = std::unique_ptr<uint64_t[]>(new uint64_t[TRIGRAM_COUNT / 64]());
+	lng distinct = 0;
+	int a = -1, b = -1;
+	for (lng i = 0; i < size; i++) {
+		int c = TrigramCharacter(data[i]);
+		if (a >= 0 && b >= 0 && c >= 0) {
+			uint32_t trigram = (a << 14) | (b << 7) | c;
+			uint64_t bit = 1ULL << (trigram % 64);
+			if (!(present[trigram / 64] & bit)) {
+				present[trigram / 64] |= bit;
+				distinct++;
+			}
+		}
+		a = b;
+		b = c;
+	}
+	panther::DestroyFileContents(data);
+
+	size_t words = 1;
+	while ((lng) words * 64 < distinct * TRIGRAM_BITS_PER_TRIGRAM) {
+		words *= 2;
+	}
+	file.bits.assign(words, 0);
+	for (uint32_t word = 0; word < TRIGRAM_COUNT / 64; word++) {
+		if (!present[word]) continue;
+		for (uint32_t bit = 0; bit < 64; bit++) {
+			if (present[word] & (1ULL << bit)) {
+				AddTrigram(file.bits, word * 64 + bit);
+			}
+		}
+	}
+}
+
+struct PGTrigramUpdate {
+	std::vector<std::string> paths;
+	std::vector<PGTrigramFile> results;
+	Task* task;
+};
+
+static bool PathInScope(const std::string& path, const std::string& scope) {
+	return path.size() >= scope.size() && path.compare(0, scope.size(), scope) == 0 &&
+		(path.size() == scope.size() || path[scope.size()] == GetSystemPathSeparator());
+}
+
+bool PGTrigramIndex::Update(std::shared_ptr<PGDirectory> root, Task* task, const std::vector<std::string>& changed_paths) {
+	PGTrigramUpdate update;
+	update.task = task;
+	// the paths below which the index is brought up to date: the changed paths of this root, or the entire root
+	std::vector<std::string> scopes;
+	if (changed_paths.size() == 0) {
+		scopes.push_back(root->path);
+	} else {
+		std::vector<std::string> paths = changed_paths;
+		std::sort(paths.begin(), paths.end());
+		for (auto it = paths.begin(); it != paths.end(); it++) {
+			if (!PathInScope(*it, root->path)) continue;
+			// paths below a path that is already checked do not have to be checked again
+			if (scopes.size() > 0 && PathInScope(*it, scopes.back())) continue;
+			scopes.push_back(*it);
+		}
+	}
+	for (auto it = scopes.begin(); it != scopes.end(); it++) {
+		// changed paths that are not a directory in the tree (anymore) only remove files from the index
+		auto directory = PGDirectory::FindDirectory(root, *it);
+		if (!directory) continue;
+		lng filenr = 0;
+		if (!directory->IterateOverFiles([](PGFile f, void* data, lng filenr, lng total_files) -> bool {
+			PGTrigramUpdate* update = (PGTrigramUpdate*)data;
+			update->paths.push_back(f.path);
+			return update->task->active;
+		}, &update, filenr, directory->TotalFiles())) {
+			return false;
+		}
+	}
+
+	// find the files that are new or have been modified since they were indexed
+	std::vector<std::string> modified_paths;
+	std::vector<PGTrigramFile> modified_files;
+	for (auto it = update.paths.begin(); it != update.paths.end(); it++) {
+		auto flags = PGGetFileFlags(*it);
+		if (flags.flags != PGFileFlagsEmpty) continue;
+		LockMutex(lock.get());
+		auto entry = files.find(*it);
+		bool up_to_date = entry != files.end() &&
+			entry->second.modification_time == flags.modification_time &&
+			entry->second.file_size == flags.file_size && !entry->second.IsRacy();
+		UnlockMutex(lock.get());
+		if (!up_to_date) {
+			PGTrigramFile file;
+			file.modification_time = flags.modification_time;
+			file.file_size = flags.file_size;
+			modified_paths.push_back(*it);
+			modified_files.push_back(file);
+		}
+		if (!task->active) {
+			return false;
+		}
+	}
+
+	// remove the files that are no longer part of the directory
+	std::unordered_set<std::string> existing(update.paths.begin(), update.paths.end());
+	LockMutex(lock.get());
+	for (auto it = files.begin(); it != files.end(); ) {
+		bool in_scope = changed_paths.size() == 0;
+		for (auto scope = scopes.begin(); scope != scopes.end() && !in_scope; scope++) {
+			in_scope = PathInScope(it->first, *scope);
+		}
+		if (in_scope && existing.count(it->first) == 0) {
+			it = files.erase(it);
+			modified = true;
+		} else {
+			it++;
+		}
+	}
+	UnlockMutex(lock.get());
+
+	// the files are read in batches, so the worker threads are released regularly and the update can be cancelled
+	for (size_t start = 0; start < modified_paths.size(); start += TRIGRAM_INDEX_BATCH_SIZE) {
+		size_t end = std::min(start + TRIGRAM_INDEX_BATCH_SIZE, modified_paths.size());
+		update.paths.assign(modified_paths.begin() + start, modified_paths.begin() + end);
+		update.results.assign(modified_files.begin() + start, modified_files.begin() + end);
+		Scheduler::RunParallel(end - start, [](lng index, void* data) {
+			PGTrigramUpdate* update = (PGTrigramUpdate*)data;
+			if (!update->task->active) return;
+			IndexFile(update->paths[index], update->results[index]);
+		}, &update);
+		if (!task->active) {
+			return false;
+		}
+		LockMutex(lock.get());
+		for (size_t i = 0; i < update.paths.size(); i++) {
+			files[update.paths[i]] = std::move(update.results[i]);
+		}
+		modified = true;
+		UnlockMutex(lock.get());
+	}
+	return true;
+}
+
+/*
+Index format (native byte order, it is only a local cache):
+"PGTI" [uint32 version] [string path] [uint32 files] [file]*
+file: [string name] [int64 modification time] [int64 size] [int64 indexed time] [uint32 words] [uint64]*
+string: [uint32 length] [bytes]
+the names of the files are relative to the path of the index
+*/
+#define PGTRIGRAM_INDEX_VERSION 2
+
+std::string PGTrigramIndex::IndexFilename(std::string path) {
+	// FNV-1a hash of the path, so every project gets its own index
+	uint64_t hash = 14695981039346656037ULL;
+	for (auto it = path.begin(); it != path.end(); it++) {
+		hash = (hash ^ (unsigned char)*it) * 1099511628211ULL;
+	}
+	char filename[64];
+	snprintf(filename, 64, "trigrams_%016llx.cache", (unsigned long long) hash);
+	return std::string(filename);
+}
+
+static void WriteIndexInteger(std::string& index, uint32_t value) {
+	index.append((char*)&value, sizeof(uint32_t));
+}
+
+static void WriteIndexNumber(std::string& index, lng value) {
+	int64_t number = (int64_t)value;
+	index.append((char*)&number, sizeof(int64_t));
+}
+
+static void WriteIndexString(std::string& index, const std::string& value) {
+	WriteIndexInteger(index, (uint32_t)value.size());
+	index += value;
+}
+
+static bool ReadIndexInteger(const char*& ptr, const char* end, uint32_t& value) {
+	if (end - ptr < (lng) sizeof(uint32_t)) return false;
+	memcpy(&value, ptr, sizeof(uint32_t));
+	ptr += sizeof(uint32_t);
+	return true;
+}
+
+static bool ReadIndexNumber(const char*& ptr, const char* end, lng& value) {
+	int64_t number;
+	if (end - ptr < (lng) sizeof(int64_t)) return false;
+	memcpy(&number, ptr, sizeof(int64_t));
+	ptr += sizeof(int64_t);
+	value = (lng)number;
+	return true;
+}
+
+static bool ReadIndexString(const char*& ptr, const char* end, std::string& value) {
+	uint32_t length;
+	if (!ReadIndexInteger(ptr, end, length) || end - ptr < (lng) length) return false;
+	value = std::string(ptr, length);
+	ptr += length;
+	return true;
+}
+
+bool PGTrigramIndex::Load(std::string filename) {
+	loaded = true;
+	lng size;
+	PGFileError error;
+	char* data = (char*)panther::ReadFile(filename, size, error);
+	if (!data) {
+		return false;
+	}
+	const char* ptr = data;
+	const char* end = data + size;
+	uint32_t version, count = 0;
+	std::string name;
+	bool success = end - ptr >= 4 && memcmp(ptr, "PGTI", 4) == 0;
+	ptr += 4;
+	success = success &&
+		ReadIndexInteger(ptr, end, version) && version == PGTRIGRAM_INDEX_VERSION &&
+		ReadIndexString(ptr, end, name) && name == this->path &&
+		ReadIndexInteger(ptr, end, count);
+	// we read the index into a separate map first, so a corrupt index is discarded entirely
+	std::unordered_map<std::string, PGTrigramFile> index;
+	for (uint32_t i = 0; success && i < count; i++) {
+		PGTrigramFile file;
+		uint32_t words;
+		success = ReadIndexString(ptr, end, name) &&
+			ReadIndexNumber(ptr, end, file.modification_time) &&
+			ReadIndexNumber(ptr, end, file.file_size) &&
+			ReadIndexNumber(ptr, end, file.indexed_time) &&
+			ReadIndexInteger(ptr, end, words) &&
+			end - ptr >= (lng) words * (lng) sizeof(uint64_t) &&
+			(words & (words - 1)) == 0;
+		if (success) {
+			file.bits.resize(words);
+			memcpy(file.bits.data(), ptr, words * sizeof(uint64_t));
+			ptr += words * sizeof(uint64_t);
+			index[PGPathJoin(this->path, name)] = std::move(file);
+		}
+	}
+	success = success && ptr == end;
+	panther::DestroyFileContents(data);
+	if (!success) {
+		return false;
+	}
+	LockMutex(lock.get());
+	if (files.size() == 0) {
+		files.swap(index);
+		modified = false;
+	}
+	UnlockMutex(lock.get());
+	return true;
+}
+
+bool PGTrigramIndex::Write(std::string filename) {
+	if (PGGlobalReplayManager::running_replay) return false;
+
+	std::string index = "PGTI";
+	LockMutex(lock.get());
+	if (!modified) {
+		UnlockMutex(lock.get());
+		return true;
+	}
+	WriteIndexInteger(index, PGTRIGRAM_INDEX_VERSION);
+	WriteIndexString(index, this->path);
+	WriteIndexInteger(index, (uint32_t)files.size());
+	for (auto it = files.begin(); it != files.end(); it++) {
+		WriteIndexString(index, it->first.substr(std::min(it->first.size(), this->path.size() + 1)));
+		WriteIndexNumber(index, it->second.modification_time);
+		WriteIndexNumber(index, it->second.file_size);
+		WriteIndexNumber(index, it->second.indexed_time);
+		WriteIndexInteger(index, (uint32_t)it->second.bits.size());
+		index.append((char*)it->second.bits.data(), it->second.bits.size() * sizeof(uint64_t));
+	}
+	modified = false;
+	UnlockMutex(lock.get());
+
+	// we write the index to a temporary file first, and then move it over the old index
+	std::string temp_filename = filename + ".tmp";
+	PGFileError error;
+	PGFileHandle handle = panther::OpenFile(temp_filename, PGFileReadWrite, error);
+	if (!handle) {
+		goto failed;
+	}
+	if (!panther::WriteToFile(handle, index.c_str(), index.size())) {
+		panther::CloseFile(handle);
+		PGRemoveFile(temp_filename);
+		goto failed;
+	}
+	panther::CloseFile(handle);
+	if (PGRenameFile(temp_filename, filename) != PGIOSuccess) {
+		PGRemoveFile(temp_filename);
+		goto failed;
+	}
+	return true;
+failed:
+	// the index on disk is out of date, so it has to be written again
+	LockMutex(lock.get());
+	modified = true;
+	UnlockMutex(lock.get());
+	return false;
+}
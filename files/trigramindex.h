@@ -0,0 +1,87 @@
+#pragma once
+
+#include "regex.h"
+#include "scheduler.h"
+#include "utils.h"
+#include "windowfunctions.h"
+
+#include "thread.h"
+
+#include <cstdint>
+#include <unordered_map>
+
+struct PGDirectory;
+
+// files larger than this are not indexed, they are always searched
+#define TRIGRAM_INDEX_MAXIMUM_FILE_SIZE (64 * 1024 * 1024)
+
+// the trigrams that occur in a single file, stored as a bloom filter
+// a trigram is three consecutive lowercase ASCII characters, trigrams that contain a newline are not stored
+struct PGTrigramFile {
+	lng modification_time;
+	lng file_size;
+	// the time at which the file was read, in the units of the modification time
+	// a file modified within a second of being read might have changed without changing its modification time,
+	// so its entry is not trusted, see IsRacy
+	lng indexed_time;
+	// empty if the file could not be indexed (e.g. it is too large or contains null bytes), such files are always searched
+	std::vector<uint64_t> bits;
+
+	PGTrigramFile() : modification_time(-1), file_size(-1), indexed_time(-1) { }
+
+	// returns true if the file could have been modified in the same second it was indexed
+	bool IsRacy() const { return indexed_time <= modification_time + PGGetFileTimeSecond(); }
+};
+
+// the trigrams a file has to contain before it can match a regex, compiled from PGRegexLiterals
+// PGRegexLiteralsAll matches every file, PGRegexLiteralsAnd requires all trigrams and all subs,
+// and PGRegexLiteralsOr requires one of the subs
+struct PGTrigramQuery {
+	PGRegexLiteralsType type;
+	std::vector<uint32_t> trigrams;
+	std::vector<PGTrigramQuery> subs;
+
+	PGTrigramQuery() : type(PGRegexLiteralsAll) { }
+};
+
+// an on-disk index of the trigrams in the files of a project directory
+// find in files uses the index to skip the files that cannot contain a match, without reading them
+// the index is kept up to date by comparing the modification time and size of every file
+// entries indexed within a second of their modification are indexed again, like racily clean entries in git
+struct PGTrigramIndex {
+	PGTrigramIndex(std::string path);
+
+	std::unique_ptr<PGMutex> lock;
+	// held while the index is loaded, updated or written, so only one update runs at a time
+	std::unique_ptr<PGMutex> update_lock;
+
+	static PGTrigramQuery CompileQuery(PGRegexHandle handle);
+	// returns true if the file is in the index and it certainly does not contain a match for the query
+	// files that are not in the index, or have been modified since they were indexed, are never excluded
+	// this function is thread safe
+	bool ExcludesFile(const std::string& path, const PGTrigramQuery& query);
+
+	// indexes the files of "root" that are new or have been modified, and removes the files that no longer exist
+	// if changed_paths is not empty only the files below those paths are checked, instead of every file of "root"
+	// returns false if the task was cancelled before the index was up to date
+	bool Update(std::shared_ptr<PGDirectory> root, Task* task, const std::vector<std::string>& changed_paths);
+
+	// the file in which the index of the directory "path" is stored
+	static std::string IndexFilename(std::string path);
+	// reads the index stored by a previous session, returns false if there is no valid index
+	bool Load(std::string filename);
+	// writes the index to disk if it has been modified since it was loaded or written
+	// if writing fails the index stays modified, so it is written again by the next call
+	bool Write(std::string filename);
+
+	bool IsLoaded() { return loaded; }
+private:
+	std::string path;
+	// map of full path -> trigrams of the file
+	std::unordered_map<std::string, PGTrigramFile> files;
+	bool loaded;
+	bool modified;
+
+	static void IndexFile(const std::string& path, PGTrigramFile& file);
+	static bool MatchQuery(const PGTrigramFile& file, const PGTrigramQuery& query);
+};
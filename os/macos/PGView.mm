@@ -544,11 +544,13 @@ void ShowWindow(PGWindowHandle handle) {
 }
 
 void RefreshWindow(PGWindowHandle window, bool redraw_now) {
-	RedrawWindow(window);
+	if (!window->manager) return;
+	window->manager->RefreshWindow(redraw_now);
 }
 
 void RefreshWindow(PGWindowHandle window, PGIRect rectangle, bool redraw_now) {
-	RedrawWindow(window, rectangle);
+	if (!window->manager) return;
+	window->manager->RefreshWindow(rectangle, redraw_now);
 }
 
 
@@ -557,7 +559,8 @@ void RedrawWindow(PGWindowHandle window) {
 }
 
 void RedrawWindow(PGWindowHandle window, PGIRect rectangle) {
-	[window->view setNeedsDisplayInRect:[window->view getBounds]];
+	// drawRect: receives the rectangle in the same coordinates
+	[window->view setNeedsDisplayInRect:NSMakeRect(rectangle.x, rectangle.y, rectangle.width, rectangle.height)];
 }
 
 Control* GetFocusedControl(PGWindowHandle window) {
@@ -915,6 +918,15 @@ PGFileInformation PGGetFileFlags(std::string path) {
 	return info;
 }
 
+lng PGGetFileTimeNow() {
+	return (lng) time(nullptr);
+}
+
+lng PGGetFileTimeSecond() {
+	// st_mtime is in whole seconds
+	return 1;
+}
+
 
 PGIOError PGRenameFile(std::string source, std::string dest) {
 	NSError * _Nullable __autoreleasing err = nil;
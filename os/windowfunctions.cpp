@@ -7,6 +7,7 @@
 
 #include "c.h"
 #include "findresults.h"
+#include "syntect.h"
 #include "xml.h"
 
 #include "keybindings.h"
@@ -139,6 +140,7 @@ void PGInitializeGlobals() {
 	PGLanguageManager::AddLanguage(new CLanguage());
 	PGLanguageManager::AddLanguage(new XMLLanguage());
 	PGLanguageManager::AddLanguage(new FindResultsLanguage());
+	SyntectLanguage::LoadLanguages("data/syntax/subl");
 
 	PGSettingsManager::Initialize();
 	PGKeyBindingsManager::Initialize();
@@ -166,7 +168,7 @@ PGWorkspace* PGInitializeFirstWorkspace() {
 	}
 	if (settings["workspaces"].array().size() == 0) {
 		// no known workspaces, add one
-		settings["workspaces"][0] = "workspace.json";
+		settings["workspaces"][0] = "workspace.msgpack";
 		settings["active_workspace"] = 0;
 		active_workspace = 0;
 	}
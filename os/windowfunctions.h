@@ -29,6 +29,9 @@ typedef struct PGPopupMenu* PGPopupMenuHandle;
 struct PGBitmap;
 typedef struct PGBitmap* PGBitmapHandle;
 
+struct PGTextBlob;
+typedef struct PGTextBlob* PGTextBlobHandle;
+
 struct PGDropData;
 typedef struct PGDropData* PGDropHandle;
 
@@ -331,6 +334,11 @@ void SetRenderBounds(PGRendererHandle, PGRect rectangle);
 // clear the render bounds
 void ClearRenderBounds(PGRendererHandle);
 
+// returns a number that changes whenever the surface of the renderer is recreated, i.e. when the previous frame is lost
+lng GetRendererSurfaceVersion(PGRendererHandle renderer);
+// move the pixels of the previous frame within the rectangle vertically by offset pixels
+// pixels moved outside of the rectangle are discarded, the exposed part of the rectangle has to be rendered again
+void ScrollRenderedRegion(PGRendererHandle renderer, PGIRect rectangle, int offset);
 void RenderGradient(PGRendererHandle handle, PGRect rectangle, PGColor left, PGColor right);
 void RenderTriangle(PGRendererHandle handle, PGPoint a, PGPoint b, PGPoint c, PGColor color, PGDrawStyle drawStyle);
 void RenderRectangle(PGRendererHandle handle, PGRect rectangle, PGColor color, PGDrawStyle style, PGScalar width = 1.0f);
@@ -346,11 +354,19 @@ PGScalar RenderString(PGRendererHandle renderer, PGFontHandle font, const std::s
 // Render text at the specified location
 void RenderText(PGRendererHandle renderer, PGFontHandle font, const char* text, size_t length, PGScalar x, PGScalar y, PGScalar max_position = INT_MAX);
 void RenderString(PGRendererHandle renderer, PGFontHandle font, const std::string& text, PGScalar x, PGScalar y, PGScalar max_position = INT_MAX);
+// Create a text blob: a piece of text that is converted to glyphs once and can then be rendered repeatedly
+PGTextBlobHandle PGCreateTextBlob();
+// Add text to the blob in the current text color of the font, x is relative to the position the blob is rendered at
+void PGTextBlobAddText(PGTextBlobHandle blob, PGFontHandle font, const char* text, size_t length, PGScalar x);
+void RenderTextBlob(PGRendererHandle renderer, PGTextBlobHandle blob, PGScalar x, PGScalar y);
+void PGDestroyTextBlob(PGTextBlobHandle blob);
 // Render squiggles under text at the specified location
 void RenderSquiggles(PGRendererHandle renderer, PGScalar width, PGScalar x, PGScalar y, PGColor color);
 void RenderFileIcon(PGRendererHandle renderer, PGFontHandle font, const char *text, PGScalar x, PGScalar y, PGScalar width, PGScalar height, PGColor text_color, PGColor page_color, PGColor edge_color);
 
 PGBitmapHandle CreateBitmapFromSize(PGScalar width, PGScalar height);
+// fill a rectangle of the bitmap with a single color; this does not require a renderer and can be used from any thread
+void FillBitmapRectangle(PGBitmapHandle bitmap, PGIRect rectangle, PGColor color);
 PGBitmapHandle CreateBitmapForText(PGFontHandle font, const char* text, size_t length);
 PGRendererHandle CreateRendererForBitmap(PGBitmapHandle handle);
 PGBitmapHandle PGLoadImage(std::string path);
@@ -388,6 +404,8 @@ PGColor GetTextColor(PGFontHandle font);
 // Sets the font used by the RenderText method
 void SetTextFontSize(PGFontHandle font, PGScalar height);
 PGScalar GetTextFontSize(PGFontHandle font);
+// returns an identifier of the typeface family the text is rendered in
+lng GetTextFontFamily(PGFontHandle font);
 void SetTextStyle(PGFontHandle font, PGTextStyle style);
 void SetTextTabWidth(PGFontHandle font, int tabwidth);
 
@@ -566,6 +584,10 @@ struct PGFileInformation {
 };
 
 PGFileInformation PGGetFileFlags(std::string path);
+// the current time, in the units of PGFileInformation::modification_time
+lng PGGetFileTimeNow();
+// the length of a second, in the units of PGFileInformation::modification_time
+lng PGGetFileTimeSecond();
 
 enum PGIOError {
 	PGIOSuccess,
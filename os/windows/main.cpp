@@ -1464,6 +1464,17 @@ PGFileInformation PGGetFileFlags(std::string path) {
 	return info;
 }
 
+lng PGGetFileTimeNow() {
+	FILETIME filetime;
+	GetSystemTimeAsFileTime(&filetime);
+	return filetime_to_lng(filetime);
+}
+
+lng PGGetFileTimeSecond() {
+	// a FILETIME counts intervals of 100 nanoseconds
+	return 10000000;
+}
+
 PGIOError PGRenameFile(std::string source, std::string dest) {
 	std::string ucs2_source = UTF8toUCS2(source);
 	std::string ucs2_target = UTF8toUCS2(dest);
@@ -1,13 +1,22 @@
-
 #pragma once
 
+#include <stddef.h>
+
 extern "C" {
 	typedef void* PGIgnoreGlob;
 
-	// create a gitignore-globset for a given directory
+	// create a gitignore-globset for a given directory, containing the .gitignore files of the directory and all its parents
+	// compiled .gitignore files are cached, and are only compiled again when their modification time changes
 	extern PGIgnoreGlob PGCreateGlobForDirectory(const char* path);
+	// create a gitignore-globset for a subdirectory from the globset of its parent directory
+	// only the .gitignore in the subdirectory itself (if any) has to be loaded
+	extern PGIgnoreGlob PGCreateGlobForSubdirectory(PGIgnoreGlob parent, const char* path);
+	// returns whether or not two globsets consist of the same (compiled) .gitignore files
+	extern bool PGIgnoreGlobEquals(PGIgnoreGlob, PGIgnoreGlob);
 	// returns whether or not a given path is ignored/should be skipped
 	extern bool PGFileIsIgnored(PGIgnoreGlob, const char* path, bool is_directory);
+	// classifies all entries of a directory listing at once, ignored[i] is set to whether or not names[i] is ignored
+	extern void PGIgnoreDirectoryEntries(PGIgnoreGlob, const char* directory, const char** names, const bool* is_directory, size_t count, bool* ignored);
 	// destroys the given ignore glob
 	extern void PGDestroyIgnoreGlob(PGIgnoreGlob);
 }
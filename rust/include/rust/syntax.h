@@ -1,24 +1,46 @@
 
 #pragma once
 
-#include "rust/syntax.h"
+#include <stddef.h>
+#include <stdint.h>
 
 extern "C" {
 	typedef void* PGSyntaxState;
 	typedef void* PGSyntaxParser;
 	typedef void* PGSyntaxSet;
+	typedef void* PGSyntaxParseResult;
+
+	// a run of characters with the same syntax type; end is the byte offset in the line after the run
+	struct PGSyntaxRun {
+		uint32_t end;
+		int16_t type;
+	};
 
 	extern PGSyntaxSet PGLoadSyntaxSet(const char* directory);
 	extern void PGDestroySyntaxSet(PGSyntaxSet);
 
+	// the syntaxes in a syntax set; the name and the extensions (separated by commas) are copied into the buffer
+	// and zero terminated, the functions return the full length so a larger buffer can be used if it did not fit
+	extern size_t PGSyntaxCount(PGSyntaxSet set);
+	extern size_t PGSyntaxName(PGSyntaxSet set, size_t index, char* buffer, size_t size);
+	extern size_t PGSyntaxExtensions(PGSyntaxSet set, size_t index, char* buffer, size_t size);
+
 	extern PGSyntaxParser PGCreateParser(PGSyntaxSet, const char* name);
 	extern void PGDestroyParser(PGSyntaxParser parser);
 
+	// parser states are interned, so equivalent states can be compared by identity
 	extern PGSyntaxState PGGetDefaultState(PGSyntaxParser parser);
-	extern PGParserState PGCopyParserState(PGSyntaxState state);
+	extern PGSyntaxState PGCopyParserState(PGSyntaxState state);
 	extern void PGDestroyParserState(PGSyntaxState state);
 
 	extern int PGStateEquivalent(PGSyntaxState a, PGSyntaxState b);
 
-	extern PGSyntaxState PGParseLine(PGSyntaxParser parser, PGSyntaxState state, const char* line);
+	// parses line_count lines starting from state (or the default state if state is null)
+	// line i starts at line_start[i - 1] (or 0 for the first line) and ends at line_start[i] (or length for the last line)
+	extern PGSyntaxParseResult PGParseLines(PGSyntaxParser parser, PGSyntaxState state, const char* text, size_t length, const long long* line_start, size_t line_count);
+	// returns the runs of the specified line; the result remains valid until the parse result is destroyed
+	extern const PGSyntaxRun* PGParseResultRuns(PGSyntaxParseResult result, size_t line, size_t* count);
+	// returns the state after the final line; the returned state has to be destroyed by the caller
+	extern PGSyntaxState PGParseResultState(PGSyntaxParseResult result);
+	extern void PGDestroyParseResult(PGSyntaxParseResult result);
 }
@@ -1,71 +1,253 @@
-
 use ignore::gitignore::{Gitignore, GitignoreBuilder};
 
-use std::path::Path;
+use std::collections::HashMap;
+use std::fs;
+use std::path::{Path, PathBuf};
 use std::ptr;
+use std::slice;
 use std::os::raw::c_char;
 use std::ffi::CStr;
+use std::sync::{Arc, Mutex, Once, ONCE_INIT};
+use std::time::SystemTime;
+
+// the ignore rules that apply to the entries of a directory:
+// the rules of the deepest .gitignore come first, followed by those of its parent directories
+pub struct IgnoreNode {
+	gitignore: Option<Arc<Gitignore>>,
+	parent: Option<Arc<IgnoreNode>>,
+}
+
+impl IgnoreNode {
+	fn is_ignored(&self, path: &Path, is_dir: bool) -> bool {
+		let mut node = Some(self);
+		while let Some(current) = node {
+			if let Some(ref gitignore) = current.gitignore {
+				// the deepest .gitignore that has an opinion about the path decides
+				let m = gitignore.matched(path, is_dir);
+				if m.is_ignore() {
+					return true;
+				}
+				if m.is_whitelist() {
+					return false;
+				}
+			}
+			node = match current.parent {
+				Some(ref parent) => Some(&**parent),
+				None => None
+			};
+		}
+		return false;
+	}
+
+	fn gitignores(&self) -> Vec<*const Gitignore> {
+		let mut result = Vec::new();
+		let mut node = Some(self);
+		while let Some(current) = node {
+			if let Some(ref gitignore) = current.gitignore {
+				result.push(&**gitignore as *const Gitignore);
+			}
+			node = match current.parent {
+				Some(ref parent) => Some(&**parent),
+				None => None
+			};
+		}
+		return result;
+	}
+}
+
+// a compiled .gitignore, together with the modification time of the file when it was compiled
+struct CachedGitignore {
+	modified: SystemTime,
+	gitignore: Arc<Gitignore>,
+}
+
+static CACHE_INIT: Once = ONCE_INIT;
+static mut CACHE: *const Mutex<HashMap<PathBuf, CachedGitignore>> = 0 as *const Mutex<HashMap<PathBuf, CachedGitignore>>;
+
+fn gitignore_cache() -> &'static Mutex<HashMap<PathBuf, CachedGitignore>> {
+	unsafe {
+		CACHE_INIT.call_once(|| {
+			CACHE = Box::into_raw(Box::new(Mutex::new(HashMap::new())));
+		});
+		return &*CACHE;
+	}
+}
+
+// returns the compiled .gitignore of a directory, or None if the directory has no .gitignore
+// a .gitignore is only compiled again if its modification time has changed since it was last compiled
+fn load_gitignore(directory: &Path) -> Option<Arc<Gitignore>> {
+	let path = directory.join(".gitignore");
+	let modified = match fs::metadata(&path).and_then(|metadata| metadata.modified()) {
+		Ok(modified) => modified,
+		Err(_) => {
+			return None;
+		}
+	};
+	{
+		let cache = gitignore_cache().lock().unwrap();
+		if let Some(entry) = cache.get(&path) {
+			if entry.modified == modified {
+				return Some(entry.gitignore.clone());
+			}
+		}
+	}
+	// we compile the .gitignore without holding the lock, so other directories can be processed in the meantime
+	let mut builder = GitignoreBuilder::new(directory);
+	builder.add(&path);
+	let gitignore = match builder.build() {
+		Ok(ig) => Arc::new(ig),
+		Err(_) => {
+			return None;
+		}
+	};
+	let mut cache = gitignore_cache().lock().unwrap();
+	cache.insert(path, CachedGitignore { modified: modified, gitignore: gitignore.clone() });
+	return Some(gitignore);
+}
+
+fn create_node(directory: &Path, parent: Option<Arc<IgnoreNode>>) -> Arc<IgnoreNode> {
+	match load_gitignore(directory) {
+		Some(gitignore) => Arc::new(IgnoreNode { gitignore: Some(gitignore), parent: parent }),
+		None => match parent {
+			// directories without a .gitignore share the node of their parent
+			Some(parent) => parent,
+			None => Arc::new(IgnoreNode { gitignore: None, parent: None }),
+		}
+	}
+}
+
+fn into_handle(node: Arc<IgnoreNode>) -> *mut Arc<IgnoreNode> {
+	let mut handle = Box::new(node);
+	let ptr: *mut _ = &mut *handle;
+	// forget the object we have created so rust does not clean it up
+	::std::mem::forget(handle);
+	return ptr;
+}
+
+fn c_path<'a>(path: *const c_char) -> Option<&'a Path> {
+	let cstr = unsafe { CStr::from_ptr(path) };
+	match cstr.to_str() {
+		Ok(path) => Some(Path::new(path)),
+		Err(_) => None
+	}
+}
 
 #[allow(non_snake_case)]
 #[no_mangle]
-pub extern "C" fn PGCreateGlobForDirectory(directory: *const c_char) -> *mut Gitignore {
-	let cstr = unsafe { CStr::from_ptr(directory) };
-	let mut path = match cstr.to_str() {
-		Ok(path) => Path::new(path),
-		Err(_) => {
+pub extern "C" fn PGCreateGlobForDirectory(directory: *const c_char) -> *mut Arc<IgnoreNode> {
+	let path = match c_path(directory) {
+		Some(path) => path,
+		None => {
 			return ptr::null_mut();
 		}
 	};
-	let mut builder = GitignoreBuilder::new(path);
-	loop {
-		builder.add(path.join(".gitignore"));
-		path = match path.parent() {
-			Some(p) => p,
-			None => break
-		};
+	// the rules of the outermost directory are applied last, so we build the chain from the root down
+	let mut directories = Vec::new();
+	let mut current = Some(path);
+	while let Some(dir) = current {
+		directories.push(dir);
+		current = dir.parent();
 	}
+	let mut node = None;
+	for dir in directories.iter().rev() {
+		node = Some(create_node(dir, node));
+	}
+	match node {
+		Some(node) => into_handle(node),
+		None => ptr::null_mut()
+	}
+}
 
-	let git_ignore = match builder.build() {
-		Ok(ig) => ig,
-		Err(_) => {
+#[allow(non_snake_case)]
+#[no_mangle]
+pub extern "C" fn PGCreateGlobForSubdirectory(parent: *mut Arc<IgnoreNode>, directory: *const c_char) -> *mut Arc<IgnoreNode> {
+	if parent.is_null() {
+		return ptr::null_mut();
+	}
+	let path = match c_path(directory) {
+		Some(path) => path,
+		None => {
 			return ptr::null_mut();
 		}
 	};
-	let mut ig = Box::new(git_ignore);
-	let ptr: *mut _ = &mut *ig;
-	// forget the object we have created so rust does not clean it up
-	::std::mem::forget(ig);
-	return ptr;
+	let parent_node: &Arc<IgnoreNode> = unsafe { &*parent };
+	return into_handle(create_node(path, Some(parent_node.clone())));
+}
+
+#[allow(non_snake_case)]
+#[no_mangle]
+pub extern "C" fn PGIgnoreGlobEquals(a: *mut Arc<IgnoreNode>, b: *mut Arc<IgnoreNode>) -> bool {
+	if a.is_null() || b.is_null() {
+		return a.is_null() && b.is_null();
+	}
+	let (a, b): (&Arc<IgnoreNode>, &Arc<IgnoreNode>) = unsafe { (&*a, &*b) };
+	return a.gitignores() == b.gitignores();
 }
 
 #[allow(non_snake_case)]
 #[no_mangle]
-pub extern "C" fn PGFileIsIgnored(ptr: *mut Gitignore, glob_text: *const c_char, is_dir: bool) -> bool {
+pub extern "C" fn PGFileIsIgnored(ptr: *mut Arc<IgnoreNode>, glob_text: *const c_char, is_dir: bool) -> bool {
 	if ptr.is_null() {
 		return false;
 	}
-	let cstr = unsafe { CStr::from_ptr(glob_text) };
-	let path = match cstr.to_str() {
-		Ok(path) => path,
-		Err(_) => {
+	let path = match c_path(glob_text) {
+		Some(path) => path,
+		None => {
 			return false;
 		}
 	};
-	let ig: Box<Gitignore> = unsafe { ::std::mem::transmute(ptr) };
-	let m = ig.matched(path, is_dir).is_ignore();
-	::std::mem::forget(ig);
-	return m;
+	let node: &Arc<IgnoreNode> = unsafe { &*ptr };
+	return node.is_ignored(path, is_dir);
+}
+
+#[allow(non_snake_case)]
+#[no_mangle]
+pub extern "C" fn PGIgnoreDirectoryEntries(ptr: *mut Arc<IgnoreNode>, directory: *const c_char, names: *const *const c_char, is_directory: *const bool, count: usize, ignored: *mut bool) {
+	if count == 0 {
+		return;
+	}
+	let names = unsafe { slice::from_raw_parts(names, count) };
+	let is_directory = unsafe { slice::from_raw_parts(is_directory, count) };
+	let ignored = unsafe { slice::from_raw_parts_mut(ignored, count) };
+	let directory = match c_path(directory) {
+		Some(directory) => directory,
+		None => {
+			for i in 0..count {
+				ignored[i] = false;
+			}
+			return;
+		}
+	};
+	if ptr.is_null() {
+		for i in 0..count {
+			ignored[i] = false;
+		}
+		return;
+	}
+	let node: &Arc<IgnoreNode> = unsafe { &*ptr };
+	let mut path = directory.to_path_buf();
+	for i in 0..count {
+		ignored[i] = match c_path(names[i]) {
+			Some(name) => {
+				path.push(name);
+				let result = node.is_ignored(&path, is_directory[i]);
+				path.pop();
+				result
+			},
+			None => false
+		};
+	}
 }
 
 #[allow(non_snake_case)]
 #[no_mangle]
-pub extern "C" fn PGDestroyIgnoreGlob(ptr: *mut Gitignore) {
+pub extern "C" fn PGDestroyIgnoreGlob(ptr: *mut Arc<IgnoreNode>) {
 	if ptr.is_null() {
 		return;
 	}
 
 	// Now, we know the pointer is non-null, we can continue.
-	let obj: Box<Gitignore> = unsafe { ::std::mem::transmute(ptr) };
+	let obj: Box<Arc<IgnoreNode>> = unsafe { ::std::mem::transmute(ptr) };
 
 	// We don't *have* to do anything else; once obj goes out of scope, it will
 	// be dropped.  I'm going to drop it explicitly, however, for clarity.
@@ -1,20 +1,139 @@
-
 use syntect::parsing::ParseState;
 use syntect::parsing::SyntaxSet;
 use syntect::parsing::SyntaxDefinition;
 use syntect::parsing::ScopeStack;
-use syntect::parsing::ScopeRepository;
+use syntect::parsing::Scope;
 
+use std::borrow::Cow;
+use std::cmp;
+use std::collections::HashMap;
+use std::collections::hash_map::DefaultHasher;
+use std::hash::{Hash, Hasher};
 use std::path::Path;
 use std::ptr;
+use std::slice;
+use std::str;
 use std::os::raw::c_char;
 use std::ffi::CStr;
+use std::sync::{Arc, Mutex, Weak};
+
+// the syntax types of the editor (see syntax/syntax.h)
+const PG_SYNTAX_ERROR: i16 = -1;
+const PG_SYNTAX_NONE: i16 = 0;
+const PG_SYNTAX_STRING: i16 = 1;
+const PG_SYNTAX_CONSTANT: i16 = 2;
+const PG_SYNTAX_COMMENT: i16 = 3;
+const PG_SYNTAX_OPERATOR: i16 = 4;
+const PG_SYNTAX_FUNCTION: i16 = 5;
+const PG_SYNTAX_KEYWORD: i16 = 6;
+const PG_SYNTAX_CLASS1: i16 = 7;
+const PG_SYNTAX_CLASS2: i16 = 8;
+
+// scopes are mapped to syntax types by prefix; more specific prefixes have to come first
+const SCOPE_TYPES: &'static [(&'static str, i16)] = &[
+	("invalid", PG_SYNTAX_ERROR),
+	("comment", PG_SYNTAX_COMMENT),
+	("string", PG_SYNTAX_STRING),
+	("constant", PG_SYNTAX_CONSTANT),
+	("keyword.operator", PG_SYNTAX_OPERATOR),
+	("keyword", PG_SYNTAX_KEYWORD),
+	("storage", PG_SYNTAX_KEYWORD),
+	("entity.name.function", PG_SYNTAX_FUNCTION),
+	("support.function", PG_SYNTAX_FUNCTION),
+	("entity.name", PG_SYNTAX_CLASS1),
+	("support.type", PG_SYNTAX_CLASS1),
+	("support.class", PG_SYNTAX_CLASS1),
+	("variable", PG_SYNTAX_CLASS2),
+];
+
+// a parse state together with the scopes that are active at that point
+// end states are interned per parser, so equal states share the same object
+pub struct SyntectState {
+	parse: ParseState,
+	scopes: ScopeStack,
+}
+
+impl SyntectState {
+	fn fingerprint(&self) -> u64 {
+		let mut hasher = DefaultHasher::new();
+		self.scopes.as_slice().hash(&mut hasher);
+		return hasher.finish();
+	}
+}
+
+pub struct SyntectParser {
+	definition: SyntaxDefinition,
+	scope_types: Vec<(Scope, i16)>,
+	// interned states by the fingerprint of their scopes
+	states: Mutex<HashMap<u64, Vec<Weak<SyntectState>>>>,
+}
+
+impl SyntectParser {
+	fn syntax_type(&self, scopes: &ScopeStack) -> i16 {
+		// the innermost scope that has a syntax type decides
+		for scope in scopes.as_slice().iter().rev() {
+			for &(prefix, syntax_type) in self.scope_types.iter() {
+				if prefix.is_prefix_of(*scope) {
+					return syntax_type;
+				}
+			}
+		}
+		return PG_SYNTAX_NONE;
+	}
+
+	fn intern(&self, state: SyntectState) -> Arc<SyntectState> {
+		let fingerprint = state.fingerprint();
+		let mut states = self.states.lock().unwrap();
+		let candidates = states.entry(fingerprint).or_insert_with(Vec::new);
+		candidates.retain(|candidate| candidate.upgrade().is_some());
+		for candidate in candidates.iter() {
+			if let Some(candidate) = candidate.upgrade() {
+				if candidate.scopes == state.scopes && candidate.parse == state.parse {
+					return candidate;
+				}
+			}
+		}
+		let result = Arc::new(state);
+		candidates.push(Arc::downgrade(&result));
+		return result;
+	}
+}
+
+// a run of characters with the same syntax type; end is the byte offset after the run
+#[repr(C)]
+pub struct PGSyntaxRun {
+	end: u32,
+	syntax_type: i16,
+}
+
+pub struct ParseResult {
+	runs: Vec<PGSyntaxRun>,
+	// the runs of line i are runs[line_runs[i]..line_runs[i + 1]]
+	line_runs: Vec<usize>,
+	state: Arc<SyntectState>,
+}
+
+fn into_handle<T>(object: T) -> *mut T {
+	let mut handle = Box::new(object);
+	let ptr: *mut _ = &mut *handle;
+	// forget the object we have created so rust does not clean it up
+	::std::mem::forget(handle);
+	return ptr;
+}
+
+fn destroy_handle<T>(ptr: *mut T) {
+	if ptr.is_null() {
+		return;
+	}
+	let obj: Box<T> = unsafe { Box::from_raw(ptr) };
+	::std::mem::drop(obj);
+}
 
 #[allow(non_snake_case)]
 #[no_mangle]
 pub extern "C" fn PGLoadSyntaxSet(directory: *const c_char) -> *mut SyntaxSet{
 	let cstr = unsafe { CStr::from_ptr(directory) };
-	let mut path = match cstr.to_str() {
+	let path = match cstr.to_str() {
 		Ok(path) => Path::new(path),
 		Err(_) => {
 			return ptr::null_mut();
@@ -29,28 +148,55 @@ pub extern "C" fn PGLoadSyntaxSet(directory: *const c_char) -> *mut SyntaxSet{
 		}
 	};
 	syntax.link_syntaxes();
-
-	let mut ig = Box::new(syntax);
-	let ptr: *mut _ = &mut *ig;
-	// forget the object we have created so rust does not clean it up
-	::std::mem::forget(ig);
-	return ptr;
+	return into_handle(syntax);
 }
 
 #[allow(non_snake_case)]
 #[no_mangle]
 pub extern "C" fn PGDestroySyntaxSet(ptr: *mut SyntaxSet) {
-	if ptr.is_null() {
-		return;
+	destroy_handle(ptr);
+}
+
+// copies text into the buffer (truncated if it does not fit, and zero terminated)
+// returns the length of the full text, so the caller can retry with a bigger buffer
+fn copy_string(text: &str, buffer: *mut c_char, size: usize) -> usize {
+	if !buffer.is_null() && size > 0 {
+		let count = cmp::min(text.len(), size - 1);
+		unsafe {
+			ptr::copy_nonoverlapping(text.as_ptr(), buffer as *mut u8, count);
+			*buffer.offset(count as isize) = 0;
+		}
+	}
+	return text.len();
+}
+
+#[allow(non_snake_case)]
+#[no_mangle]
+pub extern "C" fn PGSyntaxCount(cset: *mut SyntaxSet) -> usize {
+	if cset.is_null() {
+		return 0;
 	}
+	let syntax: &SyntaxSet = unsafe { &*cset };
+	return syntax.syntaxes().len();
+}
 
-	let obj: Box<SyntaxSet> = unsafe { ::std::mem::transmute(ptr) };
-	::std::mem::drop(obj);
+#[allow(non_snake_case)]
+#[no_mangle]
+pub extern "C" fn PGSyntaxName(cset: *mut SyntaxSet, index: usize, buffer: *mut c_char, size: usize) -> usize {
+	let syntax: &SyntaxSet = unsafe { &*cset };
+	return copy_string(&syntax.syntaxes()[index].name, buffer, size);
+}
+
+#[allow(non_snake_case)]
+#[no_mangle]
+pub extern "C" fn PGSyntaxExtensions(cset: *mut SyntaxSet, index: usize, buffer: *mut c_char, size: usize) -> usize {
+	let syntax: &SyntaxSet = unsafe { &*cset };
+	return copy_string(&syntax.syntaxes()[index].file_extensions.join(","), buffer, size);
 }
 
 #[allow(non_snake_case)]
 #[no_mangle]
-pub extern "C" fn PGCreateParser(cset: *mut SyntaxSet, cname: *const c_char) -> *mut SyntaxDefinition {
+pub extern "C" fn PGCreateParser(cset: *mut SyntaxSet, cname: *const c_char) -> *mut SyntectParser {
 	if cset.is_null() || cname.is_null() {
 		return ptr::null_mut();
 	}
@@ -63,76 +209,196 @@ pub extern "C" fn PGCreateParser(cset: *mut SyntaxSet, cname: *const c_char) ->
 		}
 	};
 
-	let syntax: Box<SyntaxSet> = unsafe { ::std::mem::transmute(cset) };
+	let syntax: &SyntaxSet = unsafe { &*cset };
 	let definition = match syntax.find_syntax_by_name(name) {
 		Some(def) => def.clone(),
 		None => {
 			return ptr::null_mut();
 		}
 	};
-	::std::mem::forget(syntax);
-
+	let mut scope_types = Vec::new();
+	for &(prefix, syntax_type) in SCOPE_TYPES.iter() {
+		if let Ok(scope) = Scope::new(prefix) {
+			scope_types.push((scope, syntax_type));
+		}
+	}
+	return into_handle(SyntectParser {
+		definition: definition,
+		scope_types: scope_types,
+		states: Mutex::new(HashMap::new()),
+	});
+}
 
-	let mut def = Box::new(definition);
-	let ptr: *mut _ = &mut *def;
-	::std::mem::forget(def);
-	return ptr;
+#[allow(non_snake_case)]
+#[no_mangle]
+pub extern "C" fn PGDestroyParser(ptr: *mut SyntectParser) {
+	destroy_handle(ptr);
 }
 
 #[allow(non_snake_case)]
 #[no_mangle]
-pub extern "C" fn PGDestroyParser(ptr: *mut SyntaxDefinition) {
-	if ptr.is_null() {
-		return;
+pub extern "C" fn PGGetDefaultState(cparser: *mut SyntectParser) -> *mut Arc<SyntectState> {
+	if cparser.is_null() {
+		return ptr::null_mut();
 	}
+	let parser: &SyntectParser = unsafe { &*cparser };
+	let state = SyntectState { parse: ParseState::new(&parser.definition), scopes: ScopeStack::new() };
+	return into_handle(parser.intern(state));
+}
 
-	let obj: Box<SyntaxDefinition> = unsafe { ::std::mem::transmute(ptr) };
-	::std::mem::drop(obj);
+#[allow(non_snake_case)]
+#[no_mangle]
+pub extern "C" fn PGDestroyParserState(ptr: *mut Arc<SyntectState>) {
+	destroy_handle(ptr);
 }
 
 #[allow(non_snake_case)]
 #[no_mangle]
-pub extern "C" fn PGGetDefaultState(cdef: *mut SyntaxDefinition) -> *mut ParseState {
-	if cdef.is_null() {
+pub extern "C" fn PGCopyParserState(cstate: *mut Arc<SyntectState>) -> *mut Arc<SyntectState> {
+	if cstate.is_null() {
 		return ptr::null_mut();
 	}
-
-	let definition: Box<SyntaxDefinition> = unsafe { ::std::mem::transmute(cdef) };
-	let state = ParseState::new(&definition);
-	::std::mem::forget(definition);
-
-	let mut ig = Box::new(state);
-	let ptr: *mut _ = &mut *ig;
-	// forget the object we have created so rust does not clean it up
-	::std::mem::forget(ig);
-	return ptr;
+	// states are immutable, so copying a state only takes another reference to it
+	let state: &Arc<SyntectState> = unsafe { &*cstate };
+	return into_handle(state.clone());
 }
 
 #[allow(non_snake_case)]
 #[no_mangle]
-pub extern "C" fn PGDestroyParserState(ptr: *mut ParseState) {
-	if ptr.is_null() {
-		return;
+pub extern "C" fn PGStateEquivalent(a: *mut Arc<SyntectState>, b: *mut Arc<SyntectState>) -> i32 {
+	if a.is_null() || b.is_null() {
+		return (a.is_null() && b.is_null()) as i32;
 	}
-
-	let obj: Box<ParseState> = unsafe { ::std::mem::transmute(ptr) };
-	::std::mem::drop(obj);
+	let (a, b): (&Arc<SyntectState>, &Arc<SyntectState>) = unsafe { (&*a, &*b) };
+	// interned states are equal only if they are the same object
+	return Arc::ptr_eq(a, b) as i32;
 }
 
+// parses line_count lines of text in one call, starting from the given state (or the default state if it is null)
+// line i starts at line_start[i - 1] (or 0) and ends at line_start[i] (or length), including its newline
 #[allow(non_snake_case)]
 #[no_mangle]
-pub extern "C" fn PGCopyParserState(cstate: *mut ParseState) -> *mut ParseState {
-	if cstate.is_null() {
+pub extern "C" fn PGParseLines(cparser: *mut SyntectParser, cstate: *mut Arc<SyntectState>, text: *const c_char, length: usize, line_start: *const i64, line_count: usize) -> *mut ParseResult {
+	if cparser.is_null() || text.is_null() {
 		return ptr::null_mut();
 	}
+	let parser: &SyntectParser = unsafe { &*cparser };
+	let text = unsafe { slice::from_raw_parts(text as *const u8, length) };
+	let line_start = if line_count > 1 { unsafe { slice::from_raw_parts(line_start, line_count - 1) } } else { &[] };
+	let (mut parse, mut scopes) = if cstate.is_null() {
+		(ParseState::new(&parser.definition), ScopeStack::new())
+	} else {
+		let state: &Arc<SyntectState> = unsafe { &*cstate };
+		(state.parse.clone(), state.scopes.clone())
+	};
 
-	let state: Box<ParseState> = unsafe { ::std::mem::transmute(cstate) };
-	let new_state = state.clone();
-	::std::mem::forget(state);
+	let mut runs = Vec::new();
+	let mut line_runs = Vec::with_capacity(line_count + 1);
+	line_runs.push(0);
+	for i in 0..line_count {
+		let start = if i == 0 { 0 } else { line_start[i - 1] as usize };
+		let end = if i + 1 == line_count { length } else { line_start[i] as usize };
+		let (mut line, offsets) = decode_line(&text[start..end]);
+		// the syntax definitions expect every line to end with a newline
+		if !line.ends_with('\n') {
+			line.to_mut().push('\n');
+		}
+		let line_length = (line.len() - 1) as u32;
+		// the runs are reported as offsets in the original bytes of the line
+		let original_offset = |offset: u32| -> u32 {
+			match offsets {
+				Some(ref offsets) => offsets[offset as usize],
+				None => offset,
+			}
+		};
 
-	let mut ig = Box::new(new_state);
-	let ptr: *mut _ = &mut *ig;
-	// forget the object we have created so rust does not clean it up
-	::std::mem::forget(ig);
-	return ptr;
+		let first_run = runs.len();
+		let mut position = 0;
+		let mut syntax_type = parser.syntax_type(&scopes);
+		for (offset, op) in parse.parse_line(&line) {
+			let offset = ::std::cmp::min(offset as u32, line_length);
+			if offset > position {
+				push_run(&mut runs, first_run, original_offset(offset), syntax_type);
+				position = offset;
+			}
+			scopes.apply(&op);
+			syntax_type = parser.syntax_type(&scopes);
+		}
+		if line_length > position {
+			push_run(&mut runs, first_run, original_offset(line_length), syntax_type);
+		}
+		line_runs.push(runs.len());
+	}
+	return into_handle(ParseResult {
+		runs: runs,
+		line_runs: line_runs,
+		state: parser.intern(SyntectState { parse: parse, scopes: scopes }),
+	});
+}
+
+// converts a line to a string, invalid UTF-8 sequences are replaced by U+FFFD
+// the replacements change the byte length of the line, so in that case the original offset of
+// every byte of the string (and of the end of the string) is returned as well
+fn decode_line(bytes: &[u8]) -> (Cow<str>, Option<Vec<u32>>) {
+	if let Ok(line) = str::from_utf8(bytes) {
+		return (Cow::Borrowed(line), None);
+	}
+	let mut line = String::with_capacity(bytes.len() + 8);
+	let mut offsets = Vec::with_capacity(bytes.len() + 8);
+	let mut position = 0;
+	while position < bytes.len() {
+		let (valid, invalid) = match str::from_utf8(&bytes[position..]) {
+			Ok(_) => (bytes.len() - position, 0),
+			Err(error) => (error.valid_up_to(), error.error_len().unwrap_or(bytes.len() - position - error.valid_up_to())),
+		};
+		line.push_str(unsafe { str::from_utf8_unchecked(&bytes[position..position + valid]) });
+		for i in 0..valid {
+			offsets.push((position + i) as u32);
+		}
+		position += valid;
+		if invalid > 0 {
+			line.push('\u{FFFD}');
+			for _ in 0..'\u{FFFD}'.len_utf8() {
+				offsets.push(position as u32);
+			}
+			position += invalid;
+		}
+	}
+	offsets.push(bytes.len() as u32);
+	return (Cow::Owned(line), Some(offsets));
+}
+
+fn push_run(runs: &mut Vec<PGSyntaxRun>, first_run: usize, end: u32, syntax_type: i16) {
+	// merge adjacent runs of the same type within a line
+	if runs.len() > first_run {
+		let last = runs.len() - 1;
+		if runs[last].syntax_type == syntax_type {
+			runs[last].end = end;
+			return;
+		}
+	}
+	runs.push(PGSyntaxRun { end: end, syntax_type: syntax_type });
+}
+
+#[allow(non_snake_case)]
+#[no_mangle]
+pub extern "C" fn PGParseResultRuns(cresult: *mut ParseResult, line: usize, count: *mut usize) -> *const PGSyntaxRun {
+	let result: &ParseResult = unsafe { &*cresult };
+	let start = result.line_runs[line];
+	let end = result.line_runs[line + 1];
+	unsafe { *count = end - start; }
+	return result.runs[start..].as_ptr();
+}
+
+#[allow(non_snake_case)]
+#[no_mangle]
+pub extern "C" fn PGParseResultState(cresult: *mut ParseResult) -> *mut Arc<SyntectState> {
+	let result: &ParseResult = unsafe { &*cresult };
+	return into_handle(result.state.clone());
+}
+
+#[allow(non_snake_case)]
+#[no_mangle]
+pub extern "C" fn PGDestroyParseResult(ptr: *mut ParseResult) {
+	destroy_handle(ptr);
 }
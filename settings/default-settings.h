@@ -10,6 +10,8 @@ const char* PANTHER_DEFAULT_SETTINGS = R"DEFAULTSETTINGS(
 	"word_wrap" : "auto",
 	"hot_exit" : true,
 	"automatic_reload_threshold" : 1000,
+	"open_files_memory_budget" : 512,
+	"find_in_files_index" : true,
 	"default_terminal" : "C:\\Proqgram Files\\Git\\git-bash.exe",
 	"ignored_files": ["*.exe", "*.app", "*.dll", "*.so", "*.dylib", "*.o", "*.O", "*.obj", "*.pyc",
 					  "*.ttf", "*.sys", "*.msi", "*.jpg", "*.jpeg", "*.png", "*.bmp", "*.ico", "*.mp3",
@@ -304,6 +304,16 @@ void PGStyleManager::LoadStyles(const char* data) {
 		}
 		this->styles[name] = PGStyle::LoadStyle(base_style, s["colors"]);
 	}
+	version++;
+}
+
+bool PGStyleManager::_SetStyle(std::string name) {
+	if (this->styles.count(name) == 0) {
+		return false;
+	}
+	this->default_style = this->styles[name];
+	version++;
+	return true;
 }
 
 PGColor PGStyleManager::_GetColor(PGColorType type, PGStyle* extra_style) {
@@ -321,6 +331,39 @@ PGColor PGStyleManager::_GetColor(PGColorType type, PGStyle* extra_style) {
 	return PGColor(255, 255, 255);
 }
 
+PGColor PGStyleManager::GetSyntaxColor(const PGSyntaxNode& node) {
+	PGColor color = PGStyleManager::GetColor(PGColorTextFieldText);
+	if (node.type == PGSyntaxString) {
+		color = PGStyleManager::GetColor(PGColorSyntaxString);
+	} else if (node.type == PGSyntaxConstant) {
+		color = PGStyleManager::GetColor(PGColorSyntaxConstant);
+	} else if (node.type == PGSyntaxComment) {
+		color = PGStyleManager::GetColor(PGColorSyntaxComment);
+	} else if (node.type == PGSyntaxOperator) {
+		color = PGStyleManager::GetColor(PGColorSyntaxOperator);
+	} else if (node.type == PGSyntaxFunction) {
+		color = PGStyleManager::GetColor(PGColorSyntaxFunction);
+	} else if (node.type == PGSyntaxKeyword) {
+		color = PGStyleManager::GetColor(PGColorSyntaxKeyword);
+	} else if (node.type == PGSyntaxClass1) {
+		color = PGStyleManager::GetColor(PGColorSyntaxClass1);
+	} else if (node.type == PGSyntaxClass2) {
+		color = PGStyleManager::GetColor(PGColorSyntaxClass2);
+	} else if (node.type == PGSyntaxClass3) {
+		color = PGStyleManager::GetColor(PGColorSyntaxClass3);
+	} else if (node.type == PGSyntaxClass4) {
+		color = PGStyleManager::GetColor(PGColorSyntaxClass4);
+	} else if (node.type == PGSyntaxClass5) {
+		color = PGStyleManager::GetColor(PGColorSyntaxClass5);
+	} else if (node.type == PGSyntaxClass6) {
+		color = PGStyleManager::GetColor(PGColorSyntaxClass6);
+	}
+	if (node.transparent) {
+		color.a = 128;
+	}
+	return color;
+}
+
 PGFontHandle PGStyleManager::GetFont(PGFontType type) {
 	switch (type) {
 		case PGFontTypeTextField:
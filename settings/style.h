@@ -1,6 +1,7 @@
 #pragma once
 
 #include "windowfunctions.h"
+#include "syntax.h"
 
 #include <map>
 
@@ -78,6 +79,12 @@ public:
 	static PGBitmapHandle GetImage(std::string path) { return GetInstance()->_GetImage(path); }
 	static PGColor GetColor(PGColorType type, PGStyle* extra_style = nullptr) { return GetInstance()->_GetColor(type, extra_style); }
 	static PGFontHandle GetFont(PGFontType);
+	// the color in which text with the specified syntax is rendered
+	static PGColor GetSyntaxColor(const PGSyntaxNode& node);
+	// switches to the style with the specified name, returns false if there is no such style
+	static bool SetStyle(std::string name) { return GetInstance()->_SetStyle(name); }
+	// incremented whenever the colors change, anything that caches rendered colors renders them again when it changes
+	static lng GetVersion() { return GetInstance()->version; }
 private:
 	PGStyleManager();
 
@@ -87,11 +94,13 @@ private:
 
 	PGBitmapHandle _GetImage(std::string path);
 	PGColor _GetColor(PGColorType type, PGStyle* extra_style);
+	bool _SetStyle(std::string name);
 
 	void LoadStyles(const char* text);
 
 	PGStyle default_style;
 	PGStyle user_style;
+	lng version = 0;
 
 	std::map<std::string, PGBitmapHandle> images;
 	std::map<std::string, PGStyle> styles;
@@ -1,31 +1,59 @@
 
 #include "mmap.h"
 #include "replaymanager.h"
+#include "scheduler.h"
 #include "workspace.h"
 
 #include <fstream>
 
 using namespace nlohmann;
 
+// the files and windows are captured again on every write, so they are not kept in the settings
+static void RemoveCapturedState(json& settings) {
+	if (!settings.is_object()) return;
+	settings.erase("files");
+	settings.erase("windows");
+}
+
 PGWorkspace::PGWorkspace() {
 }
 
 void PGWorkspace::LoadWorkspace(std::string filename) {
-	this->filename = filename;
+	// older versions stored the workspace as "workspace.json", even after it was written as MessagePack
+	// the workspace is now stored in a ".msgpack" file next to it; the old file is read until the new one has been written
+	std::string legacy_filename = "";
+	if (filename.size() > 5 && filename.substr(filename.size() - 5) == ".json") {
+		legacy_filename = filename;
+		filename = filename.substr(0, filename.size() - 5) + ".msgpack";
+	}
+	this->writer = std::make_shared<PGWorkspaceWriter>(filename, legacy_filename);
 	lng result_size;
 	PGFileError error;
 	json j;
 	char* ptr = (char*)panther::ReadFile(filename, result_size, error);
+	if (!ptr && legacy_filename.size() > 0) {
+		ptr = (char*)panther::ReadFile(legacy_filename, result_size, error);
+	}
 	if (!ptr) {
 		goto default_workspace;
 	}
 	try {
-		j = json::parse(ptr);
+		// the workspace is stored as MessagePack, older workspaces are stored as plain JSON
+		lng start = 0;
+		while (start < result_size && isspace((unsigned char)ptr[start])) start++;
+		if (start < result_size && ptr[start] == '{') {
+			j = json::parse(std::string(ptr, result_size));
+		} else {
+			j = json::from_msgpack(std::vector<uint8_t>((uint8_t*)ptr, (uint8_t*)ptr + result_size));
+		}
 	} catch (...) {
+		panther::DestroyFileContents(ptr);
 		goto default_workspace;
 	}
+	panther::DestroyFileContents(ptr);
 
 	this->settings = j;
+	RemoveCapturedState(this->settings);
 	if (j.count("workspace_name") > 0) {
 		this->workspace_name = j["workspace_name"].get<std::string>();
 	}
@@ -47,52 +75,190 @@ void PGWorkspace::LoadWorkspace(std::string filename) {
 	}
 default_workspace:
 	this->settings = j;
+	RemoveCapturedState(this->settings);
 	this->workspace_name = "Default Workspace";
 	auto window = PGCreateWindow(this, std::vector<std::shared_ptr<TextView>>());
 }
 
-std::string PGWorkspace::WriteWorkspace() {
-	if (PGGlobalReplayManager::running_replay) return "";
-
-	std::string errmsg;
-	if (filename.size() == 0) return "File not found.";
-
-	json j = settings;
+PGWorkspaceState* PGWorkspace::CaptureWorkspace(bool full) {
+	// capturing the workspace only collects the state of the controls and takes snapshots of unsaved files
+	// windows and files that have not changed reuse their previous state, except for the focused window
+	// assembling the workspace, copying the text of the files and writing the file is left to the writer
+	PGWorkspaceState* state = new PGWorkspaceState();
+	json& j = state->j;
+	j = settings;
 	findtext.WriteWorkspace(j);
 	j["workspace_name"] = this->workspace_name;
-	j["files"] = nlohmann::json::array();
-	FileManager::WriteWorkspace(j["files"]);
-	j["windows"] = nlohmann::json::array();
-	int index = 0;
+	FileManager::WriteWorkspace(state->files, state->texts);
+	lng files_version = FileManager::GetFilesVersion();
+	if (full || files_version != captured_files_version) {
+		window_states.clear();
+		captured_files_version = files_version;
+	}
 	for (auto it = windows.begin(); it != windows.end(); it++) {
-		j["windows"][index] = nlohmann::json::object();
-		PGWriteWorkspace(*it, j["windows"][index]);
-		index++;
+		auto entry = window_states.find(*it);
+		if (entry != window_states.end() && WindowHasFocus(*it)) {
+			// scrolling, moving or resizing the window and changing its layout do not invalidate its state
+			// the window the user is working in is always captured again, so those changes are not lost
+			window_states.erase(entry);
+			entry = window_states.end();
+		}
+		if (entry == window_states.end()) {
+			auto window_state = std::make_shared<json>(json::object());
+			PGWriteWorkspace(*it, *window_state);
+			entry = window_states.insert(std::pair<PGWindowHandle, std::shared_ptr<const json>>(*it, window_state)).first;
+		}
+		state->windows.push_back(entry->second);
 	}
+	state->sequence = ++capture_sequence;
+	return state;
+}
 
-	// we write the workspace to a temporary file first (workspace.json.tmp)
-	std::string temp_filename = filename + ".tmp";
+void PGWorkspace::InvalidateWindow(PGWindowHandle window) {
+	window_states.erase(window);
+}
 
-	std::ofstream out(temp_filename);
-	if (!out) {
-		return "Could not open file \"" + temp_filename + "\"";
+PGWorkspaceWriter::PGWorkspaceWriter(std::string filename, std::string legacy_filename) :
+	filename(filename), legacy_filename(legacy_filename), write_lock(CreateMutex()), file_lock(CreateMutex()) {
+}
+
+static void HashWorkspaceData(uint64_t& hash, const void* data, size_t size) {
+	// FNV-1a
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
 	}
-	if (!(out << std::setw(4) << j)) {
-		out.close();
-		goto cleanup;
+}
+
+std::string PGWorkspaceWriter::Write(PGWorkspaceState* state) {
+	std::string temp_filename = filename + ".tmp";
+	LockMutex(file_lock.get());
+	if (state->sequence <= written_sequence) {
+		// a more recent state has already been written
+		UnlockMutex(file_lock.get());
+		return "";
+	}
+	json& j = state->j;
+	j["files"] = json::array();
+	for (auto it = state->files.begin(); it != state->files.end(); it++) {
+		j["files"].push_back(**it);
+	}
+	j["windows"] = json::array();
+	for (auto it = state->windows.begin(); it != state->windows.end(); it++) {
+		j["windows"].push_back(**it);
 	}
-	out.close();
 
+	// if neither the workspace nor the unsaved texts have changed since the previous write, we are done
+	std::vector<uint8_t> data = json::to_msgpack(j);
+	uint64_t hash = 14695981039346656037ULL;
+	HashWorkspaceData(hash, data.data(), data.size());
+	for (auto it = state->texts.begin(); it != state->texts.end(); it++) {
+		lng version = it->snapshot->GetVersion();
+		HashWorkspaceData(hash, &it->index, sizeof(it->index));
+		HashWorkspaceData(hash, &it->file, sizeof(it->file));
+		HashWorkspaceData(hash, &version, sizeof(version));
+	}
+	std::string errmsg;
+	if (hash == written_hash) {
+		written_sequence = state->sequence;
+		goto finish;
+	}
+	if (state->texts.size() > 0) {
+		for (auto it = state->texts.begin(); it != state->texts.end(); it++) {
+			j["files"][it->index]["buffer"] = it->snapshot->GetText();
+		}
+		data = json::to_msgpack(j);
+	}
 	{
-		// after writing to the temporary file, we move it over the old workspace file 
-		auto ret = PGRenameFile(temp_filename, filename);
-		if (ret == PGIOSuccess) {
-			return "";
+		// we write the workspace to a temporary file first (workspace.msgpack.tmp)
+		std::ofstream out(temp_filename, std::ios::binary);
+		if (!out) {
+			errmsg = "Could not open file \"" + temp_filename + "\"";
+			goto finish;
+		}
+		if (!out.write((const char*)data.data(), data.size())) {
+			out.close();
+			PGRemoveFile(temp_filename);
+			errmsg = "I/O error.";
+			goto finish;
 		}
+		out.close();
+	}
+	// after writing to the temporary file, we move it over the old workspace file
+	if (PGRenameFile(temp_filename, filename) != PGIOSuccess) {
+		PGRemoveFile(temp_filename);
+		errmsg = "I/O error.";
+		goto finish;
+	}
+	if (legacy_filename.size() > 0) {
+		// the workspace has been migrated to the new file
+		PGRemoveFile(legacy_filename);
+		legacy_filename = "";
 	}
-cleanup:
-	PGRemoveFile(temp_filename);
-	return "I/O error.";
+	written_sequence = state->sequence;
+	written_hash = hash;
+finish:
+	UnlockMutex(file_lock.get());
+	return errmsg;
+}
+
+bool PGWorkspaceWriter::SetPendingWrite(PGWorkspaceState* state) {
+	LockMutex(write_lock.get());
+	// if there is already a pending write, its task has not started yet and will write this state instead
+	bool schedule_task = pending_write == nullptr;
+	pending_write = std::unique_ptr<PGWorkspaceState>(state);
+	UnlockMutex(write_lock.get());
+	return schedule_task;
+}
+
+void PGWorkspaceWriter::WritePending() {
+	LockMutex(write_lock.get());
+	std::unique_ptr<PGWorkspaceState> state = std::move(pending_write);
+	UnlockMutex(write_lock.get());
+	if (!state) return;
+	std::string error = Write(state.get());
+	if (error.size() > 0) {
+		LockMutex(write_lock.get());
+		write_error = error;
+		UnlockMutex(write_lock.get());
+	}
+}
+
+std::string PGWorkspaceWriter::GetWriteError() {
+	LockMutex(write_lock.get());
+	std::string error = write_error;
+	write_error = "";
+	UnlockMutex(write_lock.get());
+	return error;
+}
+
+std::string PGWorkspace::WriteWorkspace() {
+	if (PGGlobalReplayManager::running_replay) return "";
+	if (!writer) return "File not found.";
+
+	std::unique_ptr<PGWorkspaceState> state(CaptureWorkspace(true));
+	return writer->Write(state.get());
+}
+
+void PGWorkspace::WriteWorkspaceAsync() {
+	if (PGGlobalReplayManager::running_replay) return;
+	if (!writer) return;
+
+	if (writer->SetPendingWrite(CaptureWorkspace(false))) {
+		// the task holds a reference to the writer, so the write can finish after the workspace is closed
+		auto reference = new std::shared_ptr<PGWorkspaceWriter>(writer);
+		Scheduler::RegisterTask(std::make_shared<Task>([](std::shared_ptr<Task> task, void* data) {
+			std::shared_ptr<PGWorkspaceWriter>* writer = (std::shared_ptr<PGWorkspaceWriter>*) data;
+			(*writer)->WritePending();
+			delete writer;
+		}, reference), PGTaskNotUrgent);
+	}
+}
+
+std::string PGWorkspace::GetWriteError() {
+	if (!writer) return "";
+	return writer->GetWriteError();
 }
 
 void PGWorkspace::RemoveWindow(PGWindowHandle window) {
@@ -101,6 +267,7 @@ void PGWorkspace::RemoveWindow(PGWindowHandle window) {
 		WriteWorkspace();
 	}
 	windows.erase(std::find(windows.begin(), windows.end(), window));
+	window_states.erase(window);
 	if (close_workspace) {
 		PGCloseWorkspace(this);
 	} else {
@@ -4,15 +4,68 @@
 #include "utils.h"
 #include "windowfunctions.h"
 
+#include "filemanager.h"
 #include "findtextmanager.h"
 
+#include <map>
 #include <vector>
 
+// the state of the workspace at one point in time, captured on the main thread
+// the states of windows and files that have not changed are shared with the previous capture
+struct PGWorkspaceState {
+	lng sequence;
+	nlohmann::json j;
+	std::vector<std::shared_ptr<const nlohmann::json>> windows;
+	std::vector<std::shared_ptr<const nlohmann::json>> files;
+	std::vector<PGWorkspaceFileText> texts;
+};
+
+// writes captured workspace states to the workspace file
+// background writes hold a reference to the writer, so it can outlive the workspace that created it
+class PGWorkspaceWriter {
+public:
+	PGWorkspaceWriter(std::string filename, std::string legacy_filename);
+
+	// writes the state immediately, returns an error message on failure
+	std::string Write(PGWorkspaceState* state);
+	// replaces the pending write; returns true if there was no pending write, in which case a task should be scheduled
+	bool SetPendingWrite(PGWorkspaceState* state);
+	void WritePending();
+	// returns the error of the last failed background write, if any, and clears it
+	std::string GetWriteError();
+
+	std::string GetFilename() { return filename; }
+private:
+	std::string filename;
+	// a workspace file written by an older version, it is removed after the first successful write
+	std::string legacy_filename;
+
+	// protects the pending write and the write error
+	std::unique_ptr<PGMutex> write_lock;
+	std::unique_ptr<PGWorkspaceState> pending_write;
+	std::string write_error;
+
+	// held while the workspace file is written
+	std::unique_ptr<PGMutex> file_lock;
+	lng written_sequence = 0;
+	// hash of the previously written workspace, including the versions of the unsaved texts
+	// if nothing has changed the workspace is not written again
+	uint64_t written_hash = 0;
+};
+
 class PGWorkspace {
 public:
 	PGWorkspace();
 	void LoadWorkspace(std::string filename);
+	// captures the workspace and writes it immediately, returns an error message on failure
 	std::string WriteWorkspace();
+	// captures the workspace and writes it on a background thread
+	// if multiple writes are requested before the background thread gets to them, only the latest one is written
+	void WriteWorkspaceAsync();
+	// returns the error of the last failed background write, if any, and clears it
+	std::string GetWriteError();
+	// marks the state of the window as changed, so it is captured again by the next write
+	void InvalidateWindow(PGWindowHandle window);
 
 	std::vector<PGWindowHandle>& GetWindows() { return windows; }
 	std::string GetName() { return workspace_name; }
@@ -25,9 +78,17 @@ public:
 	nlohmann::json settings;
 private:
 	std::string workspace_name;
-	std::string filename;
 	std::vector<PGWindowHandle> windows;
 
 	FindTextManager findtext;
-};
 
+	// captures the workspace; if full is false only the windows that have changed since the previous capture are captured
+	PGWorkspaceState* CaptureWorkspace(bool full);
+
+	std::shared_ptr<PGWorkspaceWriter> writer;
+	lng capture_sequence = 0;
+	// the state of every window at the previous capture, invalidated windows are removed
+	std::map<PGWindowHandle, std::shared_ptr<const nlohmann::json>> window_states;
+	// the window states refer to files by index, so they are all captured again when files are opened or closed
+	lng captured_files_version = -1;
+};
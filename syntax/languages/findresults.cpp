@@ -16,7 +16,7 @@ PGParserState FindResultsHighlighter::IncrementalParseLine(TextLine& line, lng l
 	// free the current syntax of this line
 	current.syntax.clear();
 	if (size > 5) {
-		if (std::string(text, 5) == "File:") {
+		if (memcmp(text, "File:", 5) == 0) {
 			current.syntax.push_back(PGSyntaxNode(PGSyntaxString, size));
 			PGFile file = PGFile(std::string(text, size));
 			if (state->highlighter) {
@@ -4,127 +4,132 @@
 
 struct KWParserState {
 	PGParserKWState state;
-	std::string end;
-	char escape;
+	// the special token that started the current string or comment, or -1
+	lng token;
+};
+
+enum PGKWCharacterClass {
+	PGKWCharacterKeyword = 1,
+	PGKWCharacterToken = 2,
+	PGKWCharacterUnicode = 4
 };
 
 static bool KeywordCharacter(char c) {
 	return c == '#' || c == '_' || (c >= 65 && c <= 90) || (c >= 97 && c <= 122) || (c >= 48 && c <= 57);
-} 
+}
+
+// FNV-1a, the seed is chosen in GenerateIndex so that no two keywords collide
+static inline unsigned int KeywordHash(unsigned int hash, unsigned char c) {
+	return (hash ^ c) * 16777619u;
+}
 
 PGParserState KeywordHighlighter::IncrementalParseLine(TextLine& line, lng linenr, PGParserState s, PGParseErrors& errors, PGSyntax& current) {
 	assert(is_generated);
 	KWParserState* state = (KWParserState*)s;
-	char* text = line.GetLine();
+	const unsigned char* text = (const unsigned char*) line.GetLine();
 	lng size = line.GetLength();
 	// free the current syntax of this line
 	current.syntax.clear();
 	bool escaped = false;
 	// parse the actual keywords
 	for (lng i = 0; i < size; i++) {
-		int utf8_length = utf8_character_length(text[i]);
-		if (utf8_length > 1) {
-			// special characters are not supported in the keyword highlighter (for now)
-			i += utf8_length - 1;
-			continue;
-		}
 		if (state->state == PGParserKWDefault) {
-			if (KeywordCharacter(text[i])) {
+			// skip over whitespace and operators, which cannot start a keyword or a token
+			while (i < size && character_class[text[i]] == 0) {
+				i++;
+			}
+			if (i == size) {
+				break;
+			}
+			unsigned char character_type = character_class[text[i]];
+			if (character_type & PGKWCharacterKeyword) {
 				lng start = i;
-				// consume keyword
-				while (i < size && KeywordCharacter(text[i]))
+				// consume the identifier, hashing it as we go
+				unsigned int hash = keyword_seed;
+				while (i < size && (character_class[text[i]] & PGKWCharacterKeyword)) {
+					hash = KeywordHash(hash, text[i]);
 					i++;
-				std::string kw = std::string(text + start, i - start);
-				if (keyword_index.find(kw) != keyword_index.end()) {
- 					PGSyntaxType type = keyword_index[kw];
-					if (start > 0 && 
+				}
+				PGKWSlot& slot = keyword_table[hash & keyword_mask];
+				if (slot.length == i - start && memcmp(keyword_text.c_str() + slot.offset, text + start, slot.length) == 0) {
+					if (start > 0 &&
 						(current.syntax.size() == 0 || current.syntax.back().end < start)) {
 						current.syntax.push_back(PGSyntaxNode(PGSyntaxNone, start));
 					}
-					current.syntax.push_back(PGSyntaxNode(type, i));
+					current.syntax.push_back(PGSyntaxNode(slot.type, i));
 				}
-			} else {
-				char entry = text[i];
-				if (token_index.find(entry) != token_index.end()) {
-					std::vector<PGSyntaxPair>& tokens = token_index[entry];
-					for(auto it = tokens.begin(); it != tokens.end(); it++) {
-						std::string& start = it->start;
-						if (i + start.size() > size) {
-							continue;
-						}
-						bool found = true;
-						for(lng j = 0; j < start.size(); j++) {
-							if (text[i + j] != start[j]) {
-								found = false;
-								break;
-							}
-						}
-						if (found) {
-							if (i > 0 && 
-								(current.syntax.size() == 0 || current.syntax.back().end < i)) {
-								current.syntax.push_back(PGSyntaxNode(PGSyntaxNone, i));
-							}
-							state->end = it->end;
-							state->state = it->state;
-							state->escape = it->escape;
-							i = i + start.size() - 1;
-							if (state->end.size() == 0) {
-								i = size - 1;
-								break;
-							}
-						}
+				// the character following the identifier has not been looked at yet
+				i--;
+			} else if (character_type & PGKWCharacterToken) {
+				for (lng t = token_start[text[i]]; t < token_start[text[i] + 1]; t++) {
+					PGSyntaxPair& token = tokens[t];
+					lng length = token.start.size();
+					if (i + length > size || memcmp(token.start.c_str(), text + i, length) != 0) {
+						continue;
+					}
+					if (i > 0 &&
+						(current.syntax.size() == 0 || current.syntax.back().end < i)) {
+						current.syntax.push_back(PGSyntaxNode(PGSyntaxNone, i));
 					}
+					state->state = token.state;
+					state->token = t;
+					i = token.end.size() == 0 ? size - 1 : i + length - 1;
+					break;
 				}
+			} else if (character_type & PGKWCharacterUnicode) {
+				// special characters are not supported in the keyword highlighter (for now)
+				i += utf8_character_length(text[i]) - 1;
 			}
 		} else {
-			if (!escaped) {
-				if (text[i] == state->escape) {
-					escaped = true;
-					continue;
-				}
-				if (i + state->end.size() > size) {
-					i = size - 1;
-					break;
-				}
-				bool found = true;
-				for(lng j = 0; j < state->end.size(); j++) {
-					if (text[i + j] != state->end[j]) {
-						found = false;
-						break;
-					}
-				}
-				if (found) {
-					i = i + state->end.size() - 1;
-					PGSyntaxType type = (state->state == PGParserKWSLComment || state->state == PGParserKWMLComment) ? PGSyntaxComment : PGSyntaxString;
-					current.syntax.push_back(PGSyntaxNode(type, i + 1));
-					state->state = PGParserKWDefault;
-					state->end = "";
-					state->escape = '\0';
-				}
-			} else {
+			if (escaped) {
 				escaped = false;
+				continue;
+			}
+			PGSyntaxPair& token = tokens[state->token];
+			lng length = token.end.size();
+			// skip ahead to the first character that could end the token or is an escape character
+			unsigned char escape = (unsigned char) token.escape;
+			unsigned char end = length > 0 ? (unsigned char) token.end[0] : text[i];
+			while (i < size && text[i] != end && text[i] != escape) {
+				i++;
+			}
+			if (i == size) {
+				break;
+			}
+			if (text[i] == escape) {
+				escaped = true;
+				continue;
+			}
+			if (i + length > size) {
+				i = size - 1;
+				break;
+			}
+			if (memcmp(token.end.c_str(), text + i, length) == 0) {
+				i = i + length - 1;
+				PGSyntaxType type = (state->state == PGParserKWSLComment || state->state == PGParserKWMLComment) ? PGSyntaxComment : PGSyntaxString;
+				current.syntax.push_back(PGSyntaxNode(type, i + 1));
+				state->state = PGParserKWDefault;
+				state->token = -1;
 			}
 		}
 	}
 	if (state->state == PGParserKWSLComment || state->state == PGParserKWMLComment) {
 		current.syntax.push_back(PGSyntaxNode(PGSyntaxComment, size));
 		if (state->state == PGParserKWSLComment) {
-			if (state->end.size() != 0) {
-				errors.errors.push_back(PGParseError(size - 1, size - 1, linenr, "Expected " + state->end));
+			if (tokens[state->token].end.size() != 0) {
+				errors.errors.push_back(PGParseError(size - 1, size - 1, linenr, "Expected " + tokens[state->token].end));
 			}
 			state->state = PGParserKWDefault;
-			state->end = "";
-			state->escape = '\0';
+			state->token = -1;
 		}
 	} else if (state->state == PGParserKWSLString || state->state == PGParserKWMLString) {
 		current.syntax.push_back(PGSyntaxNode(PGSyntaxString, size));
 		if (state->state == PGParserKWSLString) {
-			if (state->end.size() != 0) {
-				errors.errors.push_back(PGParseError(size - 1, size - 1, linenr, "Expected " + state->end));
+			if (tokens[state->token].end.size() != 0) {
+				errors.errors.push_back(PGParseError(size - 1, size - 1, linenr, "Expected " + tokens[state->token].end));
 			}
 			state->state = PGParserKWDefault;
-			state->end = "";
-			state->escape = '\0';
+			state->token = -1;
 		}
 	}
 	return state;
@@ -133,8 +138,7 @@ PGParserState KeywordHighlighter::IncrementalParseLine(TextLine& line, lng linen
 PGParserState KeywordHighlighter::GetDefaultState() {
 	KWParserState* state = new KWParserState();
 	state->state = PGParserKWDefault;
-	state->end = "";
-	state->escape = '\0';
+	state->token = -1;
 	return state;
 }
 
@@ -142,35 +146,99 @@ PGParserState KeywordHighlighter::CopyParserState(const PGParserState inp) {
 	KWParserState* original = (KWParserState*)inp;
 	KWParserState* state = new KWParserState();
 	state->state = original->state;
-	state->end = original->end;
-	state->escape = original->escape;
+	state->token = original->token;
 	return state;
 }
 
 bool KeywordHighlighter::StateEquivalent(const PGParserState aa, const PGParserState bb) {
 	KWParserState* a = (KWParserState*)aa;
 	KWParserState* b = (KWParserState*)bb;
-	return (a->state == PGParserKWDefault && b->state == PGParserKWDefault) ? true : 
-		(a->state == b->state && a->escape == b->escape && a->end == b->end);
+	return (a->state == PGParserKWDefault && b->state == PGParserKWDefault) ? true :
+		(a->state == b->state && a->token == b->token);
 }
 
 void KeywordHighlighter::DeleteParserState(PGParserState state) {
 	delete (KWParserState*) state;
 }
 
+bool KeywordHighlighter::BuildKeywordTable(std::vector<PGKWEntry>& keywords, unsigned int seed, unsigned int size) {
+	keyword_table.assign(size, PGKWSlot());
+	keyword_text.clear();
+	for (auto it = keywords.begin(); it != keywords.end(); it++) {
+		if (it->entry.size() == 0) continue;
+		unsigned int hash = seed;
+		for (size_t i = 0; i < it->entry.size(); i++) {
+			hash = KeywordHash(hash, (unsigned char) it->entry[i]);
+		}
+		PGKWSlot& slot = keyword_table[hash & (size - 1)];
+		if (slot.length > 0) {
+			if (keyword_text.compare(slot.offset, slot.length, it->entry) == 0) {
+				// duplicate keyword: the last entry wins
+				slot.type = it->result_state;
+				continue;
+			}
+			return false;
+		}
+		slot.offset = keyword_text.size();
+		slot.length = it->entry.size();
+		slot.type = it->result_state;
+		keyword_text += it->entry;
+	}
+	return true;
+}
+
 void KeywordHighlighter::GenerateIndex(
 	std::vector<PGKWEntry>& keywords,
 	std::vector<PGSyntaxPair>& specials) {
-	for(auto it = keywords.begin(); it != keywords.end(); it++) {
-		keyword_index[it->entry] = it->result_state;
+	// search for a seed that maps every keyword to its own slot
+	// if no seed works for the current table size we double the table size
+	unsigned int size = 16;
+	while (size < keywords.size() * 2) {
+		size *= 2;
 	}
-	for(auto it = specials.begin(); it != specials.end(); it++) {
+	bool found = false;
+	while (!found) {
+		for (unsigned int seed = 2166136261u; seed < 2166136261u + 1000; seed++) {
+			if (BuildKeywordTable(keywords, seed, size)) {
+				keyword_seed = seed;
+				keyword_mask = size - 1;
+				found = true;
+				break;
+			}
+		}
+		size *= 2;
+	}
+
+	tokens.clear();
+	for (auto it = specials.begin(); it != specials.end(); it++) {
 		if (it->start.size() == 0) continue;
-		char c = it->start[0];
-		if (token_index.find(c) == token_index.end()) {
-			token_index[c] = std::vector<PGSyntaxPair>();
+		tokens.push_back(*it);
+	}
+	// tokens that start with the same character keep their relative order
+	std::stable_sort(tokens.begin(), tokens.end(), [](const PGSyntaxPair& a, const PGSyntaxPair& b) {
+		return (unsigned char) a.start[0] < (unsigned char) b.start[0];
+	});
+	lng token = 0;
+	for (int c = 0; c < 256; c++) {
+		token_start[c] = token;
+		while (token < (lng) tokens.size() && (unsigned char) tokens[token].start[0] == c) {
+			token++;
+		}
+	}
+	token_start[256] = token;
+
+	for (int c = 0; c < 256; c++) {
+		unsigned char character_type = 0;
+		if (KeywordCharacter((char) c)) {
+			character_type |= PGKWCharacterKeyword;
+		}
+		if (token_start[c + 1] > token_start[c]) {
+			character_type |= PGKWCharacterToken;
+		}
+		if (utf8_character_length((unsigned char) c) > 1) {
+			character_type |= PGKWCharacterUnicode;
 		}
-		token_index[c].push_back(*it);
+		character_class[c] = character_type;
 	}
 	this->is_generated = true;
 }
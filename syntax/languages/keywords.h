@@ -2,7 +2,7 @@
 
 #include "syntaxhighlighter.h"
 #include "utils.h"
-#include <map>
+#include <vector>
 
 enum PGParserKWState {
 	PGParserKWDefault,
@@ -28,6 +28,13 @@ struct PGKWEntry {
 	PGKWEntry(std::string entry, PGSyntaxType result_state) : entry(entry), result_state(result_state) { }
 };
 
+// a keyword in the perfect hash table of a KeywordHighlighter; slots with length 0 are empty
+struct PGKWSlot {
+	lng offset = 0;
+	lng length = 0;
+	PGSyntaxType type = PGSyntaxNone;
+};
+
 class KeywordHighlighter : public SyntaxHighlighter {
 public:
 	virtual PGParserState IncrementalParseLine(TextLine& line, lng linenr, PGParserState state, PGParseErrors& errors, PGSyntax& syntax);
@@ -35,10 +42,23 @@ public:
 	virtual PGParserState CopyParserState(const PGParserState state);
 	virtual bool StateEquivalent(const PGParserState a, const PGParserState b);
 	virtual void DeleteParserState(PGParserState state);
+	virtual bool SupportsParallelParsing() { return true; }
 protected:
 	void GenerateIndex(std::vector<PGKWEntry>& keywords, std::vector<PGSyntaxPair>& specials);
 private:
-	bool is_generated;
-	std::map<std::string, PGSyntaxType> keyword_index;
-	std::map<char, std::vector<PGSyntaxPair>> token_index;
+	bool is_generated = false;
+	// the class of every byte (see PGKWCharacterClass in keywords.cpp)
+	unsigned char character_class[256];
+	// the keywords are stored in a perfect hash table: every keyword has its own slot,
+	// so a lookup is a single hash of the identifier and at most one comparison
+	std::vector<PGKWSlot> keyword_table;
+	std::string keyword_text;
+	unsigned int keyword_seed = 0;
+	unsigned int keyword_mask = 0;
+	// special tokens sorted by their first character;
+	// the tokens starting with character c are tokens[token_start[c]] up to tokens[token_start[c + 1]]
+	std::vector<PGSyntaxPair> tokens;
+	lng token_start[257];
+
+	bool BuildKeywordTable(std::vector<PGKWEntry>& keywords, unsigned int seed, unsigned int size);
 };
@@ -6,17 +6,57 @@ struct SyntectParserState {
 	PGSyntaxState state;
 };
 
-SyntectHighlighter::SyntectHighlighter() {
-	this->parser = PGCreateParser();
+SyntectHighlighter::SyntectHighlighter(PGSyntaxSet set, std::string name) {
+	this->parser = PGCreateParser(set, name.c_str());
 }
 
 SyntectHighlighter::~SyntectHighlighter() {
-	PGDestroyParser(this->parser);
+	if (this->parser) {
+		PGDestroyParser(this->parser);
+	}
+}
+
+void SyntectHighlighter::ReadRuns(PGSyntaxParseResult result, size_t line, PGSyntax& syntax) {
+	size_t count = 0;
+	const PGSyntaxRun* runs = PGParseResultRuns(result, line, &count);
+	syntax.syntax.clear();
+	syntax.syntax.reserve(count);
+	for (size_t i = 0; i < count; i++) {
+		syntax.syntax.push_back(PGSyntaxNode(runs[i].type, runs[i].end));
+	}
 }
 
 PGParserState SyntectHighlighter::IncrementalParseLine(TextLine& line, lng linenr, PGParserState state, PGParseErrors& errors, PGSyntax& syntax) {
 	SyntectParserState* s = static_cast<SyntectParserState*>(state);
-	PGParserState _new = PGParseLine(this->parser, s->state, line.GetLine());
+	PGSyntaxParseResult result = PGParseLines(this->parser, s->state, line.GetLine(), line.GetLength(), nullptr, 1);
+	if (!result) return state;
+	ReadRuns(result, 0, syntax);
+	// states are immutable on the rust side, so we replace the state in place
+	PGDestroyParserState(s->state);
+	s->state = PGParseResultState(result);
+	PGDestroyParseResult(result);
+	return state;
+}
+
+PGParserState SyntectHighlighter::ParseBuffer(PGTextBuffer* buffer, const PGParserState state, PGParseErrors& errors) {
+	SyntectParserState* s = static_cast<SyntectParserState*>(state);
+	lng linecount = buffer->GetLineCount();
+	assert(linecount > 0);
+
+	// the entire buffer is parsed in a single call; the final character of the buffer is not part of the text
+	PGSyntaxParseResult result = PGParseLines(this->parser, s ? s->state : nullptr, buffer->buffer, buffer->current_size - 1, buffer->line_start.data(), linecount);
+	buffer->syntax.clear();
+	buffer->syntax.resize(linecount);
+	buffer->parsed = true;
+	if (!result) {
+		return s ? CopyParserState(state) : GetDefaultState();
+	}
+	for (lng i = 0; i < linecount; i++) {
+		ReadRuns(result, i, buffer->syntax[i]);
+	}
+	SyntectParserState* _new = new SyntectParserState();
+	_new->state = PGParseResultState(result);
+	PGDestroyParseResult(result);
 	return _new;
 }
 
@@ -36,6 +76,7 @@ PGParserState SyntectHighlighter::CopyParserState(const PGParserState state) {
 bool SyntectHighlighter::StateEquivalent(const PGParserState a, const PGParserState b) {
 	SyntectParserState* _a = static_cast<SyntectParserState*>(a);
 	SyntectParserState* _b = static_cast<SyntectParserState*>(b);
+	// parser states are interned, so this is a pointer comparison
 	return PGStateEquivalent(_a->state, _b->state);
 }
 
@@ -46,3 +87,51 @@ void SyntectHighlighter::DeleteParserState(PGParserState state) {
 	PGDestroyParserState(s->state);
 	delete s;
 }
+
+bool SyntectLanguage::MatchesFileExtension(std::string extension) {
+	for (auto it = extensions.begin(); it != extensions.end(); it++) {
+		if (*it == extension) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static std::string ReadSyntaxString(size_t(*function)(PGSyntaxSet, size_t, char*, size_t), PGSyntaxSet set, size_t index) {
+	char buffer[256];
+	size_t length = function(set, index, buffer, sizeof(buffer));
+	if (length < sizeof(buffer)) {
+		return std::string(buffer, length);
+	}
+	std::string result(length + 1, '\0');
+	function(set, index, &result[0], result.size());
+	result.resize(length);
+	return result;
+}
+
+void SyntectLanguage::LoadLanguages(std::string directory) {
+	PGSyntaxSet set = PGLoadSyntaxSet(directory.c_str());
+	if (!set) return;
+	size_t count = PGSyntaxCount(set);
+	if (count == 0) {
+		PGDestroySyntaxSet(set);
+		return;
+	}
+	// the set is shared by all the languages and lives as long as the language manager
+	for (size_t i = 0; i < count; i++) {
+		std::string name = ReadSyntaxString(PGSyntaxName, set, i);
+		std::string list = ReadSyntaxString(PGSyntaxExtensions, set, i);
+		std::vector<std::string> extensions;
+		size_t start = 0;
+		while (start < list.size()) {
+			size_t end = list.find(',', start);
+			if (end == std::string::npos) end = list.size();
+			if (end > start) {
+				extensions.push_back(list.substr(start, end - start));
+			}
+			start = end + 1;
+		}
+		if (extensions.size() == 0) continue;
+		PGLanguageManager::AddLanguage(new SyntectLanguage(set, name, extensions));
+	}
+}
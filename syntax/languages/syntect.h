@@ -6,15 +6,38 @@
 
 class SyntectHighlighter : public SyntaxHighlighter {
 public:
-	SyntectHighlighter();
+	SyntectHighlighter(PGSyntaxSet set, std::string name);
 	~SyntectHighlighter();
 
 	SyntaxHighlighterType GetType() { return PGSyntaxHighlighterIncremental; }
 	PGParserState IncrementalParseLine(TextLine& line, lng linenr, PGParserState state, PGParseErrors& errors, PGSyntax& syntax);
+	PGParserState ParseBuffer(PGTextBuffer* buffer, const PGParserState state, PGParseErrors& errors);
 	PGParserState GetDefaultState();
 	PGParserState CopyParserState(const PGParserState state);
 	bool StateEquivalent(const PGParserState a, const PGParserState b);
 	void DeleteParserState(PGParserState state);
 private:
 	PGSyntaxParser parser;
+
+	void ReadRuns(PGSyntaxParseResult result, size_t line, PGSyntax& syntax);
+};
+
+class SyntectLanguage : public PGLanguage {
+public:
+	SyntectLanguage(PGSyntaxSet set, std::string name, std::vector<std::string> extensions) :
+		set(set), name(name), extensions(extensions) { }
+
+	std::string GetName() { return name; }
+	SyntaxHighlighter* CreateHighlighter() { return new SyntectHighlighter(set, name); }
+	bool MatchesFileExtension(std::string extension);
+	std::string GetExtension() { return name; }
+	PGColor GetColor() { return PGColor(255, 255, 255); }
+
+	// loads the syntax definitions in the directory and registers a language for each of them
+	// languages that were registered before take precedence for the extensions they match
+	static void LoadLanguages(std::string directory);
+private:
+	PGSyntaxSet set;
+	std::string name;
+	std::vector<std::string> extensions;
 };
@@ -11,6 +11,7 @@ public:
 	PGParserState CopyParserState(const PGParserState state);
 	bool StateEquivalent(const PGParserState a, const PGParserState b);
 	void DeleteParserState(PGParserState state);
+	bool SupportsParallelParsing() { return true; }
 };
 
 class XMLLanguage : public PGLanguage {
@@ -1,5 +1,6 @@
 
 #include "syntaxhighlighter.h"
+#include "textiterator.h"
 
 const PGParserState PGParserErrorState = nullptr;
 
@@ -26,6 +27,26 @@ PGParserState SyntaxHighlighter::IncrementalParseLine(TextLine& line, lng linenr
 	return PGParserErrorState;
 }
 
+PGParserState SyntaxHighlighter::ParseBuffer(PGTextBuffer* buffer, const PGParserState state, PGParseErrors& errors) {
+	// IncrementalParseLine may modify the state it is given, so we never pass in the state of the caller
+	PGParserState current = state ? CopyParserState(state) : GetDefaultState();
+	lng linecount = buffer->GetLineCount();
+	assert(linecount > 0);
+
+	// the syntax of every line is parsed in place
+	buffer->syntax.clear();
+	buffer->syntax.resize(linecount);
+	lng index = 0;
+	for (auto it = TextLineIterator(buffer); ; it++) {
+		TextLine line = it.GetLine();
+		current = IncrementalParseLine(line, buffer->start_line + index, current, errors, buffer->syntax[index]);
+		index++;
+		// we stop before advancing the iterator, so the next buffer is not touched
+		if (index == linecount) break;
+	}
+	buffer->parsed = true;
+	return current;
+}
 
 PGParserState SyntaxHighlighter::GetDefaultState() {
 	return PGParserErrorState;
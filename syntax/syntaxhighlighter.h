@@ -35,6 +35,10 @@ public:
 	// This is the basic function that every syntax highlighter should provide
 	// Parsers that only provide this function require the entire file to be parsed
 	virtual PGParserState IncrementalParseLine(TextLine& line, lng linenr, PGParserState state, PGParseErrors& errors, PGSyntax& syntax);
+	// Parses every line of a buffer starting from the given state (or the default state if state is nullptr)
+	// The syntax of the buffer is replaced, and the state after the final line is returned; the caller owns the returned state
+	// The default implementation calls IncrementalParseLine for each line, highlighters that can parse many lines at once should override this
+	virtual PGParserState ParseBuffer(PGTextBuffer* buffer, const PGParserState state, PGParseErrors& errors);
 	// Returns the initial parser state
 	virtual PGParserState GetDefaultState();
 	// Returns a copy of the specified parser state
@@ -43,4 +47,6 @@ public:
 	virtual void DeleteParserState(PGParserState state);
 	// Returns true if two states are equivalent, and false otherwise
 	virtual bool StateEquivalent(const PGParserState a, const PGParserState b);
+	// Returns true if ParseBuffer can be called on different buffers from multiple threads at the same time
+	virtual bool SupportsParallelParsing() { return false; }
 };
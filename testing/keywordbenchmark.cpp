@@ -0,0 +1,84 @@
+// measures the throughput of the keyword highlighter (used by the C language) on a set of files
+// usage: benchmark.out [-r repetitions] file...
+// every line of the files is highlighted with IncrementalParseLine, the best time of all repetitions is reported
+
+#include "c.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct BenchmarkLine {
+	lng start;
+	lng length;
+};
+
+static bool ReadBenchmarkFile(const char* path, std::string& text) {
+	FILE* f = fopen(path, "rb");
+	if (!f) return false;
+	char buffer[65536];
+	size_t read;
+	while ((read = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+		text.append(buffer, read);
+	}
+	fclose(f);
+	if (text.size() > 0 && text.back() != '\n') {
+		text += '\n';
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	int repetitions = 5;
+	std::string text;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			repetitions = std::max(1, atoi(argv[++i]));
+			continue;
+		}
+		if (!ReadBenchmarkFile(argv[i], text)) {
+			fprintf(stderr, "could not read file %s\n", argv[i]);
+			return 1;
+		}
+	}
+	if (text.size() == 0) {
+		fprintf(stderr, "usage: %s [-r repetitions] file...\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<BenchmarkLine> lines;
+	lng start = 0;
+	for (lng i = 0; i < (lng)text.size(); i++) {
+		if (text[i] == '\n') {
+			lines.push_back({ start, i - start });
+			start = i + 1;
+		}
+	}
+
+	CHighlighter highlighter;
+	PGSyntax syntax;
+	PGParseErrors errors;
+	double best = -1;
+	lng nodes = 0;
+	for (int repetition = 0; repetition < repetitions; repetition++) {
+		PGParserState state = highlighter.GetDefaultState();
+		nodes = 0;
+		auto begin = std::chrono::high_resolution_clock::now();
+		for (size_t i = 0; i < lines.size(); i++) {
+			TextLine line(&text[lines[i].start], lines[i].length);
+			state = highlighter.IncrementalParseLine(line, i, state, errors, syntax);
+			nodes += syntax.syntax.size();
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		highlighter.DeleteParserState(state);
+		double ms = std::chrono::duration<double, std::milli>(end - begin).count();
+		if (best < 0 || ms < best) best = ms;
+	}
+	double megabytes = text.size() / 1e6;
+	printf("%zu lines, %.1f MB, %lld syntax nodes\n", lines.size(), megabytes, (long long)nodes);
+	printf("best of %d: %.1f ms, %.1f MB/s\n", repetitions, best, megabytes / (best / 1000));
+	return 0;
+}
@@ -3,6 +3,7 @@
 #define MAXIMUM_FIND_HISTORY 5
 
 #include "json.h"
+#include "scheduler.h"
 #include "utils.h"
 
 class FindTextManager {
@@ -23,4 +24,7 @@ public:
 	std::vector<std::string> find_history;
 	std::vector<std::string> filter_history;
 	std::vector<std::string> replace_history;
+
+	// the find in files search that is running, it is cancelled when a new search is started
+	std::shared_ptr<Task> find_in_files_task;
 };
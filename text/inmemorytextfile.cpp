@@ -9,6 +9,17 @@
 #include "statusbar.h"
 #include "statusnotification.h"
 
+// the number of result lines of find in files that are added to the text while searching
+// results past this are stored as compact records and added a page at a time, see ShowMoreFindResults
+#define FIND_RESULTS_MAXIMUM_LINES 100000
+// the number of result lines that ShowMoreFindResults adds at once
+#define FIND_RESULTS_PAGE_LINES 10000
+// the minimum time in milliseconds between updates of the results, about one frame
+#define FIND_RESULTS_UPDATE_INTERVAL 16
+// the minimum time in milliseconds between progress updates of the search, about one frame
+#define FIND_PROGRESS_UPDATE_INTERVAL 16
+// the number of buffers that is searched in between checking whether the search was cancelled
+#define FIND_IN_FILES_CHUNK_BUFFERS 256
 
 struct FindAllInformation {
 	ProjectExplorer* explorer;
@@ -19,7 +30,44 @@ struct FindAllInformation {
 	std::vector<PGFile> files;
 	bool ignore_binary;
 	int context_lines;
-	std::shared_ptr<Task> task;
+	// the task owns the information, see FinishFindAll
+	Task* task;
+	// used to skip the files that cannot contain a match without reading them
+	std::vector<std::shared_ptr<PGTrigramIndex>> trigram_indices;
+	PGTrigramQuery trigram_query;
+	// results that have not been added to the text yet, they are added at most once every FIND_RESULTS_UPDATE_INTERVAL
+	std::string pending_results;
+	PGTime last_update = 0;
+	lng result_lines = 0;
+	// once the results have FIND_RESULTS_MAXIMUM_LINES lines, the remaining results are stored here
+	std::shared_ptr<PGFindResultsStore> results;
+	// the last time the progress of the search was posted to the notification, at most once every FIND_PROGRESS_UPDATE_INTERVAL
+	PGTime last_progress = 0;
+};
+
+// a block of context lines found by find in files that has not been added to the results yet
+// only its location is stored, the text is read from the file again when the block is added
+struct PGFindResultsRecord {
+	// index into the filenames of the store
+	size_t file;
+	lng start_line;
+	lng end_line;
+	// the lines of the block that contain a match are match_lines[first_match, first_match + matches)
+	size_t first_match;
+	size_t matches;
+};
+
+// the results of find in files that are not shown yet
+// the search appends records to it and ShowMoreFindResults takes them out a page at a time
+struct PGFindResultsStore {
+	std::unique_ptr<PGMutex> lock;
+	std::vector<std::string> filenames;
+	std::vector<PGFindResultsRecord> records;
+	std::vector<lng> match_lines;
+	// the first record that has not been added to the results
+	size_t next_record = 0;
+
+	PGFindResultsStore() : lock(CreateMutex()) { }
 };
 
 struct OpenFileInformation {
@@ -92,6 +140,8 @@ void InMemoryTextFile::ActuallyReadFile(std::shared_ptr<TextFile> file, bool ign
 	this->lineending = PGLineEndingUnknown;
 	this->indentation = PGIndentionTabs; // FIXME: default from settings
 	this->tabwidth = 4; // FIXME: default tabwidth
+	// remember which version of the file we read, so we know whether the file can be unloaded and read again later
+	UpdateModificationTime();
 
 	LockMutex(text_lock.get());
 	lng linenr = 0;
@@ -427,6 +477,9 @@ void InMemoryTextFile::InvalidateBuffers(TextView* responsible_view) {
 		assert(buffer->index == buffer_index);
 		buffer_index++;
 		if (buffer->cumulative_width < 0) {
+			// the buffer has been modified, snapshots taken from now on need a new copy of it
+			buffer->snapshot_content.reset();
+			buffer->UpdateVersion();
 			// we don't know the length of this buffer
 			// get the current length
 			double new_width = 0;
@@ -471,6 +524,7 @@ void InMemoryTextFile::InvalidateBuffers(TextView* responsible_view) {
 	}
 	total_width = current_width;
 	linecount = current_lines;
+	version++;
 
 	// invalidate all the views of this textfield
 	for (lng i = 0; i < views.size(); i++) {
@@ -835,13 +889,13 @@ void InMemoryTextFile::ReplaceText(std::vector<Cursor>& cursors, std::string rep
 			}
 			lng start_line = curpos.buffer->GetStartLine(curpos.position);
 			assert(curpos.buffer->line_start[start_line] == curpos.position + 1);
-			curpos.buffer->line_start.erase(curpos.buffer->line_start.begin() + start_line);
+			curpos.buffer->line_start.erase(start_line, start_line + 1);
 			curpos.buffer->line_count--;
 			inserted_lines--;
 		} else if (place_newline && !replace_newline) {
 			lng start_line = curpos.buffer->GetStartLine(curpos.position);
 			curpos.buffer->line_count++;
-			curpos.buffer->line_start.insert(curpos.buffer->line_start.begin() + start_line, curpos.position + 1);
+			curpos.buffer->line_start.insert(start_line, curpos.position + 1);
 			inserted_lines++;
 		}
 		curpos.buffer->buffer[curpos.position] = replacement_text[current_position];
@@ -956,7 +1010,7 @@ void InMemoryTextFile::InsertLines(std::vector<Cursor>& cursors, std::string tex
 			extra_buffer->cumulative_width = -1;
 			extra_buffer->VerifyBuffer();
 			buffer->line_count -= extra_buffer->line_count;
-			buffer->line_start.erase(buffer->line_start.begin() + buffer->line_count - 1, buffer->line_start.end());
+			buffer->line_start.erase(buffer->line_count - 1, buffer->line_start.size());
 		}
 		buffer->buffer[position] = '\n';
 		buffer->current_size = position + 1;
@@ -1379,6 +1433,178 @@ void InMemoryTextFile::DeleteText(std::vector<Cursor>& cursors, PGTextRange rang
 	// FIXME
 }
 
+// the buffers [first_buffer, last_buffer] that are rebuilt by a bulk replace, and the buffers they are replaced by
+struct PGReplaceRun {
+	lng first_buffer;
+	lng last_buffer;
+	// the replacements [first_replacement, last_replacement) lie within the run
+	size_t first_replacement;
+	size_t last_replacement;
+	// the offset of every old and new buffer from the start of the run
+	std::vector<lng> old_offsets;
+	std::vector<lng> new_offsets;
+	std::vector<PGTextBuffer*> new_buffers;
+};
+
+// splits the text into new buffers at line boundaries, the text has to end with a newline
+static void CreateBuffers(const std::string& text, std::vector<PGTextBuffer*>& result, std::vector<lng>& offsets) {
+	const char* data = text.c_str();
+	lng size = text.size();
+	// leave room for edits, like the buffers of a file that is read from disk
+	lng maximum_size = TEXT_BUFFER_SIZE - TEXT_BUFFER_SIZE / 10;
+	lng position = 0;
+	while (position < size) {
+		lng end = position;
+		while (end < size) {
+			lng line_end = (const char*)memchr(data + end, '\n', size - end) - data + 1;
+			if (end > position && line_end - position >= maximum_size) {
+				break;
+			}
+			end = line_end;
+		}
+		PGTextBuffer* buffer = new PGTextBuffer(data + position, end - position, 0);
+		buffer->line_start.Build(data + position, end - position);
+		buffer->line_count = buffer->line_start.size() + 1;
+		// the lines are measured in InvalidateBuffers
+		buffer->cumulative_width = -1;
+		offsets.push_back(position);
+		result.push_back(buffer);
+		position = end;
+	}
+}
+
+void InMemoryTextFile::ReplaceRanges(std::vector<Cursor>& cursors, std::vector<PGCursorPosition>& start, std::vector<std::string>& removed_text, std::vector<std::string>& added_text, std::vector<PGCursorPosition>& replacement_start) {
+	size_t count = start.size();
+	// the start of every replacement relative to the start of its run, in the old and the new text
+	std::vector<lng> old_start(count);
+	std::vector<lng> new_start(count);
+
+	// every buffer that contains (part of) a replaced range is rebuilt
+	// consecutive buffers that are connected by a replaced range are rebuilt together as a run
+	std::vector<PGReplaceRun> runs;
+	for (size_t i = 0; i < count; i++) {
+		PGTextBuffer* buffer = GetBuffer(start[i].line);
+		PGTextPosition begin = PGTextPosition(buffer, buffer->GetBufferLocationFromCursor(start[i].line, start[i].position));
+		PGTextPosition end = begin;
+		end.Offset(removed_text[i].size());
+		if (runs.size() == 0 || begin.buffer->index > runs.back().last_buffer) {
+			PGReplaceRun run;
+			run.first_buffer = begin.buffer->index;
+			run.last_buffer = begin.buffer->index;
+			run.first_replacement = i;
+			run.old_offsets.push_back(0);
+			runs.push_back(run);
+		}
+		PGReplaceRun& run = runs.back();
+		while (run.last_buffer < end.buffer->index) {
+			run.old_offsets.push_back(run.old_offsets.back() + buffers[run.last_buffer]->current_size);
+			run.last_buffer++;
+		}
+		old_start[i] = run.old_offsets[begin.buffer->index - run.first_buffer] + begin.position;
+		run.last_replacement = i + 1;
+	}
+
+	// write the text of every run with the replacements applied into new buffers
+	for (auto run = runs.begin(); run != runs.end(); run++) {
+		std::string old_text;
+		for (lng i = run->first_buffer; i <= run->last_buffer; i++) {
+			old_text.append(buffers[i]->buffer, buffers[i]->current_size);
+		}
+		std::string text;
+		text.reserve(old_text.size());
+		lng position = 0;
+		for (size_t i = run->first_replacement; i < run->last_replacement; i++) {
+			assert(old_text.compare(old_start[i], removed_text[i].size(), removed_text[i]) == 0);
+			text.append(old_text, position, old_start[i] - position);
+			new_start[i] = text.size();
+			text += added_text[i];
+			position = old_start[i] + removed_text[i].size();
+		}
+		text.append(old_text, position, std::string::npos);
+		CreateBuffers(text, run->new_buffers, run->new_offsets);
+	}
+
+	// move the cursors of all views from the old buffers onto the new buffers
+	// positions inside a replaced range are moved to the end of the replacement
+	auto map_position = [&](PGTextBuffer*& buffer, lng& position) {
+		auto run = std::upper_bound(runs.begin(), runs.end(), buffer->index, [](lng index, const PGReplaceRun& run) {
+			return index < run.first_buffer;
+		});
+		if (run == runs.begin()) return;
+		run--;
+		if (buffer->index > run->last_buffer) return;
+		lng offset = run->old_offsets[buffer->index - run->first_buffer] + position;
+		lng new_offset = offset;
+		auto first = old_start.begin() + run->first_replacement;
+		auto replacement = std::upper_bound(first, old_start.begin() + run->last_replacement, offset);
+		if (replacement != first) {
+			size_t i = (replacement - old_start.begin()) - 1;
+			lng old_end = old_start[i] + removed_text[i].size();
+			if (offset == old_start[i]) {
+				new_offset = new_start[i];
+			} else if (offset < old_end) {
+				new_offset = new_start[i] + added_text[i].size();
+			} else {
+				new_offset = new_start[i] + added_text[i].size() + (offset - old_end);
+			}
+		}
+		lng index = std::upper_bound(run->new_offsets.begin(), run->new_offsets.end(), new_offset) - run->new_offsets.begin() - 1;
+		buffer = run->new_buffers[index];
+		position = new_offset - run->new_offsets[index];
+	};
+	auto map_cursors = [&](std::vector<Cursor>& list) {
+		for (auto it = list.begin(); it != list.end(); it++) {
+			map_position(it->start_buffer, it->start_buffer_position);
+			map_position(it->end_buffer, it->end_buffer_position);
+		}
+	};
+	map_cursors(cursors);
+	for (auto it = views.begin(); it != views.end(); it++) {
+		auto view = it->lock();
+		if (!view || &view->cursors == &cursors) continue;
+		LockMutex(view->lock.get());
+		map_cursors(view->cursors);
+		UnlockMutex(view->lock.get());
+	}
+
+	// swap the new buffers in
+	std::vector<PGTextBuffer*> new_buffers;
+	new_buffers.reserve(buffers.size());
+	lng next_buffer = 0;
+	for (auto run = runs.begin(); run != runs.end(); run++) {
+		new_buffers.insert(new_buffers.end(), buffers.begin() + next_buffer, buffers.begin() + run->first_buffer);
+		new_buffers.insert(new_buffers.end(), run->new_buffers.begin(), run->new_buffers.end());
+		for (lng i = run->first_buffer; i <= run->last_buffer; i++) {
+			if (highlighter && buffers[i]->state) {
+				highlighter->DeleteParserState(buffers[i]->state);
+			}
+			delete buffers[i];
+		}
+		next_buffer = run->last_buffer + 1;
+	}
+	new_buffers.insert(new_buffers.end(), buffers.begin() + next_buffer, buffers.end());
+	buffers.swap(new_buffers);
+	lng current_line = 0;
+	for (lng i = 0; i < (lng)buffers.size(); i++) {
+		PGTextBuffer* buffer = buffers[i];
+		buffer->index = i;
+		buffer->start_line = current_line;
+		buffer->_prev = i > 0 ? buffers[i - 1] : nullptr;
+		buffer->_next = i + 1 < (lng)buffers.size() ? buffers[i + 1] : nullptr;
+		current_line += buffer->line_count;
+	}
+	// the longest line might have been in one of the old buffers
+	max_line_length.buffer = nullptr;
+
+	replacement_start.resize(count);
+	for (auto run = runs.begin(); run != runs.end(); run++) {
+		for (size_t i = run->first_replacement; i < run->last_replacement; i++) {
+			lng index = std::upper_bound(run->new_offsets.begin(), run->new_offsets.end(), new_start[i]) - run->new_offsets.begin() - 1;
+			replacement_start[i] = run->new_buffers[index]->GetCursorFromPosition(new_start[i] - run->new_offsets[index]);
+		}
+	}
+}
+
 void InMemoryTextFile::ReplaceText(std::vector<Cursor>& cursors, PGTextRange range, std::string replacement_text) {
 	bool empty_range = range.startpos() == range.endpos();
 	if (replacement_text.size() == 0) {
@@ -1500,9 +1726,45 @@ void InMemoryTextFile::PasteText(std::vector<Cursor>& cursors, std::string& text
 	PerformOperation(cursors, delta);
 }
 
+// creates a bulk replacement of the selections of the cursors, the regex is deleted
+static TextDelta* CreateBulkReplace(std::vector<Cursor>& cursors, PGRegexHandle regex, std::string& replacement) {
+	std::sort(cursors.begin(), cursors.end(), Cursor::CursorOccursFirst);
+	TextDelta* replace = PGRegexReplace::CreateRegexReplace(replacement, regex);
+	PGBulkReplace* bulk = new PGBulkReplace();
+	for (auto it = cursors.begin(); it != cursors.end(); it++) {
+		PGTextRange range = it->GetCursorSelection();
+		bulk->start.push_back(range.start_buffer->GetCursorFromPosition(range.start_position));
+		bulk->removed_text.push_back(it->SelectionIsEmpty() ? std::string("") : it->GetText());
+		std::string text;
+		if (replace->type == PGDeltaRegexReplace) {
+			PGRegexReplace* regex_replace = (PGRegexReplace*)replace;
+			PGRegexMatch match = PGMatchRegex(regex_replace->regex, range, PGDirectionRight);
+			for (size_t k = 0; k < regex_replace->groups.size(); k++) {
+				text += regex_replace->groups[k].first;
+				if (match.matched && regex_replace->groups[k].second >= 0) {
+					text += match.groups[regex_replace->groups[k].second].GetString();
+				}
+			}
+		} else {
+			text = ((PGReplaceText*)replace)->text;
+		}
+		panther::replace(text, "\r\n", "\n");
+		panther::replace(text, "\r", "\n");
+		bulk->added_text.push_back(text);
+	}
+	delete replace;
+	return bulk;
+}
+
 void InMemoryTextFile::RegexReplace(std::vector<Cursor>& cursors, PGRegexHandle regex, std::string& replacement) {
 	if (!is_loaded) return;
 
+	if (cursors.size() > 1) {
+		// replacing the matches one by one moves all the text and cursors after every match for every replacement
+		// instead, the buffers that contain the matches are rebuilt in a single pass
+		PerformOperation(cursors, CreateBulkReplace(cursors, regex, replacement));
+		return;
+	}
 	TextDelta* delta = PGRegexReplace::CreateRegexReplace(replacement, regex);
 	PerformOperation(cursors, delta);
 }
@@ -1830,6 +2092,15 @@ bool InMemoryTextFile::PerformOperation(std::vector<Cursor>& cursors, TextDelta*
 			}
 			return true;
 		}
+		case PGDeltaBulkReplace:
+		{
+			PGBulkReplace* replace = (PGBulkReplace*)delta;
+			if (!redo) {
+				replace->stored_cursors = Cursor::BackupCursors(cursors);
+			}
+			ReplaceRanges(cursors, replace->start, replace->removed_text, replace->added_text, replace->replacement_start);
+			return true;
+		}
 		default:
 			assert(0);
 			return false;
@@ -1979,6 +2250,16 @@ void InMemoryTextFile::Undo(TextView* view, TextDelta* delta) {
 			UnlockMutex(view->lock.get());
 			return;
 		}
+		case PGDeltaBulkReplace:
+		{
+			PGBulkReplace* replace = (PGBulkReplace*)delta;
+			LockMutex(view->lock.get());
+			std::vector<PGCursorPosition> start;
+			ReplaceRanges(view->cursors, replace->replacement_start, replace->added_text, replace->removed_text, start);
+			view->ActuallyRestoreCursors(replace->stored_cursors);
+			UnlockMutex(view->lock.get());
+			return;
+		}
 		default:
 			assert(0);
 			break;
@@ -2009,7 +2290,9 @@ void InMemoryTextFile::SaveChanges() {
 
 	saved_undo_count = deltas.size();
 	SetUnsavedChanges(false);
-	this->Lock(PGReadLock);
+	// we write a snapshot of the text, so the file can be edited while it is being written
+	std::shared_ptr<PGTextSnapshot> saved_text = GetSnapshot();
+	const std::vector<PGTextBuffer*>& snapshot_buffers = saved_text->GetBuffers();
 	PGLineEnding line_ending = lineending;
 	if (line_ending != PGLineEndingWindows && line_ending != PGLineEndingMacOS && line_ending != PGLineEndingUnix) {
 		line_ending = GetSystemLineEnding();
@@ -2018,7 +2301,6 @@ void InMemoryTextFile::SaveChanges() {
 	PGFileError error;
 	PGFileHandle handle = panther::OpenFile(this->path, PGFileReadWrite, error);
 	if (!handle) {
-		this->Unlock(PGReadLock);
 		return;
 	}
 
@@ -2037,11 +2319,11 @@ void InMemoryTextFile::SaveChanges() {
 	lng output_size = 0;
 
 	lng position = 0;
-	for (auto it = buffers.begin(); it != buffers.end(); it++) {
+	for (auto it = snapshot_buffers.begin(); it != snapshot_buffers.end(); it++) {
 		char* line = (*it)->buffer;
 		lng prev_position = 0;
 		lng i = 0;
-		lng end = (*it) == buffers.back() ? (*it)->current_size - 1 : (*it)->current_size;
+		lng end = (*it) == snapshot_buffers.back() ? (*it)->current_size - 1 : (*it)->current_size;
 		for (i = 0; i < end; i++) {
 			if (line[i] == '\n') {
 				// new line
@@ -2064,7 +2346,7 @@ void InMemoryTextFile::SaveChanges() {
 			}
 		}
 		if (prev_position < (*it)->current_size) {
-			assert((*it) == buffers.back());
+			assert((*it) == snapshot_buffers.back());
 			this->WriteToFile(handle, encoder, line + prev_position, i - prev_position, &output_buffer, &output_size, &intermediate_buffer, &intermediate_size);
 		}
 	}
@@ -2079,13 +2361,119 @@ void InMemoryTextFile::SaveChanges() {
 	if (encoder) {
 		PGDestroyEncoder(encoder);
 	}
-	this->Unlock(PGReadLock);
 	panther::CloseFile(handle);
 	UpdateModificationTime();
 	// FIXME:
 	//if (textfield) textfield->SelectionChanged();
 }
 
+std::shared_ptr<PGTextSnapshot> InMemoryTextFile::GetSnapshot() {
+	assert(is_loaded);
+	Lock(PGReadLock);
+	LockMutex(snapshot_lock.get());
+	// if the text has not changed since the previous snapshot, and that snapshot is still in use, we share it
+	std::shared_ptr<PGTextSnapshot> result = snapshot.lock();
+	if (!result || result->GetVersion() != version) {
+		result = std::make_shared<PGTextSnapshot>(buffers, version);
+		snapshot = result;
+	}
+	UnlockMutex(snapshot_lock.get());
+	Unlock(PGReadLock);
+	return result;
+}
+
+lng InMemoryTextFile::GetMemoryUsage() {
+	if (!is_loaded) return 0;
+	Lock(PGReadLock);
+	lng usage = 0;
+	for (auto it = buffers.begin(); it != buffers.end(); it++) {
+		PGTextBuffer* buffer = *it;
+		usage += buffer->buffer_size;
+		usage += buffer->line_start.capacity() * sizeof(lng) + buffer->line_lengths.capacity() * sizeof(PGScalar);
+		for (auto syntax = buffer->syntax.begin(); syntax != buffer->syntax.end(); syntax++) {
+			usage += sizeof(PGSyntax) + syntax->syntax.capacity() * sizeof(PGSyntaxNode);
+		}
+	}
+	Unlock(PGReadLock);
+	return usage;
+}
+
+lng InMemoryTextFile::Unload() {
+	if (!is_loaded || pending_delete || FileInMemory() || HasUnsavedChanges() || find_task) return 0;
+	// the text has to be identical to the file on disk, otherwise we cannot read it back
+	if (last_modified_time < 0 || last_modified_notification != last_modified_time) return 0;
+	auto stats = PGGetFileFlags(path);
+	if (stats.flags != PGFileFlagsEmpty || stats.modification_time != last_modified_time) return 0;
+
+	// this is called from the UI thread, so we do not wait for background readers (e.g. highlighting or searching)
+	// if anyone is reading the file we skip it, it can be unloaded the next time the budget is enforced
+	if (shared_counter > 0) return 0;
+	lng freed = GetMemoryUsage();
+	LockMutex(text_lock.get());
+	if (shared_counter > 0) {
+		UnlockMutex(text_lock.get());
+		return 0;
+	}
+	if (highlighter) {
+		for (auto it = buffers.begin(); it != buffers.end(); it++) {
+			if (!(*it)->parsed) {
+				// the file is still being highlighted
+				UnlockMutex(text_lock.get());
+				return 0;
+			}
+		}
+	}
+	// reading the file again resets the line ending, indentation and tab width, so we restore them once it is loaded
+	PGTextFileSettings file_settings = GetSettings();
+	file_settings.encoding = encoding;
+	file_settings.indentation = indentation;
+	file_settings.tabwidth = tabwidth;
+	// back up the views; the cursors point into the buffers, so they are restored from the backup after loading
+	std::vector<std::pair<std::shared_ptr<TextView>, PGTextViewSettings>> settings;
+	for (auto it = views.begin(); it != views.end(); it++) {
+		auto view = it->lock();
+		if (!view) continue;
+		settings.push_back(std::pair<std::shared_ptr<TextView>, PGTextViewSettings>(view, view->GetSettings()));
+		LockMutex(view->lock.get());
+		view->cursors.clear();
+		view->active_cursor = -1;
+		view->CancelFindMatches();
+		view->find_cache = nullptr;
+		view->matches.clear();
+		view->line_wraps.clear();
+		UnlockMutex(view->lock.get());
+	}
+	for (auto it = buffers.begin(); it != buffers.end(); it++) {
+		if (highlighter && (*it)->state) {
+			highlighter->DeleteParserState((*it)->state);
+		}
+		delete *it;
+	}
+	buffers.clear();
+	max_line_length.buffer = nullptr;
+	max_line_length.position = 0;
+	linecount = 0;
+	total_width = 0;
+	longest_line = 0;
+	bytes = 0;
+	total_bytes = 1;
+	// snapshots that are still in use keep their own copy of the text
+	version++;
+	is_loaded = false;
+	deferred = true;
+	UnlockMutex(text_lock.get());
+
+	SetSettings(file_settings);
+	for (auto it = settings.begin(); it != settings.end(); it++) {
+		it->first->ApplySettings(it->second);
+	}
+	return freed;
+}
+
+void InMemoryTextFile::ReadDeferred() {
+	ActuallyReadFile(shared_from_this(), false);
+}
+
 std::string InMemoryTextFile::GetText() {
 	std::string text = "";
 	for (auto it = buffers.begin(); it != buffers.end(); it++) {
@@ -2123,21 +2511,30 @@ void InMemoryTextFile::FindMatchesWithContext(FindAllInformation* info, PGRegexH
 	lng start_line = -1;
 	lng end_line = -1;
 	while (true) {
-		PGTextRange match = FindMatch(regex_handle, PGDirectionRight, current_buffer, current_position, current_buffer, current_position, false);
+		// the file is searched in chunks, so a cancelled search stops quickly even in very large files
+		// a match has to start in the chunk, but it can extend into the buffer after the chunk
+		PGTextBuffer* chunk_end = buffers[std::min(current_buffer->index + FIND_IN_FILES_CHUNK_BUFFERS, (lng)buffers.size()) - 1];
+		PGTextBuffer* bounds_end = chunk_end == buffers.back() ? chunk_end : chunk_end->next();
+		lng bounds_position = bounds_end == buffers.back() ? bounds_end->current_size - 1 : bounds_end->current_size;
+		PGRegexMatch result = PGMatchRegex(regex_handle, PGTextRange(current_buffer, current_position, bounds_end, bounds_position), PGDirectionRight);
 		if (!info->task->active) {
 			// task is no longer active, cancel the search
 			return;
 		}
+		if (!result.matched || result.groups[0].start_buffer->index > chunk_end->index) {
+			if (chunk_end != buffers.back()) {
+				// no match in this chunk, continue with the next chunk
+				current_buffer = chunk_end->next();
+				current_position = 0;
+				continue;
+			}
+		}
+		PGTextRange match = result.matched ? result.groups[0] : PGTextRange();
 		if (match.start_buffer == nullptr) {
 			// no more matches found
 			// if there are any matches stored, report them now
 			if (matches.size() > 0) {
-				std::vector<std::string> context;
-				for (lng current_line = start_line; current_line < end_line; current_line++) {
-					TextLine line = GetLine(current_line);
-					context.push_back(std::string(line.GetLine(), line.GetLength()));
-				}
-				callback(data, path.size() == 0 ? name : path, context, matches, start_line);
+				callback(data, this, start_line, end_line, matches);
 			}
 			return;
 		}
@@ -2160,17 +2557,12 @@ void InMemoryTextFile::FindMatchesWithContext(FindAllInformation* info, PGRegexH
 			if (line - context_lines <= end_line) {
 				// the line is part of the previous context
 				// we extend the current context and add the current match
-				end_line = cursor_end_line + context_lines;
+				end_line = std::min(linecount, cursor_end_line + context_lines + 1);
 				matches.push_back(range);
 			} else {
 				// the line is not part of the previous context
 				// report on the previously found context first
-				std::vector<std::string> context;
-				for (lng current_line = start_line; current_line < end_line; current_line++) {
-					TextLine line = GetLine(current_line);
-					context.push_back(std::string(line.GetLine(), line.GetLength()));
-				}
-				callback(data, path.size() == 0 ? name : path, context, matches, start_line);
+				callback(data, this, start_line, end_line, matches);
 
 				// now create a new context for the current match
 				matches.clear();
@@ -2186,7 +2578,25 @@ void InMemoryTextFile::FindMatchesWithContext(FindAllInformation* info, PGRegexH
 	//textfield->SearchMatchesChanged();
 }
 
-void InMemoryTextFile::FindAllMatchesAsync(PGGlobSet whitelist, ProjectExplorer* explorer, PGRegexHandle regex_handle, int context_lines, bool ignore_binary) {
+// releases the resources of a find in files search and removes its notification
+// called when the search finishes, and again when its task is released, since a cancelled task might never run
+static void FinishFindAll(FindAllInformation* info) {
+	if (info->regex_handle) {
+		PGDeleteRegex(info->regex_handle);
+		info->regex_handle = nullptr;
+	}
+	if (info->whitelist) {
+		PGDestroyGlobSet(info->whitelist);
+		info->whitelist = nullptr;
+	}
+	if (info->notification) {
+		info->notification->PostRemoval();
+		info->notification = nullptr;
+	}
+	info->trigram_indices.clear();
+}
+
+std::shared_ptr<Task> InMemoryTextFile::FindAllMatchesAsync(PGGlobSet whitelist, ProjectExplorer* explorer, PGRegexHandle regex_handle, int context_lines, bool ignore_binary, PGTaskUrgency urgency) {
 	FindAllInformation* info = new FindAllInformation();
 	info->textfile = this;
 	info->regex_handle = regex_handle;
@@ -2194,6 +2604,10 @@ void InMemoryTextFile::FindAllMatchesAsync(PGGlobSet whitelist, ProjectExplorer*
 	info->context_lines = context_lines;
 	info->whitelist = whitelist;
 	info->explorer = explorer;
+	info->trigram_indices = explorer->GetTrigramIndices();
+	info->trigram_query = PGTrigramIndex::CompileQuery(regex_handle);
+	info->results = std::make_shared<PGFindResultsStore>();
+	this->find_results = info->results;
 	info->notification = GetControlManager(explorer)->statusbar->AddNotification(
 		PGStatusInProgress, 
 		"Finding \"" + PGGetRegexPattern(regex_handle) + "\" In Files", "Finding in file...", true);
@@ -2209,8 +2623,18 @@ void InMemoryTextFile::FindAllMatchesAsync(PGGlobSet whitelist, ProjectExplorer*
 			if (!info->task->active) {
 				return false;
 			}
-			info->notification->SetText("Searching File \"" + f.path + "\"");
-			info->notification->SetProgress((double)filenr / (double) total_files);
+			for (auto it = info->trigram_indices.begin(); it != info->trigram_indices.end(); it++) {
+				if ((*it)->ExcludesFile(f.path, info->trigram_query)) {
+					return true;
+				}
+			}
+			// the status bar is updated on the ui thread, at most about once per frame
+			PGTime time = PGGetTimeOS();
+			if (time - info->last_progress >= FIND_PROGRESS_UPDATE_INTERVAL) {
+				info->notification->PostText("Searching File \"" + f.path + "\"");
+				info->notification->PostProgress((double)filenr / (double)total_files);
+				info->last_progress = time;
+			}
 
 			lng size;
 			PGFileError error = PGFileSuccess;
@@ -2219,52 +2643,101 @@ void InMemoryTextFile::FindAllMatchesAsync(PGGlobSet whitelist, ProjectExplorer*
 			if (!file) {
 				return true;
 			}
-			file->FindMatchesWithContext(info, info->regex_handle, info->context_lines, [](void* data, std::string filename, const std::vector<std::string>& lines, const std::vector<PGCursorRange>& matches, lng start_line) {
+			file->FindMatchesWithContext(info, info->regex_handle, info->context_lines, [](void* data, TextFile* file, lng start_line, lng end_line, const std::vector<PGCursorRange>& matches) {
 				FindAllInformation* info = (FindAllInformation*)data;
 				if (!info->task->active) {
 					return;
 				}
-				dynamic_cast<InMemoryTextFile*>(info->textfile)->AddFindMatches(filename, lines, matches, start_line);
+				dynamic_cast<InMemoryTextFile*>(info->textfile)->AddFindMatches(info, file, start_line, end_line, matches);
 			}, info);
 			if (!info->task->active) {
 				return false;
 			}
 			return true;
 		}, info);
-		if (info->regex_handle) {
-			PGDeleteRegex(info->regex_handle);
-		}
-		if (info->whitelist) {
-			PGDestroyGlobSet(info->whitelist);
-		}
-		if (info->notification) {
-			GetControlManager(info->explorer)->statusbar->RemoveNotification(info->notification);
+		if (info->task->active) {
+			dynamic_cast<InMemoryTextFile*>(info->textfile)->FlushFindMatches(info);
 		}
+		FinishFindAll(info);
+	}, info, [](void* data) {
+		FindAllInformation* info = (FindAllInformation*)data;
+		FinishFindAll(info);
 		delete info;
-	}, info));
-	info->task = find_task;
-	Scheduler::RegisterTask(this->find_task, PGTaskUrgent);
+	}));
+	info->task = find_task.get();
+	Scheduler::RegisterTask(this->find_task, urgency);
+	return find_task;
 }
 
-void InMemoryTextFile::AddFindMatches(std::string filename, const std::vector<std::string>& lines, const std::vector<PGCursorRange>& matches, lng start_line) {
-	std::string text;
+void InMemoryTextFile::FormatFindMatches(std::string& text, const std::string& filename, TextFile* file, lng start_line, lng end_line, const std::vector<bool>& line_is_match) {
 	if (current_find_file != filename) {
-		text = "\nFile: " + filename + "\n";
+		text += "\nFile: " + filename + "\n";
 		current_find_file = filename;
 	} else {
-		text = std::string(std::to_string(start_line).size(), '.') + "\n";
+		text += std::string(std::to_string(start_line).size(), '.') + "\n";
+	}
+	for (lng linenr = start_line; linenr < end_line; linenr++) {
+		TextLine line = file->GetLine(linenr);
+		text += std::to_string(linenr) + (line_is_match[linenr - start_line] ? "> " : ": ");
+		text.append(line.GetLine(), line.GetLength());
+		text += "\n";
 	}
-	std::vector<bool> line_is_match(lines.size(), false);
+}
+
+static void AddFindRecord(PGFindResultsStore* store, const std::string& filename, lng start_line, lng end_line, const std::vector<PGCursorRange>& matches) {
+	LockMutex(store->lock.get());
+	if (store->filenames.size() == 0 || store->filenames.back() != filename) {
+		store->filenames.push_back(filename);
+	}
+	PGFindResultsRecord record;
+	record.file = store->filenames.size() - 1;
+	record.start_line = start_line;
+	record.end_line = end_line;
+	record.first_match = store->match_lines.size();
+	for (auto it = matches.begin(); it != matches.end(); it++) {
+		if (store->match_lines.size() == record.first_match || store->match_lines.back() != it->start_line) {
+			store->match_lines.push_back(it->start_line);
+		}
+	}
+	record.matches = store->match_lines.size() - record.first_match;
+	store->records.push_back(record);
+	UnlockMutex(store->lock.get());
+}
+
+void InMemoryTextFile::AddFindMatches(FindAllInformation* info, TextFile* file, lng start_line, lng end_line, const std::vector<PGCursorRange>& matches) {
+	std::string filename = file->GetFullPath().size() == 0 ? file->GetName() : file->GetFullPath();
+	if (info->result_lines >= FIND_RESULTS_MAXIMUM_LINES) {
+		// the results are already long, only the location of the block is stored
+		AddFindRecord(info->results.get(), filename, start_line, end_line, matches);
+		return;
+	}
+	std::vector<bool> line_is_match(end_line - start_line, false);
 	for (auto it = matches.begin(); it != matches.end(); it++) {
 		assert(it->start_line - start_line >= 0 && it->start_line - start_line < line_is_match.size());
 		line_is_match[it->start_line - start_line] = true;
 	}
-	lng linecount = 0;
-	for (auto it = lines.begin(); it != lines.end(); it++) {
-		bool is_match_line = line_is_match[linecount];
-		text += std::to_string(start_line + linecount) + (is_match_line ? "> " : ": ") + *it + "\n";
-		linecount++;
+	// the context lines are copied straight from the searched file into the pending results
+	FormatFindMatches(info->pending_results, filename, file, start_line, end_line, line_is_match);
+	info->result_lines += end_line - start_line;
+	// the time is not recorded in replays, it only decides how the results are batched
+	PGTime time = PGGetTimeOS();
+	if (info->result_lines >= FIND_RESULTS_MAXIMUM_LINES || time - info->last_update >= FIND_RESULTS_UPDATE_INTERVAL) {
+		// the pending results are added before any stored record, so the records are shown after them
+		FlushFindMatches(info);
+		info->last_update = time;
 	}
+}
+
+void InMemoryTextFile::FlushFindMatches(FindAllInformation* info) {
+	if (info->pending_results.size() == 0) {
+		return;
+	}
+	std::string text;
+	text.swap(info->pending_results);
+	AppendFindResults(text);
+}
+
+void InMemoryTextFile::AppendFindResults(std::string& text) {
 	this->Lock(PGWriteLock);
 	std::vector<Cursor> cursors;
 
@@ -2272,17 +2745,6 @@ void InMemoryTextFile::AddFindMatches(std::string filename, const std::vector<st
 
 	cursors.push_back(Cursor(nullptr, PGTextRange(buffer, buffer->current_size - 1, buffer, buffer->current_size - 1)));
 	this->InsertLines(cursors, text, 0);
-	// FIXME: do something with the actual matches
-	/*
-	for (auto it = matches.begin(); it != matches.end(); it++) {
-		PGCursorRange data = *it;
-		data.start_position += std::to_string(data.start_line).size() + 2;
-		data.end_position += std::to_string(data.start_line).size() + 2;
-		data.start_line += current_line - start_line;
-		data.end_line += current_line - start_line;
-		//Cursor c = Cursor(nullptr, data.start_line, data.start_position, data.end_line, data.end_position);
-		//matches.push_back(c.GetCursorSelection());
-	}*/
 	InvalidateBuffers(nullptr);
 	VerifyTextfile();
 	this->Unlock(PGWriteLock);
@@ -2290,3 +2752,71 @@ void InMemoryTextFile::AddFindMatches(std::string filename, const std::vector<st
 	this->InvalidateParsing();
 }
 
+bool InMemoryTextFile::HasMoreFindResults() {
+	auto store = find_results;
+	if (!store) return false;
+	LockMutex(store->lock.get());
+	bool more = store->next_record < store->records.size();
+	UnlockMutex(store->lock.get());
+	return more;
+}
+
+void InMemoryTextFile::ShowMoreFindResults() {
+	auto store = find_results;
+	if (!store) return;
+	// take the next page of records out of the store, so the search is not blocked while the files are read
+	std::vector<PGFindResultsRecord> records;
+	std::vector<std::string> filenames;
+	std::vector<lng> match_lines;
+	lng lines = 0;
+	LockMutex(store->lock.get());
+	while (store->next_record < store->records.size() && lines < FIND_RESULTS_PAGE_LINES) {
+		PGFindResultsRecord record = store->records[store->next_record++];
+		filenames.push_back(store->filenames[record.file]);
+		record.file = filenames.size() - 1;
+		size_t first_match = match_lines.size();
+		match_lines.insert(match_lines.end(), store->match_lines.begin() + record.first_match,
+			store->match_lines.begin() + record.first_match + record.matches);
+		record.first_match = first_match;
+		records.push_back(record);
+		lines += record.end_line - record.start_line;
+	}
+	if (store->next_record == store->records.size()) {
+		// every record has been shown, the search appends new records from the start again
+		store->records.clear();
+		store->filenames.clear();
+		store->match_lines.clear();
+		store->next_record = 0;
+	}
+	UnlockMutex(store->lock.get());
+
+	std::string text;
+	std::shared_ptr<TextFile> file;
+	for (size_t i = 0; i < records.size(); i++) {
+		PGFindResultsRecord& record = records[i];
+		if (i == 0 || filenames[record.file] != filenames[records[i - 1].file]) {
+			PGFileError error = PGFileSuccess;
+			file = InMemoryTextFile::OpenTextFile(filenames[record.file], error, true, false);
+		}
+		if (!file) {
+			// the file has been removed since it was searched
+			continue;
+		}
+		// the file might have changed since it was searched
+		lng end_line = std::min(record.end_line, file->GetLineCount());
+		if (record.start_line >= end_line) {
+			continue;
+		}
+		std::vector<bool> line_is_match(end_line - record.start_line, false);
+		for (size_t j = record.first_match; j < record.first_match + record.matches; j++) {
+			if (match_lines[j] < end_line) {
+				line_is_match[match_lines[j] - record.start_line] = true;
+			}
+		}
+		FormatFindMatches(text, filenames[record.file], file.get(), record.start_line, end_line, line_is_match);
+	}
+	if (text.size() > 0) {
+		AppendFindResults(text);
+	}
+}
+
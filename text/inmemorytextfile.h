@@ -60,14 +60,28 @@ public:
 	void ConvertToIndentation(PGLineIndentation indentation);
 
 	void FindMatchesWithContext(FindAllInformation* info, PGRegexHandle regex_handle, int context_lines, PGMatchCallback callback, void* data);
-	void FindAllMatchesAsync(PGGlobSet whitelist, ProjectExplorer* explorer, PGRegexHandle regex_handle, int context_lines, bool ignore_binary);
+	// searches the files of the project explorer in the background and adds the matches to this file
+	// the search can be cancelled through the returned task
+	std::shared_ptr<Task> FindAllMatchesAsync(PGGlobSet whitelist, ProjectExplorer* explorer, PGRegexHandle regex_handle, int context_lines, bool ignore_binary, PGTaskUrgency urgency);
+	// whether find in files has found results that are not shown yet
+	bool HasMoreFindResults();
+	// reads the next page of the results that are not shown yet from their files and adds them to the text
+	void ShowMoreFindResults();
 
 	PGTextBuffer* GetBuffer(lng line);
 	PGTextBuffer* GetBufferFromWidth(double width);
 	PGTextBuffer* GetFirstBuffer();
 	PGTextBuffer* GetLastBuffer();
+
+	std::shared_ptr<PGTextSnapshot> GetSnapshot();
+
+	lng GetMemoryUsage();
+	// only files without unsaved changes that have not been modified on disk can be unloaded
+	// the undo history is kept, the cursors and scroll positions of the views are restored after reading the file again
+	lng Unload();
 protected:
 	void ApplySettings(PGTextFileSettings settings);
+	void ReadDeferred();
 private:
 	bool WriteToFile(PGFileHandle file, PGEncoderHandle encoder, const char* text, lng size, char** output_text, lng* output_size, char** intermediate_buffer, lng* intermediate_size);
 
@@ -84,6 +98,9 @@ private:
 	void DeleteSelection(std::vector<Cursor>& cursors, size_t cursornr);
 	// delete the specified text range
 	void DeleteText(std::vector<Cursor>& cursors, PGTextRange);
+	// replace the ranges that start at <start> (in order, not overlapping) in a single pass over the buffers that contain them
+	// the cursors of all views are moved along, the start of every replacement in the new text is stored in <replacement_start>
+	void ReplaceRanges(std::vector<Cursor>& cursors, std::vector<PGCursorPosition>& start, std::vector<std::string>& removed_text, std::vector<std::string>& added_text, std::vector<PGCursorPosition>& replacement_start);
 
 	void OpenFile(std::shared_ptr<TextFile> file, PGFileEncoding encoding, char* base, size_t size, bool immediate_load);
 	void OpenFile(char* base_data, lng size, bool delete_file);
@@ -100,7 +117,13 @@ private:
 	void PerformOperation(std::vector<Cursor>& cursors, TextDelta* delta);
 	bool PerformOperation(std::vector<Cursor>& cursors, TextDelta* delta, bool redo);
 
-	void AddFindMatches(std::string filename, const std::vector<std::string>& lines, const std::vector<PGCursorRange>& matches, lng start_line);
+	// formats the lines [start_line, end_line) of "file" as find results and adds them to the pending results
+	// once the results are long, only the location of the lines is stored
+	void AddFindMatches(FindAllInformation* info, TextFile* file, lng start_line, lng end_line, const std::vector<PGCursorRange>& matches);
+	// appends the pending find results to the text
+	void FlushFindMatches(FindAllInformation* info);
+	void FormatFindMatches(std::string& text, const std::string& filename, TextFile* file, lng start_line, lng end_line, const std::vector<bool>& line_is_match);
+	void AppendFindResults(std::string& text);
 
 	void InvalidateBuffers(TextView* responsible_view);
 	void InvalidateParsing();
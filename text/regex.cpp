@@ -1,8 +1,18 @@
 
 #include "regex.h"
+#include "thread.h"
 #include "unicode.h"
 
 #include <re2/re2.h>
+#include <re2/prefilter.h>
+
+#include <list>
+#include <unordered_map>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define PGREGEX_SSE2
+#endif
 
 const PGRegexFlags PGRegexFlagsNone = 0;
 const PGRegexFlags PGRegexCaseInsensitive = 1 << 0;
@@ -10,67 +20,151 @@ const PGRegexFlags PGRegexWholeWordSearch = 1 << 1;
 
 using namespace re2;
 
-struct PGRegex {
+// the compiled form of a pattern, it is never modified after compilation
+// so it can be shared by all the handles of the same pattern, and be used by multiple threads at once
+struct PGCompiledRegex {
 	bool is_regex;
 	std::string original_pattern;
+	// for literal searches this is only set if the needle has to be matched with unicode case folding
 	std::unique_ptr<RE2> regex;
-	std::vector<lng> table;
-	std::vector<lng> reverse_table;
 	std::string needle;
+	// the positions of the two rarest characters of the needle, which are used to find candidate matches
+	lng rare_first;
+	lng rare_second;
 	PGRegexFlags flags;
 };
 
-static std::vector<lng> PGPreprocessTextSearch(std::string& needle);
+struct PGRegex {
+	std::shared_ptr<const PGCompiledRegex> compiled;
+};
+
+// the amount of compiled patterns that are kept around after their handles have been deleted
+// every RE2 program can hold a DFA cache of several MB, so we only keep the most recently used ones
+#define PGREGEX_CACHE_SIZE 16
+
+// the find box compiles the pattern again on every keystroke and every search compiles its own handle
+// the cache maps (pattern, is_regex, flags) to the compiled pattern, so repeated searches skip compilation
+class PGRegexCache {
+public:
+	static std::shared_ptr<const PGCompiledRegex> Lookup(const std::string& key) { return GetInstance()._Lookup(key); }
+	static void Insert(const std::string& key, std::shared_ptr<const PGCompiledRegex> compiled) { GetInstance()._Insert(key, compiled); }
+private:
+	typedef std::pair<std::string, std::shared_ptr<const PGCompiledRegex>> CacheEntry;
+
+	PGRegexCache() : lock(CreateMutex()) { }
+	static PGRegexCache& GetInstance() {
+		static PGRegexCache instance;
+		return instance;
+	}
+
+	std::shared_ptr<const PGCompiledRegex> _Lookup(const std::string& key);
+	void _Insert(const std::string& key, std::shared_ptr<const PGCompiledRegex> compiled);
+
+	std::unique_ptr<PGMutex> lock;
+	// most recently used entries are at the front of the list
+	std::list<CacheEntry> entries;
+	std::unordered_map<std::string, std::list<CacheEntry>::iterator> map;
+};
+
+std::shared_ptr<const PGCompiledRegex> PGRegexCache::_Lookup(const std::string& key) {
+	std::shared_ptr<const PGCompiledRegex> compiled = nullptr;
+	LockMutex(lock.get());
+	auto entry = map.find(key);
+	if (entry != map.end()) {
+		entries.splice(entries.begin(), entries, entry->second);
+		compiled = entry->second->second;
+	}
+	UnlockMutex(lock.get());
+	return compiled;
+}
+
+void PGRegexCache::_Insert(const std::string& key, std::shared_ptr<const PGCompiledRegex> compiled) {
+	LockMutex(lock.get());
+	auto entry = map.find(key);
+	if (entry != map.end()) {
+		// another thread compiled the same pattern in the meantime
+		entries.erase(entry->second);
+	}
+	entries.push_front(CacheEntry(key, compiled));
+	map[key] = entries.begin();
+	if (entries.size() > PGREGEX_CACHE_SIZE) {
+		map.erase(entries.back().first);
+		entries.pop_back();
+	}
+	UnlockMutex(lock.get());
+}
+
+static void PGPreprocessTextSearch(PGCompiledRegex* compiled);
 static PGRegexMatch PGTextSearch(PGRegexHandle handle, PGTextRange context, PGDirection direction);
 
-PGRegexHandle PGCompileRegex(std::string pattern, bool is_regex, PGRegexFlags flags) {
-	PGRegexHandle handle = new PGRegex();
+static RE2* PGCompileRE2(const std::string& pattern, PGRegexFlags flags) {
+	RE2::Options options;
+	options.set_case_sensitive(!(flags & PGRegexCaseInsensitive));
+	options.set_utf8(true);
+	options.set_log_errors(false);
+	options.set_posix_syntax(true);
+	options.set_perl_classes(true);
+	options.set_word_boundary(true);
+	options.set_one_line(false);
+	return new RE2(pattern.c_str(), options);
+}
+
+static std::shared_ptr<const PGCompiledRegex> PGCompilePattern(std::string pattern, bool is_regex, PGRegexFlags flags) {
+	auto compiled = std::make_shared<PGCompiledRegex>();
 	if (flags & PGRegexWholeWordSearch) {
 		is_regex = true;
 		pattern = "\\b" + pattern + "\\b";
 	}
-	handle->original_pattern = pattern;
-	handle->is_regex = is_regex;
-	handle->flags = flags;
+	compiled->original_pattern = pattern;
+	compiled->is_regex = is_regex;
+	compiled->flags = flags;
 	if (is_regex) {
 		// compile "pattern" as a regex pattern
-		RE2::Options options;
-		options.set_case_sensitive(!(flags & PGRegexCaseInsensitive));
-		options.set_utf8(true);
-		options.set_log_errors(false);
-		options.set_posix_syntax(true);
-		options.set_perl_classes(true);
-		options.set_word_boundary(true);
-		options.set_one_line(false);
-		RE2* regex = new RE2(pattern.c_str(), options);
+		RE2* regex = PGCompileRE2(pattern, flags);
 		if (!regex) {
 			// FIXME: report on the error
-			delete handle;
 			return nullptr;
 		}
-		handle->regex = std::unique_ptr<RE2>(regex);
+		compiled->regex = std::unique_ptr<RE2>(regex);
 	} else {
 		// regular string search
 		// perform preprocessing on the needle
-		handle->needle = pattern;
+		compiled->needle = pattern;
 		if (flags & PGRegexCaseInsensitive) {
-			handle->needle = panther::tolower(handle->needle);
-			if (handle->needle == panther::toupper(pattern)) {
+			if (std::find_if(pattern.begin(), pattern.end(), [](char c) { return (unsigned char)c >= 0x80; }) != pattern.end()) {
+				// the literal search only folds ASCII characters
+				// RE2 applies unicode simple case folding to the other characters of the needle
+				compiled->regex = std::unique_ptr<RE2>(PGCompileRE2(RE2::QuoteMeta(pattern), flags));
+			}
+			compiled->needle = panther::tolower(compiled->needle);
+			if (!compiled->regex && compiled->needle == panther::toupper(pattern)) {
 				// case insensitive is toggled on, but there are no ASCII letters in the search pattern
 				// toggle off case-insensitive search because it makes no difference
-				handle->flags = PGRegexFlagsNone;
+				compiled->flags = PGRegexFlagsNone;
 			}
 		}
-		handle->table = PGPreprocessTextSearch(handle->needle);
-		std::string reverse_needle = handle->needle;
-		std::reverse(reverse_needle.begin(), reverse_needle.end());
-		handle->reverse_table = PGPreprocessTextSearch(reverse_needle);
+		PGPreprocessTextSearch(compiled.get());
+	}
+	return compiled;
+}
+
+PGRegexHandle PGCompileRegex(std::string pattern, bool is_regex, PGRegexFlags flags) {
+	std::string key = std::to_string(flags) + (is_regex ? "r" : "t") + pattern;
+	auto compiled = PGRegexCache::Lookup(key);
+	if (!compiled) {
+		compiled = PGCompilePattern(pattern, is_regex, flags);
+		if (!compiled) {
+			return nullptr;
+		}
+		PGRegexCache::Insert(key, compiled);
 	}
+	PGRegexHandle handle = new PGRegex();
+	handle->compiled = compiled;
 	return handle;
 }
 
 std::string PGGetRegexPattern(PGRegexHandle handle) {
-	return handle->original_pattern;
+	return handle->compiled->original_pattern;
 }
 
 PGRegexMatch PGMatchRegex(PGRegexHandle handle, PGTextRange context, PGDirection direction) {
@@ -79,10 +173,10 @@ PGRegexMatch PGMatchRegex(PGRegexHandle handle, PGTextRange context, PGDirection
 	if (!handle) {
 		return match;
 	}
-	if (handle->is_regex) {
+	if (handle->compiled->regex) {
 		PGTextRange subtext = context;
 		bool find_last_match = direction == PGDirectionLeft;
-		match.matched = handle->regex.get()->Match(context, subtext, RE2::UNANCHORED, match.groups, PGREGEX_MAXIMUM_MATCHES, find_last_match);
+		match.matched = handle->compiled->regex.get()->Match(context, subtext, RE2::UNANCHORED, match.groups, PGREGEX_MAXIMUM_MATCHES, find_last_match);
 		return match;
 	} else {
 		return PGTextSearch(handle, context, direction);
@@ -90,7 +184,9 @@ PGRegexMatch PGMatchRegex(PGRegexHandle handle, PGTextRange context, PGDirection
 }
 
 PGRegexMatch PGMatchRegex(PGRegexHandle handle, const char* data, lng size, PGDirection direction) {
-	PGTextBuffer buffer;
+	// every thread reuses the same buffer to wrap the data in, constructing a new buffer
+	// for every call would increment the shared buffer version counter from every thread
+	static thread_local PGTextBuffer buffer;
 	buffer.buffer = (char*) data;
 	buffer.current_size = size;
 	buffer.buffer_size = size;
@@ -126,153 +222,300 @@ void PGDeleteRegex(PGRegexHandle handle) {
 	delete handle;
 }
 
+bool PGRegexEquals(PGRegexHandle a, PGRegexHandle b) {
+	if (a->compiled == b->compiled) return true;
+	return a->compiled->is_regex == b->compiled->is_regex && a->compiled->flags == b->compiled->flags && a->compiled->original_pattern == b->compiled->original_pattern;
+}
+
+static PGRegexLiterals PGConvertPrefilter(Prefilter* prefilter) {
+	PGRegexLiterals literals;
+	switch (prefilter->op()) {
+		case Prefilter::ATOM:
+			literals.type = PGRegexLiteralsAtom;
+			literals.atom = prefilter->atom();
+			break;
+		case Prefilter::AND:
+		case Prefilter::OR:
+			literals.type = prefilter->op() == Prefilter::AND ? PGRegexLiteralsAnd : PGRegexLiteralsOr;
+			for (auto it = prefilter->subs()->begin(); it != prefilter->subs()->end(); it++) {
+				literals.subs.push_back(PGConvertPrefilter(*it));
+			}
+			break;
+		default:
+			// NONE is treated as ALL, we never want to skip a file because of an unusual pattern
+			literals.type = PGRegexLiteralsAll;
+			break;
+	}
+	return literals;
+}
+
+PGRegexLiterals PGGetRegexLiterals(PGRegexHandle handle) {
+	PGRegexLiterals literals;
+	if (!handle) {
+		return literals;
+	}
+	if (!handle->compiled->is_regex) {
+		literals.type = PGRegexLiteralsAtom;
+		literals.atom = panther::tolower(handle->compiled->needle);
+		return literals;
+	}
+	// RE2 extracts the required strings from the regexp tree, as it does for FilteredRE2
+	Prefilter* prefilter = Prefilter::FromRE2(handle->compiled->regex.get());
+	if (prefilter) {
+		literals = PGConvertPrefilter(prefilter);
+		delete prefilter;
+	}
+	return literals;
+}
+
 int PGRegexNumberOfCapturingGroups(PGRegexHandle handle) {
-	if (!handle->is_regex) return -1;
-	return handle->regex.get()->NumberOfCapturingGroups();
+	if (!handle->compiled->is_regex) return -1;
+	return handle->compiled->regex.get()->NumberOfCapturingGroups();
 }
 
-std::vector<lng> PGPreprocessTextSearch(std::string& needle) {
-	if (needle.size() >= 1) {
-		// initialize a table of UCHAR_MAX+1 elements to value needle.size()
-		std::vector<lng> table(256, needle.size());
-		/* Populate it with the analysis of the needle */
-		/* But ignoring the last letter */
-		for(size_t a = 0; a < needle.size() - 1; a++) {
-			unsigned char index = needle[a];
-			table[index] = needle.size() - 1 - a;
+// a rough estimate of how common a character is in source code and logs, lower is rarer
+// candidate matches are found by looking for the two rarest characters of the needle
+static int PGCharacterFrequency(unsigned char c) {
+	if (c == ' ' || c == '\t') return 255;
+	if (strchr("etaoinsrhl", c) && c != '\0') return 200;
+	if (c >= 'a' && c <= 'z') return 150;
+	if ((c >= '0' && c <= '9') || (c != '\0' && strchr("_.,;()=\"'", c))) return 120;
+	if (c >= 'A' && c <= 'Z') return 80;
+	if (c >= 0x80) return 40;
+	return 60;
+}
+
+static void PGPreprocessTextSearch(PGCompiledRegex* compiled) {
+	const std::string& needle = compiled->needle;
+	bool case_insensitive = compiled->flags & PGRegexCaseInsensitive;
+	compiled->rare_first = 0;
+	compiled->rare_second = 0;
+	int first_frequency = INT_MAX, second_frequency = INT_MAX;
+	for (lng i = 0; i < (lng)needle.size(); i++) {
+		unsigned char c = needle[i];
+		// both variants of a letter are accepted, so it is as common as the lowercase letter
+		int frequency = PGCharacterFrequency(case_insensitive ? panther::chartolower(c) : c);
+		if (frequency < first_frequency) {
+			compiled->rare_second = compiled->rare_first;
+			second_frequency = first_frequency;
+			compiled->rare_first = i;
+			first_frequency = frequency;
+		} else if (frequency < second_frequency) {
+			compiled->rare_second = i;
+			second_frequency = frequency;
 		}
-		return table;
 	}
-	return std::vector<lng>();
 }
 
-PGRegexMatch PGTextSearch(PGRegexHandle handle, PGTextRange context, PGDirection direction) {
-	// find regular text within a textrange
-	// this is a modified implementation of Boyer-Moore-Horspool
-	// that works on ranges of buffer ranges
-	assert(handle);
-	assert(!handle->is_regex);
-	PGRegexMatch match;
-	match.matched = false;
-	if (handle->original_pattern.size() == 0) {
-		return match;
+static inline bool PGCompareLiteral(const char* text, const std::string& needle, bool case_insensitive) {
+	if (!case_insensitive) {
+		return memcmp(text, needle.c_str(), needle.size()) == 0;
+	}
+	// the needle is lowercase
+	for (size_t i = 0; i < needle.size(); i++) {
+		if (panther::chartolower(text[i]) != (unsigned char)needle[i]) {
+			return false;
+		}
 	}
+	return true;
+}
 
-	bool case_insensitive = handle->flags & PGRegexCaseInsensitive;
+#ifdef PGREGEX_SSE2
+static inline int PGLowestBit(unsigned int mask) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (int)index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
 
-	if (handle->needle.size() == 1) {
-		// needle size = 1 so boyer-moore makes no sense 
-		// as there are no prefixes/suffixes
-		PGTextPosition position;
-		if (case_insensitive) {
-			// case insensitive, have to find either the lower or upper variant of the character
-			position = direction == PGDirectionRight ? 
-				context._memcasechr(handle->needle[0]) : 
-				context._memcaserchr(handle->needle[0]);
+static inline int PGHighestBit(unsigned int mask) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse(&index, mask);
+	return (int)index;
+#else
+	return 31 - __builtin_clz(mask);
+#endif
+}
 
-		} else {
-			// case sensitive; just use memchr/memrchr
-			position = direction == PGDirectionRight ? 
-				context._memchr(handle->needle[0]) : 
-				context._memrchr(handle->needle[0]);
+// returns a mask of the 16 positions starting at "text" where the needle might start
+// i.e. where both rare characters of the needle are found at their offsets
+static inline unsigned int PGCandidateMask(const char* text, const PGCompiledRegex* compiled, __m128i first[2], __m128i second[2]) {
+	__m128i a = _mm_loadu_si128((const __m128i*)(text + compiled->rare_first));
+	__m128i b = _mm_loadu_si128((const __m128i*)(text + compiled->rare_second));
+	__m128i match_a = _mm_or_si128(_mm_cmpeq_epi8(a, first[0]), _mm_cmpeq_epi8(a, first[1]));
+	__m128i match_b = _mm_or_si128(_mm_cmpeq_epi8(b, second[0]), _mm_cmpeq_epi8(b, second[1]));
+	return (unsigned int)_mm_movemask_epi8(_mm_and_si128(match_a, match_b));
+}
+
+static inline void PGRareCharacters(const PGCompiledRegex* compiled, bool case_insensitive, __m128i first[2], __m128i second[2]) {
+	char a = compiled->needle[compiled->rare_first], b = compiled->needle[compiled->rare_second];
+	first[0] = _mm_set1_epi8(a);
+	first[1] = _mm_set1_epi8(case_insensitive ? (char)panther::chartoupper(a) : a);
+	second[0] = _mm_set1_epi8(b);
+	second[1] = _mm_set1_epi8(case_insensitive ? (char)panther::chartoupper(b) : b);
+}
+#endif
+
+static inline bool PGCandidate(const char* text, const PGCompiledRegex* compiled, bool case_insensitive) {
+	unsigned char a = text[compiled->rare_first], b = text[compiled->rare_second];
+	if (case_insensitive) {
+		a = panther::chartolower(a);
+		b = panther::chartolower(b);
+	}
+	return a == (unsigned char)compiled->needle[compiled->rare_first] && b == (unsigned char)compiled->needle[compiled->rare_second];
+}
+
+// returns the offset of the first occurrence of the needle that lies entirely within [data, data + size), or -1
+static lng PGFindLiteral(const PGCompiledRegex* compiled, const char* data, lng size, bool case_insensitive) {
+	const std::string& needle = compiled->needle;
+	lng last = size - (lng)needle.size();
+	lng position = 0;
+#ifdef PGREGEX_SSE2
+	__m128i first[2], second[2];
+	PGRareCharacters(compiled, case_insensitive, first, second);
+	// the loads of a block end at most at the last character of the needle for the last start in the block
+	for (; position + 15 <= last; position += 16) {
+		unsigned int mask = PGCandidateMask(data + position, compiled, first, second);
+		while (mask) {
+			int bit = PGLowestBit(mask);
+			if (PGCompareLiteral(data + position + bit, needle, case_insensitive)) {
+				return position + bit;
+			}
+			mask &= mask - 1;
 		}
-		if (position.buffer != nullptr) {
-			// found match, set the proper return value range
-			match.matched = true;
-			match.groups[0] = PGTextRange(position, position + 1);
+	}
+#endif
+	for (; position <= last; position++) {
+		if (PGCandidate(data + position, compiled, case_insensitive) &&
+			PGCompareLiteral(data + position, needle, case_insensitive)) {
+			return position;
 		}
-		return match;
 	}
+	return -1;
+}
 
-	// perform the actual search
-	const std::string& needle = handle->needle;
-	PGTextRange range = context;
+// returns the offset of the last occurrence of the needle that lies entirely within [data, data + size), or -1
+static lng PGFindLiteralReverse(const PGCompiledRegex* compiled, const char* data, lng size, bool case_insensitive) {
+	const std::string& needle = compiled->needle;
+	lng position = size - (lng)needle.size();
+#ifdef PGREGEX_SSE2
+	__m128i first[2], second[2];
+	PGRareCharacters(compiled, case_insensitive, first, second);
+	for (; position >= 15; position -= 16) {
+		// the block contains the starts [position - 15, position]
+		unsigned int mask = PGCandidateMask(data + position - 15, compiled, first, second);
+		while (mask) {
+			int bit = PGHighestBit(mask);
+			if (PGCompareLiteral(data + position - 15 + bit, needle, case_insensitive)) {
+				return position - 15 + bit;
+			}
+			mask &= ~(1u << bit);
+		}
+	}
+#endif
+	for (; position >= 0; position--) {
+		if (PGCandidate(data + position, compiled, case_insensitive) &&
+			PGCompareLiteral(data + position, needle, case_insensitive)) {
+			return position;
+		}
+	}
+	return -1;
+}
+
+// returns true if the needle occurs at the start of the range, the range can span multiple buffers
+static bool PGCompareLiteral(PGTextRange range, const std::string& needle, bool case_insensitive) {
+	return case_insensitive ?
+		range.ascii_strcasecmp(needle.c_str(), needle.size()) == 0 :
+		range._memcmp(needle.c_str(), needle.size()) == 0;
+}
+
+PGRegexMatch PGTextSearch(PGRegexHandle handle, PGTextRange context, PGDirection direction) {
+	// find regular text within a textrange
+	// every buffer is searched as a single contiguous span, only the matches that
+	// cross the boundary between two buffers are compared through the text range
+	assert(handle);
+	assert(!handle->compiled->is_regex);
+	PGRegexMatch match;
+	match.matched = false;
+	const PGCompiledRegex* compiled = handle->compiled.get();
+	const std::string& needle = compiled->needle;
+	if (needle.size() == 0) {
+		return match;
+	}
+	bool case_insensitive = compiled->flags & PGRegexCaseInsensitive;
+	lng length = needle.size();
 
 	if (direction == PGDirectionRight) {
-		// search in the right direction
-		// last_needle_char is the last character of the needle
-		// boyer-moore-horspool works by first checking if the character that is
-		// needle.size() away matches the last character of the needle
-		// if it does not, it skips ahead based on the current character
-		// the skip distance depends on how often the current character occurs in the pattern
-		// and is precomputed in PGPreprocessTextSearch for each possible character
-
-		const unsigned char last_needle_char = needle.back();
-		const unsigned char last_needle_char_upper = panther::chartoupper(last_needle_char);
-	 
-		PGTextPosition position;
-		position.buffer = context.start_buffer;
-		position.position = context.start_position;
-		while(true) {
-			const unsigned char character = *(position + (needle.size() - 1));
-			if (!character) return match;
-
-			if (last_needle_char == character || 
-				(case_insensitive && character == last_needle_char_upper)) {
-				// the character <needle size> away matches the last character of the needle
-				// perform a comparison
-				range.start_buffer = position.buffer;
-				range.start_position = position.position;
-				bool found_match = case_insensitive ? 
-					range.ascii_strcasecmp(needle.c_str(), needle.size() - 1) == 0 : 
-					range._memcmp(needle.c_str(), needle.size() - 1) == 0;
-				if (found_match) {
+		PGTextBuffer* buffer = context.start_buffer;
+		lng start = context.start_position;
+		while (buffer) {
+			lng end = buffer == context.end_buffer ? context.end_position : buffer->current_size;
+			lng offset = PGFindLiteral(compiled, buffer->buffer + start, end - start, case_insensitive);
+			if (offset >= 0) {
+				PGTextPosition position(buffer, start + offset);
+				match.matched = true;
+				match.groups[0] = PGTextRange(position, position + length);
+				return match;
+			}
+			if (buffer == context.end_buffer) {
+				break;
+			}
+			// the matches that start near the end of this buffer and continue in the next buffer
+			for (lng i = std::max(start, end - length + 1); i < end; i++) {
+				if (PGCompareLiteral(PGTextRange(buffer, i, context.end_buffer, context.end_position), needle, case_insensitive)) {
+					PGTextPosition position(buffer, i);
 					match.matched = true;
-					match.groups[0] = PGTextRange(position, position + needle.size());
+					match.groups[0] = PGTextRange(position, position + length);
 					return match;
 				}
 			}
-	 
-			if (!position.Offset(handle->table[case_insensitive ? panther::chartolower(character) : character])) {
-				return match;
-			}
+			buffer = buffer->next();
+			start = 0;
 		}
 	} else {
-		// search in the left direction
-		// this is mostly identical to the search in the right direction
-		// except just reversed; we scan the string right-to-left and
-		// look for the first character of the needle first
-		const unsigned char first_needle_char = needle.front();
-		const unsigned char first_needle_char_upper = panther::chartoupper(first_needle_char);
-	 
-		PGTextPosition position;
-		position.buffer = context.end_buffer;
-		position.position = context.end_position;
-		while(true) {
-			PGTextPosition last_position = position - (needle.size() - 1);
-			const unsigned char character = *last_position;
-			if (!character) return match;
-
-			if (first_needle_char == character || 
-				(case_insensitive && character == first_needle_char_upper)) {
-				// the character <needle size> away matches the last character of the needle
-				// perform a comparison
-				PGTextPosition second_last_position = last_position + 1;
-				range.start_buffer = last_position.buffer;
-				range.start_position = last_position.position;
-				bool found_match = case_insensitive ? 
-					range.ascii_strcasecmp(needle.c_str(), needle.size() - 1) == 0 : 
-					range._memcmp(needle.c_str(), needle.size() - 1) == 0;
-				if (found_match) {
-					match.matched = true;
-					match.groups[0] = PGTextRange(last_position, position + 1);
-					return match;
+		// this is mostly identical to the search in the right direction, except reversed
+		// the matches that cross the end of a buffer start after every match within the buffer, so they are checked first
+		PGTextBuffer* buffer = context.end_buffer;
+		lng end = context.end_position;
+		while (buffer) {
+			lng start = buffer == context.start_buffer ? context.start_position : 0;
+			if (buffer != context.end_buffer) {
+				for (lng i = end - 1; i >= std::max(start, end - length + 1); i--) {
+					if (PGCompareLiteral(PGTextRange(buffer, i, context.end_buffer, context.end_position), needle, case_insensitive)) {
+						PGTextPosition position(buffer, i);
+						match.matched = true;
+						match.groups[0] = PGTextRange(position, position + length);
+						return match;
+					}
 				}
 			}
-	 
-			if (!position.Offset(-handle->reverse_table[case_insensitive ? panther::chartolower(character) : character])) {
+			lng offset = PGFindLiteralReverse(compiled, buffer->buffer + start, end - start, case_insensitive);
+			if (offset >= 0) {
+				PGTextPosition position(buffer, start + offset);
+				match.matched = true;
+				match.groups[0] = PGTextRange(position, position + length);
 				return match;
 			}
+			if (buffer == context.start_buffer) {
+				break;
+			}
+			buffer = buffer->prev();
+			end = buffer ? buffer->current_size : 0;
 		}
 	}
+	return match;
 }
 
 bool PGRegexHasErrors(PGRegexHandle handle) {
-	if (!handle->is_regex) return false;
-	return handle->regex->error().size() != 0;
+	if (!handle->compiled->is_regex) return false;
+	return handle->compiled->regex->error().size() != 0;
 }
 
 std::string PGGetRegexError(PGRegexHandle handle) {
-	if (!handle->is_regex) return "";
-	return handle->regex->error();
+	if (!handle->compiled->is_regex) return "";
+	return handle->compiled->regex->error();
 }
@@ -7,7 +7,10 @@
 struct PGRegex;
 typedef PGRegex* PGRegexHandle;
 
-typedef void PGMatchCallback(void* data, std::string filename, const std::vector<std::string>& lines, const std::vector<PGCursorRange>& matches, lng initial_line);
+class TextFile;
+
+// reports the matches in the lines [start_line, end_line) of "file", the lines are read from the file by the callback
+typedef void PGMatchCallback(void* data, TextFile* file, lng start_line, lng end_line, const std::vector<PGCursorRange>& matches);
 
 #define PGREGEX_MAXIMUM_MATCHES 16
 
@@ -22,6 +25,27 @@ extern const PGRegexFlags PGRegexFlagsNone;
 extern const PGRegexFlags PGRegexCaseInsensitive;
 extern const PGRegexFlags PGRegexWholeWordSearch;
 
+enum PGRegexLiteralsType {
+	// any text might match
+	PGRegexLiteralsAll,
+	// the text has to contain the atom
+	PGRegexLiteralsAtom,
+	// the text has to satisfy all of the subs
+	PGRegexLiteralsAnd,
+	// the text has to satisfy one of the subs
+	PGRegexLiteralsOr
+};
+
+// the strings a text has to contain before a regex can match it
+// the strings are lowercase, so they have to be compared against a lowercase version of the text
+struct PGRegexLiterals {
+	PGRegexLiteralsType type;
+	std::string atom;
+	std::vector<PGRegexLiterals> subs;
+
+	PGRegexLiterals() : type(PGRegexLiteralsAll) { }
+};
+
 bool PGRegexHasErrors(PGRegexHandle handle);
 std::string PGGetRegexError(PGRegexHandle handle);
 std::string PGGetRegexPattern(PGRegexHandle handle);
@@ -30,5 +54,9 @@ PGRegexMatch PGMatchRegex(PGRegexHandle handle, PGTextRange context, PGDirection
 PGRegexMatch PGMatchRegex(PGRegexHandle handle, const char* data, lng size, PGDirection direction);
 PGRegexMatch PGMatchRegex(PGRegexHandle handle, std::string& context, PGDirection direction);
 int PGRegexNumberOfCapturingGroups(PGRegexHandle handle);
+// returns true if both regexes were compiled from the same pattern with the same flags
+bool PGRegexEquals(PGRegexHandle a, PGRegexHandle b);
+// extracts the required strings from the parsed pattern, used to skip files that cannot contain a match
+PGRegexLiterals PGGetRegexLiterals(PGRegexHandle handle);
 void PGDeleteRegex(PGRegexHandle handle);
 
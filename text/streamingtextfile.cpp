@@ -1,17 +1,83 @@
-
 #include "streamingtextfile.h"
 #include "style.h"
 
-StreamingTextFile::StreamingTextFile(PGFileHandle handle, std::string filename) :
-	handle(handle), TextFile(filename), decoder(nullptr),
-	output(nullptr), intermediate_buffer(nullptr),
-	cached_buffer(nullptr), cached_index(0), cached_size(0) {
+// the amount of text that can be in memory before the buffers that have not been used recently are evicted
+#define PGSTREAMING_RESIDENT_MEMORY (32 * 1024 * 1024)
+// the amount of bytes that is read ahead in the background when reading forward through the file
+#define PGSTREAMING_READ_AHEAD (256 * 1024)
+// unread ranges smaller than this are read from front to back instead of seeking past them,
+// so the line numbers of nearby lines remain exact
+#define PGSTREAMING_SEEK_DISTANCE (1024 * 1024)
+#define PGSTREAMING_SPARE_BUFFERS 16
+
+struct StreamingReadAhead {
+	std::weak_ptr<TextFile> file;
+	lng offset;
+
+	StreamingReadAhead(std::weak_ptr<TextFile> file, lng offset) : file(file), offset(offset) { }
+};
+
+StreamingTextFile::StreamingTextFile(std::string filename) :
+	handle(nullptr), TextFile(filename), decoder(nullptr),
+	output(nullptr), intermediate_buffer(nullptr), scratch(nullptr) {
 	read_only = true;
-	this->encoding = PGEncodingUnknown;
-	ReadBlock();
+	this->io_lock = std::unique_ptr<PGMutex>(CreateMutex());
+	this->read_ahead_lock = std::unique_ptr<PGMutex>(CreateMutex());
+}
+
+StreamingTextFile::StreamingTextFile(PGFileHandle handle, std::string filename) :
+	StreamingTextFile(filename) {
+	ReadStart(handle);
 	is_loaded = true;
 }
 
+void StreamingTextFile::ReadStart(PGFileHandle handle) {
+	this->handle = handle;
+	PGFileError error;
+	read_ahead_handle = panther::OpenFile(path, PGFileReadOnly, error);
+	file_size = panther::GetFileSize(handle);
+	if (file_size == (lng)((size_t)-1)) {
+		file_size = 0;
+	}
+	total_bytes = std::max(file_size, (lng)1);
+
+	// guess the encoding from the start of the file
+	lng sample_size = std::min(file_size, (lng)1024);
+	ReserveScratch(sample_size);
+	sample_size = ReadRaw(0, scratch, sample_size);
+	this->encoding = PGGuessEncoding((unsigned char*)scratch, sample_size);
+	if (encoding != PGEncodingUTF8 && encoding != PGEncodingUTF8BOM) {
+		decoder = PGCreateEncoder(this->encoding, PGEncodingUTF8);
+		seekable = false;
+	} else if (sample_size >= 3 &&
+		((unsigned char*)scratch)[0] == 0xEF &&
+		((unsigned char*)scratch)[1] == 0xBB &&
+		((unsigned char*)scratch)[2] == 0xBF) {
+		// skip UTF-8 BOM byte order mark
+		data_start = 3;
+	}
+
+	bool loaded = seekable ? LoadBlock(data_start, false, 0) : ReadConvertedBlock();
+	if (!loaded) {
+		// empty file: add a single empty line
+		PGTextBuffer* buffer = new PGTextBuffer();
+		FillBuffer(buffer, "", 0, true);
+		InsertBlock(buffer, 0, data_start, 0, 0);
+	}
+}
+
+void StreamingTextFile::ReadDeferred() {
+	PGFileHandle handle = panther::OpenFile(path, PGFileReadOnly, this->error);
+	if (!handle) {
+		bytes = -1;
+		return;
+	}
+	LockMutex(io_lock.get());
+	ReadStart(handle);
+	UnlockMutex(io_lock.get());
+	FinalizeLoading();
+}
+
 StreamingTextFile::~StreamingTextFile() {
 	if (output) {
 		free(output);
@@ -19,210 +85,585 @@ StreamingTextFile::~StreamingTextFile() {
 	if (intermediate_buffer) {
 		free(intermediate_buffer);
 	}
+	if (scratch) {
+		free(scratch);
+	}
+	if (decoder) {
+		PGDestroyEncoder(decoder);
+	}
 	panther::CloseFile(handle);
+	panther::CloseFile(read_ahead_handle);
 	for (auto it = buffers.begin(); it != buffers.end(); it++) {
 		delete *it;
 	}
+	for (auto it = spare_buffers.begin(); it != spare_buffers.end(); it++) {
+		free(*it);
+	}
 }
 
-struct BufferData {
-	char* data;
-	size_t length;
+void StreamingTextFile::ReserveScratch(lng size) {
+	if (scratch_size < size) {
+		scratch = (char*)realloc(scratch, size);
+		scratch_size = size;
+	}
+}
 
-	BufferData(char* data, size_t length) : data(data), length(length) { }
-};
+lng StreamingTextFile::ReadRaw(lng offset, char* buffer, lng size) {
+	// the caller holds the io_lock
+	lng read = 0;
+	LockMutex(read_ahead_lock.get());
+	lng read_ahead_end = read_ahead_offset + (lng)read_ahead.size();
+	if (read_ahead_offset >= 0 && offset >= read_ahead_offset && offset < read_ahead_end) {
+		read = std::min(size, read_ahead_end - offset);
+		memcpy(buffer, read_ahead.c_str() + (offset - read_ahead_offset), read);
+	}
+	UnlockMutex(read_ahead_lock.get());
+	if (read < size && panther::SeekFile(handle, offset + read)) {
+		read += panther::ReadFromFile(handle, buffer + read, size - read);
+	}
+	return read;
+}
 
-lng StreamingTextFile::ReadIntoBuffer(char*& buffer, lng& start_index) {
-	if (!buffer) {
-		free(buffer);
-		buffer = nullptr;
-	}
-	start_index = 0;
-	lng bufsiz = TEXT_BUFFER_SIZE + 1;
-	buffer = (char*)malloc(sizeof(char) * (TEXT_BUFFER_SIZE + 1));
-	bufsiz = panther::ReadFromFile(handle, buffer, TEXT_BUFFER_SIZE - cached_size);
-	if (bufsiz == 0) {
-		if (buffers.size() == 0) {
-			// FIXME: add initial buffer
-			//ConsumeBytes("", 0, max_length, current_width, current_buffer, linenr, prev_character);
-			assert(0);
-			this->encoding = PGEncodingUTF8;
+void StreamingTextFile::ScheduleReadAhead(lng offset) {
+	if (!is_loaded || !read_ahead_handle || offset >= file_size) return;
+	LockMutex(read_ahead_lock.get());
+	if (read_ahead_pending || (offset >= read_ahead_offset &&
+		offset + PGSTREAMING_READ_AHEAD / 2 <= read_ahead_offset + (lng)read_ahead.size())) {
+		// this part of the file is already being read or has been read
+		UnlockMutex(read_ahead_lock.get());
+		return;
+	}
+	read_ahead_pending = true;
+	UnlockMutex(read_ahead_lock.get());
+
+	StreamingReadAhead* info = new StreamingReadAhead(std::weak_ptr<TextFile>(shared_from_this()), offset);
+	auto task = std::make_shared<Task>([](std::shared_ptr<Task> task, void* data) {
+		StreamingReadAhead* info = (StreamingReadAhead*)data;
+		auto file = info->file.lock();
+		if (file) {
+			((StreamingTextFile*)file.get())->ReadAhead(info->offset);
 		}
-		panther::CloseFile(handle);
-		handle = nullptr;
-		free(buffer);
-		buffer = nullptr;
-		return 0;
-	}
-	if (encoding == PGEncodingUnknown) {
-		// guess encoding from the buffer
-		this->encoding = PGGuessEncoding((unsigned char*)buffer, std::min((lng)1024, bufsiz));
-		if (encoding != PGEncodingUTF8 && encoding != PGEncodingUTF8BOM) {
-			decoder = PGCreateEncoder(this->encoding, PGEncodingUTF8);
-		} else {
-			if (((unsigned char*)buffer)[0] == 0xEF &&
-				((unsigned char*)buffer)[1] == 0xBB &&
-				((unsigned char*)buffer)[2] == 0xBF) {
-				// skip UTF-8 BOM byte order mark
-				start_index = 3;
+		delete info;
+	}, info);
+	Scheduler::RegisterTask(task, PGTaskNotUrgent);
+}
+
+void StreamingTextFile::ReadAhead(lng offset) {
+	// only one read ahead task runs at a time, so the read ahead handle and buffer are not shared
+	lng size = std::min((lng)PGSTREAMING_READ_AHEAD, file_size - offset);
+	read_ahead_buffer.resize(size);
+	if (panther::SeekFile(read_ahead_handle, offset)) {
+		size = panther::ReadFromFile(read_ahead_handle, &read_ahead_buffer[0], size);
+	} else {
+		size = 0;
+	}
+	read_ahead_buffer.resize(size);
+
+	LockMutex(read_ahead_lock.get());
+	read_ahead.swap(read_ahead_buffer);
+	read_ahead_offset = offset;
+	read_ahead_pending = false;
+	UnlockMutex(read_ahead_lock.get());
+}
+
+// returns the position after the first line end in the data, or -1 if there is none
+static lng FindLineStart(const char* data, lng size) {
+	for (lng i = 0; i < size; i++) {
+		if (data[i] == '\n') {
+			return i + 1;
+		} else if (data[i] == '\r') {
+			if (i + 1 == size) {
+				// the carriage return might be followed by a newline we have not read
+				return -1;
 			}
+			return data[i + 1] == '\n' ? i + 2 : i + 1;
 		}
 	}
-	if (decoder) {
-		bufsiz = PGConvertText(decoder, buffer, bufsiz, &output, &output_size, &intermediate_buffer, &intermediate_size);
-		free(buffer);
-		buffer = nullptr;
-		start_index = 0;
-		if (bufsiz >= 0) {
-			buffer = output;
-			output = nullptr;
-			output_size = 0;
+	return -1;
+}
+
+// returns the position after the last line end in the data, or -1 if there is none
+static lng FindLastLineEnd(const char* data, lng size) {
+	for (lng i = size - 1; i >= 0; i--) {
+		if (data[i] == '\n' || (data[i] == '\r' && i + 1 < size)) {
+			return i + 1;
 		}
 	}
-	return bufsiz;
+	return -1;
+}
+
+bool StreamingTextFile::ReadLines(lng offset, lng limit, bool align, lng& start, lng& size, lng& data_index) {
+	// if we align, we read one byte in front of the offset to see whether or not a line starts at the offset
+	lng read_start = align ? offset - 1 : offset;
+	lng amount = TEXT_BUFFER_SIZE;
+	while (true) {
+		lng read_size = std::min(amount, limit - read_start);
+		ReserveScratch(read_size);
+		lng read = ReadRaw(read_start, scratch, read_size);
+		// we have reached either the limit or the end of the file
+		bool final = read < amount;
+		lng first = 0;
+		if (align) {
+			first = FindLineStart(scratch, read);
+			if (first < 0 || first >= read) {
+				if (final) return false;
+				amount *= 2;
+				continue;
+			}
+		}
+		lng last = final ? read : FindLastLineEnd(scratch + first, read - first) + first;
+		if (last <= first) {
+			if (final) return false;
+			// no complete line in the data; keep reading until we find one
+			amount *= 2;
+			continue;
+		}
+		start = read_start + first;
+		size = last - first;
+		data_index = first;
+		return true;
+	}
+}
+
+bool StreamingTextFile::ReadLinesBefore(lng end_offset, lng limit, lng& start, lng& data_index) {
+	lng amount = TEXT_BUFFER_SIZE;
+	while (true) {
+		lng read_start = std::max(limit, end_offset - amount);
+		// read one byte in front of the range to see whether or not a line starts at the start of the range
+		lng first_byte = read_start > limit ? read_start - 1 : read_start;
+		lng read_size = end_offset - first_byte;
+		ReserveScratch(read_size);
+		if (ReadRaw(first_byte, scratch, read_size) < read_size) {
+			return false;
+		}
+		if (read_start == limit) {
+			start = limit;
+			data_index = 0;
+			return true;
+		}
+		lng first = FindLineStart(scratch, read_size);
+		if (first >= 0 && first < read_size) {
+			start = first_byte + first;
+			data_index = first;
+			return true;
+		}
+		amount *= 2;
+	}
 }
 
-bool StreamingTextFile::ReadBlock() {
-	if (!handle) return false;
+bool StreamingTextFile::ReadConvertedBlock() {
+	LockMutex(io_lock.get());
+	lng last = FindLastLineEnd(converted_text.c_str(), converted_text.size());
+	while (last < 0 && converted_offset < file_size) {
+		ReserveScratch(TEXT_BUFFER_SIZE);
+		lng read = ReadRaw(converted_offset, scratch, TEXT_BUFFER_SIZE);
+		if (read == 0) break;
+		converted_offset += read;
+		lng converted = PGConvertText(decoder, scratch, read, &output, &output_size, &intermediate_buffer, &intermediate_size);
+		if (converted > 0) {
+			converted_text.append(output, converted);
+		}
+		last = FindLastLineEnd(converted_text.c_str(), converted_text.size());
+	}
+	if (converted_offset >= file_size) {
+		last = converted_text.size();
+	}
+	if (last <= 0) {
+		UnlockMutex(io_lock.get());
+		return false;
+	}
+	ScheduleReadAhead(converted_offset);
 
 	LockMutex(text_lock.get());
+	PGTextBuffer* buffer = new PGTextBuffer();
+	FillBuffer(buffer, converted_text.c_str(), last, true);
+	// converted files are only appended to, so the offsets are positions in the converted text
+	lng offset = buffers.size() > 0 ? BlockEnd(buffers.back()) : 0;
+	InsertBlock(buffer, buffers.size(), offset, last, 0);
+	UnlockMutex(text_lock.get());
+
+	converted_text.erase(0, last);
+	UnlockMutex(io_lock.get());
+	return true;
+}
 
-	lng start_index = 0;
-	char* buf = nullptr;
-	lng bufsiz = ReadIntoBuffer(buf, start_index);
-	if (bufsiz <= start_index) {
+lng StreamingTextFile::FindBlock(lng offset) {
+	// binary search for the last block that starts at or before the offset
+	lng first = 0;
+	lng last = (lng)buffers.size() - 1;
+	lng result = -1;
+	while (first <= last) {
+		lng middle = (first + last) / 2;
+		if (blocks[buffers[middle]].offset <= offset) {
+			result = middle;
+			first = middle + 1;
+		} else {
+			last = middle - 1;
+		}
+	}
+	return result;
+}
+
+lng StreamingTextFile::GapEnd(lng index) {
+	return index + 1 < (lng)buffers.size() ? blocks[buffers[index + 1]].offset : file_size;
+}
+
+bool StreamingTextFile::LoadBlock(lng offset, bool align, lng preferred_line) {
+	LockMutex(text_lock.get());
+	lng index = FindBlock(offset);
+	lng gap_start = index >= 0 ? BlockEnd(buffers[index]) : data_start;
+	lng limit = GapEnd(index);
+	UnlockMutex(text_lock.get());
+	if (offset < gap_start || offset >= limit) {
+		// the offset has already been read
+		return offset < limit;
+	}
+	if (offset == gap_start) {
+		align = false;
+	}
+
+	// read the data without holding the text lock, so the file can be used in the meantime
+	LockMutex(io_lock.get());
+	lng start, size, data_index;
+	bool success = ReadLines(offset, limit, align, start, size, data_index);
+	if (!success && align) {
+		// no line starts in the range after the offset, so the line at the offset ends at the limit
+		success = ReadLinesBefore(limit, gap_start, start, data_index);
+		size = limit - start;
+	}
+	if (success) {
+		LockMutex(text_lock.get());
+		// another thread might have read part of the range in the meantime
+		index = FindBlock(start);
+		gap_start = index >= 0 ? BlockEnd(buffers[index]) : data_start;
+		if (start >= gap_start && start + size <= GapEnd(index)) {
+			PGTextBuffer* buffer = new PGTextBuffer();
+			FillBuffer(buffer, scratch + data_index, size, true);
+			InsertBlock(buffer, index + 1, start, size, preferred_line);
+		}
 		UnlockMutex(text_lock.get());
-		return false;
+		ScheduleReadAhead(start + size);
 	}
-#ifdef PANTHER_DEBUG
-	for (size_t i = cached_index; i < cached_size; i++) {
-		// there should be no more newlines remaining in the cached buffer
-		assert(cached_buffer[i] != '\n' && cached_buffer[i] != '\r');
-	}
-#endif
-
-	// look for the last newline in the buffer
-	size_t total_size = cached_size;
-	std::vector<BufferData> buffers;
-	lng p, cp = 0;
-	while (bufsiz > start_index) {
-		for (p = bufsiz - 1; p >= start_index; p--) {
-			if (buf[p] == '\n' || buf[p] == '\r') {
-				cp = p + 1;
-				if (buf[p] == '\n' && p > 0 && buf[p - 1] == '\r') {
-					p--;
-				}
-				p--;
-				break;
-			}
+	UnlockMutex(io_lock.get());
+	return success;
+}
+
+bool StreamingTextFile::LoadBlockBefore(lng end_offset, lng preferred_end_line) {
+	LockMutex(text_lock.get());
+	lng index = FindBlock(end_offset - 1);
+	lng limit = index >= 0 ? BlockEnd(buffers[index]) : data_start;
+	UnlockMutex(text_lock.get());
+	if (limit >= end_offset) {
+		// the data in front of the offset has already been read
+		return true;
+	}
+
+	LockMutex(io_lock.get());
+	lng start, data_index;
+	bool success = ReadLinesBefore(end_offset, limit, start, data_index);
+	if (success) {
+		LockMutex(text_lock.get());
+		index = FindBlock(start);
+		limit = index >= 0 ? BlockEnd(buffers[index]) : data_start;
+		if (start >= limit && end_offset <= GapEnd(index)) {
+			PGTextBuffer* buffer = new PGTextBuffer();
+			FillBuffer(buffer, scratch + data_index, end_offset - start, true);
+			InsertBlock(buffer, index + 1, start, end_offset - start, preferred_end_line - (lng)buffer->line_count);
 		}
-		if (p < start_index) {
-			// no newline found
-			// we need to read until we find a newline, or until nothing is left in the buffer
-			buffers.push_back(BufferData(buf, bufsiz));
-			total_size += bufsiz;
-
-			bufsiz = ReadIntoBuffer(buf, start_index);
-			if (bufsiz <= start_index) {
-				break;
-			}
-		} else {
-			// found a newline
-			total_size += p;
-			break;
+		UnlockMutex(text_lock.get());
+	}
+	UnlockMutex(io_lock.get());
+	return success;
+}
+
+void StreamingTextFile::LoadNextBlock(PGTextBuffer* buffer) {
+	LockMutex(text_lock.get());
+	PGTextBuffer* next = buffer->_next;
+	lng end_offset = BlockEnd(next ? next : buffer);
+	bool last = buffer->index + 1 == (lng)buffers.size();
+	UnlockMutex(text_lock.get());
+	if (next) {
+		EnsureResident(next);
+		if (seekable) {
+			ScheduleReadAhead(end_offset);
 		}
+	} else if (seekable) {
+		LoadBlock(end_offset, false, 0);
+	} else if (last) {
+		ReadConvertedBlock();
 	}
-	// create a new buffer holding the data
-	// note: we only need to search the last buffer for new line characters
-	PGTextBuffer* last_buffer = this->buffers.size() > 0 ? this->buffers.back() : nullptr;
-	PGTextBuffer* new_buffer = new PGTextBuffer(nullptr, total_size, last_buffer ? last_buffer->start_line + last_buffer->line_count : 0);
+}
 
-	if (last_buffer) {
-		last_buffer->_next = new_buffer;
-		new_buffer->_prev = last_buffer;
-		new_buffer->cumulative_width = last_buffer->cumulative_width + last_buffer->width;
-		new_buffer->start_line = last_buffer->start_line + last_buffer->line_count;
-		new_buffer->index = last_buffer->index + 1;
+void StreamingTextFile::LoadPreviousBlock(PGTextBuffer* buffer) {
+	LockMutex(text_lock.get());
+	PGTextBuffer* prev = buffer->_prev;
+	lng offset = blocks[buffer].offset;
+	lng start_line = buffer->start_line;
+	UnlockMutex(text_lock.get());
+	if (prev) {
+		EnsureResident(prev);
+	} else if (seekable && offset > data_start) {
+		LoadBlockBefore(offset, start_line);
 	}
+}
 
-	size_t position = 0;
-	// first copy the cached data into the buffer
-	if (cached_buffer) {
-		assert(memchr(cached_buffer + cached_index, '\n', cached_size) == nullptr);
-		memcpy(new_buffer->buffer, cached_buffer + cached_index, cached_size);
-		position += cached_size;
+void StreamingTextFile::EnsureResident(PGTextBuffer* buffer) {
+	LockMutex(text_lock.get());
+	StreamingBlock& block = blocks[buffer];
+	if (block.resident) {
+		// move the buffer to the front of the list of recently used buffers
+		resident_buffers.splice(resident_buffers.begin(), resident_buffers, block.lru);
+		UnlockMutex(text_lock.get());
+		return;
 	}
-	// now copy any previous buffers into the array
-	for (auto it = buffers.begin(); it != buffers.end(); it++) {
-		memcpy(new_buffer->buffer + position, it->data, it->length);
-		position += it->length;
-		free(it->data);
-	}
-	// now move onto the last buffer
-	// this buffer we have to scan for newline characters
-	size_t prev_position = 0;
-	size_t prev_buffer_position = 0;
-	for (size_t i = start_index; i < p; i++) {
-		if (buf[i] == '\n' || buf[i] == '\r' || i + 1 == bufsiz) {
-			memcpy(new_buffer->buffer + position, buf + prev_position, i - prev_position);
-			position += i - prev_position;
-			new_buffer->buffer[position++] = '\n';
-			size_t cp = i;
-			if (buf[i] == '\r' && i + 1 < bufsiz && buf[i + 1] == '\n') {
-				i++;
-			}
-			// newline
-			new_buffer->line_start.push_back(position);
-			PGScalar length = MeasureTextWidth(PGStyleManager::default_font, new_buffer->buffer + prev_buffer_position, position - prev_buffer_position - 1);
-			if (max_line_length.buffer == nullptr || length > max_line_length.buffer->line_lengths[max_line_length.position]) {
-				max_line_length.buffer = new_buffer;
-				max_line_length.position = new_buffer->line_count;
-			}
-			new_buffer->line_lengths.push_back(length);
-			prev_position = i + 1;
-			prev_buffer_position = position;
-
-			linecount++;
-			new_buffer->width += length;
-			new_buffer->line_count++;
-			total_width += length;
+	lng offset = block.offset;
+	lng size = block.size;
+	UnlockMutex(text_lock.get());
+
+	LockMutex(io_lock.get());
+	ReserveScratch(size);
+	lng read = ReadRaw(offset, scratch, size);
+	LockMutex(text_lock.get());
+	if (!block.resident) {
+		lng line_count = buffer->line_count;
+		// the line information is kept when a buffer is evicted, so we only restore the text
+		FillBuffer(buffer, scratch, read, read != size);
+		if ((lng)buffer->line_count != line_count) {
+			// the file was modified on disk
+			AssignLineNumbers(buffer->index, buffer->start_line);
+			UpdateEstimates();
+		}
+		block.resident = true;
+		resident_buffers.push_front(buffer);
+		block.lru = resident_buffers.begin();
+		if (highlighter) {
+			HighlightBlock(buffer);
 		}
+		EvictBuffers(buffer);
 	}
-	new_buffer->current_size = position;
+	UnlockMutex(text_lock.get());
+	UnlockMutex(io_lock.get());
+}
 
-	new_buffer->next_callback = [](PGTextBuffer* buffer, void* data) {
-		StreamingTextFile* file = (StreamingTextFile*)data;
-		file->ReadBlock();
-	};
-	new_buffer->callback_data = this;
-	new_buffer->VerifyBuffer();
-	this->buffers.push_back(new_buffer);
-
-	// delete the old cache, as it has been placed into a buffer now
-	if (cached_buffer) {
-		free(cached_buffer);
-		cached_buffer = nullptr;
-		cached_size = cached_index = 0;
-	}
-	// move the remainder of the data into the cached buffer, if there is any
-	if (cp < bufsiz) {
-		cached_buffer = buf;
-		cached_size = bufsiz - cp;
-		cached_index = cp;
+void StreamingTextFile::FillBuffer(PGTextBuffer* buffer, const char* data, lng size, bool measure) {
+	// room for the newline that is added if the final line of the file does not end with one
+	lng required = size + 2;
+	if (!buffer->buffer) {
+		if (required <= TEXT_BUFFER_SIZE && spare_buffers.size() > 0) {
+			buffer->buffer = spare_buffers.back();
+			buffer->buffer_size = TEXT_BUFFER_SIZE;
+			spare_buffers.pop_back();
+		} else {
+			buffer->buffer_size = std::max(required, TEXT_BUFFER_SIZE);
+			buffer->buffer = (char*)malloc(buffer->buffer_size);
+		}
+		resident_memory += buffer->buffer_size;
+	}
+	if (measure) {
+		buffer->line_start.clear();
+		buffer->line_lengths.clear();
+		buffer->line_count = 0;
+		buffer->width = 0;
+	}
+
+	char* text = buffer->buffer;
+	lng position = 0;
+	lng line_begin = 0;
+	for (lng i = 0; i <= size; i++) {
+		if (i < size && data[i] != '\n' && data[i] != '\r') {
+			text[position++] = data[i];
+			continue;
+		}
+		if (i == size && position == line_begin && (!measure || buffer->line_count > 0)) {
+			// the data ends with a newline
+			break;
+		}
+		if (i < size && data[i] == '\r' && i + 1 < size && data[i + 1] == '\n') {
+			i++;
+		}
+		text[position++] = '\n';
+		if (measure) {
+			PGScalar length = MeasureTextWidth(PGStyleManager::default_font, text + line_begin, position - line_begin - 1);
+			buffer->line_start.push_back(position);
+			buffer->line_lengths.push_back(length);
+			buffer->line_count++;
+			buffer->width += length;
+			max_line_width = std::max(max_line_width, length);
+		}
+		line_begin = position;
+	}
+	buffer->current_size = position;
+	buffer->VerifyBuffer();
+}
+
+void StreamingTextFile::ReleaseText(PGTextBuffer* buffer) {
+	resident_memory -= buffer->buffer_size;
+	if (buffer->buffer_size == TEXT_BUFFER_SIZE && spare_buffers.size() < PGSTREAMING_SPARE_BUFFERS) {
+		spare_buffers.push_back(buffer->buffer);
 	} else {
-		// no data remaining in the current buffer; simply delete it
-		free(buf);
+		free(buffer->buffer);
+	}
+	buffer->buffer = nullptr;
+	buffer->syntax.clear();
+	buffer->parsed = false;
+}
+
+void StreamingTextFile::InsertBlock(PGTextBuffer* buffer, lng index, lng offset, lng size, lng preferred_line) {
+	buffers.insert(buffers.begin() + index, buffer);
+	StreamingBlock& block = blocks[buffer];
+	block.offset = offset;
+	block.size = size;
+	block.resident = true;
+	resident_buffers.push_front(buffer);
+	block.lru = resident_buffers.begin();
+
+	loaded_bytes += size;
+	loaded_lines += buffer->line_count;
+	loaded_width += buffer->width;
+
+	// only buffers that are directly adjacent in the file are linked together
+	// the callbacks read the missing neighbours when the buffers are iterated over
+	if (index > 0 && BlockEnd(buffers[index - 1]) == offset) {
+		buffers[index - 1]->_next = buffer;
+		buffer->_prev = buffers[index - 1];
 	}
-	VerifyTextfile();
+	if (index + 1 < (lng)buffers.size() && blocks[buffers[index + 1]].offset == offset + size) {
+		buffers[index + 1]->_prev = buffer;
+		buffer->_next = buffers[index + 1];
+	}
+	buffer->next_callback = [](PGTextBuffer* buffer, void* data) {
+		((StreamingTextFile*)data)->LoadNextBlock(buffer);
+	};
+	buffer->prev_callback = [](PGTextBuffer* buffer, void* data) {
+		((StreamingTextFile*)data)->LoadPreviousBlock(buffer);
+	};
+	buffer->callback_data = this;
 
+	AssignLineNumbers(index, preferred_line);
+	UpdateEstimates();
 	if (highlighter) {
-		HighlightText();
+		HighlightBlock(buffer);
+	}
+	EvictBuffers(buffer);
+}
+
+void StreamingTextFile::AssignLineNumbers(lng index, lng preferred_line) {
+	double average_width = AverageLineWidth();
+	for (lng i = index; i < (lng)buffers.size(); i++) {
+		PGTextBuffer* buffer = buffers[i];
+		buffer->index = i;
+		if (i == 0) {
+			// the first buffer is only the start of the file if we have not seeked past it
+			buffer->start_line = blocks[buffer].offset == data_start ? 0 : std::max(preferred_line, (lng)1);
+			buffer->cumulative_width = buffer->start_line * average_width;
+			continue;
+		}
+		PGTextBuffer* prev = buffers[i - 1];
+		lng end_line = prev->start_line + prev->line_count;
+		double end_width = prev->cumulative_width + prev->width;
+		if (buffer->_prev) {
+			// adjacent buffers continue exactly where the previous buffer ends
+			buffer->start_line = end_line;
+		} else {
+			lng start_line = buffer->start_line;
+			if (i == index) {
+				// a new buffer that ends where the next buffer starts is numbered backwards from the next buffer
+				start_line = buffer->_next ? (lng)buffer->_next->start_line - (lng)buffer->line_count : preferred_line;
+			}
+			// there is at least one unread line in between the buffers
+			buffer->start_line = std::max(start_line, end_line + 1);
+		}
+		buffer->cumulative_width = end_width + (buffer->start_line - end_line) * average_width;
+	}
+}
+
+void StreamingTextFile::UpdateEstimates() {
+	PGTextBuffer* last = buffers.back();
+	lng remaining = seekable ? file_size - BlockEnd(last) : 0;
+	lng remaining_lines = remaining > 0 ? std::max((lng)1, (lng)(remaining / AverageLineSize())) : 0;
+	linecount = last->start_line + last->line_count + remaining_lines;
+	total_width = last->cumulative_width + last->width + remaining_lines * AverageLineWidth();
+	bytes = std::min(loaded_bytes, total_bytes);
+}
+
+void StreamingTextFile::EvictBuffers(PGTextBuffer* keep) {
+	if (!seekable) return;
+	// readers can hold pointers into the text of any buffer, so nothing is evicted while the file is read
+	// the eviction is done when the last reader releases its lock instead (see ReadersFinished)
+	if (shared_counter > 0) return;
+	while (resident_memory > PGSTREAMING_RESIDENT_MEMORY && resident_buffers.size() > 1) {
+		PGTextBuffer* buffer = resident_buffers.back();
+		if (keep && (buffer == keep || buffer == keep->_prev || buffer == keep->_next)) {
+			break;
+		}
+		resident_buffers.pop_back();
+		blocks[buffer].resident = false;
+		ReleaseText(buffer);
 	}
+}
+
+void StreamingTextFile::ReadersFinished() {
+	EvictBuffers(nullptr);
+}
+
+lng StreamingTextFile::GetMemoryUsage() {
+	LockMutex(text_lock.get());
+	lng usage = resident_memory + (lng)spare_buffers.size() * TEXT_BUFFER_SIZE;
 	UnlockMutex(text_lock.get());
-	return true;
+	return usage;
+}
+
+lng StreamingTextFile::Unload() {
+	if (!is_loaded || !seekable) return 0;
+	Lock(PGWriteLock);
+	lng freed = resident_memory + (lng)spare_buffers.size() * TEXT_BUFFER_SIZE;
+	while (resident_buffers.size() > 0) {
+		PGTextBuffer* buffer = resident_buffers.back();
+		resident_buffers.pop_back();
+		blocks[buffer].resident = false;
+		ReleaseText(buffer);
+	}
+	for (auto it = spare_buffers.begin(); it != spare_buffers.end(); it++) {
+		free(*it);
+	}
+	spare_buffers.clear();
+	Unlock(PGWriteLock);
+
+	LockMutex(read_ahead_lock.get());
+	if (!read_ahead_pending) {
+		freed += read_ahead.size();
+		std::string().swap(read_ahead);
+		std::string().swap(read_ahead_buffer);
+		read_ahead_offset = -1;
+	}
+	UnlockMutex(read_ahead_lock.get());
+	return freed;
+}
+
+void StreamingTextFile::HighlightBlock(PGTextBuffer* buffer) {
+	// blocks are highlighted as they are read; a block continues from the state of the previous block
+	// only if that block is directly adjacent to it
+	PGParseErrors errors;
+	PGParserState oldstate = buffer->state;
+	buffer->state = highlighter->ParseBuffer(buffer, buffer->_prev ? buffer->_prev->state : nullptr, errors);
+	buffer->UpdateVersion();
+	if (oldstate) {
+		highlighter->DeleteParserState(oldstate);
+	}
 }
 
-std::shared_ptr<TextFile> StreamingTextFile::OpenTextFile(std::string filename, PGFileError& error, bool ignore_binary) {
+std::shared_ptr<TextFile> StreamingTextFile::OpenTextFile(std::string filename, PGFileError& error, bool ignore_binary, bool defer_loading) {
+	if (defer_loading) {
+		// the file is only opened when it is first needed, for now we only check that it still exists
+		error = PGFileSuccess;
+		if (PGGetFileFlags(filename).flags == PGFileFlagsFileNotFound) {
+			error = PGFileIOError;
+			return nullptr;
+		}
+		auto file = std::shared_ptr<StreamingTextFile>(new StreamingTextFile(filename));
+		file->deferred = true;
+		return file;
+	}
 	PGFileHandle handle = panther::OpenFile(filename, PGFileReadOnly, error);
 	if (!handle) {
 		return nullptr;
@@ -352,7 +793,7 @@ void StreamingTextFile::SetLanguage(PGLanguage* language) {
 }
 
 lng StreamingTextFile::GetLineCount() {
-	//assert(0);
+	// for seekable files this includes an estimate of the lines that have not been read yet
 	return linecount;
 }
 
@@ -362,8 +803,9 @@ void StreamingTextFile::IndentText(std::vector<Cursor>& cursors, PGDirection dir
 
 PGScalar StreamingTextFile::GetMaxLineWidth(PGFontHandle font) {
 	if (!is_loaded) return 0;
-	assert(max_line_length.buffer);
-	return GetTextFontSize(font) / 10.0 * max_line_length.buffer->line_lengths[max_line_length.position];
+	// the line lengths of evicted buffers are kept, but we track the maximum separately
+	// so we do not have to hold on to the buffer that contains the longest line
+	return GetTextFontSize(font) / 10.0 * max_line_width;
 }
 
 TextFile::PGStoreFileType StreamingTextFile::WorkspaceFileStorage() {
@@ -392,23 +834,79 @@ void StreamingTextFile::ConvertToIndentation(PGLineIndentation indentation) {
 }
 
 PGTextBuffer* StreamingTextFile::GetBuffer(lng line) {
-	while (line > linecount && handle) {
-		ReadBlock();
+	if (!seekable) {
+		while (line >= linecount && ReadConvertedBlock());
+		PGTextBuffer* buffer = buffers[PGTextBuffer::GetBuffer(buffers, line)];
+		EnsureResident(buffer);
+		return buffer;
+	}
+	while (true) {
+		LockMutex(text_lock.get());
+		PGTextBuffer* buffer = buffers[PGTextBuffer::GetBuffer(buffers, line)];
+		lng end_line = buffer->start_line + buffer->line_count;
+		lng end_offset = BlockEnd(buffer);
+		lng limit = GapEnd(buffer->index);
+		lng next_line = buffer->index + 1 < (lng)buffers.size() ? (lng)buffers[buffer->index + 1]->start_line : linecount;
+		UnlockMutex(text_lock.get());
+		if (line < end_line || end_offset >= limit) {
+			EnsureResident(buffer);
+			return buffer;
+		}
+		// the line has not been read yet: if it is close by we read up to it,
+		// otherwise we interpolate where it is in the unread range and only read the lines around it
+		double fraction = (double)(line - end_line) / std::max(next_line - end_line, (lng)1);
+		lng distance = std::min((lng)(fraction * (limit - end_offset)), limit - end_offset - 1);
+		bool success;
+		if (distance < PGSTREAMING_SEEK_DISTANCE) {
+			success = LoadBlock(end_offset, false, end_line);
+		} else {
+			success = LoadBlock(end_offset + distance, true, line);
+		}
+		if (!success) {
+			EnsureResident(buffer);
+			return buffer;
+		}
 	}
-	return buffers[PGTextBuffer::GetBuffer(buffers, line)];
 }
 
 PGTextBuffer* StreamingTextFile::GetBufferFromWidth(double width) {
-	while (width > total_width && handle) {
-		ReadBlock();
+	if (!seekable) {
+		while (width >= total_width && ReadConvertedBlock());
+		PGTextBuffer* buffer = buffers[PGTextBuffer::GetBufferFromWidth(buffers, width)];
+		EnsureResident(buffer);
+		return buffer;
 	}
-	return buffers[PGTextBuffer::GetBufferFromWidth(buffers, width)];
+	LockMutex(text_lock.get());
+	PGTextBuffer* buffer = buffers[PGTextBuffer::GetBufferFromWidth(buffers, width)];
+	double end_width = buffer->cumulative_width + buffer->width;
+	lng end_line = buffer->start_line + buffer->line_count;
+	double average_width = AverageLineWidth();
+	UnlockMutex(text_lock.get());
+	if (width < end_width || average_width <= 0) {
+		EnsureResident(buffer);
+		return buffer;
+	}
+	return GetBuffer(end_line + (lng)((width - end_width) / average_width));
 }
 
 PGTextBuffer* StreamingTextFile::GetFirstBuffer() {
-	return buffers.front();
+	PGTextBuffer* buffer = buffers.front();
+	EnsureResident(buffer);
+	return buffer;
 }
 
 PGTextBuffer* StreamingTextFile::GetLastBuffer() {
-	return buffers.back();
+	if (seekable) {
+		// read the end of the file, without reading anything in between
+		LockMutex(text_lock.get());
+		lng end_offset = BlockEnd(buffers.back());
+		lng end_line = linecount;
+		UnlockMutex(text_lock.get());
+		if (end_offset < file_size) {
+			LoadBlockBefore(file_size, end_line);
+		}
+	}
+	PGTextBuffer* buffer = buffers.back();
+	EnsureResident(buffer);
+	return buffer;
 }
@@ -1,12 +1,16 @@
 
 #include "textfile.h"
 
+#include <list>
+#include <unordered_map>
+
 
 class StreamingTextFile : public TextFile {
 public:
 	~StreamingTextFile();
 
-	static std::shared_ptr<TextFile> OpenTextFile(std::string filename, PGFileError& error, bool ignore_binary = false);
+	// if defer_loading is set the file is not read until TextFile::Load is called
+	static std::shared_ptr<TextFile> OpenTextFile(std::string filename, PGFileError& error, bool ignore_binary = false, bool defer_loading = false);
 
 	TextLine GetLine(lng linenumber);
 
@@ -48,6 +52,11 @@ public:
 
 	PGScalar GetMaxLineWidth(PGFontHandle font);
 	PGStoreFileType WorkspaceFileStorage();
+	bool IsStreaming() { return true; }
+
+	lng GetMemoryUsage();
+	// evicts the text of every buffer, the line information is kept so the buffers are read again on demand
+	lng Unload();
 
 	PGTextRange FindMatch(PGRegexHandle regex_handle, PGDirection direction, lng start_line, lng start_character, lng end_line, lng end_character, bool wrap);
 	PGTextRange FindMatch(PGRegexHandle regex_handle, PGDirection direction, PGTextBuffer* start_buffer, lng start_position, PGTextBuffer* end_buffer, lng end_position, bool wrap);
@@ -60,7 +69,20 @@ public:
 	PGTextBuffer* GetBufferFromWidth(double width);
 	PGTextBuffer* GetFirstBuffer();
 	PGTextBuffer* GetLastBuffer();
+
+	// streaming files cannot be modified, and their buffers are loaded and evicted on demand
+	std::shared_ptr<PGTextSnapshot> GetSnapshot() { return nullptr; }
 private:
+	// a block of complete lines of the file that is (or was) held in one of the buffers
+	struct StreamingBlock {
+		// the range of bytes of the file that is stored in the buffer
+		lng offset = 0;
+		lng size = 0;
+		// whether or not the text of the buffer is currently in memory
+		bool resident = false;
+		std::list<PGTextBuffer*>::iterator lru;
+	};
+
 	PGEncoderHandle decoder = nullptr;
 
 	char* output = nullptr;
@@ -68,14 +90,80 @@ private:
 	char* intermediate_buffer = nullptr;
 	lng intermediate_size = 0;
 
-	char* cached_buffer = nullptr;
-	size_t cached_index = 0;
-	size_t cached_size = 0;
-	
-	StreamingTextFile(PGFileHandle handle, std::string filename);
+	// only files that can be read without converting them support random access and eviction
+	// other files are converted and read from front to back
+	bool seekable = true;
+	lng file_size = 0;
+	// the offset of the first byte of text, after a potential byte order mark
+	lng data_start = 0;
+	// the read position and the text following the last complete line, for files that are converted
+	lng converted_offset = 0;
+	std::string converted_text;
+
+	// the buffers in the order of the file; there can be gaps between them that have not been read yet
+	std::unordered_map<PGTextBuffer*, StreamingBlock> blocks;
+	// buffers whose text is in memory, the most recently used buffer first
+	std::list<PGTextBuffer*> resident_buffers;
+	lng resident_memory = 0;
+	// text memory of evicted buffers that is reused for new buffers
+	std::vector<char*> spare_buffers;
+
+	// statistics of all blocks read so far, used to estimate the line numbers of unread parts of the file
+	lng loaded_bytes = 0;
+	lng loaded_lines = 0;
+	double loaded_width = 0;
+	PGScalar max_line_width = 0;
+
+	// protects the file handle and the scratch buffer; always acquired before the text_lock
+	std::unique_ptr<PGMutex> io_lock;
+	char* scratch = nullptr;
+	lng scratch_size = 0;
+	PGFileHandle handle;
 
-	lng ReadIntoBuffer(char*& buffer, lng& start_index);
-	bool ReadBlock();
+	// data read ahead by a background task, so reading forward does not have to wait for the disk
+	std::unique_ptr<PGMutex> read_ahead_lock;
+	PGFileHandle read_ahead_handle = nullptr;
+	std::string read_ahead;
+	std::string read_ahead_buffer;
+	lng read_ahead_offset = -1;
+	bool read_ahead_pending = false;
 
-	PGFileHandle handle;
-};
\ No newline at end of file
+	StreamingTextFile(std::string filename);
+	StreamingTextFile(PGFileHandle handle, std::string filename);
+
+	// reads the start of the file, the caller holds the io_lock (or no other thread can access the file yet)
+	void ReadStart(PGFileHandle handle);
+	void ReadDeferred();
+
+	lng ReadRaw(lng offset, char* buffer, lng size);
+	void ReserveScratch(lng size);
+	void ScheduleReadAhead(lng offset);
+	void ReadAhead(lng offset);
+
+	bool ReadLines(lng offset, lng limit, bool align, lng& start, lng& size, lng& data_index);
+	bool ReadLinesBefore(lng end_offset, lng limit, lng& start, lng& data_index);
+	bool ReadConvertedBlock();
+
+	bool LoadBlock(lng offset, bool align, lng preferred_line);
+	bool LoadBlockBefore(lng end_offset, lng preferred_end_line);
+	void LoadNextBlock(PGTextBuffer* buffer);
+	void LoadPreviousBlock(PGTextBuffer* buffer);
+	void EnsureResident(PGTextBuffer* buffer);
+
+	void FillBuffer(PGTextBuffer* buffer, const char* data, lng size, bool measure);
+	void ReleaseText(PGTextBuffer* buffer);
+	void InsertBlock(PGTextBuffer* buffer, lng index, lng offset, lng size, lng preferred_line);
+	void AssignLineNumbers(lng index, lng preferred_line);
+	void UpdateEstimates();
+	// evicts the least recently used buffers until the text fits in the memory budget again
+	// the caller holds the text_lock; nothing is evicted while a read lock is held
+	void EvictBuffers(PGTextBuffer* keep);
+	void ReadersFinished();
+	void HighlightBlock(PGTextBuffer* buffer);
+
+	lng FindBlock(lng offset);
+	lng BlockEnd(PGTextBuffer* buffer) { StreamingBlock& block = blocks[buffer]; return block.offset + block.size; }
+	lng GapEnd(lng index);
+	double AverageLineSize() { return loaded_lines > 0 ? std::max(1.0, (double)loaded_bytes / loaded_lines) : 80; }
+	double AverageLineWidth() { return loaded_lines > 0 ? loaded_width / loaded_lines : 0; }
+};
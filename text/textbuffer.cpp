@@ -4,14 +4,18 @@
 #include "textfile.h"
 #include "unicode.h"
 
+#include <atomic>
+
 lng TEXT_BUFFER_SIZE = 4096;
 
+static std::atomic<lng> buffer_version(0);
+
 
 PGTextBuffer::PGTextBuffer() : 
 	buffer(nullptr), buffer_size(0), current_size(0), start_line(0), 
 	state(nullptr), cumulative_width(0), syntax(),
 	width(0), line_count(0), index(0) {
-
+	UpdateVersion();
 }
 
 PGTextBuffer::PGTextBuffer(const char* text, lng size, lng start_line) :
@@ -26,6 +30,7 @@ PGTextBuffer::PGTextBuffer(const char* text, lng size, lng start_line) :
 	if (text) {
 		memcpy(buffer, text, size);
 	}
+	UpdateVersion();
 }
 
 PGTextBuffer::~PGTextBuffer() {
@@ -34,6 +39,10 @@ PGTextBuffer::~PGTextBuffer() {
 	}
 }
 
+void PGTextBuffer::UpdateVersion() {
+	version = ++buffer_version;
+}
+
 lng PGTextBuffer::GetLineCount() {
 	return line_count;
 }
@@ -42,25 +51,6 @@ double PGTextBuffer::GetTotalWidth(double total_width) {
 	return width;
 }
 
-
-std::vector<TextLine> PGTextBuffer::GetLines() {
-	std::vector<TextLine> lines;
-	lng current_position = 0;
-	lng line = 0;
-	for (lng i = 0; i < current_size; ) {
-		int offset = utf8_character_length(buffer[i]);
-		if (offset == 1 && buffer[i] == '\n') {
-			assert(!parsed || (line >= 0 && line < this->syntax.size()));
-			PGSyntax* syntax = parsed ? &this->syntax[line] : nullptr;
-			lines.push_back(TextLine(buffer + current_position, i - current_position, syntax));
-			current_position = i + 1;
-			line++;
-		}
-		i += offset;
-	}
-	return lines;
-}
-
 TextLine PGTextBuffer::GetLineFromPosition(ulng pos) {
 	lng line_pos = GetStartLine(pos);
 	lng start = line_pos == 0 ? 0 : line_start[line_pos - 1];
@@ -192,7 +182,7 @@ PGBufferUpdate PGTextBuffer::InsertText(std::vector<PGTextBuffer*>& buffers, PGT
 						for (lng k = buffer->line_count; k < buffer->line_start.size(); k++) {
 							new_buffer->line_start.push_back(buffer->line_start[k] - split_point);
 						}
-						buffer->line_start.erase(buffer->line_start.begin() + buffer->line_count - 1, buffer->line_start.end());
+						buffer->line_start.erase(buffer->line_count - 1, buffer->line_start.size());
 
 						PGTextBuffer* text_buffer = buffer;
 						if (split_point <= position) {
@@ -311,9 +301,7 @@ void PGTextBuffer::InsertText(ulng position, std::string text) {
 	assert(position <= current_size);
 	lng start_line = GetStartLine(position);
 	// have to update line_start for all subsequent lines
-	for (size_t i = start_line; i < line_start.size(); i++) {
-		line_start[i] += text.size();
-	}
+	line_start.Shift(start_line, text.size());
 	// first move the edge of the buffer to the right so we can fit the text into the buffer
 	memmove(buffer + position + text.size(), buffer + position, current_size - position);
 	// now insert the text into the buffer
@@ -325,9 +313,7 @@ void PGTextBuffer::InsertText(ulng position, std::string text) {
 void PGTextBuffer::DeleteText(ulng position, ulng size) {
 	lng start_line = GetStartLine(position);
 	// have to update line_start for all subsequent lines
-	for(size_t i = start_line; i < line_start.size(); i++) {
-		line_start[i] -= size;
-	}
+	line_start.Shift(start_line, -(lng)size);
 	this->_DeleteText(position, size);
 }
 
@@ -336,13 +322,11 @@ lng PGTextBuffer::DeleteLines(ulng position, ulng end_position) {
 	lng end_line = GetStartLine(end_position);
 	if (end_line != start_line) {
 		// remove any erased lines from line_start
-		line_start.erase(line_start.begin() + start_line, line_start.begin() + end_line);	
+		line_start.erase(start_line, end_line);
 	}
 	lng size = end_position - position;
 	// have to update line_start for all subsequent lines
-	for(size_t i = start_line; i < line_start.size(); i++) {
-		line_start[i] -= size;
-	}
+	line_start.Shift(start_line, -size);
 	this->_DeleteText(position, size);
 	return end_line - start_line;
 }
@@ -362,13 +346,7 @@ lng PGTextBuffer::DeleteLines(ulng position) {
 }
 
 lng PGTextBuffer::GetStartLine(lng position) {
-	// FIXME: either binary search or non-branching loop here
-	for(size_t i = 0; i < line_start.size(); i++) {
-		if (line_start[i] > position) {
-			return i;
-		}
-	}
-	return line_start.size();
+	return line_start.Find(position);
 }
 
 void PGTextBuffer::VerifyBuffer() {
@@ -385,6 +363,80 @@ void PGTextBuffer::VerifyBuffer() {
 #endif
 }
 
+void PGLineIndex::insert(size_t index, lng position) {
+	assert(index <= starts.size());
+	if (index < shift_index) {
+		// the entry is inserted before the shifted entries
+		shift_index++;
+		starts.insert(starts.begin() + index, position);
+	} else {
+		starts.insert(starts.begin() + index, position - shift);
+	}
+}
+
+void PGLineIndex::erase(size_t start, size_t end) {
+	assert(start <= end && end <= starts.size());
+	if (shift_index > start) {
+		shift_index = shift_index >= end ? shift_index - (end - start) : start;
+	}
+	starts.erase(starts.begin() + start, starts.begin() + end);
+}
+
+void PGLineIndex::clear() {
+	starts.clear();
+	shift_index = 0;
+	shift = 0;
+}
+
+void PGLineIndex::Shift(size_t index, lng offset) {
+	assert(index <= starts.size());
+	if (shift != 0 && index != shift_index) {
+		ApplyShift();
+	}
+	shift_index = index;
+	shift += offset;
+}
+
+void PGLineIndex::ApplyShift() {
+	for (size_t i = shift_index; i < starts.size(); i++) {
+		starts[i] += shift;
+	}
+	shift = 0;
+}
+
+size_t PGLineIndex::Find(lng position) const {
+	// binary search for the first entry that is bigger than position
+	size_t first = 0;
+	size_t last = starts.size();
+	while (first < last) {
+		size_t middle = first + (last - first) / 2;
+		if ((*this)[middle] > position) {
+			last = middle;
+		} else {
+			first = middle + 1;
+		}
+	}
+	return first;
+}
+
+void PGLineIndex::Build(const char* text, lng size) {
+	clear();
+	// memchr skips over the text between newlines many bytes at a time
+	const char* end = text + size - 1;
+	const char* ptr = text;
+	while (ptr < end && (ptr = (const char*)memchr(ptr, '\n', end - ptr)) != nullptr) {
+		ptr++;
+		starts.push_back(ptr - text);
+	}
+}
+
+const lng* PGLineIndex::data() {
+	if (shift != 0) {
+		ApplyShift();
+	}
+	return starts.data();
+}
+
 void SetTextBufferSize(lng bufsiz) {
 	TEXT_BUFFER_SIZE = bufsiz;
 }
@@ -2,6 +2,7 @@
 
 #include "syntax.h"
 #include "utils.h"
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -10,6 +11,7 @@ extern lng TEXT_BUFFER_SIZE;
 class TextFile;
 struct TextLine;
 struct PGTextBuffer;
+struct PGBufferContent;
 
 struct PGCursorPosition {
 	lng line;
@@ -51,6 +53,38 @@ struct PGBufferUpdate {
 	PGBufferUpdate(lng split_point, PGTextBuffer* new_buffer) : split_point(split_point), new_buffer(new_buffer) { }
 };
 
+// the start positions of the lines in a buffer: line (i + 1) starts at [i], the first line always starts at 0
+// an edit shifts the start of every line after it; rather than updating all of them on every edit
+// the most recent shift is kept pending as (shift_index, shift) and only applied when an edit is made
+// on a different line, so repeated edits of the same line (e.g. typing) take constant time
+struct PGLineIndex {
+	lng operator[](size_t index) const { return starts[index] + (index >= shift_index ? shift : 0); }
+	size_t size() const { return starts.size(); }
+	size_t capacity() const { return starts.capacity(); }
+	lng back() const { return (*this)[starts.size() - 1]; }
+
+	void push_back(lng position) { insert(starts.size(), position); }
+	void insert(size_t index, lng position);
+	// removes the entries [start, end)
+	void erase(size_t start, size_t end);
+	void clear();
+	// adds "offset" to every entry from "index" onwards
+	void Shift(size_t index, lng offset);
+	// returns the index of the first entry that is bigger than "position" (i.e. the line of "position")
+	size_t Find(lng position) const;
+	// replaces the entries with the line starts of "text", the final character of the text is not considered
+	void Build(const char* text, lng size);
+	// returns the entries as a contiguous array; this applies the pending shift,
+	// so it should only be called when the buffer could also be modified
+	const lng* data();
+private:
+	std::vector<lng> starts;
+	size_t shift_index = 0;
+	lng shift = 0;
+
+	void ApplyShift();
+};
+
 typedef void (*PGTextBufferCallback)(PGTextBuffer* buffer, void* data);
 
 struct PGTextBuffer {
@@ -70,18 +104,23 @@ public:
 	PGParserState state = nullptr;
 	bool parsed = false;
 
+	// changes whenever the text or the syntax of the buffer changes
+	// versions are never reused (not even by other buffers), so a buffer and its version identify its contents
+	lng version = 0;
+	void UpdateVersion();
+
+	// the callbacks are invoked on every access, so a streaming file can load
+	// the neighbouring buffer or reload its text if it has been evicted
 	PGTextBuffer* prev() {
 		if (prev_callback) {
-			if (!_prev) prev_callback(this, callback_data);
-			prev_callback = nullptr;
+			prev_callback(this, callback_data);
 		}
 		return _prev;
 	}
 
 	PGTextBuffer* next() {
 		if (next_callback) {
-			if (!_next) next_callback(this, callback_data);
-			next_callback = nullptr;
+			next_callback(this, callback_data);
 		}
 		return _next;
 	}
@@ -97,9 +136,13 @@ public:
 	double cumulative_width = -1;
 
 	std::vector<PGSyntax> syntax;
-	std::vector<lng> line_start;
+	PGLineIndex line_start;
 	std::vector<PGScalar> line_lengths;
 
+	// the contents of this buffer as captured by the most recent snapshot that is still alive (see textsnapshot.h)
+	// this is cleared when the buffer is modified, so snapshots share the contents of unmodified buffers
+	std::weak_ptr<PGBufferContent> snapshot_content;
+
 	void Extend(ulng new_size);
 
 	//std::string GetString() { return std::string(buffer, next ? current_size : current_size - 1); }
@@ -130,8 +173,6 @@ public:
 	lng GetLineCount();
 	// gets the total width in the buffer; parameter should be total width of the text file
 	double GetTotalWidth(double total_width);
-	// gets all the lines in the buffer as TextLines
-	std::vector<TextLine> GetLines();
 	ulng GetBufferLocationFromCursor(lng line, lng character);
 	void GetCursorFromBufferLocation(lng position, lng& line, lng& character);
 
@@ -24,6 +24,7 @@ typedef enum {
 	PGDeltaRemoveCharacter,
 	PGDeltaRemoveWord,
 	PGDeltaAddEmptyLine,
+	PGDeltaBulkReplace,
 	PGDeltaUnknown
 } PGTextType;
 
@@ -69,6 +70,20 @@ public:
 	~PGRegexReplace();
 };
 
+// replaces many ranges of the text at once (e.g. replace all)
+// the buffers that contain the ranges are rebuilt in a single pass, instead of replacing the ranges one by one
+class PGBulkReplace : public TextDelta {
+public:
+	// the start of every replaced range in the text before (start) and after (replacement_start) the replacement
+	std::vector<PGCursorPosition> start;
+	std::vector<PGCursorPosition> replacement_start;
+	std::vector<std::string> removed_text;
+	std::vector<std::string> added_text;
+
+	PGBulkReplace() :
+		TextDelta(PGDeltaBulkReplace) { }
+};
+
 class RemoveText : public TextDelta {
 public:
 	std::vector<std::string> removed_text;
@@ -17,6 +17,9 @@
 
 #include "inmemorytextfile.h"
 
+// the minimum amount of unparsed buffers for which highlighting is spread over the worker threads
+#define PARALLEL_HIGHLIGHT_THRESHOLD 4
+
 TextFile::TextFile() :
 	highlighter(nullptr), bytes(0), total_bytes(1), last_modified_time(-1), last_modified_notification(-1),
 	last_modified_deletion(false), saved_undo_count(0), read_only(false), reload_on_changed(true),
@@ -24,6 +27,7 @@ TextFile::TextFile() :
 	this->path = "";
 	this->name = std::string("untitled");
 	this->text_lock = std::unique_ptr<PGMutex>(CreateMutex());
+	this->snapshot_lock = std::unique_ptr<PGMutex>(CreateMutex());
 	this->loading_lock = std::unique_ptr<PGMutex>(CreateMutex());
 	this->indentation = PGIndentionTabs;
 	this->tabwidth = 4;
@@ -44,6 +48,7 @@ TextFile::TextFile(std::string path)  :
 	this->ext = pos == std::string::npos ? std::string("") : path.substr(pos + 1);
 	this->current_task = nullptr;
 	this->text_lock = std::unique_ptr<PGMutex>(CreateMutex());
+	this->snapshot_lock = std::unique_ptr<PGMutex>(CreateMutex());
 	this->loading_lock = std::unique_ptr<PGMutex>(CreateMutex());
 
 	this->language = PGLanguageManager::GetLanguage(ext);
@@ -51,10 +56,13 @@ TextFile::TextFile(std::string path)  :
 		highlighter = std::unique_ptr<SyntaxHighlighter>(this->language->CreateHighlighter());
 	}
 	unsaved_changes = false;
+
+	this->watch_group = FileWatcher::CreateGroup();
+	FileWatcher::WatchFile(watch_group, path);
 }
 
 TextFile::~TextFile() {
-
+	FileWatcher::DestroyGroup(watch_group);
 }
 
 
@@ -75,6 +83,8 @@ void TextFile::InvalidateBuffer(PGTextBuffer* buffer) {
 	buffer->parsed = false;
 	buffer->line_lengths.clear();
 	buffer->cumulative_width = -1;
+	buffer->snapshot_content.reset();
+	buffer->UpdateVersion();
 }
 
 void TextFile::Lock(PGLockType type) {
@@ -107,6 +117,9 @@ void TextFile::Unlock(PGLockType type) {
 		LockMutex(text_lock.get());
 		// decrement the shared counter
 		shared_counter--;
+		if (shared_counter == 0) {
+			ReadersFinished();
+		}
 		UnlockMutex(text_lock.get());
 	}
 }
@@ -197,6 +210,12 @@ void TextFile::SaveAs(std::string path) {
 }
 
 void TextFile::SetFilePath(std::string path) {
+	if (!watch_group) {
+		watch_group = FileWatcher::CreateGroup();
+	} else {
+		FileWatcher::Unwatch(watch_group, this->path);
+	}
+	FileWatcher::WatchFile(watch_group, path);
 	this->path = path;
 	this->name = path.substr(path.find_last_of(GetSystemPathSeparator()) + 1);
 	lng pos = path.find_last_of('.');
@@ -211,6 +230,15 @@ void TextFile::UpdateModificationTime() {
 	}
 }
 
+bool TextFile::PollExternalChanges() {
+	if (FileInMemory()) return false;
+	bool changed = last_modified_notification < 0 || !watch_group;
+	if (watch_group && FileWatcher::GetChanges(watch_group).size() > 0) {
+		changed = true;
+	}
+	return changed;
+}
+
 void TextFile::ChangeLineEnding(PGLineEnding lineending) {
 	if (!is_loaded) return;
 	this->lineending = lineending;
@@ -250,6 +278,12 @@ void TextFile::ApplySettings(PGTextFileSettings settings) {
 	if (settings.encoding != PGEncodingUnknown) {
 		this->encoding = settings.encoding;
 	}
+	if (settings.indentation != PGIndentionUnknown) {
+		this->indentation = settings.indentation;
+	}
+	if (settings.tabwidth > 0) {
+		this->tabwidth = settings.tabwidth;
+	}
 	if (settings.name.size() > 0) {
 		this->name = settings.name;
 	}
@@ -281,6 +315,46 @@ void TextFile::OnLoaded(PGTextFileLoadedCallback callback, PGTextFileDestructorC
 	UnlockMutex(loading_lock.get());
 }
 
+void TextFile::Load(PGTaskUrgency urgency) {
+	if (!deferred) return;
+	auto file = new std::weak_ptr<TextFile>(shared_from_this());
+	Scheduler::RegisterTask(std::make_shared<Task>([](std::shared_ptr<Task> task, void* data) {
+		std::weak_ptr<TextFile>* file = (std::weak_ptr<TextFile>*)data;
+		auto ptr = file->lock();
+		if (ptr) {
+			ptr->LoadDeferred();
+		}
+		delete file;
+	}, file), urgency);
+}
+
+bool TextFile::IsVisible() {
+	for (auto it = views.begin(); it != views.end(); it++) {
+		auto view = it->lock();
+		if (view && view->textfield && view->textfield->GetTextView() == view) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void TextFile::MarkUsed() {
+	static lng usage_counter = 0;
+	last_used = ++usage_counter;
+}
+
+void TextFile::LoadDeferred() {
+	// the file can be requested multiple times (e.g. warmed up in the background and then activated)
+	// only the first task to get here actually reads it
+	LockMutex(loading_lock.get());
+	bool load = deferred && !pending_delete;
+	deferred = false;
+	UnlockMutex(loading_lock.get());
+	if (load) {
+		ReadDeferred();
+	}
+}
+
 void TextFile::FinalizeLoading() {
 	is_loaded = true;
 	LockMutex(loading_lock.get());
@@ -531,6 +605,16 @@ void TextFile::VerifyTextfile() {
 }
 
 void TextFile::HighlightText() {
+	if (this->highlighter->SupportsParallelParsing() && Scheduler::GetThreadCount() > 0) {
+		lng unparsed = 0;
+		for (auto it = buffers.begin(); it != buffers.end(); it++) {
+			if (!(*it)->parsed) unparsed++;
+		}
+		if (unparsed >= PARALLEL_HIGHLIGHT_THRESHOLD) {
+			HighlightTextParallel();
+			return;
+		}
+	}
 	for (lng i = 0; i < (lng)this->buffers.size(); i++) {
 		if (!this->buffers[i]->parsed) {
 			// if we encounter a non-parsed block, parse it and any subsequent blocks that have to be parsed
@@ -539,25 +623,11 @@ void TextFile::HighlightText() {
 				PGTextBuffer* buffer = this->buffers[current_block];
 				PGParseErrors errors;
 				PGParserState oldstate = buffer->state;
-				PGParserState state = current_block == 0 ? this->highlighter->GetDefaultState() : this->buffers[current_block - 1]->state;
-
-				lng linecount = buffer->GetLineCount();
-				assert(linecount > 0);
+				PGParserState state = current_block == 0 ? nullptr : this->buffers[current_block - 1]->state;
 
-				buffer->syntax.clear();
-
-				int index = 0;
-				for (auto it = TextLineIterator(this->buffers[current_block]); ; it++) {
-					TextLine line = it.GetLine();
-					PGSyntax syntax;
-					state = this->highlighter->IncrementalParseLine(line, i, state, errors, syntax);
-					buffer->syntax.push_back(syntax);
-					index++;
-					if (index == linecount) break;
-				}
-				buffer->parsed = true;
-				buffer->state = this->highlighter->CopyParserState(state);
-				bool equivalent = !oldstate ? false : this->highlighter->StateEquivalent(this->buffers[current_block]->state, oldstate);
+				buffer->state = this->highlighter->ParseBuffer(buffer, state, errors);
+				buffer->UpdateVersion();
+				bool equivalent = !oldstate ? false : this->highlighter->StateEquivalent(buffer->state, oldstate);
 				if (oldstate) {
 					this->highlighter->DeleteParserState(oldstate);
 				}
@@ -570,3 +640,90 @@ void TextFile::HighlightText() {
 		}
 	}
 }
+
+struct ParallelHighlightData {
+	SyntaxHighlighter* highlighter;
+	std::vector<PGTextBuffer*>* buffers;
+	// the buffers that are parsed speculatively, and the start state we guessed for each of them
+	std::vector<lng>* speculative;
+	std::vector<PGParserState>* guesses;
+	std::vector<PGParserState>* end_states;
+};
+
+void TextFile::HighlightTextParallel() {
+	// every unparsed buffer is parsed at the same time, starting from a guessed state:
+	// the end state the previous buffer had after the last parse, or the default state if there is none
+	// afterwards we walk over the buffers in order, and parse a buffer again only if its guess was wrong
+	lng count = (lng) buffers.size();
+	std::vector<lng> speculative;
+	std::vector<PGParserState> guesses(count, nullptr);
+	std::vector<PGParserState> end_states(count, nullptr);
+	// the end state of every buffer from before this parse; these are only deleted at the end,
+	// so the guesses that point to them remain valid
+	std::vector<PGParserState> previous(count, nullptr);
+	std::vector<bool> guessed(count, false);
+	std::vector<bool> parsed(count, false);
+	for (lng i = 0; i < count; i++) {
+		if (!buffers[i]->parsed) {
+			speculative.push_back(i);
+			guessed[i] = true;
+			guesses[i] = i == 0 ? nullptr : buffers[i - 1]->state;
+		}
+	}
+
+	ParallelHighlightData data;
+	data.highlighter = this->highlighter.get();
+	data.buffers = &buffers;
+	data.speculative = &speculative;
+	data.guesses = &guesses;
+	data.end_states = &end_states;
+	Scheduler::RunParallel(speculative.size(), [](lng index, void* d) {
+		ParallelHighlightData* data = (ParallelHighlightData*)d;
+		lng i = (*data->speculative)[index];
+		PGParseErrors errors;
+		(*data->end_states)[i] = data->highlighter->ParseBuffer((*data->buffers)[i], (*data->guesses)[i], errors);
+	}, &data);
+
+	for (auto it = speculative.begin(); it != speculative.end(); it++) {
+		previous[*it] = buffers[*it]->state;
+		buffers[*it]->state = end_states[*it];
+		buffers[*it]->UpdateVersion();
+		parsed[*it] = true;
+	}
+
+	// a null state stands for the default state
+	PGParserState default_state = highlighter->GetDefaultState();
+	auto equivalent = [&](PGParserState a, PGParserState b) {
+		return highlighter->StateEquivalent(a ? a : default_state, b ? b : default_state);
+	};
+	for (lng i = 0; i < count; i++) {
+		PGTextBuffer* buffer = buffers[i];
+		PGParserState start = i == 0 ? nullptr : buffers[i - 1]->state;
+		bool reparse;
+		if (guessed[i]) {
+			// the buffer was parsed speculatively: check if we guessed the start state correctly
+			reparse = !equivalent(start, guesses[i]);
+		} else {
+			// the buffer was parsed before: parse it again only if the end state of the previous buffer changed
+			reparse = i > 0 && parsed[i - 1] && (!previous[i - 1] || !equivalent(start, previous[i - 1]));
+		}
+		if (!reparse) continue;
+
+		PGParseErrors errors;
+		if (guessed[i]) {
+			highlighter->DeleteParserState(buffer->state);
+		} else {
+			previous[i] = buffer->state;
+		}
+		buffer->state = highlighter->ParseBuffer(buffer, start, errors);
+		buffer->UpdateVersion();
+		parsed[i] = true;
+	}
+
+	highlighter->DeleteParserState(default_state);
+	for (auto it = previous.begin(); it != previous.end(); it++) {
+		if (*it) {
+			highlighter->DeleteParserState(*it);
+		}
+	}
+}
@@ -2,6 +2,7 @@
 
 #include "cursor.h"
 #include "encoding.h"
+#include "filewatcher.h"
 #include "textdelta.h"
 #include "mmap.h"
 #include "utils.h"
@@ -11,6 +12,7 @@
 #include "regex.h"
 #include "textline.h"
 #include "textiterator.h"
+#include "textsnapshot.h"
 
 #include <string>
 #include <vector>
@@ -41,7 +43,8 @@ char GetSystemPathSeparator();
 typedef enum {
 	PGIndentionSpaces,
 	PGIndentionTabs,
-	PGIndentionMixed
+	PGIndentionMixed,
+	PGIndentionUnknown
 } PGLineIndentation;
 
 class ProjectExplorer;
@@ -55,9 +58,11 @@ struct PGTextFileSettings {
 	PGLineEnding line_ending = PGLineEndingUnknown;
 	PGLanguage* language;
 	PGFileEncoding encoding = PGEncodingUnknown;
+	PGLineIndentation indentation = PGIndentionUnknown;
+	int tabwidth = 0;
 	std::string name;
 
-	PGTextFileSettings() : line_ending(PGLineEndingUnknown), language(nullptr), encoding(PGEncodingUnknown), name("") { }
+	PGTextFileSettings() : line_ending(PGLineEndingUnknown), language(nullptr), encoding(PGEncodingUnknown), indentation(PGIndentionUnknown), tabwidth(0), name("") { }
 };
 
 struct Interval {
@@ -68,6 +73,7 @@ struct Interval {
 };
 
 struct FindAllInformation;
+struct PGFindResultsStore;
 
 typedef void (*PGTextFileLoadedCallback)(std::shared_ptr<TextFile> file, void* data);
 typedef void (*PGTextFileDestructorCallback)(void* data);
@@ -135,7 +141,28 @@ public:
 	void Lock(PGLockType type);
 	void Unlock(PGLockType type);
 
+	// returns an immutable copy of the current text that can be read without holding a lock
+	// returns nullptr if the file does not support snapshots
+	virtual std::shared_ptr<PGTextSnapshot> GetSnapshot() = 0;
+	// the version is incremented every time the text changes; should only be read while the file is locked
+	lng GetVersion() { return version; }
+
 	bool IsLoaded() { return is_loaded; }
+	// files restored from the workspace are not read until they are first needed
+	// Load starts reading such a file in the background; it does nothing for any other file
+	void Load(PGTaskUrgency urgency);
+	bool IsDeferred() { return deferred; }
+
+	// the amount of memory used by the text of the file, counted towards the memory budget of the file manager
+	virtual lng GetMemoryUsage() { return 0; }
+	// frees the text of the file if it can be read back from disk without losing anything
+	// the text is read again transparently when the file is shown; returns the amount of memory that was freed
+	virtual lng Unload() { return 0; }
+	// whether or not one of the views of the file is currently shown in a textfield
+	bool IsVisible();
+	// marks the file as used, the file manager unloads the files that have not been used for the longest time first
+	void MarkUsed();
+	lng GetLastUsed() { return last_used; }
 	double LoadPercentage() { return (double) bytes / (double) total_bytes; }
 
 	virtual void IndentText(std::vector<Cursor>& cursors, PGDirection direction) = 0;
@@ -144,6 +171,7 @@ public:
 	void VerifyTextfile();
 
 	void HighlightText();
+	void HighlightTextParallel();
 
 	virtual PGScalar GetMaxLineWidth(PGFontHandle font) = 0;
 
@@ -157,6 +185,9 @@ public:
 	void SetReadOnly(bool read_only) { this->read_only = read_only; }
 
 	void UpdateModificationTime();
+	// returns true if the file might have been modified by an external program since the previous call
+	// i.e. the file watcher reported a change, or the modification time has not been obtained yet
+	bool PollExternalChanges();
 
 	void SetTabWidth(int tabwidth);
 	int GetTabWidth() { return tabwidth; }
@@ -168,6 +199,8 @@ public:
 	};
 
 	virtual PGStoreFileType WorkspaceFileStorage() = 0;
+	// streaming files are loaded in blocks and do not keep the full text in memory
+	virtual bool IsStreaming() { return false; }
 
 	bool HasUnsavedChanges() { return FileInMemory() || unsaved_changes; }
 	bool FileInMemory() { return path.size() == 0; }
@@ -214,6 +247,7 @@ protected:
 	std::string path;
 	std::string name;
 	std::string ext;
+	PGFileWatchGroupHandle watch_group = nullptr;
 
 	PGFileError error = PGFileSuccess;
 
@@ -221,6 +255,9 @@ protected:
 	lng longest_line = 0;
 
 	bool is_loaded;
+	// the file has not been read yet (or has been unloaded), see Load
+	bool deferred = false;
+	lng last_used = 0;
 	lng bytes = 0;
 	lng total_bytes = 1;
 
@@ -232,6 +269,10 @@ protected:
 	std::unique_ptr<PGMutex> text_lock;
 	int shared_counter = 0;
 
+	lng version = 0;
+	std::weak_ptr<PGTextSnapshot> snapshot;
+	std::unique_ptr<PGMutex> snapshot_lock;
+
 	std::unique_ptr<PGMutex> loading_lock;
 	struct LoadCallbackData {
 		PGTextFileLoadedCallback callback = nullptr;
@@ -249,6 +290,10 @@ protected:
 
 	void FinalizeLoading();
 	virtual void ApplySettings(PGTextFileSettings settings);
+	// called with the text_lock held when the last read lock on the file is released
+	virtual void ReadersFinished() { }
+	// reads a file whose loading was deferred, called on a worker thread
+	virtual void ReadDeferred() { }
 
 	std::vector<std::weak_ptr<TextView>> views;
 
@@ -265,8 +310,11 @@ protected:
 	void ConsumeBytes(const char* buffer, size_t buffer_size, PGScalar& max_length, double& current_width, PGTextBuffer*& current_buffer, lng& linenr, char& prev_character);
 	void ConsumeBytes(const char* buffer, size_t buffer_size, size_t& prev, int& offset, PGScalar& max_length, double& current_width, PGTextBuffer*& current_buffer, lng& linenr);
 private:
+	void LoadDeferred();
+
 	std::shared_ptr<Task> find_task = nullptr;
 	std::string current_find_file;
+	std::shared_ptr<PGFindResultsStore> find_results;
 	
 	void _InsertLine(const char* ptr, size_t current, size_t prev, PGScalar& max_length, double& current_width, PGTextBuffer*& current_buffer, lng& linenr);
 	void _InsertText(const char* ptr, size_t current, size_t prev, PGScalar& max_length, double& current_width, PGTextBuffer*& current_buffer, lng& linenr);
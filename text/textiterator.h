@@ -8,6 +8,7 @@ class TextLineIterator {
 	friend class InMemoryTextFile;
 	friend class TextFile;
 	friend class TextView;
+	friend class PGScrollIterator;
 public:
 	virtual TextLine GetLine();
 	friend TextLineIterator& operator++(TextLineIterator& element) {
@@ -0,0 +1,71 @@
+
+#include "textsnapshot.h"
+
+PGBufferContent::PGBufferContent(PGTextBuffer* buffer) :
+	size(buffer->current_size), line_count(buffer->line_count), line_start(buffer->line_start) {
+	text = (char*)malloc(size);
+	memcpy(text, buffer->buffer, size);
+}
+
+PGBufferContent::~PGBufferContent() {
+	free(text);
+}
+
+PGTextSnapshot::PGTextSnapshot(std::vector<PGTextBuffer*>& file_buffers, lng version) : version(version) {
+	// this has to be called while the file is locked
+	// only buffers that have been modified since the previous snapshot are copied
+	contents.reserve(file_buffers.size());
+	buffers.reserve(file_buffers.size());
+	for (auto it = file_buffers.begin(); it != file_buffers.end(); it++) {
+		PGTextBuffer* original = *it;
+		std::shared_ptr<PGBufferContent> content = original->snapshot_content.lock();
+		if (!content) {
+			content = std::make_shared<PGBufferContent>(original);
+			original->snapshot_content = content;
+		}
+		contents.push_back(content);
+
+		// the buffer points into the shared contents, it does not own its text
+		PGTextBuffer* buffer = new PGTextBuffer();
+		buffer->buffer = content->text;
+		buffer->buffer_size = content->size;
+		buffer->current_size = content->size;
+		buffer->line_start = content->line_start;
+		buffer->line_count = content->line_count;
+		buffer->start_line = linecount;
+		buffer->index = buffers.size();
+		if (buffers.size() > 0) {
+			buffer->_prev = buffers.back();
+			buffers.back()->_next = buffer;
+		}
+		buffers.push_back(buffer);
+		linecount += buffer->line_count;
+	}
+}
+
+PGTextSnapshot::~PGTextSnapshot() {
+	for (auto it = buffers.begin(); it != buffers.end(); it++) {
+		(*it)->buffer = nullptr;
+		delete *it;
+	}
+}
+
+PGTextBuffer* PGTextSnapshot::GetBuffer(lng line) {
+	return buffers[PGTextBuffer::GetBuffer(buffers, line)];
+}
+
+std::string PGTextSnapshot::GetText() {
+	lng size = 0;
+	for (auto it = buffers.begin(); it != buffers.end(); it++) {
+		size += (*it)->current_size;
+	}
+	std::string text;
+	text.reserve(size);
+	for (auto it = buffers.begin(); it != buffers.end(); it++) {
+		text.append((*it)->buffer, (*it)->current_size - 1);
+		if (*it != buffers.back()) {
+			text += "\n";
+		}
+	}
+	return text;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "textbuffer.h"
+#include "utils.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// the text of a buffer at the time it was captured by a snapshot
+// a buffer keeps its captured contents until it is modified, so unmodified buffers are shared between snapshots
+struct PGBufferContent {
+	char* text = nullptr;
+	lng size = 0;
+	lng line_count = 0;
+	PGLineIndex line_start;
+
+	PGBufferContent(PGTextBuffer* buffer);
+	~PGBufferContent();
+};
+
+// an immutable copy of the text of a file at one point in time
+// a snapshot can be read from any thread without locking the file it was taken from
+// the buffers of a snapshot are linked together like the buffers of a file,
+// so the regular buffer functions (regex matching, line iteration) work on a snapshot as well
+class PGTextSnapshot {
+public:
+	PGTextSnapshot(std::vector<PGTextBuffer*>& buffers, lng version);
+	~PGTextSnapshot();
+
+	lng GetVersion() { return version; }
+	lng GetLineCount() { return linecount; }
+
+	PGTextBuffer* GetBuffer(lng line);
+	PGTextBuffer* GetFirstBuffer() { return buffers.front(); }
+	PGTextBuffer* GetLastBuffer() { return buffers.back(); }
+	const std::vector<PGTextBuffer*>& GetBuffers() { return buffers; }
+	std::string GetText();
+private:
+	lng version;
+	lng linecount = 0;
+	std::vector<std::shared_ptr<PGBufferContent>> contents;
+	std::vector<PGTextBuffer*> buffers;
+};
@@ -3,6 +3,9 @@
 #include "wrappedtextiterator.h"
 #include "basictextfield.h"
 
+#include <atomic>
+#include <unordered_map>
+
 TextView::TextView(BasicTextField* textfield, std::shared_ptr<TextFile> file) :
 	textfield(textfield), file(file), wordwrap(false),
 	xoffset(0), yoffset(0, 0), wrap_width(0) {
@@ -21,20 +24,20 @@ void TextView::Initialize() {
 	file->AddTextView(shared_from_this());
 }
 
-TextLineIterator* TextView::GetScrollIterator(BasicTextField* textfield, PGVerticalScroll scroll) {
+PGScrollIterator TextView::GetScrollIterator(BasicTextField* textfield, PGVerticalScroll scroll) {
 	if (wordwrap) {
-		return new WrappedTextLineIterator(this, textfield->GetTextfieldFont(), file.get(),
+		return PGScrollIterator(this, textfield->GetTextfieldFont(), file.get(),
 			scroll, wrap_width);
 	}
-	return new TextLineIterator(file.get(), scroll.linenumber);
+	return PGScrollIterator(file.get(), scroll.linenumber);
 }
 
-TextLineIterator* TextView::GetLineIterator(BasicTextField* textfield, lng linenumber) {
+PGScrollIterator TextView::GetLineIterator(BasicTextField* textfield, lng linenumber) {
 	if (wordwrap) {
-		return new WrappedTextLineIterator(this, textfield->GetTextfieldFont(), file.get(),
+		return PGScrollIterator(this, textfield->GetTextfieldFont(), file.get(),
 			PGVerticalScroll(linenumber, 0), wrap_width);
 	}
-	return new TextLineIterator(file.get(), linenumber);
+	return PGScrollIterator(file.get(), linenumber);
 }
 
 double TextView::GetScrollPercentage(PGVerticalScroll scroll) {
@@ -185,7 +188,7 @@ PGVerticalScroll TextView::OffsetVerticalScroll(PGVerticalScroll scroll, double
 	} else {
 		lines_offset = 0;
 		lng lines = offset;
-		TextLineIterator* it = GetScrollIterator(textfield, scroll);
+		auto it = GetScrollIterator(textfield, scroll);
 		if (lines > 0) {
 			// move forward by <lines>
 			for (; lines != 0; lines--) {
@@ -453,6 +456,9 @@ int TextView::GetLineHeight() {
 }
 
 PGTextViewSettings TextView::GetSettings() {
+	if (!file->IsLoaded()) {
+		return pending_settings;
+	}
 	PGTextViewSettings settings;
 	settings.xoffset = this->xoffset;
 	settings.yoffset = this->yoffset;
@@ -467,6 +473,7 @@ struct TextViewApplySettings {
 };
 
 void TextView::ApplySettings(PGTextViewSettings& settings) {
+	pending_settings = settings;
 	TextViewApplySettings* s = new TextViewApplySettings();
 	s->settings = settings;
 	s->view = std::weak_ptr<TextView>(shared_from_this());
@@ -574,86 +581,509 @@ void TextView::VerifyTextView() {
 #endif
 }
 
-struct FindInformation {
-	TextView* view;
-	PGRegexHandle handle;
-	lng start_line;
-	lng start_character;
+// find all splits the text into segments of whole buffers of roughly this size
+// the segments are searched in parallel and the matches are merged back in order
+#define FIND_SEGMENT_SIZE (1024 * 1024)
+
+struct PGFindSegment {
+	// the matches that start in the buffers [start_buffer, end_buffer) of the snapshot belong to this segment
+	// the segment of a file without a snapshot covers the entire file (end_buffer = -1)
+	lng start_buffer;
+	lng end_buffer;
+	std::vector<PGTextRange> matches;
+	bool finished = false;
+
+	PGFindSegment(lng start_buffer, lng end_buffer) : start_buffer(start_buffer), end_buffer(end_buffer) { }
 };
 
-void TextView::RunTextFinder(std::shared_ptr<Task> task, TextView* view, PGRegexHandle regex_handle, lng current_line, lng current_character, bool select_first_match) {
-	view->finished_search = false;
-	view->matches.clear();
+struct PGFindSearch {
+	std::shared_ptr<TextFile> file;
+	// the search runs on a snapshot of the text, so edits to the file do not have to wait for it
+	// streaming files do not support snapshots; they are read locked while they are searched
+	std::shared_ptr<PGTextSnapshot> snapshot;
+	// shared with the search that replaces this one if the text changes while searching
+	std::shared_ptr<PGRegex> regex;
+
+	std::vector<PGFindSegment> segments;
+	std::atomic<lng> next_segment;
+	// set when the search is replaced or cleared, the workers stop at the next match
+	std::atomic<bool> cancelled;
+	// protects the finished flags and the matches of the segments, the merged matches and the finished flag
+	std::unique_ptr<PGMutex> lock;
+	// signalled when every segment has been merged
+	std::unique_ptr<PGCondition> merged;
+
+	// the matches that have been merged but not yet picked up by the view
+	std::vector<PGTextRange> merged_matches;
+	bool finished = false;
+
+	// the state of the merge, only used by the worker that holds the merge lock
+	std::unique_ptr<PGMutex> merge_lock;
+	lng merged_segments = 0;
+	bool has_previous_match = false;
+	PGTextPosition previous_end;
+
+	// only used by the view
+	bool select_first_match = false;
+	PGTextPosition selection;
+
+	PGFindSearch(std::shared_ptr<TextFile> file, std::shared_ptr<PGRegex> regex) :
+		file(file), regex(regex), next_segment(0), cancelled(false),
+		lock(CreateMutex()), merged(CreateCondition()), merge_lock(CreateMutex()) { }
+};
 
-	if (!regex_handle) return;
+// a match of find all relative to the buffer it starts in
+struct PGFindCachedMatch {
+	lng start_position;
+	// the match ends either in the same buffer (0) or in the next buffer (1)
+	lng end_buffer;
+	lng end_position;
+
+	PGFindCachedMatch(lng start_position, lng end_buffer, lng end_position) :
+		start_position(start_position), end_buffer(end_buffer), end_position(end_position) { }
+};
+
+// the matches that start in a single buffer
+// they only depend on the text of the buffer, the text of the next buffer (that the matches can extend into)
+// and the position at which the search entered the buffer
+struct PGFindCacheEntry {
+	lng next_version = -1;
+	// if the last match of the previous buffer extends into this buffer, the search enters it at the end of that match
+	lng entry_position = 0;
+	std::vector<PGFindCachedMatch> matches;
+};
 
-	view->file->Lock(PGReadLock);
-	bool found_initial_match = !select_first_match;
-	PGTextBuffer* selection_buffer = view->file->GetBuffer(current_line);
-	lng selection_position = selection_buffer->GetBufferLocationFromCursor(current_line, current_character);
-	PGTextPosition position = PGTextPosition(selection_buffer, selection_position);
+// the matches of the previous find all by buffer version, so that after an edit only the modified buffers are searched again
+struct PGFindCache {
+	std::shared_ptr<PGRegex> regex;
+	std::unordered_map<lng, PGFindCacheEntry> buffers;
+};
 
+// the position at which a sequential search enters the buffer, given the end of the last match before it
+// returns false if that match extends past the buffer, in which case no match can start in the buffer
+static bool GetEntryPosition(PGTextPosition previous_end, PGTextBuffer* buffer, lng& position) {
+	position = 0;
+	if (!previous_end.buffer || previous_end.buffer->start_line < buffer->start_line) {
+		return true;
+	}
+	if (previous_end.buffer != buffer) {
+		return false;
+	}
+	position = previous_end.position;
+	return true;
+}
 
+// adds a match that starts in the buffer to its cache entry
+// returns false if the match extends further than the next buffer, the buffer cannot be cached then
+static bool CacheMatch(PGTextRange& range, PGTextBuffer* buffer, PGFindCacheEntry& entry) {
+	if (range.end_buffer != buffer && range.end_buffer != buffer->next()) {
+		return false;
+	}
+	entry.matches.push_back(PGFindCachedMatch(range.start_position, range.end_buffer == buffer ? 0 : 1, range.end_position));
+	return true;
+}
+
+static void SearchSegment(PGFindSearch* search, PGFindSegment& segment) {
+	std::vector<PGTextRange> matches;
+	PGTextBuffer* last_buffer;
 	PGTextRange bounds;
-	bounds.start_buffer = view->file->GetFirstBuffer();
+	if (search->snapshot) {
+		auto& buffers = search->snapshot->GetBuffers();
+		last_buffer = buffers.back();
+		bounds.start_buffer = buffers[segment.start_buffer];
+		// the text of the next segment is included up to the end of its first buffer
+		// so matches that cross the end of the segment are found in full
+		bounds.end_buffer = buffers[std::min(segment.end_buffer, (lng)buffers.size() - 1)];
+	} else {
+		search->file->Lock(PGReadLock);
+		last_buffer = search->file->GetLastBuffer();
+		bounds.start_buffer = search->file->GetFirstBuffer();
+		bounds.end_buffer = last_buffer;
+	}
 	bounds.start_position = 0;
-	bounds.end_buffer = view->file->GetLastBuffer();
 	bounds.end_position = bounds.end_buffer->current_size - 1;
-	while (true) {
-		/*if (textfile->find_task != task) {
-			// a new find task has been activated
-			// stop searching for an outdated find query
-			PGDeleteRegex(regex_handle);
-			return;
-		}*/
-		PGRegexMatch match = PGMatchRegex(regex_handle, bounds, PGDirectionRight);
+	PGTextPosition segment_end = bounds.endpos();
+	while (!search->cancelled) {
+		PGRegexMatch match = PGMatchRegex(search->regex.get(), bounds, PGDirectionRight);
 		if (!match.matched) {
 			break;
 		}
-		view->matches.push_back(match.groups[0]);
+		PGTextRange range = match.groups[0];
+		if (segment.end_buffer >= 0 && range.start_buffer->index >= segment.end_buffer) {
+			// the match belongs to the next segment
+			break;
+		}
+		if (range.endpos() == bounds.endpos() && bounds.end_buffer != last_buffer) {
+			// the match runs up to the end of the searched text, it might continue past it
+			// search again from the same position in the remainder of the file
+			bounds.end_buffer = last_buffer;
+			bounds.end_position = last_buffer->current_size - 1;
+			continue;
+		}
+		matches.push_back(range);
+		if (bounds.start_buffer == range.end_buffer &&
+			bounds.start_position == range.end_position)
+			break;
+		bounds.start_buffer = range.end_buffer;
+		bounds.start_position = range.end_position;
+		bounds.end_buffer = segment_end.buffer;
+		bounds.end_position = segment_end.position;
+	}
+	if (!search->snapshot) {
+		search->file->Unlock(PGReadLock);
+	}
 
-		if (!found_initial_match && match.groups[0].startpos() >= position) {
-			found_initial_match = true;
-			view->selected_match = view->matches.size() - 1;
-			view->SetCursorLocation(match.groups[0]);
+	LockMutex(search->lock.get());
+	segment.matches.swap(matches);
+	segment.finished = true;
+	UnlockMutex(search->lock.get());
+}
+
+// appends the matches of a segment to the result, in the same way a sequential search would have found them
+static void MergeSegment(PGFindSearch* search, PGFindSegment& segment, std::vector<PGTextRange>& result) {
+	auto& matches = segment.matches;
+	size_t index = 0;
+	if (search->has_previous_match) {
+		// the last match of the previous segment can extend into this segment
+		// matches of this segment that overlap with it are skipped
+		while (index < matches.size() && matches[index].startpos() < search->previous_end) {
+			index++;
+		}
+		if (index > 0) {
+			// a sequential search continues from the end of the previous match, which might find different matches
+			// than the ones we skipped; so search sequentially until we find a match the segment has found as well
+			// from that match onwards the matches of the segment are the same as those of a sequential search
+			PGTextBuffer* last_buffer = search->snapshot->GetLastBuffer();
+			PGTextRange bounds(search->previous_end, PGTextPosition(last_buffer, last_buffer->current_size - 1));
+			while (true) {
+				PGRegexMatch match = PGMatchRegex(search->regex.get(), bounds, PGDirectionRight);
+				if (!match.matched || match.groups[0].start_buffer->index >= segment.end_buffer) {
+					index = matches.size();
+					break;
+				}
+				PGTextRange range = match.groups[0];
+				while (index < matches.size() && matches[index].startpos() < range.startpos()) {
+					index++;
+				}
+				if (index < matches.size() && matches[index].startpos() == range.startpos() && matches[index].endpos() == range.endpos()) {
+					break;
+				}
+				result.push_back(range);
+				search->previous_end = range.endpos();
+				if (bounds.start_buffer == range.end_buffer &&
+					bounds.start_position == range.end_position) {
+					index = matches.size();
+					break;
+				}
+				bounds.start_buffer = range.end_buffer;
+				bounds.start_position = range.end_position;
+			}
+		}
+	}
+	for (; index < matches.size(); index++) {
+		result.push_back(matches[index]);
+		search->previous_end = matches[index].endpos();
+		search->has_previous_match = true;
+	}
+	// the matches have been copied into the result
+	std::vector<PGTextRange>().swap(matches);
+}
+
+// merges the finished segments in order, so the search completes whether or not the view is updated
+// the view picks up the merged matches in UpdateFindMatches
+static void MergeFinishedSegments(PGFindSearch* search) {
+	LockMutex(search->merge_lock.get());
+	while (!search->cancelled) {
+		LockMutex(search->lock.get());
+		bool finished = search->merged_segments < (lng)search->segments.size() &&
+			search->segments[search->merged_segments].finished;
+		UnlockMutex(search->lock.get());
+		if (!finished) {
+			// the next segment is merged by the worker that finishes it
+			break;
+		}
+		std::vector<PGTextRange> matches;
+		MergeSegment(search, search->segments[search->merged_segments], matches);
+		search->merged_segments++;
+		LockMutex(search->lock.get());
+		search->merged_matches.insert(search->merged_matches.end(), matches.begin(), matches.end());
+		if (search->merged_segments == (lng)search->segments.size()) {
+			search->finished = true;
+			NotifyCondition(search->merged.get());
 		}
+		UnlockMutex(search->lock.get());
+	}
+	UnlockMutex(search->merge_lock.get());
+}
 
-		if (bounds.start_buffer == match.groups[0].end_buffer &&
-			bounds.start_position == match.groups[0].end_position)
+static void SearchSegments(PGFindSearch* search) {
+	while (!search->cancelled) {
+		lng index = search->next_segment++;
+		if (index >= (lng)search->segments.size()) {
 			break;
-		bounds.start_buffer = match.groups[0].end_buffer;
-		bounds.start_position = match.groups[0].end_position;
+		}
+		SearchSegment(search, search->segments[index]);
+		MergeFinishedSegments(search);
+	}
+}
 
+void TextView::StartFindMatches(std::shared_ptr<PGRegex> regex, bool select_first_match, lng start_line, lng start_character) {
+	auto search = std::make_shared<PGFindSearch>(file, regex);
+	search->snapshot = file->GetSnapshot();
+	search->select_first_match = select_first_match;
+	if (select_first_match) {
+		if (!search->snapshot) {
+			file->Lock(PGReadLock);
+		}
+		PGTextBuffer* selection_buffer = search->snapshot ? search->snapshot->GetBuffer(start_line) : file->GetBuffer(start_line);
+		lng selection_position = selection_buffer->GetBufferLocationFromCursor(start_line, start_character);
+		search->selection = PGTextPosition(selection_buffer, selection_position);
+		if (!search->snapshot) {
+			file->Unlock(PGReadLock);
+		}
+	}
+	if (search->snapshot) {
+		auto& buffers = search->snapshot->GetBuffers();
+		lng segment_start = 0;
+		lng segment_size = 0;
+		for (lng i = 0; i < (lng)buffers.size(); i++) {
+			segment_size += buffers[i]->current_size;
+			if (segment_size >= FIND_SEGMENT_SIZE || i == (lng)buffers.size() - 1) {
+				search->segments.push_back(PGFindSegment(segment_start, i + 1));
+				segment_start = i + 1;
+				segment_size = 0;
+			}
+		}
+	} else {
+		search->segments.push_back(PGFindSegment(0, -1));
+	}
 
-		/*if (textfile->find_task != task) {
-			// a new find task has been activated
-			// stop searching for an outdated find query
-			PGDeleteRegex(regex_handle);
-			return;
+	lng workers = std::max((lng)1, std::min((lng)search->segments.size(), Scheduler::GetThreadCount()));
+	for (lng i = 0; i < workers; i++) {
+		Scheduler::RegisterTask(std::make_shared<Task>([](std::shared_ptr<Task> task, void* data) {
+			std::shared_ptr<PGFindSearch>* search = (std::shared_ptr<PGFindSearch>*)data;
+			SearchSegments(search->get());
+			delete search;
+		}, new std::shared_ptr<PGFindSearch>(search)), PGTaskUrgent);
+	}
+	finished_search = false;
+	find_search = search;
+}
+
+void TextView::CancelFindMatches() {
+	if (find_search) {
+		find_search->cancelled = true;
+		find_search = nullptr;
+	}
+	finished_search = true;
+}
+
+TextView::~TextView() {
+	if (find_search) {
+		find_search->cancelled = true;
+	}
+}
+
+bool TextView::UpdateFindMatches() {
+	auto search = find_search;
+	if (!search) return false;
+
+	std::vector<PGTextRange> new_matches;
+	LockMutex(search->lock.get());
+	new_matches.swap(search->merged_matches);
+	bool finished = search->finished;
+	UnlockMutex(search->lock.get());
+	if (new_matches.size() == 0 && !finished) {
+		return false;
+	}
+
+	lng initial_match = -1;
+	if (search->select_first_match) {
+		for (size_t i = 0; i < new_matches.size(); i++) {
+			if (new_matches[i].startpos() >= search->selection) {
+				search->select_first_match = false;
+				initial_match = matches.size() + i;
+				break;
+			}
 		}
-		if (!start_buffer && !end_buffer) {
-			textfile->finished_search = true;
-			break;
-		}*/
 	}
-	view->finished_search = true;
-	view->file->Unlock(PGReadLock);
-#ifdef PANTHER_DEBUG
-	// FIXME: check if matches overlap?
-	/*for (lng i = 0; i < textfile->matches.size() - 1; i++) {
-	if (textfile->matches[i].start_line == textfile->matches[i].start_line) {
+	if (search->snapshot) {
+		// the matches point into the snapshot, if the text has not changed since the snapshot was taken
+		// the buffers of the file are identical to those of the snapshot, and we can map the matches onto them
+		// otherwise we search again in the new text
+		file->Lock(PGReadLock);
+		if (file->GetVersion() != search->snapshot->GetVersion()) {
+			file->Unlock(PGReadLock);
+			CancelFindMatches();
+			matches.clear();
+			if (selected_match >= 0) {
+				selected_match = 0;
+			}
+			if (file->IsLoaded()) {
+				StartFindMatches(search->regex, false, 0, 0);
+			}
+			return true;
+		}
+		for (auto it = new_matches.begin(); it != new_matches.end(); it++) {
+			it->start_buffer = file->GetBuffer(it->start_buffer->start_line);
+			it->end_buffer = file->GetBuffer(it->end_buffer->start_line);
+		}
+		file->Unlock(PGReadLock);
+	}
+	matches.insert(matches.end(), new_matches.begin(), new_matches.end());
+	if (initial_match >= 0) {
+		selected_match = initial_match;
+		SetCursorLocation(matches[initial_match]);
+	}
+	if (finished) {
+		find_search = nullptr;
+		finished_search = true;
+		BuildFindCache(search->regex);
+	}
+	// the views of background tabs are updated as well, their textfield shows another view
+	if (textfield && textfield->GetTextView().get() == this) {
+		textfield->SearchMatchesChanged();
+		textfield->Invalidate();
+	}
+	return true;
+}
 
+void TextView::WaitForFindMatches() {
+	while (find_search) {
+		auto search = find_search;
+		// rather than only waiting for the workers, help them with the remaining segments
+		SearchSegments(search.get());
+		LockMutex(search->lock.get());
+		while (!search->finished) {
+			WaitCondition(search->merged.get(), search->lock.get());
+		}
+		UnlockMutex(search->lock.get());
+		UpdateFindMatches();
 	}
-	}*/
-#endif
-	if (regex_handle) PGDeleteRegex(regex_handle);
-	if (view->textfield) {
-		view->textfield->SearchMatchesChanged();
-		view->textfield->Invalidate();
+}
+
+void TextView::BuildFindCache(std::shared_ptr<PGRegex> regex) {
+	find_cache = nullptr;
+	if (file->IsStreaming()) return;
+
+	auto cache = std::make_shared<PGFindCache>();
+	cache->regex = regex;
+	file->Lock(PGReadLock);
+	size_t index = 0;
+	PGTextPosition previous_end;
+	for (PGTextBuffer* buffer = file->GetFirstBuffer(); buffer; buffer = buffer->next()) {
+		PGFindCacheEntry entry;
+		entry.next_version = buffer->next() ? buffer->next()->version : -1;
+		bool cacheable = GetEntryPosition(previous_end, buffer, entry.entry_position);
+		for (; index < matches.size() && matches[index].start_buffer == buffer; index++) {
+			cacheable = cacheable && CacheMatch(matches[index], buffer, entry);
+			previous_end = matches[index].endpos();
+		}
+		if (cacheable) {
+			cache->buffers[buffer->version] = std::move(entry);
+		}
 	}
+	file->Unlock(PGReadLock);
+	find_cache = cache;
+}
+
+bool TextView::FindMatchesIncremental(bool select_first_match, lng start_line, lng start_character) {
+	auto old_cache = find_cache;
+	file->Lock(PGReadLock);
+	// if a large part of the file has been modified (e.g. by replace all) the buffers are searched in the background instead
+	lng modified_size = 0;
+	for (PGTextBuffer* buffer = file->GetFirstBuffer(); buffer; buffer = buffer->next()) {
+		auto cached = old_cache->buffers.find(buffer->version);
+		if (cached == old_cache->buffers.end() || cached->second.next_version != (buffer->next() ? buffer->next()->version : -1)) {
+			modified_size += buffer->current_size;
+		}
+	}
+	if (modified_size > FIND_SEGMENT_SIZE) {
+		file->Unlock(PGReadLock);
+		return false;
+	}
+
+	auto cache = std::make_shared<PGFindCache>();
+	cache->regex = old_cache->regex;
+	PGRegexHandle regex = cache->regex.get();
+	PGTextBuffer* last_buffer = file->GetLastBuffer();
+	PGTextPosition previous_end;
+	matches.clear();
+	for (PGTextBuffer* buffer = file->GetFirstBuffer(); buffer; buffer = buffer->next()) {
+		PGTextBuffer* next = buffer->next();
+		PGFindCacheEntry entry;
+		entry.next_version = next ? next->version : -1;
+		if (!GetEntryPosition(previous_end, buffer, entry.entry_position)) {
+			continue;
+		}
+		bool cacheable = true;
+		auto cached = old_cache->buffers.find(buffer->version);
+		if (cached != old_cache->buffers.end() &&
+			cached->second.next_version == entry.next_version &&
+			cached->second.entry_position == entry.entry_position) {
+			// neither the buffer nor the text its matches depend on has changed
+			entry.matches = std::move(cached->second.matches);
+			for (auto it = entry.matches.begin(); it != entry.matches.end(); it++) {
+				matches.push_back(PGTextRange(buffer, it->start_position, it->end_buffer ? next : buffer, it->end_position));
+			}
+		} else {
+			// search the buffer again, the matches that start in it can extend into the next buffer
+			PGTextPosition window_end = next ? PGTextPosition(next, next->current_size - 1) : PGTextPosition(buffer, buffer->current_size - 1);
+			PGTextRange bounds(PGTextPosition(buffer, entry.entry_position), window_end);
+			while (true) {
+				PGRegexMatch match = PGMatchRegex(regex, bounds, PGDirectionRight);
+				if (!match.matched || match.groups[0].start_buffer != buffer) {
+					break;
+				}
+				PGTextRange range = match.groups[0];
+				if (range.endpos() == bounds.endpos() && bounds.end_buffer != last_buffer) {
+					// the match runs up to the end of the searched text, it might continue past it
+					bounds.end_buffer = last_buffer;
+					bounds.end_position = last_buffer->current_size - 1;
+					continue;
+				}
+				matches.push_back(range);
+				cacheable = cacheable && CacheMatch(range, buffer, entry);
+				if (bounds.start_buffer == range.end_buffer &&
+					bounds.start_position == range.end_position)
+					break;
+				bounds.start_buffer = range.end_buffer;
+				bounds.start_position = range.end_position;
+				bounds.end_buffer = window_end.buffer;
+				bounds.end_position = window_end.position;
+			}
+		}
+		if (matches.size() > 0 && matches.back().start_buffer == buffer) {
+			previous_end = matches.back().endpos();
+		}
+		if (cacheable) {
+			cache->buffers[buffer->version] = std::move(entry);
+		}
+	}
+	if (select_first_match && matches.size() > 0) {
+		PGTextBuffer* selection_buffer = file->GetBuffer(start_line);
+		PGTextPosition selection = PGTextPosition(selection_buffer, selection_buffer->GetBufferLocationFromCursor(start_line, start_character));
+		for (size_t i = 0; i < matches.size(); i++) {
+			if (matches[i].startpos() >= selection) {
+				selected_match = i;
+				SetCursorLocation(matches[i]);
+				break;
+			}
+		}
+	}
+	file->Unlock(PGReadLock);
+	find_cache = cache;
+	finished_search = true;
+	if (textfield) {
+		textfield->SearchMatchesChanged();
+		textfield->Invalidate();
+	}
+	return true;
 }
 
 void TextView::ClearMatches() {
+	CancelFindMatches();
+	find_cache = nullptr;
 	matches.clear();
 	if (textfield) {
 		textfield->SearchMatchesChanged();
@@ -663,33 +1093,30 @@ void TextView::ClearMatches() {
 
 void TextView::FindAllMatches(PGRegexHandle handle, bool select_first_match, lng start_line, lng start_character, lng end_line, lng end_character, bool wrap) {
 	if (!file->IsLoaded()) return;
+	CancelFindMatches();
+	if (find_cache && handle && PGRegexEquals(find_cache->regex.get(), handle)) {
+		// the same search as the previous one, typically because the text has been edited
+		// only the buffers that have been modified since then have to be searched again
+		if (FindMatchesIncremental(select_first_match, start_line, start_character)) {
+			PGDeleteRegex(handle);
+			return;
+		}
+	}
+	find_cache = nullptr;
+	matches.clear();
 	if (!handle) {
-		matches.clear();
 		if (textfield) {
 			textfield->SelectionChanged();
 			textfield->SearchMatchesChanged();
 		}
 		return;
 	}
-
-	FindInformation* info = new FindInformation();
-	info->view = this;
-	info->handle = handle;
-	info->start_line = start_line;
-	info->start_character = start_character;
-
-	RunTextFinder(nullptr, this, handle, start_line, start_character, select_first_match);
-	/*
-
-	this->find_task = new Task([](Task* t, void* in) {
-	FindInformation* info = (FindInformation*)in;
-	RunTextFinder(t, info->textfile, info->pattern, PGDirectionRight,
-	info->end_line, info->end_character,
-	info->start_line, info->start_character, info->match_case,
-	true, info->regex);
-	delete info;
-	}, (void*)info);
-	Scheduler::RegisterTask(this->find_task, PGTaskUrgent);*/
+	// the matches are added to the view as the segments are finished, see UpdateFindMatches
+	StartFindMatches(std::shared_ptr<PGRegex>(handle, PGDeleteRegex), select_first_match, start_line, start_character);
+	if (textfield) {
+		textfield->SearchMatchesChanged();
+		textfield->Invalidate();
+	}
 }
 
 bool TextView::FindMatch(PGRegexHandle handle, PGDirection direction, bool wrap, bool include_selection) {
@@ -700,20 +1127,20 @@ bool TextView::FindMatch(PGRegexHandle handle, PGDirection direction, bool wrap,
 		// simply select the next match, rather than searching again
 		if (!finished_search) {
 			// the search is still in progress: we might not have found the proper match to select
-			if (direction == PGDirectionLeft && selected_match == 0) {
-				// our FindPrev will wrap us to the end, however, there might be matches
-				// that we still have not found, hence we have to wait
-				while (!finished_search && selected_match == 0);
-			} else if (direction == PGDirectionRight && selected_match == matches.size() - 1) {
-				// our FindNext will wrap us back to the start
-				// however, there might still be matches after us
-				// hence we have to wait
-				while (!finished_search && selected_match == matches.size() - 1);
+			// if we would wrap around (or have nothing to select yet), there might be matches
+			// that we still have not found, hence we have to wait
+			if (matches.size() == 0 ||
+				(direction == PGDirectionLeft && selected_match == 0) ||
+				(direction == PGDirectionRight && selected_match >= (lng)matches.size() - 1)) {
+				WaitForFindMatches();
 			}
 		}
 		if (matches.size() == 0) {
 			return false;
 		}
+		if (selected_match >= (lng)matches.size()) {
+			selected_match = 0;
+		}
 		if (!include_selection) {
 			if (direction == PGDirectionLeft) {
 				selected_match = selected_match == 0 ? matches.size() - 1 : selected_match - 1;
@@ -3,8 +3,11 @@
 #include "cursor.h"
 #include "textfile.h"
 #include "utils.h"
+#include "wrappedtextiterator.h"
 
 class BasicTextField;
+struct PGFindSearch;
+struct PGFindCache;
 
 struct PGTextViewSettings {
 	double xoffset = -1;
@@ -24,6 +27,7 @@ class TextView : public std::enable_shared_from_this<TextView> {
 	friend class TextFile;
 public:
 	TextView(BasicTextField* field, std::shared_ptr<TextFile> file);
+	~TextView();
 
 	void Initialize();
 
@@ -48,8 +52,8 @@ public:
 
 	BasicTextField* textfield;
 
-	TextLineIterator* GetScrollIterator(BasicTextField* textfield, PGVerticalScroll scroll);
-	TextLineIterator* GetLineIterator(BasicTextField* textfield, lng linenumber);
+	PGScrollIterator GetScrollIterator(BasicTextField* textfield, PGVerticalScroll scroll);
+	PGScrollIterator GetLineIterator(BasicTextField* textfield, lng linenumber);
 
 	void InsertText(char character);
 	void InsertText(PGUTF8Character character);
@@ -124,7 +128,11 @@ public:
 	bool FindMatch(PGRegexHandle regex_handle, PGDirection direction, bool wrap, bool include_selection);
 	void FindAllMatches(PGRegexHandle regex_handle, bool select_first_match, lng start_line, lng start_character, lng end_line, lng end_character, bool wrap);
 
-	static void RunTextFinder(std::shared_ptr<Task> task, TextView* textfile, PGRegexHandle regex_handle, lng start_line, lng start_character, bool select_first_match);
+	// find all searches in the background, the matches are added to the view while the search progresses
+	// returns true and notifies the textfield if new matches have been added since the previous call
+	bool UpdateFindMatches();
+	// blocks until find all has found every match in the file
+	void WaitForFindMatches();
 
 	Cursor RestoreCursor(PGCursorRange data);
 	// same as RestoreCursor, but selections are replaced by the LOWEST value
@@ -147,8 +155,22 @@ public:
 
 	void VerifyTextView();
 private:
+	// the settings that are applied once the file has been loaded
+	// they are returned by GetSettings until then, so they are not lost when the workspace is written
+	PGTextViewSettings pending_settings;
+
 	void ActuallyRestoreCursors(std::vector<PGCursorRange>& data);
 
+	// the find all search that is currently running, if any
+	std::shared_ptr<PGFindSearch> find_search;
+	void StartFindMatches(std::shared_ptr<PGRegex> regex, bool select_first_match, lng start_line, lng start_character);
+	void CancelFindMatches();
+	// the matches of the previous find all, used to search only the modified buffers when the same search is performed again
+	std::shared_ptr<PGFindCache> find_cache;
+	void BuildFindCache(std::shared_ptr<PGRegex> regex);
+	// returns false if too much of the file has been modified, the file has to be searched in full then
+	bool FindMatchesIncremental(bool select_first_match, lng start_line, lng start_character);
+
 	void ClearExtraCursors();
 	void ClearCursors();
 };
\ No newline at end of file
@@ -112,3 +112,37 @@ void WrappedTextLineIterator::SetLineFromOffsets() {
 		wrapped_line.syntax = &this->syntax;
 	}
 }
+
+WrappedTextLineIterator::WrappedTextLineIterator(const WrappedTextLineIterator& other) :
+	TextLineIterator(other), view(other.view), font(other.font), wrap_width(other.wrap_width),
+	start_wrap(other.start_wrap), end_wrap(other.end_wrap), inner_line(other.inner_line),
+	max_inner_line(other.max_inner_line), wrap_positions(other.wrap_positions),
+	wrapped_line(other.wrapped_line), syntax(other.syntax) {
+	if (other.wrapped_line.syntax == &other.syntax) {
+		wrapped_line.syntax = &this->syntax;
+	}
+}
+
+PGScrollIterator::PGScrollIterator(TextFile* textfile, lng linenumber) : wrapped(false) {
+	new (&line_iterator) TextLineIterator(textfile, linenumber);
+}
+
+PGScrollIterator::PGScrollIterator(TextView* view, PGFontHandle font, TextFile* textfile, PGVerticalScroll scroll, PGScalar wrap_width) : wrapped(true) {
+	new (&wrapped_iterator) WrappedTextLineIterator(view, font, textfile, scroll, wrap_width);
+}
+
+PGScrollIterator::PGScrollIterator(const PGScrollIterator& other) : wrapped(other.wrapped) {
+	if (wrapped) {
+		new (&wrapped_iterator) WrappedTextLineIterator(other.wrapped_iterator);
+	} else {
+		new (&line_iterator) TextLineIterator(other.line_iterator);
+	}
+}
+
+PGScrollIterator::~PGScrollIterator() {
+	if (wrapped) {
+		wrapped_iterator.~WrappedTextLineIterator();
+	} else {
+		line_iterator.~TextLineIterator();
+	}
+}
@@ -17,6 +17,8 @@ public:
 	PGVerticalScroll GetCurrentScrollOffset();
 
 	WrappedTextLineIterator(TextView* view, PGFontHandle font, TextFile* textfile, PGVerticalScroll scroll, PGScalar wrap_width);
+	// the wrapped line can point to the syntax of the iterator itself, a copy points it to its own syntax
+	WrappedTextLineIterator(const WrappedTextLineIterator& other);
 protected:
 	void PrevLine();
 	void NextLine();
@@ -34,7 +36,30 @@ protected:
 	PGSyntax syntax;
 
 private:
+	WrappedTextLineIterator& operator=(const WrappedTextLineIterator&);
+
 	void SetCurrentScrollOffset(PGVerticalScroll scroll);
 
 	void SetLineFromOffsets();
 };
+
+// holds either a TextLineIterator or a WrappedTextLineIterator (if word wrap is enabled) by value,
+// so the iterators used for drawing and scrolling live on the stack instead of being allocated every time
+class PGScrollIterator {
+public:
+	PGScrollIterator(TextFile* textfile, lng linenumber);
+	PGScrollIterator(TextView* view, PGFontHandle font, TextFile* textfile, PGVerticalScroll scroll, PGScalar wrap_width);
+	PGScrollIterator(const PGScrollIterator& other);
+	~PGScrollIterator();
+
+	TextLineIterator* operator->() { return wrapped ? &wrapped_iterator : &line_iterator; }
+	TextLineIterator& operator*() { return *operator->(); }
+private:
+	PGScrollIterator& operator=(const PGScrollIterator&);
+
+	bool wrapped;
+	union {
+		TextLineIterator line_iterator;
+		WrappedTextLineIterator wrapped_iterator;
+	};
+};
@@ -13,9 +13,13 @@
 
 PG_CONTROL_INITIALIZE_KEYBINDINGS(ControlManager);
 
+// if more regions than this are invalidated in a single frame they are merged into one
+#define MAX_INVALIDATED_AREAS 16
+
 ControlManager::ControlManager(PGWindowHandle window) :
 	PGContainer(window), active_projectexplorer(nullptr), active_findtext(nullptr), 
-	is_focused(true), columns(0), rows(0), projectexplorer_width(200)
+	is_focused(true), columns(0), rows(0), projectexplorer_width(200),
+	invalidation_lock(CreateMutex()), invalidated(false)
 {
 #ifdef PANTHER_DEBUG
 	entrance_count = 0;
@@ -50,24 +54,33 @@ void ControlManager::Update(void) {
 	}
 	SetCursor(this->window, cursor);
 	// after the periodic render, render anything that needs to be rerendered (if any)
-	if (this->invalidated) {
+	std::vector<PGIRect> areas;
+	LockMutex(invalidation_lock.get());
+	bool redraw_window = this->invalidated;
+	areas.swap(this->invalidated_areas);
+	this->invalidated = false;
+	UnlockMutex(invalidation_lock.get());
+	if (redraw_window) {
 		RedrawWindow(window);
-	} else if (this->invalidated_area.width != 0) {
-		RedrawWindow(window, this->invalidated_area);
+	} else if (areas.size() > 0) {
+		CoalesceRectangles(areas);
+		for (auto it = areas.begin(); it != areas.end(); it++) {
+			RedrawWindow(window, *it);
+		}
 	}
-	this->invalidated = 0;
-	this->invalidated_area.width = 0;
 	LeaveManager();
 
 	if (write_workspace_counter > 0) {
 		write_workspace_counter--;
 		if (write_workspace_counter == 0) {
-			std::string msg = PGGetWorkspace(window)->WriteWorkspace();
-			if (msg.size() != 0) {
-				statusbar->AddTimedNotification(PGStatusError, "Failed to save workspace.", "Failed to save workspace: " + msg, 1, 15);
-			}
+			// the workspace is written in the background, errors are reported on a later update
+			PGGetWorkspace(window)->WriteWorkspaceAsync();
 		}
 	}
+	std::string msg = PGGetWorkspace(window)->GetWriteError();
+	if (msg.size() != 0) {
+		statusbar->AddTimedNotification(PGStatusError, "Failed to save workspace.", "Failed to save workspace: " + msg, 1, 15);
+	}
 }
 
 bool ControlManager::KeyboardCharacter(char character, PGModifier modifier) {
@@ -82,7 +95,9 @@ bool ControlManager::KeyboardCharacter(char character, PGModifier modifier) {
 }
 
 void ControlManager::RefreshWindow(bool redraw_now) {
+	LockMutex(invalidation_lock.get());
 	this->invalidated = true;
+	UnlockMutex(invalidation_lock.get());
 	if (redraw_now) RedrawWindow(window);
 }
 
@@ -100,27 +115,53 @@ void ControlManager::ShowProjectExplorer(bool visible) {
 	this->TriggerResize();
 }
 
-void ControlManager::RefreshWindow(PGIRect rectangle, bool redraw_now) {
-	// invalidate a rectangle
-	if (this->invalidated_area.width == 0) {
-		// if there is no currently invalidated rectangle,
-		// the invalidated rectangle is simply the supplied rectangle
-		this->invalidated_area = rectangle;
-	} else {
-		int maxx = this->invalidated_area.x + this->invalidated_area.width;
-		int maxy = this->invalidated_area.y + this->invalidated_area.height;
-
-		// otherwise we merge the two rectangles into one big one
-		this->invalidated_area.x = std::min(this->invalidated_area.x, rectangle.x);
-		this->invalidated_area.y = std::min(this->invalidated_area.y, rectangle.y);
-		this->invalidated_area.width = std::max(maxx, rectangle.x + rectangle.width) - this->invalidated_area.x;
-		this->invalidated_area.height = std::max(maxy, rectangle.y + rectangle.height) - this->invalidated_area.y;
-		assert(this->invalidated_area.x <= rectangle.x &&
-			this->invalidated_area.y <= rectangle.y &&
-			this->invalidated_area.x + this->invalidated_area.width >= rectangle.x + rectangle.width &&
-			this->invalidated_area.y + this->invalidated_area.height >= rectangle.y + rectangle.height);
+static PGIRect MergeRectangles(const PGIRect& a, const PGIRect& b) {
+	int x = std::min(a.x, b.x);
+	int y = std::min(a.y, b.y);
+	int width = std::max(a.x + a.width, b.x + b.width) - x;
+	int height = std::max(a.y + a.height, b.y + b.height) - y;
+	return PGIRect(x, y, width, height);
+}
+
+static lng RectangleArea(const PGIRect& rect) {
+	return (lng)rect.width * (lng)rect.height;
+}
+
+void ControlManager::CoalesceRectangles(std::vector<PGIRect>& rectangles) {
+	// two rectangles are merged if their bounding box is not larger than the two rectangles separately
+	// this merges overlapping and adjacent rectangles, while keeping rectangles that are far apart separate
+	bool merged = true;
+	while (merged) {
+		merged = false;
+		for (size_t i = 0; i < rectangles.size(); i++) {
+			for (size_t j = i + 1; j < rectangles.size(); j++) {
+				PGIRect bounds = MergeRectangles(rectangles[i], rectangles[j]);
+				if (RectangleArea(bounds) <= RectangleArea(rectangles[i]) + RectangleArea(rectangles[j])) {
+					rectangles[i] = bounds;
+					rectangles.erase(rectangles.begin() + j);
+					merged = true;
+					j--;
+				}
+			}
+		}
+	}
+	if (rectangles.size() > MAX_INVALIDATED_AREAS) {
+		PGIRect bounds = rectangles[0];
+		for (auto it = rectangles.begin() + 1; it != rectangles.end(); it++) {
+			bounds = MergeRectangles(bounds, *it);
+		}
+		rectangles.clear();
+		rectangles.push_back(bounds);
 	}
-	if (redraw_now) RedrawWindow(window, invalidated_area);
+}
+
+void ControlManager::RefreshWindow(PGIRect rectangle, bool redraw_now) {
+	// invalidate a rectangle; rectangles are collected and coalesced in the next Update
+	if (rectangle.width <= 0 || rectangle.height <= 0) return;
+	LockMutex(invalidation_lock.get());
+	this->invalidated_areas.push_back(rectangle);
+	UnlockMutex(invalidation_lock.get());
+	if (redraw_now) RedrawWindow(window, rectangle);
 }
 
 void ControlManager::RegisterMouseRegion(PGIRect* rect, Control* control, PGMouseCallback mouse_event, void* data) {
@@ -440,6 +481,8 @@ void ControlManager::LeaveManager() {
 void ControlManager::MouseWheel(int x, int y, double hdistance, double distance, PGModifier modifier) {
 	EnterManager();
 	PGContainer::MouseWheel(x, y, hdistance, distance, modifier);
+	// windows can be scrolled without having focus, so the scroll position is captured with the next write
+	PGGetWorkspace(window)->InvalidateWindow(window);
 	LeaveManager();
 }
 
@@ -582,6 +625,7 @@ void ControlManager::ActiveFileChanged(Control *control) {
 }
 
 void ControlManager::InvalidateWorkspace() {
+	PGGetWorkspace(window)->InvalidateWindow(window);
 	if (write_workspace_counter == 0) {
 		write_workspace_counter = 50;
 	}
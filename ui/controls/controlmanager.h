@@ -104,7 +104,9 @@ private:
 	std::vector<TextFieldContainer*> textfields;
 	std::vector<Splitter*> splitters;
 
-	PGIRect invalidated_area;
+	// the regions of the window that have to be redrawn, coalesced once per frame
+	std::vector<PGIRect> invalidated_areas;
+	std::unique_ptr<PGMutex> invalidation_lock;
 	bool invalidated;
 	bool is_destroyed = false;
 	bool is_dragging = false;
@@ -112,6 +114,8 @@ private:
 
 	void EnterManager();
 	void LeaveManager();
+
+	static void CoalesceRectangles(std::vector<PGIRect>& rectangles);
 #ifdef PANTHER_DEBUG
 	int entrance_count = 0;
 #endif
@@ -565,7 +565,12 @@ void PGFindText::FindInFiles() {
 		PGDestroyGlobSet(whitelist);
 	}*/
 	// now schedule the actual search
-	textfile->FindAllMatchesAsync(whitelist, manager->active_projectexplorer, regex, 2, ignore_binary_files);
+	// the previous search is stopped, its results are no longer interesting
+	auto& find_in_files_task = GetFindTextManager().find_in_files_task;
+	if (find_in_files_task) {
+		find_in_files_task->active = false;
+	}
+	find_in_files_task = textfile->FindAllMatchesAsync(whitelist, manager->active_projectexplorer, regex, 2, ignore_binary_files, PGTaskUrgent);
 }
 
 bool PGFindText::SelectAllMatches(bool in_selection) {
@@ -573,20 +578,32 @@ bool PGFindText::SelectAllMatches(bool in_selection) {
 	auto view = manager->active_textfield->GetTextView();
 	if (!view->file->IsLoaded()) return false;
 
-	if (HighlightMatches()) {
-		// toggle-highlight is turned on
-		// so we should already be searching
-		// wait for the search to finish
-		while (!view->FinishedSearch());
-	} else {
+	if (!HighlightMatches()) {
+		// if toggle-highlight is turned on we should already be searching
 		// otherwise, we have to actually perform the search
-		// FIXME: if FindAll becomes non-blocking, we have to call the
-		// blocking version here
 		this->FindAll(false);
 	}
+	// wait for the search to finish
+	view->WaitForFindMatches();
 	assert(view->FinishedSearch());
 	return view->SelectMatches(in_selection);
 }
+
+void PGFindText::Update(void) {
+	if (counting_matches && notification) {
+		ControlManager* manager = GetControlManager(this);
+		auto view = manager->active_textfield->GetTextView();
+		size_t match_count = view->GetFindMatches().size();
+		if (view->FinishedSearch() || match_count != counted_matches) {
+			notification->SetType(match_count == 0 && view->FinishedSearch() ? PGStatusWarning : PGStatusInProgress);
+			notification->SetText("Found " + std::to_string(match_count) + " matches");
+			counting_matches = !view->FinishedSearch();
+			counted_matches = match_count;
+		}
+	}
+	PGContainer::Update();
+}
+
 void PGFindText::FindAll(bool select_first_match) {
 	ControlManager* manager = GetControlManager(this);
 	auto view = manager->active_textfield->GetTextView();
@@ -602,6 +619,7 @@ void PGFindText::FindAll(bool select_first_match) {
 
 	if (pattern.size() == 0) {
 		view->ClearMatches();
+		counting_matches = false;
 		if (notification) {
 			GetControlManager(this)->statusbar->RemoveNotification(notification);
 			notification = nullptr;
@@ -614,6 +632,7 @@ void PGFindText::FindAll(bool select_first_match) {
 		type = PGStatusError;
 		text = "Failed to compile regex: " + PGGetRegexError(regex_handle);
 		this->field->SetValidInput(false);
+		counting_matches = false;
 		goto set_notification;
 	}
 	view->FindAllMatches(regex_handle, select_first_match,
@@ -622,10 +641,13 @@ void PGFindText::FindAll(bool select_first_match) {
 		toggle_wrap->IsToggled());
 	
 	{
+		// the search continues in the background, the number of matches is updated in Update
 		size_t match_count = view->GetFindMatches().size();
-		type = match_count == 0 ? PGStatusWarning : PGStatusInProgress;
+		type = match_count == 0 && view->FinishedSearch() ? PGStatusWarning : PGStatusInProgress;
 		text = "Found " + std::to_string(match_count) + " matches";
 		this->field->SetValidInput(true);
+		counting_matches = !view->FinishedSearch();
+		counted_matches = match_count;
 	}
 
 set_notification:
@@ -19,6 +19,7 @@ public:
 	bool KeyboardButton(PGButton button, PGModifier modifier);
 	
 	void Draw(PGRendererHandle renderer);
+	void Update(void);
 
 	bool HighlightMatches() { return type != PGFindReplaceManyFiles && toggle_highlight && toggle_highlight->IsToggled(); }
 	
@@ -96,6 +97,9 @@ private:
 	FindTextManager& GetFindTextManager();
 
 	std::shared_ptr<PGStatusNotification> notification = nullptr;
+	// find all is still running, so the number of matches in the notification has to be updated
+	bool counting_matches = false;
+	size_t counted_matches = 0;
 
 	void UpdateFieldHeight(bool force_update = false);
 
@@ -17,11 +17,12 @@ PG_CONTROL_INITIALIZE_KEYBINDINGS(ProjectExplorer);
 #define PROJECT_EXPLORER_PADDING 24
 
 ProjectExplorer::ProjectExplorer(PGWindowHandle window) :
-	PGContainer(window), dragging_scrollbar(false), renaming_file(-1), scrollbar_offset(0), file_render_height(0), show_all_files(true) {
+	PGContainer(window), dragging_scrollbar(false), renaming_file(-1), scrollbar_offset(0), file_render_height(0), show_all_files(true), processing_changes(false) {
 	font = PGCreateFont(PGFontTypePopup);
 	SetTextFontSize(font, 12);
 
 	lock = std::unique_ptr<PGMutex>(CreateMutex());
+	watch_group = FileWatcher::CreateGroup();
 
 	std::string ignore_list;
 	if (PGSettingsManager::GetSetting("ignored_files", ignore_list)) {
@@ -45,7 +46,12 @@ ProjectExplorer::ProjectExplorer(PGWindowHandle window) :
 
 ProjectExplorer::~ProjectExplorer() {
 	this->update_task = nullptr;
+	this->change_task = nullptr;
+	FileWatcher::DestroyGroup(watch_group);
 	LockMutex(lock.get());
+	if (index_task) {
+		index_task->active = false;
+	}
 }
 
 void ProjectExplorer::Initialize(void) {
@@ -100,13 +106,49 @@ void ProjectExplorer::Initialize(void) {
 }
 
 void ProjectExplorer::Update(void) {
-	UpdateDirectories(false);
+	for (auto it = directories.begin(); it != directories.end(); it++) {
+		if (it->directory->last_modified_time < 0) {
+			// this directory has not been read yet
+			UpdateDirectories(false);
+			break;
+		}
+	}
+	// afterwards we do not check the directories ourselves, the file watcher tells us what has changed
+	if (processing_changes) return;
+	auto changes = FileWatcher::GetChanges(watch_group);
+	if (changes.size() > 0) {
+		UpdateChangedDirectories(changes);
+	}
 }
 
 struct UpdateInformation {
 	ProjectExplorer* explorer;
+	bool force;
 };
 
+struct CrawlInformation {
+	ProjectExplorer* explorer;
+	// the crawl is cancelled when this task is replaced
+	std::shared_ptr<Task>* current_task;
+	Task* task;
+};
+
+bool ProjectExplorer::CrawlCallback(PGDirectory* directory, void* data) {
+	CrawlInformation* crawl = (CrawlInformation*)data;
+	if (crawl->current_task->get() != crawl->task) {
+		return false;
+	}
+	if (directory->loaded_files) {
+		// the directory has been read, from now on the file watcher reports changes to it
+		// the project directories are the roots, they are polled if the watcher cannot watch them
+		FileWatcher::WatchDirectory(crawl->explorer->watch_group, directory->path, !directory->parent);
+	}
+	if (directory->parent && directory->parent->IsExpanded()) {
+		crawl->explorer->Invalidate();
+	}
+	return true;
+}
+
 void ProjectExplorer::UpdateDirectories(bool force) {
 	bool update_directory = force;
 	if (!force) {
@@ -121,34 +163,48 @@ void ProjectExplorer::UpdateDirectories(bool force) {
 	if (update_directory) {
 		UpdateInformation* info = new UpdateInformation();
 		info->explorer = this;
+		info->force = force;
 		this->update_task = std::shared_ptr<Task>(new Task([](std::shared_ptr<Task> task, void* data) {
 			UpdateInformation* info = (UpdateInformation*)data;
 			LockMutex(info->explorer->lock.get());
 			auto directories = info->explorer->directories;
 			UnlockMutex(info->explorer->lock.get());
+			bool show_all_files = info->explorer->show_all_files;
+			CrawlInformation crawl;
+			crawl.explorer = info->explorer;
+			crawl.current_task = &info->explorer->update_task;
+			crawl.task = task.get();
 			for (auto it = directories.begin(); it != directories.end(); it++) {
-				std::queue<std::shared_ptr<PGDirectory>> open_directories;
-				PGIgnoreGlob glob = info->explorer->show_all_files ? nullptr : PGCreateGlobForDirectory(it->directory->path.c_str());
-				it->directory->Update(glob, open_directories, it->index);
-				while (open_directories.size() > 0) {
-					if (info->explorer->update_task != task) {
-						break;
-					}
-					std::shared_ptr<PGDirectory> subdir = open_directories.front();
-					open_directories.pop();
-					subdir->Update(glob, open_directories, it->index);
-					if (subdir->parent && subdir->parent->IsExpanded()) {
-						info->explorer->Invalidate();
-					}
+				if (info->explorer->update_task != task) {
+					break;
+				}
+				// changes to the .gitignore change which files are shown
+				FileWatcher::WatchFile(info->explorer->watch_group, PGPathJoin(it->directory->path, ".gitignore"));
+				// directories whose modification time is unchanged are not read again
+				// unless the .gitignore has changed, because then their contents might be filtered differently
+				bool force = info->force;
+				lng ignore_modification_time = -1;
+				if (!show_all_files) {
+					auto flags = PGGetFileFlags(PGPathJoin(it->directory->path, ".gitignore"));
+					ignore_modification_time = flags.flags == PGFileFlagsEmpty ? flags.modification_time : -1;
 				}
+				if (ignore_modification_time != it->directory->ignore_modification_time) {
+					it->directory->ignore_modification_time = ignore_modification_time;
+					force = true;
+				}
+				bool finished = PGDirectory::Crawl(it->directory, !show_all_files, it->index, force, CrawlCallback, &crawl);
+				if (finished) {
 #ifdef PANTHER_DEBUG
-				if (info->explorer->update_task == task) {
 					LockMutex(info->explorer->lock.get());
 					info->explorer->VerifyDirectories();
 					UnlockMutex(info->explorer->lock.get());
-				}
 #endif
-				PGDestroyIgnoreGlob(glob);
+					// store the tree so the next startup can show it immediately
+					it->directory->WriteSnapshot(PGDirectory::SnapshotFilename(it->directory->path, show_all_files));
+				}
+			}
+			if (info->explorer->update_task == task) {
+				info->explorer->UpdateTrigramIndices();
 			}
 			info->explorer->Invalidate();
 			delete info;
@@ -157,6 +213,122 @@ void ProjectExplorer::UpdateDirectories(bool force) {
 	}
 }
 
+struct ChangeInformation {
+	ProjectExplorer* explorer;
+	std::vector<std::string> changes;
+};
+
+void ProjectExplorer::UpdateChangedDirectories(std::vector<std::string>& changes) {
+	for (auto it = changes.begin(); it != changes.end(); it++) {
+		if (!show_all_files && PGFile(*it).Filename() == ".gitignore") {
+			// the .gitignore of a project has changed, every directory might be filtered differently
+			this->UpdateDirectories(true);
+			return;
+		}
+	}
+	ChangeInformation* info = new ChangeInformation();
+	info->explorer = this;
+	info->changes = changes;
+	processing_changes = true;
+	this->change_task = std::shared_ptr<Task>(new Task([](std::shared_ptr<Task> task, void* data) {
+		ChangeInformation* info = (ChangeInformation*)data;
+		LockMutex(info->explorer->lock.get());
+		auto directories = info->explorer->directories;
+		UnlockMutex(info->explorer->lock.get());
+		bool show_all_files = info->explorer->show_all_files;
+		CrawlInformation crawl;
+		crawl.explorer = info->explorer;
+		crawl.current_task = &info->explorer->change_task;
+		crawl.task = task.get();
+		for (auto it = directories.begin(); it != directories.end(); it++) {
+			for (auto path = info->changes.begin(); path != info->changes.end(); path++) {
+				if (info->explorer->change_task != task) {
+					break;
+				}
+				auto directory = PGDirectory::FindDirectory(it->directory, *path);
+				if (!directory) continue;
+				// read the changed directory again, and crawl any directories that have been added to it
+				std::vector<std::shared_ptr<PGDirectory>> subdirectories;
+				directory->Update(!show_all_files, subdirectories, it->index, true);
+				CrawlCallback(directory.get(), &crawl);
+				for (auto subdirectory = subdirectories.begin(); subdirectory != subdirectories.end(); subdirectory++) {
+					if (!(*subdirectory)->loaded_files) {
+						PGDirectory::Crawl(*subdirectory, !show_all_files, it->index, false, CrawlCallback, &crawl);
+					}
+				}
+			}
+		}
+		if (info->explorer->change_task == task) {
+			// the files in the changed directories are indexed again
+			info->explorer->UpdateTrigramIndices(info->changes);
+		}
+		info->explorer->Invalidate();
+		info->explorer->processing_changes = false;
+		delete info;
+	}, info));
+	Scheduler::RegisterTask(change_task, PGTaskUrgent);
+}
+
+struct TrigramIndexInformation {
+	std::vector<std::shared_ptr<PGDirectory>> directories;
+	std::vector<std::shared_ptr<PGTrigramIndex>> indices;
+	std::vector<std::string> changes;
+	std::shared_ptr<std::atomic<bool>> finished;
+};
+
+void ProjectExplorer::UpdateTrigramIndices(std::vector<std::string> changes) {
+	bool index_files = true;
+	PGSettingsManager::GetSetting("find_in_files_index", index_files);
+	if (!index_files) return;
+
+	TrigramIndexInformation* info = new TrigramIndexInformation();
+	auto task = std::make_shared<Task>([](std::shared_ptr<Task> task, void* data) {
+		TrigramIndexInformation* info = (TrigramIndexInformation*)data;
+		bool finished = true;
+		for (size_t i = 0; i < info->indices.size() && task->active; i++) {
+			PGTrigramIndex* index = info->indices[i].get();
+			std::string filename = PGTrigramIndex::IndexFilename(info->directories[i]->path);
+			LockMutex(index->update_lock.get());
+			if (!index->IsLoaded()) {
+				index->Load(filename);
+			}
+			// a partially updated index is written as well, so the work is not lost if the editor is closed
+			if (!index->Update(info->directories[i], task.get(), info->changes)) {
+				finished = false;
+			}
+			index->Write(filename);
+			UnlockMutex(index->update_lock.get());
+		}
+		*info->finished = finished && task->active;
+		delete info;
+	}, info);
+	// the task does not touch the project explorer, so it can safely outlive it
+	LockMutex(lock.get());
+	for (auto it = directories.begin(); it != directories.end(); it++) {
+		info->directories.push_back(it->directory);
+		info->indices.push_back(it->trigrams);
+	}
+	if (index_task) {
+		// the previous update is cancelled, the new update continues where it left off
+		index_task->active = false;
+		if (!*index_finished) {
+			// the paths the previous update did not get to are checked by the new update
+			if (changes.size() > 0 && index_changes.size() > 0) {
+				changes.insert(changes.end(), index_changes.begin(), index_changes.end());
+			} else {
+				changes.clear();
+			}
+		}
+	}
+	info->changes = changes;
+	info->finished = std::make_shared<std::atomic<bool>>(false);
+	index_changes = changes;
+	index_finished = info->finished;
+	index_task = task;
+	UnlockMutex(lock.get());
+	Scheduler::RegisterTask(task, PGTaskNotUrgent);
+}
+
 void ProjectExplorer::SetShowAllFiles(bool show_all_files) {
 	this->show_all_files = show_all_files;
 	this->UpdateDirectories(true);
@@ -671,6 +843,9 @@ void ProjectExplorer::AddDirectory(std::string directory) {
 
 	auto dir = std::shared_ptr<PGDirectory>(new PGDirectory(directory, nullptr));
 	if (dir) {
+		DirectoryIndex entry(dir);
+		// show the tree of the previous session while the directories are verified
+		dir->LoadSnapshot(PGDirectory::SnapshotFilename(dir->path, show_all_files), entry.index);
 		dir->SetExpanded(true);
 #ifdef PANTHER_DEBUG
 		VerifyDirectories();
@@ -678,7 +853,7 @@ void ProjectExplorer::AddDirectory(std::string directory) {
 		lng displayed_files = this->TotalFiles();
 		this->update_task = nullptr;
 		LockMutex(lock.get());
-		this->directories.push_back(dir);
+		this->directories.push_back(entry);
 		UnlockMutex(lock.get());
 		this->UpdateDirectories(false);
 		this->ScrollToFile(displayed_files + RenderedFiles() - 1);
@@ -692,6 +867,7 @@ void ProjectExplorer::AddDirectory(std::string directory) {
 void ProjectExplorer::RemoveDirectory(lng index) {
 	assert(index >= 0 && index < directories.size());
 	this->update_task = nullptr;
+	FileWatcher::Unwatch(watch_group, directories[index].directory->path, true);
 	LockMutex(lock.get());
 	directories.erase(directories.begin() + index);
 	UnlockMutex(lock.get());
@@ -722,6 +898,16 @@ std::vector<std::shared_ptr<SearchIndex>> ProjectExplorer::GetIndices() {
 	return indices;
 }
 
+std::vector<std::shared_ptr<PGTrigramIndex>> ProjectExplorer::GetTrigramIndices() {
+	std::vector<std::shared_ptr<PGTrigramIndex>> indices;
+	LockMutex(lock.get());
+	for (size_t i = 0; i < directories.size(); i++) {
+		indices.push_back(directories[i].trigrams);
+	}
+	UnlockMutex(lock.get());
+	return indices;
+}
+
 void ProjectExplorer::SelectFile(lng selected_file, PGSelectFileType type, bool open_file, bool click) {
 	FinishRename(true, false);
 	if (type == PGSelectSingleFile) {
@@ -834,10 +1020,13 @@ void ProjectExplorer::LoadWorkspace(nlohmann::json& j) {
 					std::string path = dir["directory"];
 					auto directory = std::shared_ptr<PGDirectory>(new PGDirectory(path, nullptr));
 					if (directory) {
+						DirectoryIndex entry(directory);
+						// the snapshot has to be loaded first, so the expansions of subdirectories can be restored
+						directory->LoadSnapshot(PGDirectory::SnapshotFilename(path, show_all_files), entry.index);
 						if (dir.count("expansions") > 0 && dir["expansions"].is_object()) {
 							directory->LoadWorkspace(dir["expansions"]);
 						}
-						directories.push_back(directory);
+						directories.push_back(entry);
 					}
 				}
 			}
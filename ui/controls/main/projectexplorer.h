@@ -4,10 +4,12 @@
 #include "button.h"
 #include "container.h"
 #include "directory.h"
+#include "filewatcher.h"
 #include "simpletextfield.h"
 #include "togglebutton.h"
 #include "scrollbar.h"
 #include "searchindex.h"
+#include "trigramindex.h"
 
 #include <unordered_set>
 
@@ -77,6 +79,7 @@ public:
 	void IterateOverFiles(PGDirectoryIterCallback callback, void* data);
 
 	std::vector<std::shared_ptr<SearchIndex>> GetIndices();
+	std::vector<std::shared_ptr<PGTrigramIndex>> GetTrigramIndices();
 
 	virtual PGControlType GetControlType() { return PGControlTypeProjectExplorer; }
 private:
@@ -87,8 +90,23 @@ private:
 #endif
 
 	void UpdateDirectories(bool force);
+	static bool CrawlCallback(PGDirectory* directory, void* data);
+	// reads only the directories that have been reported as changed by the file watcher
+	void UpdateChangedDirectories(std::vector<std::string>& changes);
+	// brings the trigram indices of the directories up to date in the background
+	// if changes is not empty only the files below the changed paths are checked
+	void UpdateTrigramIndices(std::vector<std::string> changes = std::vector<std::string>());
 
 	std::shared_ptr<Task> update_task;
+	std::shared_ptr<Task> change_task;
+	// set while the change task is running; new changes are collected by the watcher in the meantime
+	std::atomic<bool> processing_changes;
+	std::shared_ptr<Task> index_task;
+	// the changed paths the current index task checks (empty if it checks every file), and whether it has finished
+	// if a task is cancelled before it has finished, the next task checks its paths as well
+	std::vector<std::string> index_changes;
+	std::shared_ptr<std::atomic<bool>> index_finished;
+	PGFileWatchGroupHandle watch_group = nullptr;
 
 	void Undo(FileOperationDelta*);
 	void Redo(FileOperationDelta*);
@@ -114,10 +132,12 @@ private:
 	void ActuallyPerformRename(std::string old_name, std::string new_name, bool update_selection);
 
 	struct DirectoryIndex {
-		DirectoryIndex(std::shared_ptr<PGDirectory> directory) : directory(directory), index(std::make_shared<SearchIndex>()) { }
+		DirectoryIndex(std::shared_ptr<PGDirectory> directory) : directory(directory), index(std::make_shared<SearchIndex>()),
+			trigrams(std::make_shared<PGTrigramIndex>(directory->path)) { }
 
 		std::shared_ptr<PGDirectory> directory;
 		std::shared_ptr<SearchIndex> index;
+		std::shared_ptr<PGTrigramIndex> trigrams;
 	};
 
 	PGGlobSet ignore_glob;
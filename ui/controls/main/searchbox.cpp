@@ -307,7 +307,7 @@ void SearchBox::Filter(std::string filter) {
 	for (auto it = this->entries.begin(); it != this->entries.end(); it++) {
 		additional_entries.push_back(&*it);
 	}
-	auto entries = SearchIndex::Search(indices, additional_entries, filter, SEARCHBOX_MAX_ENTRIES);
+	auto entries = SearchIndex::Search(indices, additional_entries, filter, SEARCHBOX_MAX_ENTRIES, &search_cache);
 	for (auto it = entries.begin(); it != entries.end(); it++) {
 		displayed_entries.push_back(*it);
 	}
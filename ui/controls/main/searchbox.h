@@ -52,6 +52,8 @@ private:
 	std::vector<std::shared_ptr<SearchIndex>> indices;
 	std::vector<SearchEntry> entries;
 	std::vector<SearchEntry*> displayed_entries;
+	// results of the previous search, used to refine the search while typing
+	SearchCache search_cache;
 
 	bool render_subtitles = false;
 
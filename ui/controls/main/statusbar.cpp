@@ -271,18 +271,22 @@ std::shared_ptr<PGStatusNotification> StatusBar::AddNotification(PGStatusType ty
 }
 
 void StatusBar::RemoveNotification(std::shared_ptr<PGStatusNotification> notification) {
+	RemoveNotification(notification.get());
+}
+
+void StatusBar::RemoveNotification(PGStatusNotification* notification) {
 	PGStatusNotification* n = notifications;
 	PGStatusNotification* prev = nullptr;
 	while (n && n->GetControlType() == PGControlTypeStatusNotification) {
-		if (n == notification.get()) {
+		if (n == notification) {
 			if (prev) {
 				prev->right_anchor = n->right_anchor;
 			}
-			if (notification.get() == notifications) {
+			if (notification == notifications) {
 				notifications = n->right_anchor->GetControlType() == PGControlTypeStatusNotification ?
 					(PGStatusNotification*) n->right_anchor : nullptr;
 			}
-			this->RemoveControl(notification.get());
+			this->RemoveControl(notification);
 			return;
 		}
 		prev = n;
@@ -310,6 +314,16 @@ void StatusBar::AddTimedNotification(PGStatusType type, std::string text, std::s
 }
 
 void StatusBar::Update(/* double t */) {
+	// apply the updates that background tasks have posted since the previous frame
+	std::vector<PGStatusNotification*> removed;
+	for (PGStatusNotification* n = notifications; n && n->GetControlType() == PGControlTypeStatusNotification; n = (PGStatusNotification*)n->right_anchor) {
+		if (!n->ApplyPostedUpdates()) {
+			removed.push_back(n);
+		}
+	}
+	for (auto it = removed.begin(); it != removed.end(); it++) {
+		RemoveNotification(*it);
+	}
 	for(size_t i = 0; i < timed_notifications.size(); i++) {
 		auto ptr = timed_notifications[i].lock();
 		if (ptr) {
@@ -31,6 +31,7 @@ public:
 	void AddTimedNotification(PGStatusType type, std::string text, std::string tooltip, int id, double time);
 	std::shared_ptr<PGStatusNotification> AddNotification(PGStatusType type, std::string text, std::string tooltip, bool progress_bar);
 	void RemoveNotification(std::shared_ptr<PGStatusNotification> notification);
+	void RemoveNotification(PGStatusNotification* notification);
 
 	TextField* GetActiveTextField();
 
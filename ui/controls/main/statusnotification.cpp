@@ -27,6 +27,51 @@ void PGStatusNotification::SetType(PGStatusType type) {
 	this->Invalidate();
 }
 
+void PGStatusNotification::PostText(std::string text) {
+	updates.enqueue(PGStatusUpdate(PGStatusUpdateText, text, 0));
+}
+
+void PGStatusNotification::PostProgress(double progress) {
+	updates.enqueue(PGStatusUpdate(PGStatusUpdateProgress, "", progress));
+}
+
+void PGStatusNotification::PostRemoval() {
+	updates.enqueue(PGStatusUpdate(PGStatusUpdateRemoval, "", 0));
+}
+
+bool PGStatusNotification::ApplyPostedUpdates() {
+	// only the most recent text and progress are shown, so the notification is redrawn at most once
+	PGStatusUpdate update;
+	std::string text;
+	double progress = 0;
+	bool has_text = false, has_progress = false, removed = false;
+	while (updates.try_dequeue(update)) {
+		switch (update.type) {
+			case PGStatusUpdateText:
+				text.swap(update.text);
+				has_text = true;
+				break;
+			case PGStatusUpdateProgress:
+				progress = update.progress;
+				has_progress = true;
+				break;
+			case PGStatusUpdateRemoval:
+				removed = true;
+				break;
+		}
+	}
+	if (removed) {
+		return false;
+	}
+	if (has_text) {
+		SetText(text);
+	}
+	if (has_progress) {
+		SetProgress(progress);
+	}
+	return true;
+}
+
 void PGStatusNotification::ResolveSize(PGSize new_size) {
 	if (font) {
 		this->fixed_width = MeasureTextWidth(font, text);
@@ -3,12 +3,29 @@
 #include "utils.h"
 #include "control.h"
 
+#include "concurrentqueue.h"
+
 enum PGStatusType {
 	PGStatusInProgress,
 	PGStatusWarning,
 	PGStatusError,
 };
 
+enum PGStatusUpdateType {
+	PGStatusUpdateText,
+	PGStatusUpdateProgress,
+	PGStatusUpdateRemoval
+};
+
+struct PGStatusUpdate {
+	PGStatusUpdateType type;
+	std::string text;
+	double progress;
+
+	PGStatusUpdate() : type(PGStatusUpdateText), progress(0) { }
+	PGStatusUpdate(PGStatusUpdateType type, std::string text, double progress) : type(type), text(text), progress(progress) { }
+};
+
 class PGStatusNotification : public Control {
 public:
 	PGStatusNotification(PGWindowHandle window, PGFontHandle font, PGStatusType type, std::string display_text, std::string tooltip, bool progress_bar);
@@ -17,6 +34,14 @@ public:
 	void SetProgress(double progress);
 	void SetType(PGStatusType type);
 
+	// the Post functions can be called from any thread, the updates are applied by the status bar once per frame
+	void PostText(std::string text);
+	void PostProgress(double progress);
+	// removes the notification from the status bar
+	void PostRemoval();
+	// applies the posted updates, returns false if the notification should be removed
+	bool ApplyPostedUpdates();
+
 	void ResolveSize(PGSize new_size);
 
 	PGControlType GetControlType() { return PGControlTypeStatusNotification; }
@@ -30,4 +55,6 @@ private:
 	std::string text;
 	PGStatusType type;
 	double completion_percentage;
+
+	moodycamel::ConcurrentQueue<PGStatusUpdate> updates;
 };
@@ -0,0 +1,250 @@
+
+#include "minimap.h"
+#include "scheduler.h"
+#include "style.h"
+#include "textfield.h"
+#include "unicode.h"
+
+// how strongly the text stands out from the background of the minimap
+#define MINIMAP_TEXT_OPACITY 0.6
+
+MinimapTileQueue::~MinimapTileQueue() {
+	for (auto it = results.begin(); it != results.end(); it++) {
+		if (it->bitmap) {
+			DeleteImage(it->bitmap);
+		}
+	}
+}
+
+struct MinimapTileTask {
+	std::weak_ptr<TextFile> file;
+	std::shared_ptr<MinimapTileQueue> queue;
+	MinimapTileRequest request;
+	lng generation;
+	int width;
+	int line_height;
+	int tabwidth;
+
+	MinimapTileTask(std::shared_ptr<TextFile> file, std::shared_ptr<MinimapTileQueue> queue, MinimapTileRequest request, lng generation, int width, int line_height, int tabwidth) :
+		file(file), queue(queue), request(request), generation(generation), width(width), line_height(line_height), tabwidth(tabwidth) { }
+};
+
+static PGColor BlendColor(PGColor color, PGColor background) {
+	double opacity = MINIMAP_TEXT_OPACITY * color.a / 255.0;
+	return PGColor(
+		(byte)(background.r + (color.r - background.r) * opacity),
+		(byte)(background.g + (color.g - background.g) * opacity),
+		(byte)(background.b + (color.b - background.b) * opacity));
+}
+
+static PGBitmapHandle RenderTile(PGTextBuffer* buffer, int width, int line_height, int tabwidth) {
+	PGColor background = PGStyleManager::GetColor(PGColorMainMenuBackground);
+	PGColor text_color = PGStyleManager::GetColor(PGColorTextFieldText);
+	int height = (int)(buffer->line_count * line_height);
+	PGBitmapHandle bitmap = CreateBitmapFromSize(width, height);
+	FillBitmapRectangle(bitmap, PGIRect(0, 0, width, height), background);
+	// leave a row of pixels between lines if there is room for it
+	int block_height = line_height > 1 ? line_height - 1 : 1;
+	for (lng i = 0; i < (lng)buffer->line_count; i++) {
+		lng start = i == 0 ? 0 : buffer->line_start[i - 1];
+		lng end = (i == (lng)buffer->line_count - 1 ? buffer->current_size : buffer->line_start[i]) - 1;
+		const char* text = buffer->buffer + start;
+		lng length = end - start;
+		PGSyntax* syntax = buffer->parsed && i < (lng)buffer->syntax.size() ? &buffer->syntax[i] : nullptr;
+		int y = (int)(i * line_height);
+
+		// consecutive characters with the same color are filled as a single block
+		lng column = 0;
+		lng block_start = -1;
+		PGColor block_color;
+		auto fill_block = [&]() {
+			if (block_start >= 0) {
+				lng block_end = std::min(column, (lng)width);
+				FillBitmapRectangle(bitmap, PGIRect((int)block_start, y, (int)(block_end - block_start), block_height), BlendColor(block_color, background));
+				block_start = -1;
+			}
+		};
+		size_t node = 0;
+		for (lng position = 0; position < length && column < width; ) {
+			char c = text[position];
+			if (c == ' ' || c == '\t') {
+				fill_block();
+				column += c == '\t' ? tabwidth : 1;
+				position++;
+				continue;
+			}
+			PGColor color = text_color;
+			if (syntax) {
+				while (node < syntax->syntax.size() && syntax->syntax[node].end <= position) {
+					node++;
+				}
+				if (node < syntax->syntax.size()) {
+					color = PGStyleManager::GetSyntaxColor(syntax->syntax[node]);
+				}
+			}
+			if (block_start >= 0 && (color.r != block_color.r || color.g != block_color.g || color.b != block_color.b || color.a != block_color.a)) {
+				fill_block();
+			}
+			if (block_start < 0) {
+				block_start = column;
+				block_color = color;
+			}
+			column++;
+			int offset = utf8_character_length(c);
+			position += offset > 0 ? offset : 1;
+		}
+		fill_block();
+	}
+	return bitmap;
+}
+
+static void RenderTileTask(TextFile* file, MinimapTileTask* info) {
+	MinimapTileRequest& request = info->request;
+	PGBitmapHandle bitmap = nullptr;
+	file->Lock(PGReadLock);
+	// the buffer might have been modified or deleted since the tile was requested
+	if (request.start_line < file->GetLineCount()) {
+		PGTextBuffer* buffer = file->GetBuffer(request.start_line);
+		if (buffer == request.buffer && buffer->version == request.version) {
+			bitmap = RenderTile(buffer, info->width, info->line_height, info->tabwidth);
+		}
+	}
+	file->Unlock(PGReadLock);
+
+	MinimapTileQueue* queue = info->queue.get();
+	LockMutex(queue->lock.get());
+	if (queue->textfield) {
+		// if the tile could not be rendered we still report back, so the tile can be requested again
+		queue->results.push_back(MinimapTileResult(request.buffer, request.version, info->generation, bitmap));
+		if (bitmap) {
+			queue->textfield->InvalidateMinimap();
+		}
+	} else if (bitmap) {
+		DeleteImage(bitmap);
+	}
+	UnlockMutex(queue->lock.get());
+}
+
+Minimap::Minimap(TextField* textfield) : queue(std::make_shared<MinimapTileQueue>(textfield)) {
+
+}
+
+Minimap::~Minimap() {
+	// tiles that are still being rendered are discarded when they are finished
+	LockMutex(queue->lock.get());
+	queue->textfield = nullptr;
+	UnlockMutex(queue->lock.get());
+}
+
+void Minimap::SetLineHeight(int line_height) {
+	line_height = std::max(line_height, 1);
+	if (this->line_height != line_height) {
+		this->line_height = line_height;
+		generation++;
+		tiles.clear();
+	}
+}
+
+lng Minimap::GetColumn(TextLine line, lng position) {
+	const char* text = line.GetLine();
+	lng column = 0;
+	for (lng i = 0; i < position && i < line.GetLength(); ) {
+		if (text[i] == '\t') {
+			column += tabwidth;
+			i++;
+		} else {
+			column++;
+			int offset = utf8_character_length(text[i]);
+			i += offset > 0 ? offset : 1;
+		}
+	}
+	return column;
+}
+
+void Minimap::Draw(PGRendererHandle renderer, std::shared_ptr<TextFile> file, lng start_line, PGScalar x, PGScalar y, PGScalar width, PGScalar height) {
+	// the tiles are rendered in the colors of the style, so they are rendered again when the style changes
+	if ((int)width != this->width || file->GetTabWidth() != tabwidth || PGStyleManager::GetVersion() != style_version) {
+		this->width = (int)width;
+		this->tabwidth = file->GetTabWidth();
+		this->style_version = PGStyleManager::GetVersion();
+		generation++;
+		tiles.clear();
+	}
+	frame++;
+
+	// pick up the tiles that have been rendered in the background
+	std::vector<MinimapTileResult> results;
+	LockMutex(queue->lock.get());
+	results.swap(queue->results);
+	UnlockMutex(queue->lock.get());
+	for (auto it = results.begin(); it != results.end(); it++) {
+		auto entry = tiles.find(it->buffer);
+		if (it->generation == generation && entry != tiles.end()) {
+			MinimapTile& tile = entry->second;
+			if (tile.requested_version == it->version) {
+				tile.requested_version = -1;
+			}
+			// versions only increase, so a tile for a newer version replaces the current one
+			if (it->bitmap && it->version > tile.version) {
+				if (tile.bitmap) {
+					DeleteImage(tile.bitmap);
+				}
+				tile.bitmap = it->bitmap;
+				tile.version = it->version;
+				continue;
+			}
+		}
+		if (it->bitmap) {
+			DeleteImage(it->bitmap);
+		}
+	}
+
+	std::vector<MinimapTileRequest> requests;
+	if (start_line < file->GetLineCount()) {
+		PGTextBuffer* buffer = file->GetBuffer(start_line);
+		PGScalar buffer_y = y - (start_line - (lng)buffer->start_line) * line_height;
+		while (buffer && buffer_y < y + height) {
+			MinimapTile& tile = tiles[buffer];
+			tile.frame = frame;
+			if (tile.version != buffer->version && tile.requested_version != buffer->version) {
+				tile.requested_version = buffer->version;
+				requests.push_back(MinimapTileRequest(buffer, buffer->start_line, buffer->version));
+			}
+			if (tile.bitmap) {
+				// an outdated tile is shown until the new tile has been rendered
+				RenderImage(renderer, tile.bitmap, (int)x, (int)buffer_y);
+			}
+			buffer_y += buffer->line_count * line_height;
+			buffer = buffer->next();
+		}
+	}
+	if (requests.size() > 0) {
+		RequestTiles(file, requests);
+	}
+
+	if (tiles.size() > MAX_MINIMAP_TILES) {
+		// drop the tiles that are no longer visible
+		for (auto it = tiles.begin(); it != tiles.end(); ) {
+			if (it->second.frame != frame) {
+				it = tiles.erase(it);
+			} else {
+				it++;
+			}
+		}
+	}
+}
+
+void Minimap::RequestTiles(std::shared_ptr<TextFile> file, std::vector<MinimapTileRequest>& requests) {
+	// every tile is rendered in a separate task, so the visible tiles are rendered in parallel
+	for (auto it = requests.begin(); it != requests.end(); it++) {
+		MinimapTileTask* info = new MinimapTileTask(file, queue, *it, generation, width, line_height, tabwidth);
+		Scheduler::RegisterTask(std::make_shared<Task>([](std::shared_ptr<Task> task, void* data) {
+			MinimapTileTask* info = (MinimapTileTask*)data;
+			auto file = info->file.lock();
+			if (file) {
+				RenderTileTask(file.get(), info);
+			}
+			delete info;
+		}, info), PGTaskUrgent);
+	}
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "textfile.h"
+#include "windowfunctions.h"
+
+#include <unordered_map>
+
+class TextField;
+
+// the maximum amount of tiles that are kept around when they are not visible
+#define MAX_MINIMAP_TILES 64
+
+// the minimap of a single buffer
+struct MinimapTile {
+	PGBitmapHandle bitmap = nullptr;
+	// the version of the buffer that is shown by the bitmap
+	lng version = -1;
+	// the version of the buffer for which a new bitmap is being rendered
+	lng requested_version = -1;
+	lng frame = -1;
+
+	MinimapTile() { }
+	MinimapTile(const MinimapTile&) = delete;
+	~MinimapTile() {
+		if (bitmap) {
+			DeleteImage(bitmap);
+		}
+	}
+};
+
+struct MinimapTileRequest {
+	PGTextBuffer* buffer;
+	lng start_line;
+	lng version;
+
+	MinimapTileRequest(PGTextBuffer* buffer, lng start_line, lng version) : buffer(buffer), start_line(start_line), version(version) { }
+};
+
+struct MinimapTileResult {
+	PGTextBuffer* buffer;
+	lng version;
+	lng generation;
+	PGBitmapHandle bitmap;
+
+	MinimapTileResult(PGTextBuffer* buffer, lng version, lng generation, PGBitmapHandle bitmap) : buffer(buffer), version(version), generation(generation), bitmap(bitmap) { }
+};
+
+// the tiles that have been rendered in the background, waiting to be picked up by the minimap
+struct MinimapTileQueue {
+	std::unique_ptr<PGMutex> lock;
+	// the textfield is notified when new tiles are available, it is set to nullptr when the textfield is destroyed
+	TextField* textfield;
+	std::vector<MinimapTileResult> results;
+
+	MinimapTileQueue(TextField* textfield) : lock(CreateMutex()), textfield(textfield) { }
+	~MinimapTileQueue();
+};
+
+// the minimap renders every buffer into a bitmap on a worker thread
+// every character is a block of a single pixel wide in the color of its syntax
+// tiles are only rendered again when the version of their buffer changes
+class Minimap {
+public:
+	Minimap(TextField* textfield);
+	~Minimap();
+
+	// renders the minimap of the file, the line start_line is rendered at (x, y)
+	// the file has to be locked while calling this function
+	void Draw(PGRendererHandle renderer, std::shared_ptr<TextFile> file, lng start_line, PGScalar x, PGScalar y, PGScalar width, PGScalar height);
+
+	void SetLineHeight(int line_height);
+	int GetLineHeight() { return line_height; }
+
+	// the column at which the character at the specified position of the line is rendered
+	lng GetColumn(TextLine line, lng position);
+private:
+	std::shared_ptr<MinimapTileQueue> queue;
+	std::unordered_map<PGTextBuffer*, MinimapTile> tiles;
+	lng frame = 0;
+
+	// the settings the tiles are rendered with; the generation is incremented whenever they change
+	lng generation = 0;
+	int width = 0;
+	int line_height = 1;
+	int tabwidth = 0;
+	lng style_version = -1;
+
+	void RequestTiles(std::shared_ptr<TextFile> file, std::vector<MinimapTileRequest>& requests);
+};
@@ -8,11 +8,17 @@
 
 PG_CONTROL_INITIALIZE_KEYBINDINGS(TabControl);
 
+// shared by all tab controls, so the most recently used tabs can be compared across windows
+static lng tab_usage_counter = 0;
+
 #define MAX_TAB_WIDTH 150.0f
 #define BASE_TAB_OFFSET 30.0f
 #define EXTRA_TAB_WIDTH 30.0f
 #define TAB_SPACING 15.0f
 
+// the amount of tabs per tab control whose files are read in the background after restoring the workspace
+#define MAX_WARM_TABS 8
+
 #define SAVE_CHANGES_TITLE "Save Changes?"
 #define SAVE_CHANGES_DIALOG "The current file has unsaved changes. Save changes before closing?"
 
@@ -95,6 +101,10 @@ void TabControl::Update() {
 		if (MovePositionTowards((*it).x, (*it).target_x, 3)) {
 			invalidate = true;
 		}
+		// find all keeps running while a tab is in the background, and only the shown view is updated by its textfield
+		if ((*it).view->file->IsLoaded()) {
+			(*it).view->UpdateFindMatches();
+		}
 		index++;
 	}
 	if (MovePositionTowards(scroll_position, target_scroll, 3)) {
@@ -421,7 +431,12 @@ void TabControl::LoadWorkspace(nlohmann::json& j) {
 					}
 
 					view->ApplySettings(settings);
-					this->tabs.push_back(OpenTab(view));
+					Tab tab = OpenTab(view);
+					if (it->count("last_used") > 0 && (*it)["last_used"].is_number_integer()) {
+						tab.last_used = (*it)["last_used"].get<lng>();
+						tab_usage_counter = std::max(tab_usage_counter, tab.last_used);
+					}
+					this->tabs.push_back(tab);
 				}
 			}
 		}
@@ -438,6 +453,20 @@ void TabControl::LoadWorkspace(nlohmann::json& j) {
 			SwitchToTab(tabs[selected_tab].view);
 		}
 		assert(tabs.size() > 0);
+		// files are only read when their tab is shown
+		// read the files of the most recently used tabs in the background, so switching to them is instant
+		std::vector<Tab*> recent_tabs;
+		for (auto it = tabs.begin(); it != tabs.end(); it++) {
+			if (it->view->file->IsDeferred()) {
+				recent_tabs.push_back(&*it);
+			}
+		}
+		std::stable_sort(recent_tabs.begin(), recent_tabs.end(), [](const Tab* a, const Tab* b) {
+			return a->last_used > b->last_used;
+		});
+		for (size_t i = 0; i < recent_tabs.size() && i < MAX_WARM_TABS; i++) {
+			recent_tabs[i]->view->file->Load(PGTaskNotUrgent);
+		}
 		j.erase(j.find("tabs"));
 	}
 }
@@ -451,15 +480,18 @@ void TabControl::WriteWorkspace(nlohmann::json& j) {
 		assert(view);
 		nlohmann::json& cur = f[index];
 
-		auto cursor_data = Cursor::GetCursorData(view->GetCursors());
-		Cursor::StoreCursors(cur, cursor_data);
+		// files that have not been loaded (or have been unloaded) return the settings they will be restored with
+		PGTextViewSettings settings = view->GetSettings();
+		Cursor::StoreCursors(cur, settings.cursor_data);
 
 		cur["file_index"] = FileManager::GetFileIndex(view->file);
-		if (view->wordwrap) {
-			cur["yoffset"] = { view->yoffset.linenumber, view->yoffset.inner_line };
+		cur["last_used"] = it->last_used;
+		lng linenumber = std::max((lng)0, settings.yoffset.linenumber);
+		if (settings.wordwrap) {
+			cur["yoffset"] = { linenumber, std::max((lng)0, settings.yoffset.inner_line) };
 		} else {
-			cur["xoffset"] = view->xoffset;
-			cur["yoffset"] = view->yoffset.linenumber;
+			cur["xoffset"] = std::max(0.0, settings.xoffset);
+			cur["yoffset"] = linenumber;
 		}
 		index++;
 	}
@@ -990,6 +1022,12 @@ void TabControl::SwitchToFile(std::shared_ptr<TextView> view) {
 	}
 	if (textfield->GetTextView() == view) return;
 
+	for (auto it = tabs.begin(); it != tabs.end(); it++) {
+		if (it->view == view) {
+			it->last_used = ++tab_usage_counter;
+			break;
+		}
+	}
 	textfield->SetTextView(view);
 	if (temporary_textfile && view != temporary_textfile) {
 		CloseTemporaryFile();
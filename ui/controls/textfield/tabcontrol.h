@@ -15,8 +15,10 @@ struct Tab {
 	PGScalar target_x = -1;
 	bool hover = false;
 	bool button_hover = false;
+	// the tab that was shown most recently has the highest value
+	lng last_used = 0;
 
-	Tab(std::shared_ptr<TextView> view, lng id) : view(view), x(-1), target_x(-1), id(id), hover(false), button_hover(false) { }
+	Tab(std::shared_ptr<TextView> view, lng id) : view(view), x(-1), target_x(-1), id(id), hover(false), button_hover(false), last_used(0) { }
 };
 
 struct PGTabMouseRegion : public PGMouseRegion {
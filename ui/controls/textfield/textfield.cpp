@@ -14,6 +14,7 @@
 #include "tabcontrol.h"
 
 #include "goto.h"
+#include "inmemorytextfile.h"
 #include "notification.h"
 #include "searchbox.h"
 #include "settings.h"
@@ -56,9 +57,12 @@ TextField::TextField(PGWindowHandle window, std::shared_ptr<TextView> view) :
 	PGSettingsManager::GetSetting("display_minimap", display_minimap);
 	SetTextFontSize(minimap_font, 2.5f);
 	margin_width = 4;
+	minimap = std::unique_ptr<Minimap>(new Minimap(this));
 }
 
 TextField::~TextField() {
+	// stop the background tasks from notifying this textfield
+	minimap = nullptr;
 	ControlManager* manager = GetControlManager(this);
 	if (manager) {
 		manager->UnregisterMouseRegion(&minimap_region);
@@ -95,29 +99,169 @@ void TextField::Update() {
 			}, this, notification, "Close");
 			ShowNotification();
 		}
+	} else if (view && view->file->IsLoaded()) {
+		// changes to the file on disk are reported by the file watcher, so this is cheap
+		CheckExternalChanges();
+		// pick up the matches that find all has found since the previous update
+		view->UpdateFindMatches();
+		// long find in files results are added a page at a time, once the view has scrolled close to their end
+		InMemoryTextFile* results = dynamic_cast<InMemoryTextFile*>(view->file.get());
+		if (results && results->HasMoreFindResults() &&
+			view->GetLineOffset().linenumber + 2 * GetLineHeight() >= view->file->GetLineCount()) {
+			results->ShowMoreFindResults();
+		}
 	}
 	BasicTextField::Update();
 }
 
-void TextField::DrawTextField(PGRendererHandle renderer, PGFontHandle font, bool minimap, PGScalar position_x, PGScalar position_x_text, PGScalar position_y, PGScalar width, bool render_overlay) {
+// find the part of the line that we actually have to render
+static void MeasureLine(PGFontHandle font, const char* line, lng length, PGScalar xoffset, PGScalar render_width, CachedLine& measured) {
+	lng render_start = 0, render_end = length;
+	measured.character_widths = CumulativeCharacterWidths(font, line, length, xoffset, render_width, render_start, render_end);
+	render_end = render_start + measured.character_widths.size();
+	if (measured.character_widths.size() == 0) {
+		if (render_start == 0 && render_end == 0) {
+			// empty line, render cursor/selections
+			measured.character_widths.push_back(0);
+			render_end = 1;
+		} else {
+			// the entire line is out of bounds, nothing to render
+			render_start = -1;
+			render_end = -1;
+		}
+	}
+	measured.render_start = render_start;
+	measured.render_end = render_end;
+}
+
+static size_t HashLine(const char* line, lng length, PGSyntax* syntax) {
+	// FNV-1a over the text and the syntax of the line
+	size_t hash = 2166136261u;
+	for (lng i = 0; i < length; i++) {
+		hash = (hash ^ (unsigned char)line[i]) * 16777619u;
+	}
+	if (syntax) {
+		for (auto it = syntax->syntax.begin(); it != syntax->syntax.end(); it++) {
+			hash = (hash ^ (size_t)it->type) * 16777619u;
+			hash = (hash ^ (size_t)it->end) * 16777619u;
+			hash = (hash ^ (size_t)it->transparent) * 16777619u;
+		}
+	}
+	return hash;
+}
+
+static bool LineEquals(CachedLine& cached_line, const char* line, lng length, PGSyntax* syntax) {
+	if ((lng)cached_line.text.size() != length || memcmp(cached_line.text.c_str(), line, length) != 0) {
+		return false;
+	}
+	size_t syntax_size = syntax ? syntax->syntax.size() : 0;
+	if (cached_line.syntax.size() != syntax_size) {
+		return false;
+	}
+	for (size_t i = 0; i < syntax_size; i++) {
+		PGSyntaxNode& a = cached_line.syntax[i];
+		PGSyntaxNode& b = syntax->syntax[i];
+		if (a.type != b.type || a.end != b.end || a.transparent != b.transparent) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// shape the rendered part of the line, colored by its syntax
+static PGTextBlobHandle CreateLineBlob(PGFontHandle font, CachedLine& cached_line) {
+	PGTextBlobHandle blob = PGCreateTextBlob();
+	const char* line = cached_line.text.c_str();
+	lng render_start = cached_line.render_start, render_end = cached_line.render_end;
+	std::vector<PGScalar>& character_widths = cached_line.character_widths;
+	lng position = 0;
+	PGScalar x = 0;
+	for (auto it = cached_line.syntax.begin(); it != cached_line.syntax.end(); it++) {
+		if (it->end <= position) {
+			continue;
+		}
+		if (it->end >= render_start && position < render_end) {
+			lng spos = std::max(position, render_start);
+			lng epos = std::min(it->end, render_end - 1);
+			SetTextColor(font, PGStyleManager::GetSyntaxColor(*it));
+			PGTextBlobAddText(blob, font, line + spos, epos - spos, x);
+			x += character_widths[epos - render_start] - character_widths[spos - render_start];
+		}
+		position = it->end;
+	}
+	if (render_end > position) {
+		position = std::max(position, render_start);
+		SetTextColor(font, PGStyleManager::GetColor(PGColorTextFieldText));
+		PGTextBlobAddText(blob, font, line + position, render_end - position - 1, x);
+	}
+	return blob;
+}
+
+CachedLine* TextField::GetCachedLine(PGFontHandle font, const char* line, lng length, PGSyntax* syntax, PGScalar xoffset, PGScalar render_width) {
+	CachedLine* cached_line = &line_cache.lines[HashLine(line, length, syntax)];
+	if (cached_line->frame >= 0 && LineEquals(*cached_line, line, length, syntax)) {
+		cached_line->frame = line_cache.frame;
+		return cached_line;
+	}
+	if (cached_line->frame == line_cache.frame) {
+		// another line with the same hash is rendered in this frame, so we cannot replace it
+		line_cache.collisions.push_back(std::unique_ptr<CachedLine>(new CachedLine()));
+		cached_line = line_cache.collisions.back().get();
+	} else if (cached_line->blob) {
+		PGDestroyTextBlob(cached_line->blob);
+		cached_line->blob = nullptr;
+	}
+	cached_line->text.assign(line, length);
+	if (syntax) {
+		cached_line->syntax = syntax->syntax;
+	} else {
+		cached_line->syntax.clear();
+	}
+	MeasureLine(font, line, length, xoffset, render_width, *cached_line);
+	cached_line->frame = line_cache.frame;
+	return cached_line;
+}
+
+void TextField::DrawTextField(PGRendererHandle renderer, PGFontHandle font, bool minimap, PGVerticalScroll start_line, PGScalar position_x, PGScalar position_x_text, PGScalar position_y, PGScalar width, bool render_overlay, PGScalar redraw_start, PGScalar redraw_end) {
 	PGScalar xoffset = 0;
 	PGScalar max_x = position_x_text + width;
 	if (!minimap)
 		xoffset = view->GetXOffset();
 	PGScalar y = Y();
-	auto start_line = view->GetLineOffset();
 	const std::vector<Cursor>& cursors = view->GetCursors();
 	TextLine current_line;
 	PGColor selection_color = PGStyleManager::GetColor(PGColorTextFieldSelection);
 	PGScalar line_height = GetTextHeight(font);
 	PGScalar initial_position_y = position_y;
 	PGScalar render_width = GetTextfieldWidth();
-	if (minimap) {
-		// start line of the minimap
-		start_line = GetMinimapStartLine();
+	if (redraw_end < 0) {
+		redraw_end = position_y + this->height;
 	}
 	// set tab width
 	SetTextTabWidth(font, view->file->GetTabWidth());
+	// where the cached lines start, left of the text unless the x offset is at the start of its bucket
+	PGScalar line_x = position_x_text;
+	if (!minimap) {
+		PGScalar font_size = GetTextFontSize(font);
+		lng font_family = GetTextFontFamily(font);
+		PGScalar xoffset_bucket = std::floor(xoffset / RENDER_LINE_CACHE_BUCKET) * RENDER_LINE_CACHE_BUCKET;
+		if (line_cache.font != font || line_cache.font_family != font_family || line_cache.font_size != font_size ||
+			line_cache.tabwidth != view->file->GetTabWidth() || line_cache.style_version != PGStyleManager::GetVersion() ||
+			line_cache.xoffset_bucket != xoffset_bucket || line_cache.render_width != render_width) {
+			// the render settings changed: the cached lines have to be measured again
+			line_cache.lines.clear();
+			line_cache.font = font;
+			line_cache.font_family = font_family;
+			line_cache.font_size = font_size;
+			line_cache.tabwidth = view->file->GetTabWidth();
+			line_cache.style_version = PGStyleManager::GetVersion();
+			line_cache.xoffset_bucket = xoffset_bucket;
+			line_cache.render_width = render_width;
+		}
+		line_cache.frame++;
+		line_cache.collisions.clear();
+		line_x = position_x_text + xoffset_bucket - xoffset;
+	}
 
 	std::string selected_word = std::string();
 	if (!minimap) {
@@ -135,7 +279,7 @@ void TextField::DrawTextField(PGRendererHandle renderer, PGFontHandle font, bool
 	lng block = -1;
 	bool parsed = false;
 
-	TextLineIterator* line_iterator = view->GetScrollIterator(this, start_line);
+	auto line_iterator = view->GetScrollIterator(this, start_line);
 	auto buffer = line_iterator->CurrentBuffer();
 	lng current_cursor = 0;
 	lng current_match = 0;
@@ -148,8 +292,7 @@ void TextField::DrawTextField(PGRendererHandle renderer, PGFontHandle font, bool
 	if (!minimap) {
 		rendered_lines.clear();
 	}
-	std::vector<std::vector<PGScalar>> cumulative_character_widths;
-	std::vector<std::pair<lng, lng>> render_start_end;
+	std::vector<CachedLine*> cached_lines;
 
 	while ((current_line = line_iterator->GetLine()).IsValid()) {
 		if (position_y > initial_position_y + this->height) break;
@@ -173,7 +316,19 @@ void TextField::DrawTextField(PGRendererHandle renderer, PGFontHandle font, bool
 
 			if (!minimap) {
 				rendered_lines.push_back(RenderedLine(current_line, current_start_line,
-					current_start_position, line_iterator->GetInnerLine(), view->wordwrap && current_line.syntax ? *current_line.syntax : PGSyntax()));
+					current_start_position, line_iterator->GetInnerLine()));
+				if (position_y + line_height <= redraw_start || position_y >= redraw_end) {
+					// this line is still on the screen from the previous frame
+					cached_lines.push_back(nullptr);
+					// skip the cursors that end on this line
+					while (current_cursor < (lng)cursors.size() && cursors[current_cursor].GetCursorSelection().endpos() <= current_range.endpos()) {
+						current_cursor++;
+						if (current_cursor < (lng)cursors.size()) {
+							selected_line = cursors[current_cursor].SelectedPosition().line;
+						}
+					}
+					goto next_line;
+				}
 			}
 
 			// render the linenumber of the current line if it is not wrapped
@@ -194,27 +349,23 @@ void TextField::DrawTextField(PGRendererHandle renderer, PGFontHandle font, bool
 			char* line = current_line.GetLine();
 			lng length = current_line.GetLength();
 
-			// find the part of the line that we actually have to render
-			lng render_start = 0, render_end = length;
-			auto character_widths = CumulativeCharacterWidths(font, line, length, xoffset, render_width, render_start, render_end);
-			render_end = render_start + character_widths.size();
+			CachedLine measured_line;
+			CachedLine* cached_line = &measured_line;
+			if (!minimap) {
+				// the main textfield reuses the measurements of the previous frames
+				cached_line = GetCachedLine(font, line, length, current_line.syntax, line_cache.xoffset_bucket, render_width + RENDER_LINE_CACHE_BUCKET);
+				cached_lines.push_back(cached_line);
+			} else {
+				MeasureLine(font, line, length, xoffset, render_width, measured_line);
+			}
+			std::vector<PGScalar>& character_widths = cached_line->character_widths;
+			lng render_start = cached_line->render_start, render_end = cached_line->render_end;
 			if (character_widths.size() == 0) {
-				if (render_start == 0 && render_end == 0) {
-					// empty line, render cursor/selections
-					character_widths.push_back(0);
-					render_end = 1;
-				} else {
-					// the entire line is out of bounds, nothing to render
-					if (!minimap) {
-						cumulative_character_widths.push_back(character_widths);
-						render_start_end.push_back(std::pair<lng, lng>(-1, -1));
-					}
-					goto next_line;
-				}
+				goto next_line;
 			}
 			if (!minimap) {
-				cumulative_character_widths.push_back(character_widths);
-				render_start_end.push_back(std::pair<lng, lng>(render_start, render_end));
+				// the cached line can start left of the text, do not render the matches and selections over the line numbers
+				SetRenderBounds(renderer, PGRect(position_x_text - margin_width, position_y, textfield_region.width + margin_width, line_height + 1));
 			}
 
 			bool render_search_match = false;
@@ -249,7 +400,7 @@ void TextField::DrawTextField(PGRendererHandle renderer, PGFontHandle font, bool
 					if (end == length + 1) {
 						width += MeasureTextWidth(font, " ");
 					}
-					PGRect rect(position_x_text + x_offset, position_y, width, line_height);
+					PGRect rect(line_x + x_offset, position_y, width, line_height);
 					RenderRectangle(renderer, rect, PGStyleManager::GetColor(PGColorTextFieldFindMatch), PGDrawStyleFill);
 					render_search_match = true;
 					if (end < length) {
@@ -306,7 +457,7 @@ void TextField::DrawTextField(PGRendererHandle renderer, PGFontHandle font, bool
 						font,
 						line,
 						length,
-						position_x_text,
+						line_x,
 						position_y,
 						start,
 						end,
@@ -330,7 +481,7 @@ void TextField::DrawTextField(PGRendererHandle renderer, PGFontHandle font, bool
 							RenderCaret(renderer,
 								font,
 								character_widths[render_position - render_start],
-								position_x_text,
+								line_x,
 								position_y,
 								PGStyleManager::GetColor(PGColorTextFieldCaret));
 						}
@@ -348,6 +499,7 @@ void TextField::DrawTextField(PGRendererHandle renderer, PGFontHandle font, bool
 
 			// render the actual text
 			if (!minimap) {
+				ClearRenderBounds(renderer);
 				// for the main textfield we render the actual text later
 				goto next_line;
 			}
@@ -359,7 +511,6 @@ void TextField::DrawTextField(PGRendererHandle renderer, PGFontHandle font, bool
 			PGSyntax* syntax = current_line.syntax;
 			if (syntax) {
 				for (auto it = syntax->syntax.begin(); it != syntax->syntax.end(); it++) {
-					bool squiggles = false;
 					//assert(syntax->end > position);
 					if (it->end <= position) {
 						continue;
@@ -367,40 +518,7 @@ void TextField::DrawTextField(PGRendererHandle renderer, PGFontHandle font, bool
 					if (it->end >= render_start && position < render_end) {
 						lng spos = std::max(position, render_start);
 						lng epos = std::min(it->end, render_end - 1);
-						PGColor color = PGStyleManager::GetColor(PGColorTextFieldText);
-						if (it->type == PGSyntaxError) {
-							squiggles = true;
-						} else if (it->type == PGSyntaxNone) {
-							color = PGStyleManager::GetColor(PGColorTextFieldText);
-						} else if (it->type == PGSyntaxString) {
-							color = PGStyleManager::GetColor(PGColorSyntaxString);
-						} else if (it->type == PGSyntaxConstant) {
-							color = PGStyleManager::GetColor(PGColorSyntaxConstant);
-						} else if (it->type == PGSyntaxComment) {
-							color = PGStyleManager::GetColor(PGColorSyntaxComment);
-						} else if (it->type == PGSyntaxOperator) {
-							color = PGStyleManager::GetColor(PGColorSyntaxOperator);
-						} else if (it->type == PGSyntaxFunction) {
-							color = PGStyleManager::GetColor(PGColorSyntaxFunction);
-						} else if (it->type == PGSyntaxKeyword) {
-							color = PGStyleManager::GetColor(PGColorSyntaxKeyword);
-						} else if (it->type == PGSyntaxClass1) {
-							color = PGStyleManager::GetColor(PGColorSyntaxClass1);
-						} else if (it->type == PGSyntaxClass2) {
-							color = PGStyleManager::GetColor(PGColorSyntaxClass2);
-						} else if (it->type == PGSyntaxClass3) {
-							color = PGStyleManager::GetColor(PGColorSyntaxClass3);
-						} else if (it->type == PGSyntaxClass4) {
-							color = PGStyleManager::GetColor(PGColorSyntaxClass4);
-						} else if (it->type == PGSyntaxClass5) {
-							color = PGStyleManager::GetColor(PGColorSyntaxClass5);
-						} else if (it->type == PGSyntaxClass6) {
-							color = PGStyleManager::GetColor(PGColorSyntaxClass6);
-						}
-						if (it->transparent) {
-							color.a = 128;
-						}
-						SetTextColor(font, color);
+						SetTextColor(font, PGStyleManager::GetSyntaxColor(*it));
 						RenderText(renderer, font, line + spos, epos - spos, bitmap_x, bitmap_y);
 
 						PGScalar text_width = character_widths[epos - render_start] - character_widths[spos - render_start];
@@ -453,76 +571,16 @@ next_line:
 			char* line = it2->tline.GetLine();
 			lng length = it2->tline.GetLength();
 
-			lng render_start = render_start_end[index].first, render_end = render_start_end[index].second;
-			auto character_widths = cumulative_character_widths[index++];
-			if (character_widths.size() == 0) {
+			CachedLine* cached_line = cached_lines[index++];
+			if (!cached_line || cached_line->character_widths.size() == 0) {
 				position_y += line_height;
 				continue;
 			}
-			lng position = 0;
-
-			PGScalar bitmap_x = position_x_text + character_widths[0];
-			PGScalar bitmap_y = position_y;
-			PGSyntax* syntax = view->wordwrap ? &it2->syntax : it2->tline.syntax;
-			if (syntax) {
-				for (auto it = syntax->syntax.begin(); it != syntax->syntax.end(); it++) {
-					bool squiggles = false;
-					//assert(syntax->end > position);
-					if (it->end <= position) {
-						continue;
-					}
-					if (it->end >= render_start && position < render_end) {
-						lng spos = std::max(position, render_start);
-						lng epos = std::min(it->end, render_end - 1);
-						PGColor color = PGStyleManager::GetColor(PGColorTextFieldText);
-						if (it->type == PGSyntaxError) {
-							squiggles = true;
-						} else if (it->type == PGSyntaxNone) {
-							color = PGStyleManager::GetColor(PGColorTextFieldText);
-						} else if (it->type == PGSyntaxString) {
-							color = PGStyleManager::GetColor(PGColorSyntaxString);
-						} else if (it->type == PGSyntaxConstant) {
-							color = PGStyleManager::GetColor(PGColorSyntaxConstant);
-						} else if (it->type == PGSyntaxComment) {
-							color = PGStyleManager::GetColor(PGColorSyntaxComment);
-						} else if (it->type == PGSyntaxOperator) {
-							color = PGStyleManager::GetColor(PGColorSyntaxOperator);
-						} else if (it->type == PGSyntaxFunction) {
-							color = PGStyleManager::GetColor(PGColorSyntaxFunction);
-						} else if (it->type == PGSyntaxKeyword) {
-							color = PGStyleManager::GetColor(PGColorSyntaxKeyword);
-						} else if (it->type == PGSyntaxClass1) {
-							color = PGStyleManager::GetColor(PGColorSyntaxClass1);
-						} else if (it->type == PGSyntaxClass2) {
-							color = PGStyleManager::GetColor(PGColorSyntaxClass2);
-						} else if (it->type == PGSyntaxClass3) {
-							color = PGStyleManager::GetColor(PGColorSyntaxClass3);
-						} else if (it->type == PGSyntaxClass4) {
-							color = PGStyleManager::GetColor(PGColorSyntaxClass4);
-						} else if (it->type == PGSyntaxClass5) {
-							color = PGStyleManager::GetColor(PGColorSyntaxClass5);
-						} else if (it->type == PGSyntaxClass6) {
-							color = PGStyleManager::GetColor(PGColorSyntaxClass6);
-						}
-
-						if (it->transparent) {
-							color.a = 128;
-						}
-						SetTextColor(font, color);
-						RenderText(renderer, font, line + spos, epos - spos, bitmap_x, bitmap_y);
-
-						PGScalar text_width = character_widths[epos - render_start] - character_widths[spos - render_start];
-						bitmap_x += text_width;
-					}
-					position = it->end;
-				}
-			}
-
-			if (render_end > position) {
-				position = std::max(position, render_start);
-				SetTextColor(font, PGStyleManager::GetColor(PGColorTextFieldText));
-				RenderText(renderer, font, line + position, render_end - position - 1, bitmap_x, bitmap_y);
+			if (!cached_line->blob) {
+				// the line has not been drawn since it was changed: shape it now
+				cached_line->blob = CreateLineBlob(font, *cached_line);
 			}
+			RenderTextBlob(renderer, cached_line->blob, line_x + cached_line->character_widths[0], position_y);
 
 			if ((lng)selected_word.size() > 0 && length >= (lng)selected_word.size()) {
 				// FIXME: use strstr here instead of implementing the search ourself
@@ -551,6 +609,16 @@ next_line:
 			position_y += line_height;
 		}
 		ClearRenderBounds(renderer);
+		if (line_cache.lines.size() > MAX_RENDER_LINE_CACHE) {
+			// drop the lines that are no longer visible
+			for (auto it = line_cache.lines.begin(); it != line_cache.lines.end(); ) {
+				if (it->second.frame != line_cache.frame) {
+					it = line_cache.lines.erase(it);
+				} else {
+					it++;
+				}
+			}
+		}
 	}
 
 	if (!minimap) {
@@ -569,6 +637,63 @@ next_line:
 	}
 }
 
+static void DrawMinimapRanges(PGRendererHandle renderer, Minimap* minimap, TextFile* file, const std::vector<PGTextRange>& ranges, lng start_line, lng end_line, PGScalar x, PGScalar y, PGColor color, bool render_marker) {
+	if (ranges.size() == 0 || start_line >= file->GetLineCount()) return;
+	int line_height = minimap->GetLineHeight();
+	PGTextBuffer* buffer = file->GetBuffer(start_line);
+	PGTextPosition start_position = PGTextPosition(buffer, buffer->GetBufferLocationFromCursor(start_line, 0));
+	// skip all the ranges that end before the first visible line
+	auto it = std::lower_bound(ranges.begin(), ranges.end(), start_position, [](const PGTextRange& lhs, const PGTextPosition& rhs) -> bool {
+		return lhs.endpos() < rhs;
+	});
+	for (; it != ranges.end(); it++) {
+		PGCursorPosition start = it->start_buffer->GetCursorFromPosition(it->start_position);
+		PGCursorPosition end = it->end_buffer->GetCursorFromPosition(it->end_position);
+		if (start.line > end_line) break;
+		if (start.line == end.line && start.position == end.position) continue;
+		for (lng linenr = std::max(start.line, start_line); linenr <= std::min(end.line, end_line); linenr++) {
+			TextLine line = file->GetLine(linenr);
+			lng start_column = linenr == start.line ? minimap->GetColumn(line, start.position) : 0;
+			lng end_column = linenr == end.line ? minimap->GetColumn(line, end.position) : minimap->GetColumn(line, line.GetLength()) + 1;
+			PGScalar line_y = y + (linenr - start_line) * line_height;
+			RenderRectangle(renderer, PGRect(x + start_column, line_y, std::max(end_column - start_column, (lng)1), line_height), color, PGDrawStyleFill);
+			if (render_marker) {
+				// render a small rectangle to the left of the line to indicate that there is a search match on this line
+				RenderRectangle(renderer, PGRect(x - line_height, line_y, line_height, line_height), color, PGDrawStyleFill);
+			}
+		}
+	}
+}
+
+void TextField::DrawMinimap(PGRendererHandle renderer, PGScalar x, PGScalar y, PGScalar width, bool render_overlay) {
+	minimap->SetLineHeight((int)(GetTextHeight(minimap_font) + 0.5f));
+	PGScalar line_height = minimap->GetLineHeight();
+	this->minimap_line_height = line_height;
+	lng start_line = GetMinimapStartLine().linenumber;
+	lng end_line = start_line + (lng)(this->height / line_height) + 1;
+
+	minimap->Draw(renderer, view->file, start_line, x, y, width, this->height);
+
+	// selections and search matches change much more often than the text, so they are drawn on top of the tiles
+	DrawMinimapRanges(renderer, minimap.get(), view->file.get(), view->GetFindMatches(), start_line, end_line, x, y, PGStyleManager::GetColor(PGColorTextFieldFindMatch), true);
+	const std::vector<Cursor>& cursors = view->GetCursors();
+	std::vector<PGTextRange> selections;
+	for (auto it = cursors.begin(); it != cursors.end(); it++) {
+		selections.push_back(it->GetCursorSelection());
+	}
+	DrawMinimapRanges(renderer, minimap.get(), view->file.get(), selections, start_line, end_line, x, y, PGStyleManager::GetColor(PGColorTextFieldSelection), false);
+
+	if (render_overlay) {
+		// render the overlay for the minimap
+		PGRect rect(x, y + GetMinimapOffset(), width, line_height * GetLineHeight());
+		RenderRectangle(renderer, rect,
+			this->drag_type == PGDragMinimap ?
+			PGStyleManager::GetColor(PGColorMinimapDrag) :
+			PGStyleManager::GetColor(PGColorMinimapHover)
+			, PGDrawStyleFill);
+	}
+}
+
 void TextField::Draw(PGRendererHandle renderer) {
 	bool window_has_focus = WindowHasFocus(window);
 	PGPoint position = Position();
@@ -609,30 +734,40 @@ void TextField::Draw(PGRendererHandle renderer) {
 				view->SetXOffset(xoffset);
 			}
 		}
-		// render the background of the textfield
-		RenderRectangle(renderer, PGIRect(x, y, textfield_width, this->height), PGStyleManager::GetColor(PGColorTextFieldBackground), PGDrawStyleFill);
-
-		// render the actual text field
 		textfield_region.width = textfield_width - text_offset - margin_width * 2;
 		textfield_region.height = this->height;
 		view->SetWordWrap(view->GetWordWrap(), GetTextfieldWidth());
-		PGIRect rectangle = PGIRect(0, 0, this->width, this->height);
-		DrawTextField(renderer, textfield_font, false, x, x + text_offset + margin_width * 2, y, textfield_width, false);
+
+		// if possible, reuse the text rendered in the previous frame
+		PGIRect text_region = PGIRect(x, y, textfield_width, this->height);
+		PGVerticalScroll scroll = view->GetLineOffset();
+		PGRect redraw_region = ScrollRenderedText(renderer, text_region, GetTextHeight(textfield_font), scroll);
+		if (redraw_region.height > 0) {
+			SetRenderBounds(renderer, redraw_region);
+			// render the background of the textfield
+			RenderRectangle(renderer, text_region, PGStyleManager::GetColor(PGColorTextFieldBackground), PGDrawStyleFill);
+			// render the actual text field
+			DrawTextField(renderer, textfield_font, false, scroll, x, x + text_offset + margin_width * 2, y, textfield_width, false, redraw_region.y, redraw_region.y + redraw_region.height);
+			if (this->display_minimap && !view->GetWordWrap()) {
+				// render the minimap gradient between the minimap and the textfield
+				RenderGradient(renderer, PGIRect(x + textfield_width - 5, y, 5, this->height), PGColor(0, 0, 0, 0), PGColor(0, 0, 0, 128));
+			}
+			ClearRenderBounds(renderer);
+		}
 
 		// render the minimap
 		if (this->display_minimap) {
 			bool mouse_in_minimap = window_has_focus && this->mouse_in_minimap;
-			PGIRect shadow_rect = PGIRect(x + textfield_width - 5, y, 5, this->height);
 			if (is_minimap_dirty) {
 				// only rerender the actual minimap if it is dirty
 
 				// render the background of the minimap
 				RenderRectangle(renderer, PGIRect(x + textfield_width, y, minimap_region.width, this->height), PGStyleManager::GetColor(PGColorMainMenuBackground), PGDrawStyleFill);
-				DrawTextField(renderer, minimap_font, true, x + textfield_width + 1, x + textfield_width, y, minimap_region.width, mouse_in_minimap);
-			}
-			if (!view->GetWordWrap()) {
-				// render the minimap gradient between the minimap and the textfield
-				RenderGradient(renderer, shadow_rect, PGColor(0, 0, 0, 0), PGColor(0, 0, 0, 128));
+				if (!view->GetWordWrap() && !view->file->IsStreaming()) {
+					DrawMinimap(renderer, x + textfield_width, y, minimap_region.width, mouse_in_minimap);
+				} else {
+					DrawTextField(renderer, minimap_font, true, GetMinimapStartLine(), x + textfield_width + 1, x + textfield_width, y, minimap_region.width, mouse_in_minimap);
+				}
 			}
 		}
 
@@ -677,6 +812,98 @@ void TextField::Draw(PGRendererHandle renderer) {
 	Control::Draw(renderer);
 }
 
+TextRenderState TextField::GetRenderState(PGRendererHandle renderer, PGIRect region, lng start_line, lng end_line) {
+	TextRenderState state;
+	state.valid = true;
+	state.surface_version = GetRendererSurfaceVersion(renderer);
+	state.region = region;
+	// text that is covered by other controls cannot be reused in the next frame
+	state.covered = view->GetWordWrap() || display_horizontal_scrollbar ||
+		(display_scrollbar && region.x + region.width > X() + this->width - SCROLLBAR_SIZE) ||
+		notification || active_searchbox || active_codecompletion;
+	state.text_offset = text_offset;
+	state.xoffset = view->GetXOffset();
+	state.font_size = GetTextFontSize(textfield_font);
+	state.tabwidth = view->file->GetTabWidth();
+	state.file_version = view->file->GetVersion();
+	state.matches_version = matches_version;
+	state.display_carets = display_carets;
+	const std::vector<Cursor>& cursors = view->GetCursors();
+	for (auto it = cursors.begin(); it != cursors.end(); it++) {
+		state.cursors.push_back(it->BeginCursorPosition());
+		state.cursors.push_back(it->SelectedCursorPosition());
+		state.cursors.push_back(it->EndCursorPosition());
+	}
+	state.start_line = start_line;
+	state.end_line = std::min(end_line, view->file->GetLineCount() - 1);
+	state.buffer_version = -1;
+	PGTextBuffer* buffer = view->file->GetBuffer(state.start_line);
+	while (buffer && (lng)buffer->start_line <= state.end_line) {
+		state.buffer_version = std::max(state.buffer_version, buffer->version);
+		buffer = buffer->next();
+	}
+	return state;
+}
+
+PGRect TextField::ScrollRenderedText(PGRendererHandle renderer, PGIRect region, PGScalar line_height, PGVerticalScroll& scroll) {
+	TextRenderState& previous = render_state;
+	double scroll_offset = (scroll.linenumber + scroll.line_fraction) * line_height;
+	lng start_line = scroll.linenumber;
+	lng end_line = start_line + (lng)(region.height / line_height) + 1;
+	TextRenderState state = GetRenderState(renderer, region, start_line, end_line);
+	state.scroll = scroll_offset;
+
+	// the previous frame can only be reused if nothing was drawn on top of the text
+	bool reuse_frame = previous.valid && state.surface_version > 0 && !previous.covered && !state.covered;
+	// everything except for the scroll offset has to be the same as in the previous frame
+	reuse_frame = reuse_frame && state.surface_version == previous.surface_version &&
+		state.region.x == previous.region.x && state.region.y == previous.region.y &&
+		state.region.width == previous.region.width && state.region.height == previous.region.height &&
+		state.text_offset == previous.text_offset && state.xoffset == previous.xoffset &&
+		state.font_size == previous.font_size && state.tabwidth == previous.tabwidth &&
+		state.file_version == previous.file_version && state.matches_version == previous.matches_version &&
+		state.display_carets == previous.display_carets && state.cursors == previous.cursors;
+	// the scroll offset is rounded to whole pixels, so the moved pixels line up with the newly rendered text
+	double offset = std::round(scroll_offset - previous.scroll);
+	reuse_frame = reuse_frame && std::abs(offset) < region.height;
+	if (reuse_frame) {
+		// the lines that remain visible must not have been modified or highlighted since the previous frame
+		lng first_line = std::max(previous.start_line, start_line);
+		lng last_line = std::min(previous.end_line, state.end_line);
+		if (first_line <= last_line) {
+			PGTextBuffer* buffer = view->file->GetBuffer(first_line);
+			while (buffer && (lng)buffer->start_line <= last_line) {
+				if (buffer->version > previous.buffer_version) {
+					reuse_frame = false;
+					break;
+				}
+				buffer = buffer->next();
+			}
+		}
+	}
+	if (!reuse_frame) {
+		render_state = state;
+		return PGRect(region);
+	}
+	// snap the rendered text to the moved pixels
+	state.scroll = previous.scroll + offset;
+	double line = state.scroll / line_height;
+	scroll.linenumber = std::max((lng)0, std::min((lng)line, view->file->GetLineCount() - 1));
+	scroll.line_fraction = (PGScalar)std::max(0.0, std::min(1.0, line - scroll.linenumber));
+	render_state = state;
+	if (offset == 0) {
+		// nothing changed: the text does not have to be rendered at all
+		return PGRect(region.x, region.y, region.width, 0);
+	}
+	ScrollRenderedRegion(renderer, region, (int)-offset);
+	if (offset > 0) {
+		// scrolled down: the bottom of the region is exposed
+		return PGRect(region.x, region.y + region.height - offset, region.width, offset);
+	} else {
+		return PGRect(region.x, region.y, region.width, -offset);
+	}
+}
+
 PGScalar TextField::GetTextfieldWidth() {
 	return textfield_region.width;
 }
@@ -1056,12 +1283,18 @@ void TextField::InvalidateBetweenLines(lng start, lng end) {
 }
 
 void TextField::InvalidateMinimap() {
-	PGScalar minimap_width = GetMinimapWidth();
-	this->Invalidate();
+	// only the minimap has to be shown again, the text is reused from the previous frame
+	is_minimap_dirty = true;
+	int minimap_x = (int)(X() + this->width) - minimap_region.width - SCROLLBAR_SIZE;
+	RefreshWindow(this->window, PGIRect(minimap_x, (int)Y(), minimap_region.width + SCROLLBAR_SIZE, (int)this->height), false);
+	Control::Invalidate(false);
 }
 
 void TextField::SetTextView(std::shared_ptr<TextView> view) {
 	this->prev_loaded = false;
+	if (this->view) {
+		this->view->file->MarkUsed();
+	}
 	if (this->view != view && this->view) {
 		this->view->file->last_modified_deletion = false;
 		this->view->file->last_modified_notification = this->view->file->last_modified_time;
@@ -1069,14 +1302,19 @@ void TextField::SetTextView(std::shared_ptr<TextView> view) {
 	}
 	this->view = view;
 	view->SetTextField(this);
+	// files restored from the workspace (or unloaded to save memory) are read when they are shown
+	view->file->MarkUsed();
+	view->file->Load(PGTaskUrgent);
+	FileManager::EnforceMemoryBudget();
 	GetControlManager(this)->ActiveFileChanged(this);
 	this->SelectionChanged();
 	this->TextChanged();
 }
 
-void TextField::SelectionChanged() {
+void TextField::CheckExternalChanges() {
 	if (!view->file->FileInMemory()) {
-		if (!notification) {
+		// the file watcher tells us when the file has changed, so we only check the file on disk when required
+		if (!notification && view->file->PollExternalChanges()) {
 			auto stats = PGGetFileFlags(view->file->GetFullPath());
 			if (stats.flags == PGFileFlagsFileNotFound) {
 				// the current file has been deleted
@@ -1137,6 +1375,10 @@ void TextField::SelectionChanged() {
 			}
 		}
 	}
+}
+
+void TextField::SelectionChanged() {
+	CheckExternalChanges();
 	BasicTextField::SelectionChanged();
 	GetControlManager(this)->SelectionChanged(this);
 }
@@ -1318,6 +1560,7 @@ void TextField::InitializeKeybindings() {
 		std::string text = tf->view->CopyText();
 		auto regex = PGCompileRegex(text, false, PGRegexFlagsNone);
 		tf->view->FindAllMatches(regex, false, 0, 0, 0, 0, true);
+		tf->view->WaitForFindMatches();
 		tf->view->SelectMatches(false);
 	};
 	noargs["insert_newline_before"] = [](Control* c) {
@@ -1464,6 +1707,7 @@ void TextField::Invalidate(bool initial_invalidate) {
 }
 
 void TextField::SearchMatchesChanged() {
+	matches_version++;
 	lng line, character;
 	scrollbar->center_decorations.clear();
 	double prev_percentage = -1.0;
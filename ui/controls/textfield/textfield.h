@@ -10,8 +10,10 @@
 #include "decoratedscrollbar.h"
 
 #include "codecompletion.h"
+#include "minimap.h"
 
 #include <map>
+#include <unordered_map>
 
 class TabControl;
 
@@ -31,18 +33,85 @@ enum PGGotoType {
 };
 
 #define MAX_MINIMAP_LINE_CACHE 10000
+// the amount of measured and shaped lines that are kept around for subsequent frames
+#define MAX_RENDER_LINE_CACHE 1000
+// the cached lines are measured from the start of the bucket the horizontal scroll offset falls in
+// scrolling horizontally only measures the lines again when the offset moves into another bucket
+#define RENDER_LINE_CACHE_BUCKET 512
 
 struct RenderedLine {
 	TextLine tline;
 	lng line;
 	lng position;
 	lng inner_line;
-	PGSyntax syntax;
 
-	RenderedLine(TextLine tline, lng line, lng position, lng inner_line, PGSyntax syntax) : tline(tline), line(line), position(position), inner_line(inner_line), syntax(syntax) {
+	RenderedLine(TextLine tline, lng line, lng position, lng inner_line) : tline(tline), line(line), position(position), inner_line(inner_line) {
 	}
 };
 
+// a line of text that was rendered in a previous frame, together with its measurements and shaped text
+struct CachedLine {
+	// the contents of the line
+	std::string text;
+	std::vector<PGSyntaxNode> syntax;
+	// the part of the line that is rendered and the cumulative widths of those characters
+	lng render_start = 0;
+	lng render_end = 0;
+	std::vector<PGScalar> character_widths;
+	// the shaped and colored text, created the first time the line is drawn
+	PGTextBlobHandle blob = nullptr;
+	lng frame = -1;
+
+	CachedLine() { }
+	CachedLine(const CachedLine&) = delete;
+	~CachedLine() {
+		if (blob) {
+			PGDestroyTextBlob(blob);
+		}
+	}
+};
+
+// lines are cached by their contents, so edits and scrolling do not invalidate unchanged lines
+// the cached measurements are only valid for the render settings they were created with
+struct LineCache {
+	std::unordered_map<size_t, CachedLine> lines;
+	// lines rendered in the current frame that have the same hash as another rendered line
+	std::vector<std::unique_ptr<CachedLine>> collisions;
+	lng frame = 0;
+	PGFontHandle font = nullptr;
+	lng font_family = -1;
+	PGScalar font_size = -1;
+	int tabwidth = -1;
+	// the blobs are colored with the colors of the style
+	lng style_version = -1;
+	PGScalar xoffset_bucket = -1;
+	PGScalar render_width = -1;
+};
+
+// the state with which the text was rendered in the previous frame
+// if only the vertical scroll offset changed since then, the previous frame is moved instead of rendered again
+struct TextRenderState {
+	bool valid = false;
+	lng surface_version = -1;
+	PGIRect region;
+	bool covered = false;
+	PGScalar text_offset = -1;
+	PGScalar xoffset = -1;
+	PGScalar font_size = -1;
+	int tabwidth = -1;
+	lng file_version = -1;
+	lng matches_version = -1;
+	bool display_carets = false;
+	// the begin, selected and end position of every cursor
+	std::vector<PGTextPosition> cursors;
+	// the visible lines and the newest version of the buffers they are in
+	lng start_line = -1;
+	lng end_line = -1;
+	lng buffer_version = -1;
+	// the vertical offset of the rendered text in pixels
+	double scroll = 0;
+};
+
 class TextField : public BasicTextField {
 public:
 	TextField(PGWindowHandle, std::shared_ptr<TextView> file);
@@ -66,6 +135,8 @@ public:
 	void InvalidateMinimap();
 
 	void SelectionChanged();
+	// notifies the user when the file has been modified or deleted by an external program
+	void CheckExternalChanges();
 
 	bool IsDragging();
 
@@ -131,6 +202,8 @@ private:
 	PGScalar drag_offset;
 
 	std::vector<RenderedLine> rendered_lines;
+	LineCache line_cache;
+	CachedLine* GetCachedLine(PGFontHandle font, const char* line, lng length, PGSyntax* syntax, PGScalar xoffset, PGScalar render_width);
 
 	PGScalar max_xoffset;
 
@@ -143,7 +216,16 @@ private:
 	PGVerticalScroll GetMinimapStartLine();
 	void SetMinimapOffset(PGScalar offset);
 
-	void DrawTextField(PGRendererHandle, PGFontHandle, bool minimap, PGScalar position_x, PGScalar position_x_text, PGScalar position_y, PGScalar width, bool render_overlay);
+	// only the lines that intersect with [redraw_start, redraw_end) are rendered, a negative redraw_end renders all lines
+	void DrawTextField(PGRendererHandle, PGFontHandle, bool minimap, PGVerticalScroll start_line, PGScalar position_x, PGScalar position_x_text, PGScalar position_y, PGScalar width, bool render_overlay, PGScalar redraw_start = 0, PGScalar redraw_end = -1);
+	TextRenderState render_state;
+	lng matches_version = 0;
+	TextRenderState GetRenderState(PGRendererHandle renderer, PGIRect region, lng start_line, lng end_line);
+	// moves the text of the previous frame if possible, and returns the part of the region that still has to be rendered
+	PGRect ScrollRenderedText(PGRendererHandle renderer, PGIRect region, PGScalar line_height, PGVerticalScroll& scroll);
+	// renders the minimap from the tiles rendered in the background, with the selections and search matches on top
+	void DrawMinimap(PGRendererHandle renderer, PGScalar x, PGScalar y, PGScalar width, bool render_overlay);
+	std::unique_ptr<Minimap> minimap;
 
 	void CreateNotification(PGNotificationType type, std::string text);
 	void ShowNotification();
@@ -215,8 +215,11 @@ void RenderControlsToBitmap(PGRendererHandle renderer, SkBitmap& bitmap, PGIRect
 	//bitmap.setConfig(SkBitmap::kARGB_8888_Config, canvas_width, canvas_height);
 	lng w = (lng)(rect.width * scale_factor);
 	lng h = (lng)(rect.height * scale_factor);
-	if ((lng)bitmap.width() != w || (lng)bitmap.height() != h) {
+	if ((lng)bitmap.width() != w || (lng)bitmap.height() != h || renderer->surface != &bitmap) {
+		static lng surface_version = 0;
 		manager->Invalidate();
+		renderer->surface = &bitmap;
+		renderer->surface_version = ++surface_version;
 		bitmap.allocN32Pixels(w, h);
 		bitmap.setAlphaType(kOpaque_SkAlphaType);
 #ifdef PANTHER_DEBUG
@@ -234,6 +237,37 @@ void RenderControlsToBitmap(PGRendererHandle renderer, SkBitmap& bitmap, PGIRect
 }
 
 
+lng GetRendererSurfaceVersion(PGRendererHandle renderer) {
+	return renderer->surface_version;
+}
+
+void ScrollRenderedRegion(PGRendererHandle renderer, PGIRect rectangle, int offset) {
+	if (PGGlobalReplayManager::running_replay) return;
+	SkBitmap* bitmap = renderer->surface;
+	if (!bitmap || offset == 0) return;
+	// the rectangle is in user coordinates, the pixels are moved in device coordinates
+	const SkMatrix& matrix = renderer->canvas->getTotalMatrix();
+	SkRect device_rect;
+	matrix.mapRect(&device_rect, CreateSkRect(PGRect(rectangle)));
+	SkIRect area;
+	device_rect.round(&area);
+	if (!area.intersect(SkIRect::MakeWH(bitmap->width(), bitmap->height()))) return;
+	int device_offset = SkScalarRoundToInt(offset * matrix.getScaleY());
+	if (std::abs(device_offset) >= area.height()) return;
+	size_t row_bytes = area.width() * bitmap->bytesPerPixel();
+	if (device_offset > 0) {
+		// moving the pixels down: start from the bottom so we do not overwrite rows we still have to move
+		for (int y = area.bottom() - 1; y >= area.top() + device_offset; y--) {
+			memcpy(bitmap->getAddr(area.left(), y), bitmap->getAddr(area.left(), y - device_offset), row_bytes);
+		}
+	} else {
+		for (int y = area.top(); y < area.bottom() + device_offset; y++) {
+			memcpy(bitmap->getAddr(area.left(), y), bitmap->getAddr(area.left(), y - device_offset), row_bytes);
+		}
+	}
+	bitmap->notifyPixelsChanged();
+}
+
 void RenderTriangle(PGRendererHandle handle, PGPoint a, PGPoint b, PGPoint c, PGColor color, PGDrawStyle drawStyle) {
 	if (PGGlobalReplayManager::running_replay) return;
 	SkPath path;
@@ -324,8 +358,11 @@ void RenderDashedLine(PGRendererHandle handle, PGLine line, PGColor color, PGSca
 	handle->paint->setPathEffect(nullptr);
 }
 
-void RenderText(PGRendererHandle renderer, PGFontHandle font, const char *text, size_t len, PGScalar x, PGScalar y, PGScalar max_position) {
-	if (PGGlobalReplayManager::running_replay) return;
+typedef void(*PGTextSegmentCallback)(const SkPaint& paint, const char* text, size_t length, PGScalar x, PGScalar y, void* data);
+
+// splits the text into segments that can be drawn with a single paint (i.e. the main font or a fallback font)
+// tabs are skipped and replaced by an offset in the x position of the next segment
+static void LayoutText(PGFontHandle font, const char *text, size_t len, PGScalar x, PGScalar y, PGScalar max_position, PGTextSegmentCallback callback, void* data) {
 	PGScalar x_offset = 0;
 	size_t position = 0;
 	size_t i = 0;
@@ -336,7 +373,7 @@ void RenderText(PGRendererHandle renderer, PGFontHandle font, const char *text,
 			if (font->textpaint->getTypeface()->charsToGlyphs(text + i, SkTypeface::kUTF8_Encoding, nullptr, 1) == 0) {
 				// if not, we first render the previous characters using the main font
 				if (position < i) {
-					renderer->canvas->drawText(text + position, i - position, x, y + font->text_offset, *font->textpaint);
+					callback(*font->textpaint, text + position, i - position, x, y + font->text_offset, data);
 					x += font->textpaint->measureText(text + position, i - position);
 				}
 				bool skip_search = false;
@@ -351,7 +388,7 @@ void RenderText(PGRendererHandle renderer, PGFontHandle font, const char *text,
 					for (auto it = font->fallback_paints.begin(); it != font->fallback_paints.end(); it++) {
 						assert((*it)->getTypeface());
 						if ((*it)->getTypeface()->charsToGlyphs(text + i, SkTypeface::kUTF8_Encoding, nullptr, 1) != 0) {
-							renderer->canvas->drawText(text + i, offset, x, y + font->text_offset, **it);
+							callback(**it, text + i, offset, x, y + font->text_offset, data);
 							x += (*it)->measureText(text + i, offset);
 							found_fallback = true;
 							break;
@@ -360,7 +397,7 @@ void RenderText(PGRendererHandle renderer, PGFontHandle font, const char *text,
 				}
 				if (!found_fallback) {
 					// if we don't have a fallback font we render the ? character
-					renderer->canvas->drawText("\xef\xbf\xbd", 3, x, y + font->text_offset, *font->textpaint);
+					callback(*font->textpaint, "\xef\xbf\xbd", 3, x, y + font->text_offset, data);
 					x += font->character_width;
 				}
 				x_offset = 0;
@@ -370,7 +407,7 @@ void RenderText(PGRendererHandle renderer, PGFontHandle font, const char *text,
 		} else {
 			if (text[i] == '\t') {
 				if (position < i) {
-					renderer->canvas->drawText(text + position, i - position, x, y + font->text_offset, *font->textpaint);
+					callback(*font->textpaint, text + position, i - position, x, y + font->text_offset, data);
 					x += font->textpaint->measureText(text + position, i - position);
 				}
 				position = i + offset;
@@ -389,10 +426,51 @@ void RenderText(PGRendererHandle renderer, PGFontHandle font, const char *text,
 			break;
 	}
 	if (position < i) {
-		renderer->canvas->drawText(text + position, i - position, x, y + font->text_offset, *font->textpaint);
+		callback(*font->textpaint, text + position, i - position, x, y + font->text_offset, data);
 	}
 }
 
+void RenderText(PGRendererHandle renderer, PGFontHandle font, const char *text, size_t len, PGScalar x, PGScalar y, PGScalar max_position) {
+	if (PGGlobalReplayManager::running_replay) return;
+	LayoutText(font, text, len, x, y, max_position, [](const SkPaint& paint, const char* text, size_t length, PGScalar x, PGScalar y, void* data) {
+		((PGRendererHandle)data)->canvas->drawText(text, length, x, y, paint);
+	}, renderer);
+}
+
+PGTextBlobHandle PGCreateTextBlob() {
+	return new PGTextBlob();
+}
+
+void PGTextBlobAddText(PGTextBlobHandle blob, PGFontHandle font, const char* text, size_t length, PGScalar x) {
+	SkTextBlobBuilder builder;
+	LayoutText(font, text, length, x, 0, INT_MAX, [](const SkPaint& paint, const char* text, size_t length, PGScalar x, PGScalar y, void* data) {
+		int count = paint.textToGlyphs(text, length, nullptr);
+		if (count <= 0) return;
+		// the glyphs are looked up once here, so drawing the blob does not have to convert the text again
+		SkPaint glyph_paint(paint);
+		glyph_paint.setTextEncoding(SkPaint::kGlyphID_TextEncoding);
+		const SkTextBlobBuilder::RunBuffer& run = ((SkTextBlobBuilder*)data)->allocRun(glyph_paint, count, x, y);
+		paint.textToGlyphs(text, length, run.glyphs);
+	}, &builder);
+	sk_sp<SkTextBlob> text_blob = builder.make();
+	if (text_blob) {
+		blob->runs.push_back(std::pair<sk_sp<SkTextBlob>, SkColor>(text_blob, font->textpaint->getColor()));
+	}
+}
+
+void RenderTextBlob(PGRendererHandle renderer, PGTextBlobHandle blob, PGScalar x, PGScalar y) {
+	if (PGGlobalReplayManager::running_replay) return;
+	SkPaint paint;
+	for (auto it = blob->runs.begin(); it != blob->runs.end(); it++) {
+		paint.setColor(it->second);
+		renderer->canvas->drawTextBlob(it->first.get(), x, y, paint);
+	}
+}
+
+void PGDestroyTextBlob(PGTextBlobHandle blob) {
+	delete blob;
+}
+
 PGScalar RenderText(PGRendererHandle renderer, PGFontHandle font, const char *text, size_t len, PGScalar x, PGScalar y, PGTextAlign alignment) {
 	PGScalar width = MeasureTextWidth(font, text, len);
 	if (alignment & PGTextAlignRight) {
@@ -432,6 +510,10 @@ PGBitmapHandle CreateBitmapFromSize(PGScalar width, PGScalar height) {
 	return handle;
 }
 
+void FillBitmapRectangle(PGBitmapHandle bitmap, PGIRect rectangle, PGColor color) {
+	bitmap->bitmap->erase(CreateSkColor(color), SkIRect::MakeXYWH(rectangle.x, rectangle.y, rectangle.width, rectangle.height));
+}
+
 PGBitmapHandle CreateBitmapForText(PGFontHandle font, const char* text, size_t length) {
 	PGScalar width = MeasureTextWidth(font, text, length);
 	PGScalar height = GetTextHeight(font);
@@ -811,6 +893,11 @@ PGScalar GetTextFontSize(PGFontHandle font) {
 	return font->textpaint->getTextSize();
 }
 
+lng GetTextFontFamily(PGFontHandle font) {
+	SkTypeface* typeface = font->textpaint->getTypeface();
+	return typeface ? typeface->uniqueID() : 0;
+}
+
 void RenderFileIcon(PGRendererHandle renderer, PGFontHandle font, const char *text,
 	PGScalar x, PGScalar y, PGScalar width, PGScalar height,
 	PGColor text_color, PGColor page_color, PGColor edge_color) {
@@ -10,13 +10,18 @@
 #include <SkSurface.h>
 #include <SkPath.h>
 #include <SkTypeface.h>
+#include <SkTextBlob.h>
 #include "controlmanager.h"
 
 struct PGRenderer {
 	SkCanvas* canvas;
 	SkPaint* paint;
+	// the bitmap the canvas renders to, which keeps the contents of the previous frame
+	SkBitmap* surface;
+	// changes whenever the surface is (re)allocated and the previous frame is lost
+	lng surface_version;
 
-	PGRenderer() : canvas(nullptr), paint(nullptr) {}
+	PGRenderer() : canvas(nullptr), paint(nullptr), surface(nullptr), surface_version(0) {}
 };
 
 struct PGFont {
@@ -36,6 +41,11 @@ struct PGBitmap {
 	SkBitmap* bitmap;
 };
 
+struct PGTextBlob {
+	// text blobs do not store the color of their text, so every color gets its own blob
+	std::vector<std::pair<sk_sp<SkTextBlob>, SkColor>> runs;
+};
+
 void RenderControlsToBitmap(PGRendererHandle renderer, SkBitmap& bitmap, PGIRect rect, ControlManager* manager, PGScalar scale_factor);
 PGRendererHandle InitializeRenderer();
 SkBitmap* PGGetBitmap(PGBitmapHandle);
@@ -1,6 +1,8 @@
 
 #include "scheduler.h"
 
+#include <atomic>
+
 
 Scheduler::Scheduler() {
 }
@@ -40,3 +42,59 @@ void Scheduler::_RegisterTask(std::shared_ptr<Task> task, PGTaskUrgency urgency)
 		nonurgent_queue.enqueue(task);
 	}
 }
+
+struct ParallelTaskData {
+	PGParallelFunction function;
+	void* data;
+	lng count;
+	std::atomic<lng> next_index;
+	std::atomic<lng> finished_indices;
+	// the caller waits on the condition until the last index has been processed
+	std::unique_ptr<PGMutex> lock;
+	std::unique_ptr<PGCondition> finished;
+
+	ParallelTaskData(lng count, PGParallelFunction function, void* data) :
+		function(function), data(data), count(count), next_index(0), finished_indices(0),
+		lock(CreateMutex()), finished(CreateCondition()) { }
+};
+
+static void RunParallelIndices(ParallelTaskData* info) {
+	while (true) {
+		lng index = info->next_index++;
+		if (index >= info->count) {
+			// all indices have been claimed
+			// note that "data" can be gone already at this point, so we must not touch it
+			break;
+		}
+		info->function(index, info->data);
+		if (++info->finished_indices == info->count) {
+			// notify while holding the lock, so the caller cannot miss it between checking and waiting
+			LockMutex(info->lock.get());
+			NotifyCondition(info->finished.get());
+			UnlockMutex(info->lock.get());
+		}
+	}
+}
+
+void Scheduler::_RunParallel(lng count, PGParallelFunction function, void* data) {
+	if (count <= 0) return;
+	auto info = std::make_shared<ParallelTaskData>(count, function, data);
+	// helpers hold a reference to the shared counters, so helpers that only start
+	// running after we have returned find no work left and exit immediately
+	lng helpers = std::min((lng)threads.size(), count - 1);
+	for (lng i = 0; i < helpers; i++) {
+		auto counters = new std::shared_ptr<ParallelTaskData>(info);
+		_RegisterTask(std::make_shared<Task>([](std::shared_ptr<Task> task, void* data) {
+			std::shared_ptr<ParallelTaskData>* info = (std::shared_ptr<ParallelTaskData>*) data;
+			RunParallelIndices(info->get());
+			delete info;
+		}, counters), PGTaskUrgent);
+	}
+	RunParallelIndices(info.get());
+	// wait for any indices that are still being processed by the helper threads
+	LockMutex(info->lock.get());
+	while (info->finished_indices < count) {
+		WaitCondition(info->finished.get(), info->lock.get());
+	}
+	UnlockMutex(info->lock.get());
+}
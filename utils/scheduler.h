@@ -3,11 +3,14 @@
 #include "blockingconcurrentqueue.h"
 #include "utils.h"
 #include "thread.h"
+#include <atomic>
 #include <vector>
 
 struct Task;
 
 typedef void(*PGThreadFunctionParams)(std::shared_ptr<Task>, void*);
+typedef void(*PGParallelFunction)(lng index, void* data);
+typedef void(*PGTaskDestructor)(void* data);
 
 enum PGTaskUrgency {
 	PGTaskUrgent,
@@ -17,9 +20,19 @@ enum PGTaskUrgency {
 struct Task {
 	PGThreadFunctionParams function;
 	void* parameter;
-	bool active;
+	// called with the parameter when the task is released, whether or not it has run
+	// a task that is cancelled before it runs is never called, so it can only clean up here
+	PGTaskDestructor destructor;
+	// cleared (from any thread) to cancel the task, long running tasks check it regularly
+	std::atomic<bool> active;
 
-	Task(PGThreadFunctionParams function, void* parameter) : function(function), parameter(parameter), active(true) { }
+	Task(PGThreadFunctionParams function, void* parameter, PGTaskDestructor destructor = nullptr) :
+		function(function), parameter(parameter), destructor(destructor), active(true) { }
+	~Task() {
+		if (destructor) {
+			destructor(parameter);
+		}
+	}
 };
 
 class Scheduler {
@@ -32,10 +45,16 @@ public:
 	static bool IsRunning() { return GetInstance().running; }
 
 	static void RegisterTask(std::shared_ptr<Task> task, PGTaskUrgency urgency) { GetInstance()._RegisterTask(task, urgency); }
+
+	// Runs function(i, data) for every i in [0, count) spread over the worker threads
+	// the calling thread also processes indices, so this never waits on busy workers
+	// returns only after every index has been processed
+	static void RunParallel(lng count, PGParallelFunction function, void* data) { GetInstance()._RunParallel(count, function, data); }
 private:
 	Scheduler();
 	void _SetThreadCount(lng threads);
 	void _RegisterTask(std::shared_ptr<Task> task, PGTaskUrgency);
+	void _RunParallel(lng count, PGParallelFunction function, void* data);
 	static void RunThread(void);
 	static Scheduler& GetInstance()
 	{
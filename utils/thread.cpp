@@ -29,3 +29,17 @@ void LockMutex(PGMutexHandle handle) {
 void UnlockMutex(PGMutexHandle handle) {
 	handle->mutex.unlock();
 }
+
+PGConditionHandle CreateCondition() {
+	return new PGCondition();
+}
+
+void WaitCondition(PGConditionHandle handle, PGMutexHandle mutex) {
+	std::unique_lock<std::mutex> lock(mutex->mutex, std::adopt_lock);
+	handle->condition.wait(lock);
+	lock.release();
+}
+
+void NotifyCondition(PGConditionHandle handle) {
+	handle->condition.notify_all();
+}
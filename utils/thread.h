@@ -2,6 +2,7 @@
 
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 
 typedef void(*PGThreadFunction)(void);
 
@@ -26,4 +27,14 @@ typedef struct PGMutex* PGMutexHandle;
 
 PGMutexHandle CreateMutex(void);
 void LockMutex(PGMutexHandle);
-void UnlockMutex(PGMutexHandle);
\ No newline at end of file
+void UnlockMutex(PGMutexHandle);
+struct PGCondition {
+	std::condition_variable condition;
+};
+
+typedef struct PGCondition* PGConditionHandle;
+
+PGConditionHandle CreateCondition(void);
+// the mutex must be locked by the caller, it is released while waiting and locked again before returning
+void WaitCondition(PGConditionHandle, PGMutexHandle);
+void NotifyCondition(PGConditionHandle);